@@ -0,0 +1,159 @@
+#**********************************************************************************
+# Copyright (C) 2023 Craig Setera
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this file,
+# You can obtain one at https://mozilla.org/MPL/2.0/.
+#*********************************************************************************/
+
+#
+# Converts images into the tiled RGB565 format read by TiledImage, so art
+# bundled with the firmware or an asset pack is drawn without decoding.
+# See lib/CoverArt/include/TiledImage.h for the layout.
+#
+# From the command line:
+#   python extra_scripts/convert_art.py <image> <output.tile> [--max-size WxH] [--tile-size N]
+#
+# Reading the image needs Pillow (pip install pillow).  The same
+# conversion is available on the device and in native builds as
+# TiledImage::convert.
+#
+import argparse
+import struct
+
+MAGIC = b"TIL1"
+CF_TRUE_COLOR = 4
+CF_TRUE_COLOR_ALPHA = 5
+LZ4_MAX_INPUT_SIZE = 65535
+
+# LZ4 requires the last literals of a block to be at least this long,
+# and no match may start closer than this to the end
+LZ4_LAST_LITERALS = 5
+LZ4_MATCH_LIMIT = 12
+LZ4_MIN_MATCH = 4
+
+def lz4_length(length):
+    extra = b""
+    while length >= 255:
+        extra += b"\xff"
+        length -= 255
+    return extra + bytes([length])
+
+def lz4_sequence(literals, match_length, offset):
+    literal_token = min(len(literals), 15)
+    out = bytearray()
+    if offset is None:
+        out.append(literal_token << 4)
+    else:
+        out.append((literal_token << 4) | min(match_length - LZ4_MIN_MATCH, 15))
+    if len(literals) >= 15:
+        out += lz4_length(len(literals) - 15)
+    out += literals
+    if offset is not None:
+        out += struct.pack("<H", offset)
+        if match_length - LZ4_MIN_MATCH >= 15:
+            out += lz4_length(match_length - LZ4_MIN_MATCH - 15)
+    return out
+
+def lz4_compress(data):
+    """Compress one LZ4 block with a simple greedy matcher."""
+    out = bytearray()
+    table = {}
+    anchor = 0
+    position = 0
+    limit = len(data) - LZ4_MATCH_LIMIT
+
+    while position < limit:
+        key = data[position:position + LZ4_MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = position
+        if candidate is None or position - candidate > 65535:
+            position += 1
+            continue
+
+        length = LZ4_MIN_MATCH
+        end = len(data) - LZ4_LAST_LITERALS
+        while position + length < end and data[candidate + length] == data[position + length]:
+            length += 1
+
+        out += lz4_sequence(data[anchor:position], length, position - candidate)
+        position += length
+        anchor = position
+
+    out += lz4_sequence(data[anchor:], 0, None)
+    return bytes(out)
+
+def to_rgb565(image):
+    """Return the pixels as RGB565 rows, with alpha after each pixel if the image has any."""
+    has_alpha = image.mode in ("RGBA", "LA", "PA") or "transparency" in image.info
+    image = image.convert("RGBA" if has_alpha else "RGB")
+    pixels = bytearray()
+    for pixel in image.getdata():
+        red, green, blue = pixel[0], pixel[1], pixel[2]
+        pixels += struct.pack("<H", ((red >> 3) << 11) | ((green >> 2) << 5) | (blue >> 3))
+        if has_alpha:
+            pixels.append(pixel[3])
+    return bytes(pixels), has_alpha
+
+def build_tiled(image, tile_size):
+    width, height = image.size
+    pixels, has_alpha = to_rgb565(image)
+    pixel_size = 3 if has_alpha else 2
+    if tile_size * tile_size * pixel_size > LZ4_MAX_INPUT_SIZE:
+        raise ValueError("A %dx%d tile does not fit in an LZ4 block" % (tile_size, tile_size))
+
+    tiles_across = (width + tile_size - 1) // tile_size
+    tiles_down = (height + tile_size - 1) // tile_size
+    tile_count = tiles_across * tiles_down
+
+    header = MAGIC + struct.pack("<HHBBH", width, height, CF_TRUE_COLOR_ALPHA if has_alpha else CF_TRUE_COLOR, tile_size, 0)
+    offset = len(header) + (tile_count + 1) * 4
+    offsets = []
+    data = bytearray()
+
+    stride = width * pixel_size
+    for index in range(tile_count):
+        left = (index % tiles_across) * tile_size
+        top = (index // tiles_across) * tile_size
+        tile_width = min(tile_size, width - left)
+        tile_height = min(tile_size, height - top)
+
+        tile = b"".join(
+            pixels[(top + y) * stride + left * pixel_size:(top + y) * stride + (left + tile_width) * pixel_size]
+            for y in range(tile_height))
+
+        # Tiles that do not shrink are stored as they are
+        compressed = lz4_compress(tile)
+        offsets.append(offset + len(data))
+        data += compressed if len(compressed) < len(tile) else tile
+
+    offsets.append(offset + len(data))
+    return header + struct.pack("<%dI" % len(offsets), *offsets) + bytes(data)
+
+def convert_art(source, output, max_size=None, tile_size=32):
+    from PIL import Image
+
+    image = Image.open(source)
+    if max_size:
+        # Never scaled up, as on the device
+        image.thumbnail(max_size, Image.LANCZOS)
+
+    tiled = build_tiled(image, tile_size)
+    with open(output, "wb") as file:
+        file.write(tiled)
+
+    print("Converted %s into %s (%dx%d, %d bytes)" % (source, output, image.size[0], image.size[1], len(tiled)))
+
+def parse_size(text):
+    width, height = text.lower().split("x")
+    return (int(width), int(height))
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Convert an image into the tiled RGB565 format")
+    parser.add_argument("source", help="the image to convert")
+    parser.add_argument("output", help="the .tile file to write")
+    parser.add_argument("--max-size", type=parse_size, help="fit the image within WIDTHxHEIGHT")
+    parser.add_argument("--tile-size", type=int, default=32, help="the width and height of the tiles")
+    arguments = parser.parse_args()
+
+    convert_art(arguments.source, arguments.output, arguments.max_size, arguments.tile_size)
@@ -0,0 +1,123 @@
+#**********************************************************************************
+# Copyright (C) 2023 Craig Setera
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this file,
+# You can obtain one at https://mozilla.org/MPL/2.0/.
+#*********************************************************************************/
+
+#
+# Packs a directory tree into an InMemoryFS asset pack, which
+# InMemoryFS::mountAssetPack mounts in one step without copying.
+# See lib/InMemoryFS/src/AssetPack.h for the layout.
+#
+# From the command line:
+#   python extra_scripts/pack_assets.py <directory> <output> [--c-array <name>]
+#
+# With --c-array the pack is written as C source holding a const array,
+# so it can be compiled into flash and mounted from there.
+#
+# As a PlatformIO custom target, the directory and output come from the
+# custom_asset_pack_dir and custom_asset_pack_output environment options.
+#
+import argparse
+import os
+import struct
+
+MAGIC = b"IMFP"
+FORMAT_VERSION = 1
+HEADER_SIZE = 12
+INDEX_ENTRY_SIZE = 12
+
+def align(offset):
+    return (offset + 3) & ~3
+
+def collect_files(directory):
+    files = []
+    for root, dirs, names in os.walk(directory):
+        for name in names:
+            full_path = os.path.join(root, name)
+            relative_path = os.path.relpath(full_path, directory).replace(os.sep, "/")
+            files.append((relative_path.encode("utf-8"), full_path))
+
+    # Sorted by bytes to match the strcmp binary search
+    files.sort(key=lambda file: file[0])
+    return files
+
+def build_pack(directory):
+    files = collect_files(directory)
+
+    paths_offset = HEADER_SIZE + len(files) * INDEX_ENTRY_SIZE
+    paths = b"".join(path + b"\0" for path, _ in files)
+
+    index = b""
+    data = b""
+    path_offset = paths_offset
+    data_start = align(paths_offset + len(paths))
+
+    for path, full_path in files:
+        with open(full_path, "rb") as file:
+            contents = file.read()
+
+        data += b"\0" * (align(len(data)) - len(data))
+        index += struct.pack("<III", path_offset, data_start + len(data), len(contents))
+        data += contents
+        path_offset += len(path) + 1
+
+    header = MAGIC + struct.pack("<II", FORMAT_VERSION, len(files))
+    padding = b"\0" * (data_start - paths_offset - len(paths))
+    return header + index + paths + padding + data
+
+def write_c_array(pack, name, output):
+    with open(output, "w") as file:
+        file.write("// Generated by extra_scripts/pack_assets.py, do not edit\n")
+        file.write("#include <stdint.h>\n\n")
+        file.write("const uint32_t %s_size = %d;\n" % (name, len(pack)))
+        file.write("const uint8_t %s[] __attribute__((aligned(4))) = {\n" % name)
+        for offset in range(0, len(pack), 16):
+            line = ", ".join("0x%02x" % byte for byte in pack[offset:offset + 16])
+            file.write("  " + line + ",\n")
+        file.write("};\n")
+
+def pack_assets(directory, output, array_name=None):
+    pack = build_pack(directory)
+    if array_name:
+        write_c_array(pack, array_name, output)
+    else:
+        with open(output, "wb") as file:
+            file.write(pack)
+
+    print("Packed %s into %s (%d bytes)" % (directory, output, len(pack)))
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Build an InMemoryFS asset pack")
+    parser.add_argument("directory", help="the directory tree to pack")
+    parser.add_argument("output", help="the pack file to write")
+    parser.add_argument("--c-array", dest="array_name", help="write C source defining an array with this name")
+    arguments = parser.parse_args()
+
+    pack_assets(arguments.directory, arguments.output, arguments.array_name)
+else:
+    Import("env")
+
+    def pack_assets_target(*args, **kwargs):
+        directory = env.GetProjectOption("custom_asset_pack_dir", "")
+        output = env.GetProjectOption("custom_asset_pack_output", "")
+        if not directory or not output:
+            raise AssertionError("Set custom_asset_pack_dir and custom_asset_pack_output to pack assets")
+
+        array_name = env.GetProjectOption("custom_asset_pack_array", "asset_pack") if output.endswith(".c") else None
+        pack_assets(directory, output, array_name)
+
+    #
+    # Wire up the custom targets
+    #
+    env.AddCustomTarget(
+        name="pack_assets",
+        dependencies=None,
+        actions=[
+            pack_assets_target
+        ],
+        title="Pack Assets",
+        description="Pack a directory tree into an InMemoryFS asset pack"
+    )
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "CancelToken.h"
+#include "Surface.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(ESP32)
+	#include <freertos/FreeRTOS.h>
+	#include <freertos/task.h>
+#else
+	#include <thread>
+#endif
+
+// Where art is kept, on LittleFS as mounted by the Arduino core
+#ifndef COVERART_STORE_DIRECTORY
+	#if defined(ESP32)
+		#define COVERART_STORE_DIRECTORY "/littlefs/coverart"
+	#else
+		#define COVERART_STORE_DIRECTORY ".coverart"
+	#endif
+#endif
+
+// The most bytes of art kept on flash
+#ifndef COVERART_STORE_CAPACITY
+	#define COVERART_STORE_CAPACITY (1024 * 1024)
+#endif
+
+// The most finished art waiting to be written before more is dropped
+#ifndef COVERART_STORE_MAX_PENDING
+	#define COVERART_STORE_MAX_PENDING 4
+#endif
+
+/**
+ * Keeps decoded cover art in files, so art survives a reboot or an OTA
+ * update and the first screen after boot shows it without downloading
+ * and decoding it again.
+ *
+ * Art is stored exactly as it is shown, already scaled and in the
+ * display's color format, compressed with LZ4 in blocks so a load is a
+ * file read and a fast decompress.  Each file is named by a hash of the
+ * image source and the size it was decoded for, and holds both so a
+ * collision is never mistaken for a hit.
+ *
+ * Saving compresses the art straight away but leaves the file write to
+ * a background writer, a low priority task on the ESP32 and a thread
+ * elsewhere, so flash writes never hold up decoding or the UI.  Files
+ * are written under a temporary name and renamed once complete.  When
+ * the store is over capacity the least recently used files are deleted.
+ * The order of use is kept in an index file, rewritten by the writer
+ * when it is otherwise idle.
+ *
+ * Loads and saves may be made from any thread.
+ */
+class ArtStore {
+public:
+	/**
+	 * @brief Counters describing the behavior of the store.
+	 */
+	struct Stats {
+		uint32_t hits;
+		uint32_t misses;
+		uint32_t writes;
+		uint32_t evictions;
+		uint32_t storedBytes;
+		uint32_t entryCount;
+	};
+
+	/**
+	 * Returns the store shared by the application.
+	 */
+	static ArtStore &get();
+
+	ArtStore(const char *directory = COVERART_STORE_DIRECTORY, uint32_t capacity = COVERART_STORE_CAPACITY);
+	~ArtStore();
+
+	// Disable copy semantics
+	ArtStore(const ArtStore&) = delete;
+
+	/**
+	 * Reads the index, creating the directory if needed, and starts the
+	 * writer.  Files left by an interrupted write are cleaned up.
+	 *
+	 * @return false if the directory cannot be used
+	 */
+	bool start();
+
+	/**
+	 * Stops the writer once the art waiting to be written is written.
+	 */
+	void stop();
+
+	/**
+	 * Loads stored art.
+	 *
+	 * @param source the image source the art was decoded from
+	 * @param maxWidth the width limit the art was decoded for
+	 * @param maxHeight the height limit the art was decoded for
+	 * @param cancel checked between blocks
+	 * @return a new surface holding one reference, or nullptr if the art
+	 *         is not stored
+	 */
+	Surface *load(const char *source, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel = CancelToken());
+
+	/**
+	 * Compresses art and queues it to be written.  The surface is not
+	 * referenced once this returns.
+	 *
+	 * @param source the image source the art was decoded from
+	 * @param maxWidth the width limit the art was decoded for
+	 * @param maxHeight the height limit the art was decoded for
+	 * @param surface the decoded art
+	 */
+	void save(const char *source, uint16_t maxWidth, uint16_t maxHeight, Surface *surface);
+
+	/**
+	 * Waits until the art queued so far and the index are written.
+	 */
+	void flush();
+
+	Stats getStats();
+
+private:
+	struct Entry {
+		uint32_t hash;
+		uint32_t size;
+		uint32_t lastUse;
+	};
+
+	struct PendingWrite {
+		uint32_t hash;
+		uint8_t *data;
+		uint32_t size;
+	};
+
+	std::string directory;
+	uint32_t capacity;
+
+	// Guarded by the mutex
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<Entry> entries;
+	std::vector<PendingWrite> pending;
+	uint32_t useClock;
+	uint32_t storedBytes;
+	bool indexDirty;
+	bool writing;
+	bool running;
+	bool stopping;
+	uint32_t loadingHash;
+	bool loading;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t writes;
+	uint32_t evictions;
+
+#if defined(ESP32)
+	TaskHandle_t task;
+
+	static void taskMain(void *parameter);
+#else
+	std::thread thread;
+#endif
+
+	static std::string keyOf(const char *source, uint16_t maxWidth, uint16_t maxHeight);
+	static uint32_t hashOf(const std::string &key);
+	std::string pathOf(uint32_t hash, const char *extension) const;
+
+	void readIndex();
+	void writeIndex();
+	void work();
+	void write(const PendingWrite &write);
+	std::vector<uint32_t> evict(uint32_t incoming);
+	Entry *find(uint32_t hash);
+	void forget(uint32_t hash);
+};
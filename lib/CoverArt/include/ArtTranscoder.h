@@ -0,0 +1,111 @@
+#pragma once
+
+#include "CoverArtPipeline.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// The bytes of transcoded art kept to hand out again
+#ifndef COVERART_TRANSCODER_BUDGET
+	#define COVERART_TRANSCODER_BUDGET (8 * 1024 * 1024)
+#endif
+
+/**
+ * Turns cover art URLs into payloads a display can draw without
+ * decoding, so the download and the decode of large art happen once on
+ * a host rather than on every display.
+ *
+ * The art is downloaded, decoded and scaled to fit the size displays
+ * show it at, then encoded as a TiledImage: RGB565 tiles compressed
+ * with LZ4.  A display fetching the payload through its cover art
+ * pipeline decodes it with the TiledImage decoder.
+ *
+ * Payloads are kept by name, a hash of the URL, so every display asking
+ * for the same art gets the same bytes.  When the payloads are over
+ * budget the least recently used are dropped.
+ *
+ * Transcoding uses LVGL's decoders, so runs on the LVGL thread.  Payloads
+ * may be looked up from any thread.
+ */
+class ArtTranscoder {
+public:
+	/**
+	 * @brief The bytes of a transcoded image, shared with whoever is
+	 * sending them.
+	 */
+	typedef std::shared_ptr<const std::vector<uint8_t>> Payload;
+
+	/**
+	 * @brief Counters describing the behavior of the transcoder.
+	 */
+	struct Stats {
+		uint32_t transcodes;
+		uint32_t hits;
+		uint32_t failures;
+		uint32_t storedBytes;
+		uint32_t entryCount;
+	};
+
+	/**
+	 * @param fetcher downloads art into InMemoryFS
+	 * @param width the widest displays show art
+	 * @param height the tallest displays show art
+	 * @param budget the most bytes of payloads kept
+	 */
+	ArtTranscoder(CoverArtPipeline::Fetcher fetcher, uint16_t width, uint16_t height, uint32_t budget = COVERART_TRANSCODER_BUDGET);
+
+	// Disable copy semantics
+	ArtTranscoder(const ArtTranscoder&) = delete;
+
+	/**
+	 * Transcodes the art at a URL, or returns the payload kept from an
+	 * earlier transcode.
+	 *
+	 * @param url the URL of the art
+	 * @return the payload, or nullptr if the art could not be fetched or
+	 *         decoded
+	 */
+	Payload transcode(const std::string &url);
+
+	/**
+	 * Looks up a payload by name.
+	 *
+	 * @param name the name returned by nameOf
+	 * @return the payload or nullptr if it is not kept
+	 */
+	Payload find(const std::string &name);
+
+	Stats getStats();
+
+	/**
+	 * Returns the name the payload for a URL is kept under, a file name
+	 * ending in .tile so displays recognize the format.
+	 */
+	static std::string nameOf(const std::string &url);
+
+private:
+	struct Entry {
+		std::string name;
+		Payload payload;
+		uint32_t lastUse;
+	};
+
+	CoverArtPipeline::Fetcher fetcher;
+	uint16_t width;
+	uint16_t height;
+	uint32_t budget;
+
+	// Guarded by the mutex
+	std::mutex mutex;
+	std::vector<Entry> entries;
+	uint32_t useClock;
+	uint32_t storedBytes;
+	uint32_t transcodes;
+	uint32_t hits;
+	uint32_t failures;
+
+	Surface *decode(const std::string &url);
+	void evict();
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * Tells work done for a request whether a newer request has made it
+ * obsolete, so downloads and decodes can stop early and free their
+ * buffers.
+ *
+ * A token holds the generation of the request it was issued for and
+ * watches a counter that is bumped for every new request.  It is cheap
+ * enough to check once per row or network read, from any thread.  A
+ * default constructed token is never cancelled.
+ */
+class CancelToken {
+public:
+	CancelToken() : latest(nullptr), generation(0) {}
+
+	CancelToken(const std::atomic<uint32_t> &latest, uint32_t generation) :
+		latest(&latest), generation(generation) {}
+
+	bool isCancelled() const {
+		return (latest != nullptr) && (latest->load(std::memory_order_relaxed) != generation);
+	}
+
+private:
+	const std::atomic<uint32_t> *latest;
+	uint32_t generation;
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Surface.h"
+
+/**
+ * Rounds the corners of decoded art once, so the image widget can show
+ * it as a plain blit instead of clipping its corners with a radius mask
+ * on every redraw.
+ *
+ * Opaque art has its corners blended into the color behind the image,
+ * and art with an alpha channel has its corners faded out.  The edge is
+ * antialiased by how much of each pixel lies inside the arc.
+ */
+namespace CornerMask {
+	/**
+	 * Round the corners of a surface in place.
+	 *
+	 * @param surface the art
+	 * @param radius the corner radius in pixels, limited to half the
+	 *               shorter side
+	 * @param background the color the corners of opaque art blend into
+	 */
+	void apply(Surface *surface, uint16_t radius, lv_color_t background);
+}
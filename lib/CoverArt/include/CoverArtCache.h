@@ -0,0 +1,194 @@
+#pragma once
+
+#include "Surface.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// The bytes of decoded cover art kept for reuse.  A 216x216 cover is
+// about 91KB in RGB565.
+#ifndef COVERART_CACHE_BUDGET
+	#ifdef BOARD_HAS_PSRAM
+		#define COVERART_CACHE_BUDGET (2 * 1024 * 1024)
+	#else
+		#define COVERART_CACHE_BUDGET (256 * 1024)
+	#endif
+#endif
+
+/**
+ * A cache of decoded cover art, keyed by image source.
+ *
+ * Showing art from the cache is a blit of an already decoded surface,
+ * so redraws never decode again and returning to a recent album is
+ * instant.  When the cache is over budget the least recently used
+ * surfaces are dropped.  Surfaces still shown by an image widget stay
+ * alive until released, but no longer count against the budget.
+ *
+ * Art is decoded to fit the target size, the space it is shown in, so
+ * large covers never exist at full resolution.
+ *
+ * InMemoryFS sources are tagged with the version they were decoded
+ * from, so replacing a file invalidates its cached art.
+ *
+ * Art can have its corners rounded as it is cached, so it is drawn as a
+ * plain blit rather than through LVGL's corner clipping.
+ *
+ * The cache is used from the LVGL thread.
+ */
+class CoverArtCache {
+public:
+	/**
+	 * @brief A function to decode an image source into a new surface.
+	 */
+	typedef std::function<Surface *(const char *source)> Decoder;
+
+	/**
+	 * @brief Counters describing the behavior of the cache.
+	 */
+	struct Stats {
+		uint32_t hits;
+		uint32_t misses;
+		uint32_t evictions;
+		uint32_t residentBytes;
+		uint32_t entryCount;
+	};
+
+	/**
+	 * Returns the cache shared by the application.
+	 */
+	static CoverArtCache &get();
+
+	CoverArtCache(uint32_t budget = COVERART_CACHE_BUDGET, Decoder decoder = nullptr);
+	~CoverArtCache();
+
+	// Disable copy semantics
+	CoverArtCache(const CoverArtCache&) = delete;
+
+	/**
+	 * Returns the decoded art for an image source, decoding it on a miss.
+	 * The caller holds a reference to the surface until it releases it.
+	 *
+	 * @param source the path of the image, such as an InMemoryFS path
+	 * @return the decoded image or nullptr if it could not be decoded
+	 */
+	const lv_img_dsc_t *acquire(const char *source);
+
+	/**
+	 * Returns the cached art for an image source without decoding it.
+	 * The caller holds a reference to the surface until it releases it.
+	 *
+	 * @param source the path of the image
+	 * @return the cached image or nullptr if it is not cached
+	 */
+	const lv_img_dsc_t *lookup(const char *source);
+
+	/**
+	 * Returns whether current art for an image source is cached, without
+	 * counting as a use.
+	 */
+	bool contains(const char *source) const;
+
+	/**
+	 * Adds art decoded elsewhere, such as by the cover art pipeline.
+	 * The caller's reference to the surface passes to the cache and the
+	 * caller gets a new one to release.  The corners of the surface are
+	 * rounded in place.
+	 *
+	 * @param source the path the surface was decoded from
+	 * @param version the version of the source when it was decoded
+	 * @param surface the decoded surface
+	 * @return the image of the surface
+	 */
+	const lv_img_dsc_t *insert(const char *source, uint32_t version, Surface *surface);
+
+	/**
+	 * Releases an image returned by acquire.
+	 */
+	void release(const lv_img_dsc_t *image);
+
+	/**
+	 * Drops every cached surface.  Surfaces in use stay alive until
+	 * they are released.
+	 */
+	void clear();
+
+	/**
+	 * Limits the bytes of decoded art kept, evicting to meet the budget.
+	 */
+	void setBudget(uint32_t bytes);
+
+	uint32_t getBudget() const {
+		return budget;
+	}
+
+	/**
+	 * Sets the box art is scaled down to fit while decoding.  Changing
+	 * the size drops the art already cached.
+	 *
+	 * @param width the widest art may be, or 0 for no limit
+	 * @param height the tallest art may be, or 0 for no limit
+	 */
+	void setTargetSize(uint16_t width, uint16_t height);
+
+	uint16_t getTargetWidth() const {
+		return targetWidth;
+	}
+
+	uint16_t getTargetHeight() const {
+		return targetHeight;
+	}
+
+	/**
+	 * Sets the corners baked into art as it is cached.  Changing them
+	 * drops the art already cached.
+	 *
+	 * @param radius the corner radius, or 0 for square corners
+	 * @param background the color behind the image, which the corners
+	 *                   of opaque art blend into
+	 */
+	void setCorners(uint16_t radius, lv_color_t background);
+
+	uint16_t getCornerRadius() const {
+		return cornerRadius;
+	}
+
+	lv_color_t getCornerBackground() const {
+		return cornerBackground;
+	}
+
+	Stats getStats() const;
+
+	/**
+	 * Returns the version of an InMemoryFS source, or 0 for other sources.
+	 * This may be called from any thread.
+	 *
+	 * @param source the image path
+	 * @return the version
+	 */
+	static uint32_t versionOf(const char *source);
+
+private:
+	struct Entry {
+		std::string source;
+		uint32_t version;
+		uint32_t lastAccess;
+		Surface *surface;
+	};
+
+	Decoder decoder;
+	std::vector<Entry> entries;
+	uint32_t budget;
+	uint16_t targetWidth;
+	uint16_t targetHeight;
+	uint16_t cornerRadius;
+	lv_color_t cornerBackground;
+	uint32_t residentBytes;
+	uint32_t accessClock;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t evictions;
+
+	void evict();
+	void remove(size_t index);
+};
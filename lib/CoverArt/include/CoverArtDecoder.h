@@ -0,0 +1,79 @@
+#pragma once
+
+#include "CancelToken.h"
+#include "Surface.h"
+
+#include <vector>
+
+/**
+ * Decodes cover art into surfaces using the image decoders registered
+ * with LVGL.
+ *
+ * Art larger than the space it is shown in is scaled down while it is
+ * decoded, so the surface is exactly what gets drawn and LVGL never has
+ * to scale it when rendering.  Decoders producing a line at a time are
+ * read through a single line buffer.
+ *
+ * PNGs are read a row at a time by PngReader and JPEGs a block row at a
+ * time by JpegReader, so they never exist at full resolution either.
+ * Everything else goes through LVGL, except that away from the LVGL
+ * thread tiled images are read by TiledImage.
+ *
+ * LVGL's decoders share LVGL's memory and buffers with the drawing code,
+ * so they may only run on the LVGL thread.  decodeOffThread uses the
+ * project's own readers alone and may run anywhere.
+ */
+namespace CoverArtDecoder {
+	/**
+	 * @brief What a decode away from the LVGL thread leaves for the LVGL
+	 * thread to release: surfaces, whose last reference must be dropped
+	 * there, and InMemoryFS image descriptors, whose release touches
+	 * LVGL's image cache.
+	 */
+	struct Retired {
+		std::vector<Surface *> surfaces;
+		std::vector<const lv_img_dsc_t *> descriptors;
+
+		/**
+		 * Moves everything another list holds into this one.
+		 */
+		void take(Retired &other);
+
+		/**
+		 * Releases everything.  Call on the LVGL thread.
+		 */
+		void release();
+	};
+
+	/**
+	 * Decode an image into a new surface on the LVGL thread.  InMemoryFS
+	 * paths are decoded from the stored bytes in place rather than
+	 * through the driver.
+	 *
+	 * @param source an LVGL image source: a path or an image descriptor
+	 * @param maxWidth the widest the surface may be, or 0 for no limit
+	 * @param maxHeight the tallest the surface may be, or 0 for no limit
+	 * @param cancel checked between rows, abandoning the decode and
+	 *               freeing its buffers once cancelled
+	 * @return the surface, holding one reference, or nullptr if the image
+	 *         could not be decoded to a true color format or the decode
+	 *         was cancelled
+	 */
+	Surface *decode(const void *source, uint16_t maxWidth = 0, uint16_t maxHeight = 0, const CancelToken &cancel = CancelToken());
+
+	/**
+	 * Decode an image into a new surface without touching LVGL, so on any
+	 * thread.  Only InMemoryFS paths to images the project's own readers
+	 * handle are decoded; anything else is left for decode on the LVGL
+	 * thread.
+	 *
+	 * @param source an InMemoryFS path
+	 * @param maxWidth the widest the surface may be, or 0 for no limit
+	 * @param maxHeight the tallest the surface may be, or 0 for no limit
+	 * @param cancel checked between rows
+	 * @param retired receives what has to be released on the LVGL thread
+	 * @param needsLvgl set if the image can only be decoded by decode
+	 * @return the surface, holding one reference, or nullptr
+	 */
+	Surface *decodeOffThread(const char *source, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel, Retired &retired, bool &needsLvgl);
+}
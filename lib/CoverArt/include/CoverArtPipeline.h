@@ -0,0 +1,269 @@
+#pragma once
+
+#include "ArtStore.h"
+#include "CancelToken.h"
+#include "CoverArtCache.h"
+#include "CoverArtDecoder.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(ESP32)
+	#include <freertos/FreeRTOS.h>
+	#include <freertos/task.h>
+#else
+	#include <thread>
+#endif
+
+// The core cover art is decoded on.  The Arduino loop, and with it LVGL,
+// runs on core 1.
+#ifndef COVERART_PIPELINE_CORE
+	#define COVERART_PIPELINE_CORE 0
+#endif
+
+#ifndef COVERART_PIPELINE_PRIORITY
+	#define COVERART_PIPELINE_PRIORITY 1
+#endif
+
+#ifndef COVERART_PIPELINE_STACK_SIZE
+	#define COVERART_PIPELINE_STACK_SIZE 8192
+#endif
+
+// How many upcoming covers are fetched and decoded ahead of time
+#ifndef COVERART_PREFETCH_COUNT
+	#define COVERART_PREFETCH_COUNT 3
+#endif
+
+// How often the LVGL thread checks for finished art, in milliseconds
+#ifndef COVERART_PIPELINE_POLL_PERIOD
+	#define COVERART_PIPELINE_POLL_PERIOD 20
+#endif
+
+/**
+ * Decodes cover art away from the LVGL thread, so a track change never
+ * stalls touch input or animations while an image is decoded.
+ *
+ * Art already in the cover art cache is handed over at once.  Anything
+ * else is decoded by a worker, a task pinned to the other core on the
+ * ESP32 and a thread elsewhere, into a new surface that no widget can
+ * see.  An LVGL timer picks up the finished surface and hands it over
+ * on the LVGL thread, where showing it is a pointer swap.
+ *
+ * Only the latest request matters.  Requests are tagged with a
+ * generation, and a newer request cancels the older one wherever it
+ * is: waiting for the worker, downloading or decoding.  Cancelled work
+ * stops at its next network read or row and frees its buffers, so
+ * skipping through ten tracks costs about one decode rather than ten.
+ *
+ * The art of upcoming tracks can be prefetched while the worker is
+ * otherwise idle, so a track change finds its art in the cache and
+ * swaps it in the same frame as the title.  Prefetching gives way to
+ * requests: a request cancels the prefetch in progress, which is
+ * retried afterwards, unless it is for the same art, in which case the
+ * prefetch becomes the request.
+ *
+ * Sources may be URLs when a fetcher is set.  The worker downloads
+ * them into InMemoryFS, decodes them and removes the download, and the
+ * art is cached under the URL.  With an art store, fetched art is also
+ * kept on flash and loaded from there after a reboot.
+ *
+ * Requests are made on the LVGL thread.  The worker uses no LVGL state:
+ * it decodes only what the project's own readers handle, and hands
+ * anything needing LVGL's decoders, such as interlaced PNGs, back to be
+ * decoded on the LVGL thread when it is picked up.  Surfaces and InMemoryFS image
+ * descriptors the worker is done with are retired and released on the
+ * LVGL thread.
+ */
+class CoverArtPipeline {
+public:
+	/**
+	 * @brief A function receiving requested art on the LVGL thread.  It
+	 * owns a reference to the image, to be released through the cache,
+	 * and is given nullptr if the art could not be decoded.
+	 */
+	typedef std::function<void(const lv_img_dsc_t *image)> Handler;
+
+	/**
+	 * @brief A function to decode an image source into a new surface on
+	 * the worker, without touching LVGL.  What has to be released on the
+	 * LVGL thread is added to retired, and needsLvgl is set for sources
+	 * only the LvglDecoder can decode.
+	 */
+	typedef std::function<Surface *(const char *source, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel,
+		CoverArtDecoder::Retired &retired, bool &needsLvgl)> Decoder;
+
+	/**
+	 * @brief A function to decode an image source into a new surface on
+	 * the LVGL thread, for sources the worker handed back.
+	 */
+	typedef std::function<Surface *(const char *source, uint16_t maxWidth, uint16_t maxHeight)> LvglDecoder;
+
+	/**
+	 * @brief A function to download a URL into an InMemoryFS file on the
+	 * worker, giving up once cancelled.
+	 *
+	 * @param url the URL of the image
+	 * @param path the InMemoryFS path to write, without the drive letter
+	 * @param cancel checked between network reads
+	 * @return true if the file was downloaded
+	 */
+	typedef std::function<bool(const char *url, const char *path, const CancelToken &cancel)> Fetcher;
+
+	/**
+	 * Returns the pipeline shared by the application.
+	 */
+	static CoverArtPipeline &get();
+
+	CoverArtPipeline(CoverArtCache &cache = CoverArtCache::get(), Decoder decoder = nullptr, LvglDecoder lvglDecoder = nullptr);
+	~CoverArtPipeline();
+
+	// Disable copy semantics
+	CoverArtPipeline(const CoverArtPipeline&) = delete;
+
+	/**
+	 * Starts the worker and the timer handing art over.  Call after LVGL
+	 * has been initialized.  Until then art is decoded as it is requested.
+	 */
+	void start();
+
+	/**
+	 * Stops the worker, waiting for a decode in progress to finish.
+	 */
+	void stop();
+
+	/**
+	 * Sets how URL sources are downloaded.  Without a fetcher they
+	 * cannot be decoded.
+	 */
+	void setFetcher(Fetcher fetcher);
+
+	/**
+	 * Sets where fetched art is kept across reboots, or nullptr to keep
+	 * it only in memory.  The store must be started.
+	 */
+	void setStore(ArtStore *store);
+
+	/**
+	 * Requests the art for an image source, replacing and cancelling any
+	 * earlier request.  Cached art is handed to the handler before
+	 * returning.
+	 *
+	 * @param source the path of the image, such as an InMemoryFS path, or
+	 *               a URL to fetch it from
+	 * @param handler receives the art
+	 */
+	void request(const char *source, Handler handler);
+
+	/**
+	 * Sets the art of the tracks coming up next, such as from the
+	 * player's queue, replacing the previous list.  Art not already
+	 * cached is fetched and decoded when the worker has nothing else to
+	 * do, for as many sources as fit in the cache alongside the art
+	 * being shown, up to COVERART_PREFETCH_COUNT.  Art only LVGL's
+	 * decoders can read is just downloaded, and decoded if it is
+	 * requested.  Prefetching needs the pipeline to be started.
+	 *
+	 * @param sources the upcoming image sources, soonest first
+	 */
+	void setUpcoming(const std::vector<std::string> &sources);
+
+	/**
+	 * Cancels the outstanding request, so its handler is never called.
+	 */
+	void cancel();
+
+	/**
+	 * Hands finished art over.  This is run by the timer, but may be
+	 * called directly on the LVGL thread.
+	 */
+	void poll();
+
+	/**
+	 * Returns the InMemoryFS path a URL is downloaded to.  The extension
+	 * is kept so the decoders recognize the image type.
+	 *
+	 * @param url the URL of the image
+	 * @return the path, without the drive letter
+	 */
+	static std::string fetchPath(const std::string &url);
+
+	/**
+	 * Returns whether a source is a URL the pipeline downloads, rather
+	 * than an image source LVGL can open itself.
+	 */
+	static bool isUrl(const std::string &source);
+
+private:
+	struct Job {
+		std::string source;
+		uint32_t generation;
+		uint32_t version;
+		uint16_t maxWidth;
+		uint16_t maxHeight;
+	};
+
+	struct Result {
+		Job job;
+		Surface *surface;
+
+		// Left for the LVGL thread to decode, along with any download
+		bool needsLvgl;
+	};
+
+	// Where fetched art is downloaded to
+	static constexpr const char *FETCH_DIRECTORY = "coverart/";
+
+	CoverArtCache &cache;
+	Decoder decoder;
+	LvglDecoder lvglDecoder;
+
+	// Bumped on the LVGL thread for every request and read by the worker
+	std::atomic<uint32_t> generation;
+
+	// Bumped when a request takes the worker from prefetching
+	std::atomic<uint32_t> prefetchGeneration;
+
+	// Used only on the LVGL thread
+	Handler handler;
+	lv_timer_t *timer;
+
+	// Shared with the worker and guarded by the mutex
+	std::mutex mutex;
+	std::condition_variable wake;
+	Fetcher fetcher;
+	ArtStore *store;
+	bool running;
+	bool stopping;
+	bool hasJob;
+	Job job;
+	bool hasResult;
+	Result result;
+	CoverArtDecoder::Retired retired;
+
+	std::vector<Job> prefetchQueue;
+	uint32_t upcomingVersion;
+	std::string prefetching;
+	bool promoted;
+	uint32_t promotedGeneration;
+	std::vector<Result> prefetched;
+
+#if defined(ESP32)
+	TaskHandle_t task;
+
+	static void taskMain(void *parameter);
+#else
+	std::thread thread;
+#endif
+
+	void work();
+	void finishPrefetch(const Result &finished, uint32_t listVersion, const CancelToken &cancel);
+	void retire(const Result &dropped);
+	Surface *produce(const Job &job, const Fetcher &fetch, ArtStore *store, const CancelToken &cancel, CoverArtDecoder::Retired &leftovers, bool &needsLvgl);
+	Surface *decodeDeferred(const Job &job, ArtStore *store);
+	static void discardDeferred(const Job &job);
+	static void timerCallback(lv_timer_t *timer);
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "Surface.h"
+
+/**
+ * Scales an image down into a surface one source row at a time using an
+ * area filter, so the full resolution image never needs to be held.
+ *
+ * Each output pixel is the average of the source area it covers, with
+ * source pixels straddling an output boundary split between the two
+ * output pixels by their coverage.  All of the arithmetic is integer:
+ * the weights are exact and the sums cannot overflow for sources up to
+ * the 2047 pixel limit of LVGL images.
+ *
+ * Rows are summed vertically as they arrive, in planar arrays with one
+ * weight per row so the loop vectorizes, and the horizontal pass runs
+ * once per target row rather than once per source row.
+ *
+ * Scaling up is not supported; the target must be no larger than the
+ * source in either direction.
+ */
+class ImageScaler {
+public:
+	/**
+	 * Fit an image within a box, keeping its aspect ratio and never
+	 * scaling it up.
+	 *
+	 * @param width the width of the image
+	 * @param height the height of the image
+	 * @param boxWidth the width of the box, or 0 for no limit
+	 * @param boxHeight the height of the box, or 0 for no limit
+	 * @param fitWidth receives the fitted width
+	 * @param fitHeight receives the fitted height
+	 */
+	static void fitWithin(uint16_t width, uint16_t height, uint16_t boxWidth, uint16_t boxHeight,
+		uint16_t &fitWidth, uint16_t &fitHeight);
+
+	/**
+	 * Prepare to scale an image into a surface.
+	 *
+	 * @param sourceWidth the width of the source rows
+	 * @param sourceHeight the number of source rows
+	 * @param sourceFormat LV_IMG_CF_TRUE_COLOR or LV_IMG_CF_TRUE_COLOR_ALPHA
+	 * @param target the surface receiving the scaled image
+	 */
+	ImageScaler(uint16_t sourceWidth, uint16_t sourceHeight, lv_img_cf_t sourceFormat, Surface *target);
+	~ImageScaler();
+
+	// Disable copy semantics
+	ImageScaler(const ImageScaler&) = delete;
+
+	/**
+	 * Return whether the scaler could be set up.  It fails if the
+	 * target is larger than the source or memory could not be allocated.
+	 */
+	bool isValid() const {
+		return columns != nullptr;
+	}
+
+	/**
+	 * Add the next source row, writing target rows as they complete.
+	 *
+	 * @param row the row in the source format
+	 */
+	void pushRow(const uint8_t *row);
+
+	/**
+	 * Return whether every source row has been added.
+	 */
+	bool isComplete() const {
+		return sourceRow == sourceHeight;
+	}
+
+private:
+	// The most channels held, red, green, blue and alpha
+	static const uint8_t MAX_CHANNELS = 4;
+
+	/**
+	 * Where a source column lands.  The column adds weight parts to
+	 * target column index and the rest of its weight to the next.
+	 */
+	struct Column {
+		uint16_t index;
+		uint16_t weight;
+	};
+
+	uint16_t sourceWidth;
+	uint16_t sourceHeight;
+	lv_img_cf_t sourceFormat;
+	Surface *target;
+	uint8_t channels;
+	uint16_t sourceRow;
+	uint16_t targetRow;
+
+	Column *columns;
+
+	// One source row split into channels
+	uint8_t *unpacked[MAX_CHANNELS];
+
+	// Vertical sums for the target row in progress and the one after it
+	uint32_t *currentSums[MAX_CHANNELS];
+	uint32_t *nextSums[MAX_CHANNELS];
+
+	// Horizontal sums of a completed row, one column longer than the target
+	uint32_t *rowSums;
+
+	uint8_t *storage;
+
+	void unpack(const uint8_t *row);
+	void emitRow();
+};
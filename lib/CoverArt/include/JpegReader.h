@@ -0,0 +1,129 @@
+#pragma once
+
+#include <functional>
+#include <lvgl.h>
+#include <stdint.h>
+
+struct JDEC;
+
+/**
+ * Reads a JPEG image with TJpgDec, the decoder behind LVGL's SJPG, but
+ * without going through LVGL, so it may run on any thread.
+ *
+ * TJpgDec produces the image a block row at a time, which is converted
+ * to the display's color format and handed out a row at a time, so
+ * beyond the caller's output only a single block row of pixels and the
+ * decoder's 4KB work area are held.  It can also reduce the image by up
+ * to 8 as it decodes, which is much cheaper than scaling every pixel.
+ *
+ * Baseline JPEGs in grayscale or YCbCr are supported.  TJpgDec refuses
+ * progressive JPEGs, and as SJPG is built on it LVGL cannot decode them
+ * either.
+ */
+class JpegReader {
+public:
+	/**
+	 * Receives each row of the image in turn, in LV_IMG_CF_TRUE_COLOR.
+	 * Returning false stops the decode.
+	 */
+	typedef std::function<bool(const uint8_t *row)> RowHandler;
+
+	JpegReader();
+	~JpegReader();
+
+	// Disable copy semantics
+	JpegReader(const JpegReader&) = delete;
+
+	/**
+	 * Open a JPEG and read its headers.  InMemoryFS paths are read from
+	 * the stored bytes in place when they are held contiguously.
+	 *
+	 * @param source an LVGL image source: a path ending in .jpg or .jpeg
+	 *               or an image descriptor holding the bytes of a JPEG file
+	 * @return false if the source is not a JPEG this reader can decode
+	 */
+	bool open(const void *source);
+
+	/**
+	 * Return whether the source is a JPEG, even if it was refused.
+	 */
+	bool isJpeg() const {
+		return jpeg;
+	}
+
+	uint16_t width() const {
+		return imageWidth;
+	}
+
+	uint16_t height() const {
+		return imageHeight;
+	}
+
+	/**
+	 * Return the most the image can be reduced while decoding and still
+	 * be at least a given size.
+	 *
+	 * @param minWidth the narrowest the reduced image may be
+	 * @param minHeight the shortest the reduced image may be
+	 * @return the reduction as a power of two, from 0 to 3
+	 */
+	uint8_t reductionFor(uint16_t minWidth, uint16_t minHeight) const;
+
+	/**
+	 * Decode the image.  A reader decodes only once.
+	 *
+	 * @param reduction the image is reduced by 2 to this power, so it
+	 *                  is width() >> reduction wide
+	 * @param handler receives the rows
+	 * @return false if the image data is malformed or the handler
+	 *         stopped the decode
+	 */
+	bool decode(uint8_t reduction, RowHandler handler);
+
+	/**
+	 * Hands over the InMemoryFS descriptor the JPEG is read through, so a
+	 * reader used away from the LVGL thread can leave releasing it to the
+	 * LVGL thread.  The descriptor must not be released while the reader
+	 * is still reading.
+	 *
+	 * @return the descriptor, or nullptr if the JPEG is not read in place
+	 */
+	const lv_img_dsc_t *takeStoredImage() {
+		const lv_img_dsc_t *image = storedImage;
+		storedImage = nullptr;
+		return image;
+	}
+
+private:
+	// The work area TJpgDec needs, as LVGL's SJPG gives it
+	static const uint16_t WORK_AREA_SIZE = 4096;
+
+	// Where the bytes come from: memory or an open LVGL file
+	const uint8_t *memory;
+	uint32_t memorySize;
+	uint32_t memoryPosition;
+	const lv_img_dsc_t *storedImage;
+	lv_fs_file_t file;
+	bool fileOpen;
+
+	JDEC *decoder;
+	void *workArea;
+	bool jpeg;
+	bool decoded;
+
+	uint16_t imageWidth;
+	uint16_t imageHeight;
+
+	// The block row being assembled and where its rows go
+	uint8_t *band;
+	uint32_t bandStride;
+	uint16_t outputWidth;
+	RowHandler rowHandler;
+
+	// The functions TJpgDec calls back into
+	struct Callbacks;
+
+	bool openSource(const void *source);
+	size_t readBytes(uint8_t *buffer, size_t count);
+	bool storeBlock(const uint8_t *bitmap, uint16_t left, uint16_t right, uint16_t top, uint16_t bottom);
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Surface.h"
+
+// The largest size BlurHash placeholders are decoded at.  They hold no
+// detail, so they are drawn scaled up to fill the cover slot.
+#ifndef COVERART_PLACEHOLDER_SIZE
+	#define COVERART_PLACEHOLDER_SIZE 32
+#endif
+
+/**
+ * Decodes the tiny placeholder art a now playing message can carry, to
+ * show in the cover slot the moment the track changes while the full
+ * art is fetched and decoded.
+ *
+ * Two encodings are understood: a BlurHash string, a blurred impression
+ * of the art in a few dozen characters, and a square thumbnail of at
+ * most 64x64 pixels as base64 encoded 8-bit RGB triples.  Either decodes
+ * in well under a millisecond into a small surface, which the image
+ * widget scales up to the slot.
+ */
+namespace Placeholder {
+	/**
+	 * Decode a placeholder in either encoding.
+	 *
+	 * @param encoded a BlurHash or a base64 thumbnail
+	 * @return the surface, holding one reference, or nullptr if the
+	 *         placeholder is malformed
+	 */
+	Surface *decode(const char *encoded);
+
+	/**
+	 * Decode a BlurHash.
+	 *
+	 * @param hash the BlurHash string
+	 * @param size the width and height to decode at, up to
+	 *             COVERART_PLACEHOLDER_SIZE
+	 * @return the surface or nullptr if the hash is malformed
+	 */
+	Surface *fromBlurHash(const char *hash, uint16_t size = COVERART_PLACEHOLDER_SIZE);
+
+	/**
+	 * Decode a square thumbnail of base64 encoded RGB triples, row by row.
+	 *
+	 * @param base64 the encoded pixels
+	 * @return the surface or nullptr if the encoding is malformed or the
+	 *         pixels do not form a square
+	 */
+	Surface *fromThumbnail(const char *base64);
+}
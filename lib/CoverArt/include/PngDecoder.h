@@ -0,0 +1,18 @@
+#pragma once
+
+/**
+ * An LVGL image decoder for PNG images built on PngReader.
+ *
+ * The image is decoded straight into a surface in the display's color
+ * format, so the peak memory is the decoded image plus the inflate
+ * window, instead of LVGL's PNG decoder holding the image as 32-bit RGBA
+ * alongside its conversion.  Images it refuses, such as interlaced ones,
+ * fall through to LVGL's decoder.
+ */
+namespace PngDecoder {
+	/**
+	 * Register the decoder ahead of the decoders LVGL registers itself.
+	 * Must be called after lv_init.
+	 */
+	void registerDecoder();
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <lvgl.h>
+#include <stdint.h>
+
+class Inflater;
+
+/**
+ * Reads a PNG image a row at a time, converting each row straight to the
+ * display's color format.
+ *
+ * The compressed data is inflated incrementally, so the memory needed
+ * beyond the caller's output is the 32KB inflate window and two rows of
+ * raw pixels, rather than the whole image as 32-bit RGBA.
+ *
+ * Every non-interlaced PNG is supported.  Interlaced images cannot be
+ * produced in row order without holding them in full, so they are
+ * refused and left to LVGL's own PNG decoder.  Chunk CRCs are not
+ * checked.
+ */
+class PngReader {
+public:
+	PngReader();
+	~PngReader();
+
+	// Disable copy semantics
+	PngReader(const PngReader&) = delete;
+
+	/**
+	 * Open a PNG and read its header.  InMemoryFS paths are read from the
+	 * stored bytes in place when they are held contiguously.
+	 *
+	 * @param source an LVGL image source: a path ending in .png or an
+	 *               image descriptor holding the bytes of a PNG file
+	 * @return false if the source is not a PNG this reader can decode
+	 */
+	bool open(const void *source);
+
+	uint16_t width() const {
+		return imageWidth;
+	}
+
+	uint16_t height() const {
+		return imageHeight;
+	}
+
+	/**
+	 * Return the format rows are produced in: LV_IMG_CF_TRUE_COLOR_ALPHA
+	 * if the image has any transparency, otherwise LV_IMG_CF_TRUE_COLOR.
+	 */
+	lv_img_cf_t format() const {
+		return hasAlpha ? LV_IMG_CF_TRUE_COLOR_ALPHA : LV_IMG_CF_TRUE_COLOR;
+	}
+
+	/**
+	 * Decode the next row.
+	 *
+	 * @param out receives width pixels in the format
+	 * @return false if the image data is malformed or truncated
+	 */
+	bool readRow(uint8_t *out);
+
+	/**
+	 * Hands over the InMemoryFS descriptor the PNG is read through, so a
+	 * reader used away from the LVGL thread can leave releasing it to the
+	 * LVGL thread.  The descriptor must not be released while the reader
+	 * is still reading.
+	 *
+	 * @return the descriptor, or nullptr if the PNG is not read in place
+	 */
+	const lv_img_dsc_t *takeStoredImage() {
+		const lv_img_dsc_t *image = storedImage;
+		storedImage = nullptr;
+		return image;
+	}
+
+private:
+	// The largest image LVGL can describe
+	static const uint16_t MAX_DIMENSION = 2047;
+
+	// The most file data read at once when the image is not in memory
+	static const uint16_t INPUT_BUFFER_SIZE = 1024;
+
+	// Where the bytes come from: memory or an open LVGL file
+	const uint8_t *memory;
+	uint32_t memorySize;
+	uint32_t memoryPosition;
+	const lv_img_dsc_t *storedImage;
+	lv_fs_file_t file;
+	bool fileOpen;
+	uint8_t *inputBuffer;
+
+	uint16_t imageWidth;
+	uint16_t imageHeight;
+	uint8_t colorType;
+	uint8_t bitDepth;
+	bool hasAlpha;
+
+	// Palette entries as RGBA, and the transparent color of images without a palette
+	uint8_t *palette;
+	uint16_t paletteSize;
+	bool hasTransparentColor;
+	uint16_t transparentColor[3];
+
+	uint32_t chunkRemaining;
+	Inflater *inflater;
+
+	// The raw bytes of the row being decoded and the row before it, each
+	// preceded by the filter type, in one allocation
+	uint8_t *rowStorage;
+	uint8_t *currentRow;
+	uint8_t *previousRow;
+	uint32_t rowBytes;
+
+	bool openSource(const void *source);
+	bool readBytes(uint8_t *buffer, uint32_t count);
+	bool skipBytes(uint32_t count);
+	uint32_t borrowBytes(const uint8_t *&data, uint32_t count);
+	bool readChunkHeader(uint32_t &length, uint32_t &type);
+	bool readHeaderChunk(uint32_t length);
+	bool readPalette(uint32_t length);
+	bool readTransparency(uint32_t length);
+	uint32_t nextImageData(const uint8_t *&data);
+
+	bool unfilter();
+	void convert(uint8_t *out);
+};
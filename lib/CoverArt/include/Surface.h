@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <lvgl.h>
+
+/**
+ * An image decoded into the display's color format, ready to be drawn by
+ * LVGL as a plain blit.  The pixels live in PSRAM when the board has it.
+ *
+ * Surfaces are reference counted so a cache can drop one while an image
+ * widget is still showing it.  The image descriptor is the first member,
+ * so the descriptor handed to LVGL can be converted back to its surface.
+ */
+class Surface {
+public:
+	/**
+	 * Allocate a surface.  The pixels are left uninitialized.
+	 *
+	 * @param width the width in pixels
+	 * @param height the height in pixels
+	 * @param cf LV_IMG_CF_TRUE_COLOR, or LV_IMG_CF_TRUE_COLOR_ALPHA for
+	 *           images with transparency
+	 * @return the surface, holding one reference, or nullptr if the
+	 *         memory could not be allocated
+	 */
+	static Surface *create(uint16_t width, uint16_t height, lv_img_cf_t cf);
+
+	/**
+	 * Return the surface behind an image descriptor.
+	 */
+	static Surface *fromImage(const lv_img_dsc_t *image) {
+		return (Surface *) image;
+	}
+
+	// Disable copy semantics
+	Surface(const Surface&) = delete;
+
+	lv_img_dsc_t image;
+
+	uint16_t width() const {
+		return image.header.w;
+	}
+
+	uint16_t height() const {
+		return image.header.h;
+	}
+
+	/**
+	 * Return the bytes per pixel.
+	 */
+	uint8_t pixelSize() const {
+		return (image.header.cf == LV_IMG_CF_TRUE_COLOR_ALPHA) ? LV_IMG_PX_SIZE_ALPHA_BYTE : sizeof(lv_color_t);
+	}
+
+	uint32_t stride() const {
+		return width() * pixelSize();
+	}
+
+	uint8_t *pixels() {
+		return (uint8_t *) image.data;
+	}
+
+	uint8_t *row(uint16_t y) {
+		return pixels() + (y * stride());
+	}
+
+	uint32_t byteSize() const {
+		return image.data_size;
+	}
+
+	/**
+	 * Take a reference to the surface.
+	 */
+	void acquire() {
+		refCount.fetch_add(1);
+	}
+
+	/**
+	 * Drop a reference, freeing the surface with the last one.  The last
+	 * reference must be dropped on the LVGL thread.
+	 */
+	void release();
+
+private:
+	Surface() : refCount(1) {}
+	~Surface();
+
+	std::atomic<uint32_t> refCount;
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "Surface.h"
+
+#include <lvgl.h>
+#include <stdint.h>
+#include <vector>
+
+// The width and height of the tiles images are converted with
+#ifndef COVERART_TILE_SIZE
+	#define COVERART_TILE_SIZE 32
+#endif
+
+/**
+ * A compact image format holding pixels already in the display's color
+ * format, split into square tiles that can each be read on their own.
+ *
+ * The file is a header, an index of where each tile starts and the tiles
+ * in row order.  Each tile holds its pixels row by row, each pixel two
+ * bytes of RGB565, little endian, followed by an alpha byte for images
+ * with alpha.  A tile is compressed with LZ4 unless that would not make
+ * it smaller, which its size in the index shows.  Tiles on the right and
+ * bottom edges are cut to the image.
+ *
+ *   offset  size  field
+ *   0       4     magic "TIL1"
+ *   4       2     width
+ *   6       2     height
+ *   8       1     LV_IMG_CF_TRUE_COLOR or LV_IMG_CF_TRUE_COLOR_ALPHA
+ *   9       1     tile size
+ *   10      2     reserved, 0
+ *   12      4n+4  the file offset of each of the n tiles and of the end
+ *
+ * The LVGL decoder produces the image a line at a time, decoding only
+ * the tiles the lines cross.  A redraw of part of the image decodes just
+ * the tiles under it, and the most held at once is one row of tiles,
+ * never the whole image.
+ */
+class TiledImage {
+public:
+	/**
+	 * Encode a surface in the tiled format.
+	 *
+	 * @param surface the image
+	 * @param tileSize the width and height of the tiles, small enough for
+	 *                 a tile to fit in one LZ4 block
+	 * @return the bytes of the file, empty if the tile size is too large
+	 */
+	static std::vector<uint8_t> encode(Surface *surface, uint8_t tileSize = COVERART_TILE_SIZE);
+
+	/**
+	 * Decode an image and write it to a file in the tiled format.
+	 *
+	 * @param source an LVGL image source
+	 * @param path the file to write, a path for the C library
+	 * @param maxWidth the widest the image may be, or 0 for no limit
+	 * @param maxHeight the tallest the image may be, or 0 for no limit
+	 * @return false if the image could not be decoded or written
+	 */
+	static bool convert(const void *source, const char *path, uint16_t maxWidth = 0, uint16_t maxHeight = 0);
+
+	/**
+	 * Register the LVGL decoder for tiled images.  Must be called after
+	 * lv_init.
+	 */
+	static void registerDecoder();
+
+	TiledImage();
+	~TiledImage();
+
+	// Disable copy semantics
+	TiledImage(const TiledImage&) = delete;
+
+	/**
+	 * Open a tiled image and read its index.  InMemoryFS paths are read
+	 * from the stored bytes in place when they are held contiguously.
+	 *
+	 * @param source an LVGL image source: a path ending in .tile or an
+	 *               image descriptor holding the bytes of a tiled image
+	 * @return false if the source is not a valid tiled image
+	 */
+	bool open(const void *source);
+
+	uint16_t width() const {
+		return imageWidth;
+	}
+
+	uint16_t height() const {
+		return imageHeight;
+	}
+
+	lv_img_cf_t format() const {
+		return colorFormat;
+	}
+
+	/**
+	 * Read part of a line, decoding the tiles it crosses unless they are
+	 * already held from an earlier line of the same row of tiles.
+	 *
+	 * @param x the first column
+	 * @param y the line
+	 * @param length the number of pixels
+	 * @param out receives the pixels in the format
+	 * @return false if the area is outside the image or a tile is corrupt
+	 */
+	bool readLine(uint16_t x, uint16_t y, uint16_t length, uint8_t *out);
+
+	/**
+	 * Return the number of tiles decoded since the image was opened.
+	 */
+	uint32_t getTilesDecoded() const {
+		return tilesDecoded;
+	}
+
+	/**
+	 * Hands over the InMemoryFS descriptor the image is read through, so
+	 * an image read away from the LVGL thread can leave releasing it to
+	 * the LVGL thread.  The descriptor must not be released while the
+	 * image is still being read.
+	 *
+	 * @return the descriptor, or nullptr if the image is not read in place
+	 */
+	const lv_img_dsc_t *takeStoredImage() {
+		const lv_img_dsc_t *image = storedImage;
+		storedImage = nullptr;
+		return image;
+	}
+
+private:
+	// The largest image LVGL can describe
+	static const uint16_t MAX_DIMENSION = 2047;
+
+	// No tile row held
+	static const uint16_t NO_ROW = 0xFFFF;
+
+	// Where the bytes come from: memory or an open LVGL file
+	const uint8_t *memory;
+	uint32_t sourceSize;
+	const lv_img_dsc_t *storedImage;
+	lv_fs_file_t file;
+	bool fileOpen;
+
+	uint16_t imageWidth;
+	uint16_t imageHeight;
+	lv_img_cf_t colorFormat;
+	uint8_t pixelSize;
+	uint8_t tileSize;
+	uint16_t tilesAcross;
+	uint16_t tilesDown;
+	uint32_t *offsets;
+
+	// One row of tiles as whole image rows, with a flag per tile marking
+	// those decoded, and room to read and decompress a tile
+	uint8_t *band;
+	uint8_t *bandTiles;
+	uint8_t *scratch;
+	uint16_t bandRow;
+	uint32_t tilesDecoded;
+
+	bool openSource(const void *source);
+	bool readIndex();
+	bool readAt(uint32_t offset, uint8_t *buffer, uint32_t count);
+	bool decodeTile(uint16_t column);
+};
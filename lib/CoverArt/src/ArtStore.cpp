@@ -0,0 +1,529 @@
+#include "ArtStore.h"
+
+#include <Lz4.h>
+#include <algorithm>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// The bytes of art compressed as one LZ4 block
+static const uint32_t BLOCK_SIZE = 16384;
+
+static_assert(BLOCK_SIZE <= Lz4::MAX_INPUT_SIZE, "Art blocks must fit in an LZ4 block");
+
+// Files are only read by the device that wrote them, so fields are kept
+// in its byte order
+static const char ART_MAGIC[4] = { 'T', 'S', 'A', '1' };
+static const char INDEX_MAGIC[4] = { 'T', 'S', 'A', 'I' };
+static const uint32_t HEADER_SIZE = 16;
+
+static const char *ART_EXTENSION = ".art";
+static const char *TEMP_EXTENSION = ".tmp";
+static const char *INDEX_NAME = "index";
+
+ArtStore &ArtStore::get() {
+	static ArtStore store;
+	return store;
+}
+
+ArtStore::ArtStore(const char *directory, uint32_t capacity) :
+	directory(directory), capacity(capacity), useClock(0), storedBytes(0), indexDirty(false), writing(false), running(false), stopping(false),
+	loadingHash(0), loading(false), hits(0), misses(0), writes(0), evictions(0) {
+}
+
+ArtStore::~ArtStore() {
+	stop();
+}
+
+bool ArtStore::start() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (running) {
+		return true;
+	}
+
+	mkdir(directory.c_str(), 0755);
+	struct stat info;
+	if ((stat(directory.c_str(), &info) != 0) || !S_ISDIR(info.st_mode)) {
+		return false;
+	}
+
+	readIndex();
+
+	running = true;
+	stopping = false;
+
+#if defined(ESP32)
+	if (xTaskCreate(taskMain, "artstore", 4096, this, tskIDLE_PRIORITY + 1, &task) != pdPASS) {
+		running = false;
+		return false;
+	}
+#else
+	thread = std::thread(&ArtStore::work, this);
+#endif
+
+	return true;
+}
+
+void ArtStore::stop() {
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!running) {
+			return;
+		}
+
+		stopping = true;
+		wake.notify_all();
+
+#if defined(ESP32)
+		wake.wait(lock, [this] { return !running; });
+#endif
+	}
+
+#if !defined(ESP32)
+	thread.join();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	running = false;
+#endif
+}
+
+Surface *ArtStore::load(const char *source, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel) {
+	std::string key = keyOf(source, maxWidth, maxHeight);
+	uint32_t hash = hashOf(key);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Entry *entry = find(hash);
+		if ((entry == nullptr) || loading) {
+			misses++;
+			return nullptr;
+		}
+
+		// Keep the file from being evicted while it is read
+		entry->lastUse = ++useClock;
+		loading = true;
+		loadingHash = hash;
+	}
+
+	Surface *surface = nullptr;
+	uint8_t *scratch = nullptr;
+	bool ok = false;
+
+	FILE *file = fopen(pathOf(hash, ART_EXTENSION).c_str(), "rb");
+	uint8_t header[HEADER_SIZE];
+	if ((file != nullptr) && (fread(header, 1, HEADER_SIZE, file) == HEADER_SIZE) && (memcmp(header, ART_MAGIC, 4) == 0)) {
+		uint16_t width, height, keyLength;
+		uint32_t dataSize;
+		memcpy(&width, header + 4, 2);
+		memcpy(&height, header + 6, 2);
+		memcpy(&keyLength, header + 10, 2);
+		memcpy(&dataSize, header + 12, 4);
+		lv_img_cf_t cf = header[8];
+
+		std::string storedKey(keyLength, '\0');
+		ok = (keyLength == key.size()) && (fread(&storedKey[0], 1, keyLength, file) == keyLength) && (storedKey == key);
+		if (ok && ((cf == LV_IMG_CF_TRUE_COLOR) || (cf == LV_IMG_CF_TRUE_COLOR_ALPHA))) {
+			surface = Surface::create(width, height, cf);
+			scratch = (uint8_t *) malloc(BLOCK_SIZE);
+		}
+
+		ok = (surface != nullptr) && (scratch != nullptr) && (surface->byteSize() == dataSize);
+		for (uint32_t offset = 0; ok && (offset < dataSize); offset += BLOCK_SIZE) {
+			uint32_t length = (dataSize - offset < BLOCK_SIZE) ? dataSize - offset : BLOCK_SIZE;
+			uint32_t stored;
+			ok = !cancel.isCancelled() && (fread(&stored, 1, 4, file) == 4) && (stored <= length);
+			if (!ok) {
+				break;
+			}
+
+			// A block stored at its full length is uncompressed
+			if (stored == length) {
+				ok = fread(surface->pixels() + offset, 1, length, file) == length;
+			} else {
+				ok = (fread(scratch, 1, stored, file) == stored) &&
+					(Lz4::decompress(scratch, stored, surface->pixels() + offset, length) == (int32_t) length);
+			}
+		}
+	}
+
+	if (file != nullptr) {
+		fclose(file);
+	}
+
+	free(scratch);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	loading = false;
+	if (ok) {
+		hits++;
+		indexDirty = true;
+		wake.notify_all();
+		return surface;
+	}
+
+	if (surface != nullptr) {
+		surface->release();
+	}
+
+	misses++;
+	if (!cancel.isCancelled()) {
+		// The file is unreadable, so drop it
+		forget(hash);
+		remove(pathOf(hash, ART_EXTENSION).c_str());
+		indexDirty = true;
+		wake.notify_all();
+	}
+
+	return nullptr;
+}
+
+void ArtStore::save(const char *source, uint16_t maxWidth, uint16_t maxHeight, Surface *surface) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!running || stopping || (pending.size() >= COVERART_STORE_MAX_PENDING)) {
+			return;
+		}
+	}
+
+	std::string key = keyOf(source, maxWidth, maxHeight);
+	uint32_t dataSize = surface->byteSize();
+	uint32_t blockCount = (dataSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	// No block is stored larger than it is
+	uint32_t bound = HEADER_SIZE + key.size() + (blockCount * 4) + dataSize;
+	if (bound > capacity) {
+		return;
+	}
+
+	uint8_t *data = (uint8_t *) malloc(bound);
+	if (data == nullptr) {
+		return;
+	}
+
+	uint16_t width = surface->width();
+	uint16_t height = surface->height();
+	uint16_t keyLength = key.size();
+	memcpy(data, ART_MAGIC, 4);
+	memcpy(data + 4, &width, 2);
+	memcpy(data + 6, &height, 2);
+	data[8] = surface->image.header.cf;
+	data[9] = 0;
+	memcpy(data + 10, &keyLength, 2);
+	memcpy(data + 12, &dataSize, 4);
+	memcpy(data + HEADER_SIZE, key.data(), keyLength);
+
+	uint32_t end = HEADER_SIZE + keyLength;
+	for (uint32_t offset = 0; offset < dataSize; offset += BLOCK_SIZE) {
+		uint32_t length = (dataSize - offset < BLOCK_SIZE) ? dataSize - offset : BLOCK_SIZE;
+		const uint8_t *in = surface->pixels() + offset;
+
+		uint32_t stored = Lz4::compress(in, length, data + end + 4, length - 1);
+		if (stored == 0) {
+			memcpy(data + end + 4, in, length);
+			stored = length;
+		}
+
+		memcpy(data + end, &stored, 4);
+		end += 4 + stored;
+	}
+
+	uint8_t *shrunk = (uint8_t *) realloc(data, end);
+	if (shrunk != nullptr) {
+		data = shrunk;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!running || stopping || (pending.size() >= COVERART_STORE_MAX_PENDING)) {
+		free(data);
+		return;
+	}
+
+	pending.push_back({ hashOf(key), data, end });
+	wake.notify_all();
+}
+
+void ArtStore::flush() {
+	std::unique_lock<std::mutex> lock(mutex);
+	wake.wait(lock, [this] { return !running || (pending.empty() && !writing && !indexDirty); });
+}
+
+ArtStore::Stats ArtStore::getStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return { hits, misses, writes, evictions, storedBytes, (uint32_t) entries.size() };
+}
+
+/**
+ * Returns the key art is stored under: the source and the size limits
+ * it was decoded for.
+ */
+std::string ArtStore::keyOf(const char *source, uint16_t maxWidth, uint16_t maxHeight) {
+	char size[16];
+	snprintf(size, sizeof(size), "@%ux%u", maxWidth, maxHeight);
+	return std::string(source) + size;
+}
+
+/**
+ * Returns the FNV-1a hash naming the file of a key.
+ */
+uint32_t ArtStore::hashOf(const std::string &key) {
+	uint32_t hash = 2166136261u;
+	for (char c : key) {
+		hash = (hash ^ (uint8_t) c) * 16777619u;
+	}
+
+	return hash;
+}
+
+std::string ArtStore::pathOf(uint32_t hash, const char *extension) const {
+	char name[16];
+	snprintf(name, sizeof(name), "/%08x", (unsigned int) hash);
+	return directory + name + extension;
+}
+
+/**
+ * Reads the index, with the mutex held.  Indexed files that are missing
+ * are dropped, art files missing from the index are adopted as the
+ * least recently used, and temporary files from interrupted writes are
+ * deleted.
+ */
+void ArtStore::readIndex() {
+	entries.clear();
+	storedBytes = 0;
+	useClock = 0;
+
+	FILE *file = fopen((directory + "/" + INDEX_NAME).c_str(), "rb");
+	if (file != nullptr) {
+		char magic[4];
+		uint32_t count;
+		if ((fread(magic, 1, 4, file) == 4) && (memcmp(magic, INDEX_MAGIC, 4) == 0) && (fread(&count, 1, 4, file) == 4)) {
+			// Entries run from least to most recently used
+			uint32_t record[2];
+			for (uint32_t i = 0; (i < count) && (fread(record, 1, sizeof(record), file) == sizeof(record)); i++) {
+				struct stat info;
+				if ((find(record[0]) == nullptr) && (stat(pathOf(record[0], ART_EXTENSION).c_str(), &info) == 0) && ((uint32_t) info.st_size == record[1])) {
+					entries.push_back({ record[0], record[1], ++useClock });
+					storedBytes += record[1];
+				} else {
+					indexDirty = true;
+				}
+			}
+		}
+
+		fclose(file);
+	}
+
+	DIR *dir = opendir(directory.c_str());
+	if (dir != nullptr) {
+		std::vector<std::string> temporary;
+		struct dirent *item;
+		while ((item = readdir(dir)) != nullptr) {
+			const char *name = item->d_name;
+			size_t length = strlen(name);
+			if ((length == 12) && (strcmp(name + 8, TEMP_EXTENSION) == 0)) {
+				temporary.push_back(directory + "/" + name);
+			} else if ((length == 12) && (strcmp(name + 8, ART_EXTENSION) == 0)) {
+				uint32_t hash = strtoul(std::string(name, 8).c_str(), nullptr, 16);
+				struct stat info;
+				if ((find(hash) == nullptr) && (stat(pathOf(hash, ART_EXTENSION).c_str(), &info) == 0)) {
+					entries.insert(entries.begin(), { hash, (uint32_t) info.st_size, 0 });
+					storedBytes += info.st_size;
+					indexDirty = true;
+				}
+			}
+		}
+
+		closedir(dir);
+
+		for (const std::string &path : temporary) {
+			remove(path.c_str());
+		}
+	}
+
+	for (uint32_t hash : evict(0)) {
+		remove(pathOf(hash, ART_EXTENSION).c_str());
+	}
+}
+
+/**
+ * Writes the index, replacing the previous one once complete.
+ */
+void ArtStore::writeIndex() {
+	std::vector<Entry> ordered;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ordered = entries;
+		indexDirty = false;
+	}
+
+	std::sort(ordered.begin(), ordered.end(), [](const Entry &a, const Entry &b) {
+		return a.lastUse < b.lastUse;
+	});
+
+	std::string path = directory + "/" + INDEX_NAME;
+	std::string temporary = path + TEMP_EXTENSION;
+	FILE *file = fopen(temporary.c_str(), "wb");
+	if (file == nullptr) {
+		return;
+	}
+
+	uint32_t count = ordered.size();
+	bool ok = (fwrite(INDEX_MAGIC, 1, 4, file) == 4) && (fwrite(&count, 1, 4, file) == 4);
+	for (const Entry &entry : ordered) {
+		uint32_t record[2] = { entry.hash, entry.size };
+		ok = ok && (fwrite(record, 1, sizeof(record), file) == sizeof(record));
+	}
+
+	ok = (fclose(file) == 0) && ok;
+	remove(path.c_str());
+	if (!ok || (rename(temporary.c_str(), path.c_str()) != 0)) {
+		remove(temporary.c_str());
+	}
+}
+
+/**
+ * Writes queued art, and then the index, until the store is stopped.
+ */
+void ArtStore::work() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		wake.wait(lock, [this] { return !pending.empty() || indexDirty || stopping; });
+
+		if (!pending.empty()) {
+			PendingWrite next = pending.front();
+			pending.erase(pending.begin());
+			writing = true;
+
+			lock.unlock();
+			write(next);
+			free(next.data);
+			lock.lock();
+
+			writing = false;
+		} else if (indexDirty) {
+			writing = true;
+
+			lock.unlock();
+			writeIndex();
+			lock.lock();
+
+			writing = false;
+		} else {
+			break;
+		}
+
+		wake.notify_all();
+	}
+}
+
+#if defined(ESP32)
+void ArtStore::taskMain(void *parameter) {
+	ArtStore *store = (ArtStore *) parameter;
+	store->work();
+
+	{
+		std::lock_guard<std::mutex> lock(store->mutex);
+		store->running = false;
+		store->wake.notify_all();
+	}
+
+	vTaskDelete(nullptr);
+}
+#endif
+
+/**
+ * Writes one file of art, making room for it first.
+ */
+void ArtStore::write(const PendingWrite &write) {
+	std::vector<uint32_t> victims;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		forget(write.hash);
+		victims = evict(write.size);
+	}
+
+	for (uint32_t hash : victims) {
+		remove(pathOf(hash, ART_EXTENSION).c_str());
+	}
+
+	std::string path = pathOf(write.hash, ART_EXTENSION);
+	std::string temporary = pathOf(write.hash, TEMP_EXTENSION);
+	FILE *file = fopen(temporary.c_str(), "wb");
+	if (file == nullptr) {
+		return;
+	}
+
+	bool ok = fwrite(write.data, 1, write.size, file) == write.size;
+	ok = (fclose(file) == 0) && ok;
+	remove(path.c_str());
+	if (!ok || (rename(temporary.c_str(), path.c_str()) != 0)) {
+		remove(temporary.c_str());
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	entries.push_back({ write.hash, write.size, ++useClock });
+	storedBytes += write.size;
+	writes++;
+	indexDirty = true;
+}
+
+/**
+ * Drops least recently used entries, with the mutex held, until there
+ * is room for incoming more bytes.  The file being loaded is kept.
+ *
+ * @param incoming the bytes about to be written
+ * @return the hashes of the files to delete
+ */
+std::vector<uint32_t> ArtStore::evict(uint32_t incoming) {
+	std::vector<uint32_t> victims;
+
+	while ((storedBytes + incoming > capacity) && !entries.empty()) {
+		size_t victim = entries.size();
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (loading && (entries[i].hash == loadingHash)) {
+				continue;
+			}
+
+			if ((victim == entries.size()) || (entries[i].lastUse < entries[victim].lastUse)) {
+				victim = i;
+			}
+		}
+
+		if (victim == entries.size()) {
+			break;
+		}
+
+		victims.push_back(entries[victim].hash);
+		storedBytes -= entries[victim].size;
+		entries.erase(entries.begin() + victim);
+		evictions++;
+		indexDirty = true;
+	}
+
+	return victims;
+}
+
+ArtStore::Entry *ArtStore::find(uint32_t hash) {
+	for (Entry &entry : entries) {
+		if (entry.hash == hash) {
+			return &entry;
+		}
+	}
+
+	return nullptr;
+}
+
+/**
+ * Drops the entry for a hash, with the mutex held.
+ */
+void ArtStore::forget(uint32_t hash) {
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].hash == hash) {
+			storedBytes -= entries[i].size;
+			entries.erase(entries.begin() + i);
+			return;
+		}
+	}
+}
@@ -0,0 +1,106 @@
+#include "ArtTranscoder.h"
+#include "CoverArtDecoder.h"
+#include "TiledImage.h"
+
+#include <InMemoryFS.h>
+#include <stdio.h>
+
+ArtTranscoder::ArtTranscoder(CoverArtPipeline::Fetcher fetcher, uint16_t width, uint16_t height, uint32_t budget) :
+	fetcher(fetcher), width(width), height(height), budget(budget), useClock(0), storedBytes(0), transcodes(0), hits(0), failures(0) {
+}
+
+ArtTranscoder::Payload ArtTranscoder::transcode(const std::string &url) {
+	std::string name = nameOf(url);
+	Payload payload = find(name);
+	if (payload) {
+		std::lock_guard<std::mutex> lock(mutex);
+		hits++;
+		return payload;
+	}
+
+	Surface *surface = decode(url);
+	if (surface != nullptr) {
+		payload = std::make_shared<const std::vector<uint8_t>>(TiledImage::encode(surface));
+		surface->release();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!payload || payload->empty()) {
+		failures++;
+		return nullptr;
+	}
+
+	transcodes++;
+	entries.push_back({ name, payload, ++useClock });
+	storedBytes += payload->size();
+	evict();
+
+	return payload;
+}
+
+ArtTranscoder::Payload ArtTranscoder::find(const std::string &name) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (Entry &entry : entries) {
+		if (entry.name == name) {
+			entry.lastUse = ++useClock;
+			return entry.payload;
+		}
+	}
+
+	return nullptr;
+}
+
+ArtTranscoder::Stats ArtTranscoder::getStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return { transcodes, hits, failures, storedBytes, (uint32_t) entries.size() };
+}
+
+std::string ArtTranscoder::nameOf(const std::string &url) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (char c : url) {
+		hash = (hash ^ (uint8_t) c) * 16777619u;
+	}
+
+	char name[16];
+	snprintf(name, sizeof(name), "%08x.tile", (unsigned int) hash);
+	return name;
+}
+
+/**
+ * Downloads and decodes art, scaled to the display size.  Only the
+ * decoded art is kept.
+ */
+Surface *ArtTranscoder::decode(const std::string &url) {
+	if (!fetcher) {
+		return nullptr;
+	}
+
+	std::string path = CoverArtPipeline::fetchPath(url);
+	Surface *surface = nullptr;
+	if (fetcher(url.c_str(), path.c_str(), CancelToken())) {
+		std::string drivePath = std::string(1, InMemoryFS::DRIVE_LETTER) + ":" + path;
+		surface = CoverArtDecoder::decode(drivePath.c_str(), width, height);
+	}
+
+	InMemoryFS::unregisterFile(path.c_str());
+	return surface;
+}
+
+/**
+ * Drops least recently used payloads until within budget.  The newest
+ * payload is always kept.
+ */
+void ArtTranscoder::evict() {
+	while ((storedBytes > budget) && (entries.size() > 1)) {
+		size_t oldest = 0;
+		for (size_t i = 1; i < entries.size(); i++) {
+			if (entries[i].lastUse < entries[oldest].lastUse) {
+				oldest = i;
+			}
+		}
+
+		storedBytes -= entries[oldest].payload->size();
+		entries.erase(entries.begin() + oldest);
+	}
+}
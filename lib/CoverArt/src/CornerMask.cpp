@@ -0,0 +1,61 @@
+#include "CornerMask.h"
+
+#include <math.h>
+
+/**
+ * Cover part of a pixel.
+ *
+ * @param pixel the pixel in the surface format
+ * @param hasAlpha whether the pixel has an alpha byte after its color
+ * @param opa how much of the pixel lies inside the corner
+ * @param background the color opaque pixels blend into
+ */
+static void maskPixel(uint8_t *pixel, bool hasAlpha, lv_opa_t opa, lv_color_t background) {
+	if (hasAlpha) {
+		uint8_t *alpha = pixel + LV_IMG_PX_SIZE_ALPHA_BYTE - 1;
+		*alpha = (*alpha * opa) / LV_OPA_COVER;
+	} else {
+		lv_color_t *color = (lv_color_t *) pixel;
+		*color = lv_color_mix(*color, background, opa);
+	}
+}
+
+void CornerMask::apply(Surface *surface, uint16_t radius, lv_color_t background) {
+	uint16_t width = surface->width();
+	uint16_t height = surface->height();
+	radius = LV_MIN(radius, LV_MIN(width, height) / 2);
+	if (radius == 0) {
+		return;
+	}
+
+	bool hasAlpha = (surface->image.header.cf == LV_IMG_CF_TRUE_COLOR_ALPHA);
+	uint8_t pixelSize = surface->pixelSize();
+	uint32_t stride = surface->stride();
+	uint8_t *pixels = surface->pixels();
+
+	// Work out the coverage of one corner and apply it to all four, so
+	// only the pixels outside the arc or on its edge are touched
+	for (uint16_t y = 0; y < radius; y++) {
+		float dy = radius - (y + 0.5f);
+		uint8_t *top = pixels + (y * stride);
+		uint8_t *bottom = pixels + ((height - 1 - y) * stride);
+
+		for (uint16_t x = 0; x < radius; x++) {
+			float dx = radius - (x + 0.5f);
+			float coverage = radius + 0.5f - sqrtf((dx * dx) + (dy * dy));
+			if (coverage >= 1) {
+				// The rest of the row is inside the arc
+				break;
+			}
+
+			lv_opa_t opa = (coverage <= 0) ? (lv_opa_t) LV_OPA_TRANSP : (lv_opa_t) ((coverage * LV_OPA_COVER) + 0.5f);
+			uint32_t left = x * pixelSize;
+			uint32_t right = (width - 1 - x) * pixelSize;
+
+			maskPixel(top + left, hasAlpha, opa, background);
+			maskPixel(top + right, hasAlpha, opa, background);
+			maskPixel(bottom + left, hasAlpha, opa, background);
+			maskPixel(bottom + right, hasAlpha, opa, background);
+		}
+	}
+}
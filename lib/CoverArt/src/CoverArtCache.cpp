@@ -0,0 +1,176 @@
+#include "CoverArtCache.h"
+#include "CornerMask.h"
+#include "CoverArtDecoder.h"
+
+#include <InMemoryFS.h>
+
+CoverArtCache &CoverArtCache::get() {
+	static CoverArtCache cache;
+	return cache;
+}
+
+CoverArtCache::CoverArtCache(uint32_t budget, Decoder decoder) :
+	decoder(decoder), budget(budget), targetWidth(0), targetHeight(0), cornerRadius(0), cornerBackground(lv_color_make(0, 0, 0)), residentBytes(0), accessClock(0), hits(0), misses(0), evictions(0) {
+	if (!this->decoder) {
+		this->decoder = [this](const char *source) {
+			return CoverArtDecoder::decode(source, targetWidth, targetHeight);
+		};
+	}
+}
+
+CoverArtCache::~CoverArtCache() {
+	for (Entry &entry : entries) {
+		entry.surface->release();
+	}
+}
+
+uint32_t CoverArtCache::versionOf(const char *source) {
+	if ((source[0] == InMemoryFS::DRIVE_LETTER) && (source[1] == ':')) {
+		return InMemoryFS::getVersion(source + 2);
+	}
+
+	return 0;
+}
+
+const lv_img_dsc_t *CoverArtCache::acquire(const char *source) {
+	const lv_img_dsc_t *image = lookup(source);
+	if (image != nullptr) {
+		return image;
+	}
+
+	uint32_t version = versionOf(source);
+	Surface *surface = decoder(source);
+	if (surface == nullptr) {
+		return nullptr;
+	}
+
+	return insert(source, version, surface);
+}
+
+const lv_img_dsc_t *CoverArtCache::lookup(const char *source) {
+	uint32_t version = versionOf(source);
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		Entry &entry = entries[i];
+		if (entry.source != source) {
+			continue;
+		}
+
+		if (entry.version != version) {
+			// The file has been replaced since it was decoded
+			remove(i);
+			break;
+		}
+
+		hits++;
+		entry.lastAccess = ++accessClock;
+		entry.surface->acquire();
+		return &entry.surface->image;
+	}
+
+	misses++;
+	return nullptr;
+}
+
+bool CoverArtCache::contains(const char *source) const {
+	uint32_t version = versionOf(source);
+	for (const Entry &entry : entries) {
+		if ((entry.source == source) && (entry.version == version)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const lv_img_dsc_t *CoverArtCache::insert(const char *source, uint32_t version, Surface *surface) {
+	// Replace any art already cached for the source
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].source == source) {
+			remove(i);
+			break;
+		}
+	}
+
+	// Corners are rounded once here rather than clipped on every redraw
+	CornerMask::apply(surface, cornerRadius, cornerBackground);
+
+	// The entry keeps the caller's reference and the caller gets another
+	surface->acquire();
+	entries.push_back({ source, version, ++accessClock, surface });
+	residentBytes += surface->byteSize();
+	evict();
+
+	return &surface->image;
+}
+
+void CoverArtCache::release(const lv_img_dsc_t *image) {
+	if (image != nullptr) {
+		Surface::fromImage(image)->release();
+	}
+}
+
+void CoverArtCache::clear() {
+	while (!entries.empty()) {
+		remove(entries.size() - 1);
+	}
+}
+
+void CoverArtCache::setBudget(uint32_t bytes) {
+	budget = bytes;
+	evict();
+}
+
+void CoverArtCache::setTargetSize(uint16_t width, uint16_t height) {
+	if ((width != targetWidth) || (height != targetHeight)) {
+		targetWidth = width;
+		targetHeight = height;
+		clear();
+	}
+}
+
+void CoverArtCache::setCorners(uint16_t radius, lv_color_t background) {
+	if ((radius != cornerRadius) || (background.full != cornerBackground.full)) {
+		cornerRadius = radius;
+		cornerBackground = background;
+		clear();
+	}
+}
+
+CoverArtCache::Stats CoverArtCache::getStats() const {
+	return { hits, misses, evictions, residentBytes, (uint32_t) entries.size() };
+}
+
+/**
+ * Drops least recently used entries until the cache is within budget.
+ * The most recently used entry is always kept so the art just acquired
+ * survives even when it alone exceeds the budget.
+ */
+void CoverArtCache::evict() {
+	while ((residentBytes > budget) && (entries.size() > 1)) {
+		size_t victim = 0;
+		for (size_t i = 1; i < entries.size(); i++) {
+			if (entries[i].lastAccess < entries[victim].lastAccess) {
+				victim = i;
+			}
+		}
+
+		if (entries[victim].lastAccess == accessClock) {
+			break;
+		}
+
+		remove(victim);
+		evictions++;
+	}
+}
+
+/**
+ * Removes an entry, dropping the cache's reference to its surface.
+ *
+ * @param index the index of the entry
+ */
+void CoverArtCache::remove(size_t index) {
+	residentBytes -= entries[index].surface->byteSize();
+	entries[index].surface->release();
+	entries.erase(entries.begin() + index);
+}
@@ -0,0 +1,369 @@
+#include "CoverArtDecoder.h"
+#include "ImageScaler.h"
+#include "JpegReader.h"
+#include "PngReader.h"
+#include "TiledImage.h"
+
+#include <InMemoryFS.h>
+#include <functional>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A function producing one source row, either into the line buffer or
+ * by pointing at a row already in memory.
+ */
+typedef std::function<bool(uint16_t y, uint8_t *line, const uint8_t *&row)> RowReader;
+
+/**
+ * Fill a surface from the rows of an image, scaling them down when the
+ * surface is smaller.  Only one source row is held at a time.
+ *
+ * @param surface the surface to fill, in the source's format
+ * @param width the width of the source
+ * @param height the height of the source
+ * @param readRow produces each source row in turn
+ * @param cancel checked before each row
+ * @return whether every row could be read
+ */
+static bool fillSurface(Surface *surface, uint16_t width, uint16_t height, RowReader readRow, const CancelToken &cancel) {
+	if ((width == surface->width()) && (height == surface->height())) {
+		for (uint16_t y = 0; y < height; y++) {
+			const uint8_t *row = surface->row(y);
+			if (cancel.isCancelled() || !readRow(y, surface->row(y), row)) {
+				return false;
+			}
+
+			if (row != surface->row(y)) {
+				memcpy(surface->row(y), row, surface->stride());
+			}
+		}
+
+		return true;
+	}
+
+	ImageScaler scaler(width, height, surface->image.header.cf, surface);
+	uint8_t *line = (uint8_t *) malloc((uint32_t) width * surface->pixelSize());
+	bool ok = scaler.isValid() && (line != nullptr);
+
+	for (uint16_t y = 0; ok && (y < height); y++) {
+		const uint8_t *row = line;
+		ok = !cancel.isCancelled() && readRow(y, line, row);
+		if (ok) {
+			scaler.pushRow(row);
+		}
+	}
+
+	free(line);
+	return ok;
+}
+
+/**
+ * Drop a surface that could not be filled, now or, away from the LVGL
+ * thread, by leaving it to be retired.
+ */
+static void discard(Surface *surface, CoverArtDecoder::Retired *retired) {
+	if (retired != nullptr) {
+		retired->surfaces.push_back(surface);
+	} else {
+		surface->release();
+	}
+}
+
+/**
+ * Decode a PNG without LVGL's decoder, a row at a time.
+ *
+ * @param reader the open PNG
+ * @param maxWidth the widest the surface may be, or 0 for no limit
+ * @param maxHeight the tallest the surface may be, or 0 for no limit
+ * @param cancel stops the decode when cancelled
+ * @param retired receives a surface that could not be filled, or
+ *                nullptr to release it at once
+ * @return the surface or nullptr
+ */
+static Surface *decodePng(PngReader &reader, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel, CoverArtDecoder::Retired *retired) {
+	uint16_t width, height;
+	ImageScaler::fitWithin(reader.width(), reader.height(), maxWidth, maxHeight, width, height);
+
+	Surface *surface = Surface::create(width, height, reader.format());
+	if (surface == nullptr) {
+		return nullptr;
+	}
+
+	bool ok = fillSurface(surface, reader.width(), reader.height(), [&reader](uint16_t y, uint8_t *line, const uint8_t *&row) {
+		return reader.readRow(line);
+	}, cancel);
+
+	if (!ok) {
+		discard(surface, retired);
+		return nullptr;
+	}
+
+	return surface;
+}
+
+/**
+ * Decode a JPEG without LVGL's decoder, reducing it while it is decoded
+ * as far as the surface allows and scaling the rest of the way.
+ *
+ * @param reader the open JPEG
+ * @param maxWidth the widest the surface may be, or 0 for no limit
+ * @param maxHeight the tallest the surface may be, or 0 for no limit
+ * @param cancel stops the decode when cancelled
+ * @param retired receives a surface that could not be filled, or
+ *                nullptr to release it at once
+ * @return the surface or nullptr
+ */
+static Surface *decodeJpeg(JpegReader &reader, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel, CoverArtDecoder::Retired *retired) {
+	uint16_t width, height;
+	ImageScaler::fitWithin(reader.width(), reader.height(), maxWidth, maxHeight, width, height);
+
+	Surface *surface = Surface::create(width, height, LV_IMG_CF_TRUE_COLOR);
+	if (surface == nullptr) {
+		return nullptr;
+	}
+
+	uint8_t reduction = reader.reductionFor(width, height);
+	uint16_t sourceWidth = reader.width() >> reduction;
+	uint16_t sourceHeight = reader.height() >> reduction;
+
+	bool ok;
+	if ((sourceWidth == width) && (sourceHeight == height)) {
+		uint16_t y = 0;
+		ok = reader.decode(reduction, [&](const uint8_t *row) {
+			if (cancel.isCancelled() || (y == height)) {
+				return false;
+			}
+
+			memcpy(surface->row(y++), row, surface->stride());
+			return true;
+		}) && (y == height);
+	} else {
+		ImageScaler scaler(sourceWidth, sourceHeight, LV_IMG_CF_TRUE_COLOR, surface);
+		ok = scaler.isValid() && reader.decode(reduction, [&](const uint8_t *row) {
+			if (cancel.isCancelled() || scaler.isComplete()) {
+				return false;
+			}
+
+			scaler.pushRow(row);
+			return true;
+		}) && scaler.isComplete();
+	}
+
+	if (!ok) {
+		discard(surface, retired);
+		return nullptr;
+	}
+
+	return surface;
+}
+
+/**
+ * Decode a tiled image without LVGL's decoder, a line at a time.
+ *
+ * @param image the open tiled image
+ * @param maxWidth the widest the surface may be, or 0 for no limit
+ * @param maxHeight the tallest the surface may be, or 0 for no limit
+ * @param cancel stops the decode when cancelled
+ * @param retired receives a surface that could not be filled
+ * @return the surface or nullptr
+ */
+static Surface *decodeTiled(TiledImage &image, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel, CoverArtDecoder::Retired *retired) {
+	uint16_t width, height;
+	ImageScaler::fitWithin(image.width(), image.height(), maxWidth, maxHeight, width, height);
+
+	Surface *surface = Surface::create(width, height, image.format());
+	if (surface == nullptr) {
+		return nullptr;
+	}
+
+	bool ok = fillSurface(surface, image.width(), image.height(), [&image](uint16_t y, uint8_t *line, const uint8_t *&row) {
+		return image.readLine(0, y, image.width(), line);
+	}, cancel);
+
+	if (!ok) {
+		discard(surface, retired);
+		return nullptr;
+	}
+
+	return surface;
+}
+
+/**
+ * Return the format an LVGL decoder produces pixels in.  Decoders of
+ * other file formats, such as SJPG and lv_png, report their images as
+ * raw and produce true color, as lv_draw_img takes them to.
+ *
+ * @param cf the color format the decoder reports
+ * @return the format of its pixels, or LV_IMG_CF_UNKNOWN if they are
+ *         not true color
+ */
+static lv_img_cf_t pixelFormat(lv_img_cf_t cf) {
+	switch (cf) {
+		case LV_IMG_CF_TRUE_COLOR:
+		case LV_IMG_CF_RAW:
+			return LV_IMG_CF_TRUE_COLOR;
+
+		case LV_IMG_CF_TRUE_COLOR_ALPHA:
+		case LV_IMG_CF_RAW_ALPHA:
+			return LV_IMG_CF_TRUE_COLOR_ALPHA;
+
+		default:
+			return LV_IMG_CF_UNKNOWN;
+	}
+}
+
+/**
+ * Decode an image through the LVGL decoders into a surface, scaling it
+ * to fit within the limits.
+ *
+ * @param source an LVGL image source
+ * @param maxWidth the widest the surface may be, or 0 for no limit
+ * @param maxHeight the tallest the surface may be, or 0 for no limit
+ * @param cancel stops the decode when cancelled
+ * @return the surface or nullptr
+ */
+static Surface *decodeWithLvgl(const void *source, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel) {
+	lv_img_decoder_dsc_t dsc;
+	if (lv_img_decoder_open(&dsc, source, lv_color_black(), 0) != LV_RES_OK) {
+		return nullptr;
+	}
+
+	Surface *surface = nullptr;
+	lv_img_cf_t cf = pixelFormat(dsc.header.cf);
+	uint16_t width = dsc.header.w;
+	uint16_t height = dsc.header.h;
+	if (cf != LV_IMG_CF_UNKNOWN) {
+		ImageScaler::fitWithin(dsc.header.w, dsc.header.h, maxWidth, maxHeight, width, height);
+		surface = Surface::create(width, height, cf);
+	}
+
+	if (surface != nullptr) {
+		bool ok = fillSurface(surface, dsc.header.w, dsc.header.h, [&dsc, surface](uint16_t y, uint8_t *line, const uint8_t *&row) {
+			if (dsc.img_data != nullptr) {
+				row = dsc.img_data + ((uint32_t) y * dsc.header.w * surface->pixelSize());
+				return true;
+			}
+
+			// Decoders such as SJPG only produce a line at a time
+			row = line;
+			return lv_img_decoder_read_line(&dsc, 0, y, dsc.header.w, line) == LV_RES_OK;
+		}, cancel);
+
+		if (!ok) {
+			surface->release();
+			surface = nullptr;
+		}
+	}
+
+	lv_img_decoder_close(&dsc);
+	return surface;
+}
+
+Surface *CoverArtDecoder::decode(const void *source, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel) {
+	if (cancel.isCancelled()) {
+		return nullptr;
+	}
+
+	{
+		// The reader's window is freed before falling back to LVGL
+		PngReader png;
+		if (png.open(source)) {
+			return decodePng(png, maxWidth, maxHeight, cancel, nullptr);
+		}
+	}
+
+	{
+		JpegReader jpeg;
+		if (jpeg.open(source)) {
+			return decodeJpeg(jpeg, maxWidth, maxHeight, cancel, nullptr);
+		}
+
+		// SJPG is built on the same decoder, so it would refuse the JPEG too
+		if (jpeg.isJpeg()) {
+			return nullptr;
+		}
+	}
+
+	if (lv_img_src_get_type(source) == LV_IMG_SRC_FILE) {
+		const char *path = (const char *) source;
+		const lv_img_dsc_t *stored = (path[0] == InMemoryFS::DRIVE_LETTER) ? InMemoryFS::asImageDescriptor(path) : nullptr;
+		if (stored != nullptr) {
+			Surface *surface = decodeWithLvgl(stored, maxWidth, maxHeight, cancel);
+			InMemoryFS::releaseImageDescriptor(stored);
+			return surface;
+		}
+	}
+
+	return decodeWithLvgl(source, maxWidth, maxHeight, cancel);
+}
+
+/**
+ * Leave a reader's InMemoryFS descriptor to be released on the LVGL
+ * thread.
+ */
+static void retire(const lv_img_dsc_t *stored, CoverArtDecoder::Retired &retired) {
+	if (stored != nullptr) {
+		retired.descriptors.push_back(stored);
+	}
+}
+
+Surface *CoverArtDecoder::decodeOffThread(const char *source, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel, Retired &retired, bool &needsLvgl) {
+	needsLvgl = false;
+	if (cancel.isCancelled()) {
+		return nullptr;
+	}
+
+	// Files on other drives are read through drivers that may use LVGL
+	if ((source[0] != InMemoryFS::DRIVE_LETTER) || (source[1] != ':')) {
+		needsLvgl = true;
+		return nullptr;
+	}
+
+	// The readers are finished with their descriptors, even if they
+	// refused the image after taking them
+	PngReader png;
+	bool opened = png.open(source);
+	Surface *surface = opened ? decodePng(png, maxWidth, maxHeight, cancel, &retired) : nullptr;
+	retire(png.takeStoredImage(), retired);
+	if (opened) {
+		return surface;
+	}
+
+	TiledImage tiled;
+	opened = tiled.open(source);
+	surface = opened ? decodeTiled(tiled, maxWidth, maxHeight, cancel, &retired) : nullptr;
+	retire(tiled.takeStoredImage(), retired);
+	if (opened) {
+		return surface;
+	}
+
+	JpegReader jpeg;
+	opened = jpeg.open(source);
+	surface = opened ? decodeJpeg(jpeg, maxWidth, maxHeight, cancel, &retired) : nullptr;
+	retire(jpeg.takeStoredImage(), retired);
+
+	// JPEGs TJpgDec refuses, such as progressive ones, are beyond SJPG too
+	needsLvgl = !jpeg.isJpeg() && !cancel.isCancelled();
+	return surface;
+}
+
+void CoverArtDecoder::Retired::take(Retired &other) {
+	surfaces.insert(surfaces.end(), other.surfaces.begin(), other.surfaces.end());
+	descriptors.insert(descriptors.end(), other.descriptors.begin(), other.descriptors.end());
+	other.surfaces.clear();
+	other.descriptors.clear();
+}
+
+void CoverArtDecoder::Retired::release() {
+	for (Surface *surface : surfaces) {
+		surface->release();
+	}
+
+	for (const lv_img_dsc_t *descriptor : descriptors) {
+		InMemoryFS::releaseImageDescriptor(descriptor);
+	}
+
+	surfaces.clear();
+	descriptors.clear();
+}
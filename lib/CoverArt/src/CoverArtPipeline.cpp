@@ -0,0 +1,569 @@
+#include "CoverArtPipeline.h"
+#include "CornerMask.h"
+#include "CoverArtDecoder.h"
+
+#include <InMemoryFS.h>
+#include <stdio.h>
+#include <string.h>
+
+CoverArtPipeline &CoverArtPipeline::get() {
+	static CoverArtPipeline pipeline;
+	return pipeline;
+}
+
+CoverArtPipeline::CoverArtPipeline(CoverArtCache &cache, Decoder decoder, LvglDecoder lvglDecoder) :
+	cache(cache), decoder(decoder), lvglDecoder(lvglDecoder), generation(0), prefetchGeneration(0), timer(nullptr), store(nullptr), running(false), stopping(false), hasJob(false), hasResult(false),
+	upcomingVersion(0), promoted(false), promotedGeneration(0) {
+	if (!this->decoder) {
+		this->decoder = [](const char *source, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel,
+			CoverArtDecoder::Retired &retired, bool &needsLvgl) {
+			return CoverArtDecoder::decodeOffThread(source, maxWidth, maxHeight, cancel, retired, needsLvgl);
+		};
+	}
+
+	if (!this->lvglDecoder) {
+		this->lvglDecoder = [](const char *source, uint16_t maxWidth, uint16_t maxHeight) {
+			return CoverArtDecoder::decode(source, maxWidth, maxHeight);
+		};
+	}
+}
+
+CoverArtPipeline::~CoverArtPipeline() {
+	stop();
+}
+
+void CoverArtPipeline::start() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (running) {
+		return;
+	}
+
+	running = true;
+	stopping = false;
+
+#if defined(ESP32)
+	if (xTaskCreatePinnedToCore(taskMain, "coverart", COVERART_PIPELINE_STACK_SIZE, this, COVERART_PIPELINE_PRIORITY, &task, COVERART_PIPELINE_CORE) != pdPASS) {
+		// Without a worker, requests are decoded on the LVGL thread
+		running = false;
+		return;
+	}
+#else
+	thread = std::thread(&CoverArtPipeline::work, this);
+#endif
+
+	timer = lv_timer_create(timerCallback, COVERART_PIPELINE_POLL_PERIOD, this);
+}
+
+void CoverArtPipeline::stop() {
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!running) {
+			return;
+		}
+
+		stopping = true;
+		hasJob = false;
+		prefetchQueue.clear();
+		upcomingVersion++;
+		promoted = false;
+
+		// Abandon the work in progress
+		generation++;
+		prefetchGeneration++;
+		wake.notify_all();
+
+#if defined(ESP32)
+		wake.wait(lock, [this] { return !running; });
+#endif
+	}
+
+#if !defined(ESP32)
+	thread.join();
+	running = false;
+#endif
+
+	if (timer != nullptr) {
+		lv_timer_del(timer);
+		timer = nullptr;
+	}
+
+	// Nothing is waiting for art any more
+	handler = nullptr;
+	if (hasResult) {
+		hasResult = false;
+		retire(result);
+	}
+
+	for (Result &ready : prefetched) {
+		retire(ready);
+	}
+	prefetched.clear();
+
+	retired.release();
+}
+
+void CoverArtPipeline::setFetcher(Fetcher fetcher) {
+	std::lock_guard<std::mutex> lock(mutex);
+	this->fetcher = fetcher;
+}
+
+void CoverArtPipeline::setStore(ArtStore *store) {
+	std::lock_guard<std::mutex> lock(mutex);
+	this->store = store;
+}
+
+void CoverArtPipeline::request(const char *source, Handler handler) {
+	uint32_t current = ++generation;
+
+	const lv_img_dsc_t *image = cache.lookup(source);
+	Fetcher fetch;
+	ArtStore *keep;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if ((image == nullptr) && running) {
+			this->handler = handler;
+			hasJob = false;
+
+			if (prefetching == source) {
+				// The art is already being prefetched
+				promoted = true;
+				promotedGeneration = current;
+				return;
+			}
+
+			// The art has been prefetched but not yet picked up
+			for (size_t i = 0; i < prefetched.size(); i++) {
+				if (prefetched[i].job.source == source) {
+					if (hasResult) {
+						retire(result);
+					}
+
+					result = prefetched[i];
+					result.job.generation = current;
+					hasResult = true;
+					prefetched.erase(prefetched.begin() + i);
+					return;
+				}
+			}
+
+			// Take the worker from prefetching
+			promoted = false;
+			prefetchGeneration++;
+			for (size_t i = 0; i < prefetchQueue.size(); i++) {
+				if (prefetchQueue[i].source == source) {
+					prefetchQueue.erase(prefetchQueue.begin() + i);
+					break;
+				}
+			}
+
+			job = { source, current, CoverArtCache::versionOf(source), cache.getTargetWidth(), cache.getTargetHeight() };
+			hasJob = true;
+			wake.notify_one();
+			return;
+		}
+
+		// Cached art replaces anything still waiting to be decoded
+		hasJob = false;
+		promoted = false;
+		fetch = fetcher;
+		keep = store;
+	}
+
+	this->handler = nullptr;
+	if (image == nullptr) {
+		// Without a worker the art is decoded here
+		Job inPlace = { source, current, CoverArtCache::versionOf(source), cache.getTargetWidth(), cache.getTargetHeight() };
+		CoverArtDecoder::Retired leftovers;
+		bool needsLvgl;
+		Surface *surface = produce(inPlace, fetch, keep, CancelToken(), leftovers, needsLvgl);
+		if (needsLvgl) {
+			surface = decodeDeferred(inPlace, keep);
+		}
+
+		leftovers.release();
+		if (surface != nullptr) {
+			image = cache.insert(source, inPlace.version, surface);
+		}
+	}
+
+	handler(image);
+}
+
+void CoverArtPipeline::setUpcoming(const std::vector<std::string> &sources) {
+	// Leave room in the cache for the art being shown
+	uint16_t width = cache.getTargetWidth();
+	uint16_t height = cache.getTargetHeight();
+	uint32_t coverBytes = (uint32_t) width * height * sizeof(lv_color_t);
+	size_t limit = COVERART_PREFETCH_COUNT;
+	if (coverBytes > 0) {
+		uint32_t room = (cache.getBudget() > coverBytes) ? (cache.getBudget() - coverBytes) / coverBytes : 0;
+		if (room < limit) {
+			limit = room;
+		}
+	}
+
+	std::vector<Job> queue;
+	for (size_t i = 0; (i < sources.size()) && (i < limit); i++) {
+		const char *source = sources[i].c_str();
+		if (!cache.contains(source)) {
+			queue.push_back({ source, 0, CoverArtCache::versionOf(source), width, height });
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!running) {
+		return;
+	}
+
+	// Art waiting to be picked up is not prefetched again, and art left
+	// for the LVGL thread is kept only while it is upcoming
+	for (size_t i = 0; i < prefetched.size();) {
+		bool upcoming = false;
+		for (size_t j = 0; j < queue.size(); j++) {
+			if (queue[j].source == prefetched[i].job.source) {
+				queue.erase(queue.begin() + j);
+				upcoming = true;
+				break;
+			}
+		}
+
+		if (!upcoming && prefetched[i].needsLvgl) {
+			retire(prefetched[i]);
+			prefetched.erase(prefetched.begin() + i);
+		} else {
+			i++;
+		}
+	}
+
+	prefetchQueue = queue;
+	upcomingVersion++;
+	wake.notify_one();
+}
+
+void CoverArtPipeline::cancel() {
+	generation++;
+	handler = nullptr;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	hasJob = false;
+	promoted = false;
+}
+
+void CoverArtPipeline::poll() {
+	Result finished;
+	bool haveResult;
+	CoverArtDecoder::Retired stale;
+	std::vector<Result> ready;
+	ArtStore *keep;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		haveResult = hasResult;
+		if (haveResult) {
+			finished = result;
+			hasResult = false;
+		}
+
+		stale.take(retired);
+		keep = store;
+
+		// Art left for LVGL's decoders waits until it is requested, so
+		// prefetching never stalls the LVGL thread
+		for (size_t i = 0; i < prefetched.size();) {
+			if (prefetched[i].needsLvgl) {
+				i++;
+				continue;
+			}
+
+			ready.push_back(prefetched[i]);
+			prefetched.erase(prefetched.begin() + i);
+		}
+	}
+
+	stale.release();
+
+	for (Result &prefetch : ready) {
+		if ((prefetch.job.maxWidth == cache.getTargetWidth()) && (prefetch.job.maxHeight == cache.getTargetHeight())) {
+			cache.release(cache.insert(prefetch.job.source.c_str(), prefetch.job.version, prefetch.surface));
+		} else {
+			prefetch.surface->release();
+		}
+	}
+
+	if (!haveResult) {
+		return;
+	}
+
+	if (finished.needsLvgl) {
+		if ((finished.job.generation != generation) || !handler) {
+			// Not worth stalling the LVGL thread for
+			discardDeferred(finished.job);
+			return;
+		}
+
+		finished.surface = decodeDeferred(finished.job, keep);
+	}
+
+	const lv_img_dsc_t *image = nullptr;
+	if (finished.surface != nullptr) {
+		if ((finished.job.maxWidth == cache.getTargetWidth()) && (finished.job.maxHeight == cache.getTargetHeight())) {
+			image = cache.insert(finished.job.source.c_str(), finished.job.version, finished.surface);
+		} else {
+			// Decoded for a size art is no longer shown at, so it is not
+			// cached, but it is shown the same way cached art is
+			CornerMask::apply(finished.surface, cache.getCornerRadius(), cache.getCornerBackground());
+			image = &finished.surface->image;
+		}
+	}
+
+	if ((finished.job.generation != generation) || !handler) {
+		cache.release(image);
+		return;
+	}
+
+	Handler done = handler;
+	handler = nullptr;
+	done(image);
+}
+
+/**
+ * Decodes the latest request, repeatedly, until the pipeline is stopped.
+ * Upcoming art is prefetched when there is no request.
+ */
+void CoverArtPipeline::work() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		wake.wait(lock, [this] { return hasJob || !prefetchQueue.empty() || stopping; });
+		if (stopping) {
+			break;
+		}
+
+		Job current;
+		bool isPrefetch = !hasJob;
+		uint32_t listVersion = upcomingVersion;
+		if (isPrefetch) {
+			current = prefetchQueue.front();
+			current.generation = prefetchGeneration;
+			prefetchQueue.erase(prefetchQueue.begin());
+			prefetching = current.source;
+		} else {
+			current = job;
+			hasJob = false;
+		}
+
+		Fetcher fetch = fetcher;
+		ArtStore *keep = store;
+
+		lock.unlock();
+		CancelToken cancel = isPrefetch ? CancelToken(prefetchGeneration, current.generation) : CancelToken(generation, current.generation);
+		CoverArtDecoder::Retired leftovers;
+		Result finished = { current, nullptr, false };
+		finished.surface = produce(current, fetch, keep, cancel, leftovers, finished.needsLvgl);
+		lock.lock();
+
+		retired.take(leftovers);
+		if (isPrefetch) {
+			finishPrefetch(finished, listVersion, cancel);
+			continue;
+		}
+
+		if (cancel.isCancelled()) {
+			// Finished too late to be wanted
+			retire(finished);
+			continue;
+		}
+
+		// An earlier result not yet picked up can no longer be wanted
+		if (hasResult) {
+			retire(result);
+		}
+
+		result = finished;
+		hasResult = true;
+	}
+}
+
+/**
+ * Deals with a finished prefetch, with the mutex held.  A prefetch that
+ * gave way to a request is queued again unless the upcoming art has
+ * changed since, and one a request is waiting for becomes its result.
+ *
+ * @param finished the prefetch job and its art
+ * @param listVersion the version of the upcoming list it came from
+ * @param cancel the token it was decoded with
+ */
+void CoverArtPipeline::finishPrefetch(const Result &finished, uint32_t listVersion, const CancelToken &cancel) {
+	prefetching.clear();
+
+	if (cancel.isCancelled()) {
+		retire(finished);
+		if (listVersion == upcomingVersion) {
+			prefetchQueue.insert(prefetchQueue.begin(), finished.job);
+		}
+
+		return;
+	}
+
+	if (promoted) {
+		promoted = false;
+		if (hasResult) {
+			retire(result);
+		}
+
+		result = finished;
+		result.job.generation = promotedGeneration;
+		hasResult = true;
+		return;
+	}
+
+	if ((finished.surface != nullptr) || finished.needsLvgl) {
+		prefetched.push_back(finished);
+	}
+}
+
+/**
+ * Drops a result no longer wanted, with the mutex held or on the LVGL
+ * thread once the worker has stopped.  The art is released on the LVGL
+ * thread, and a download left for it is removed.
+ */
+void CoverArtPipeline::retire(const Result &dropped) {
+	if (dropped.surface != nullptr) {
+		retired.surfaces.push_back(dropped.surface);
+	}
+
+	if (dropped.needsLvgl) {
+		discardDeferred(dropped.job);
+	}
+}
+
+/**
+ * Decodes the art for a job, first downloading it if the source is a URL.
+ * Art only LVGL's decoders can read is left for the LVGL thread, keeping
+ * the download for it.
+ *
+ * @param job the request
+ * @param fetch downloads URLs
+ * @param store keeps fetched art across reboots, or nullptr
+ * @param cancel stops the download or decode once cancelled
+ * @param leftovers receives what has to be released on the LVGL thread
+ * @param needsLvgl set if the art is left for decodeDeferred
+ * @return the surface or nullptr
+ */
+Surface *CoverArtPipeline::produce(const Job &job, const Fetcher &fetch, ArtStore *store, const CancelToken &cancel,
+	CoverArtDecoder::Retired &leftovers, bool &needsLvgl) {
+
+	needsLvgl = false;
+	if (!isUrl(job.source)) {
+		return decoder(job.source.c_str(), job.maxWidth, job.maxHeight, cancel, leftovers, needsLvgl);
+	}
+
+	if (store != nullptr) {
+		Surface *stored = store->load(job.source.c_str(), job.maxWidth, job.maxHeight, cancel);
+		if (stored != nullptr) {
+			return stored;
+		}
+	}
+
+	if (!fetch) {
+		return nullptr;
+	}
+
+	std::string path = fetchPath(job.source);
+	if (!fetch(job.source.c_str(), path.c_str(), cancel)) {
+		InMemoryFS::unregisterFile(path.c_str());
+		return nullptr;
+	}
+
+	// Only the decoded art is kept
+	std::string drivePath = std::string(1, InMemoryFS::DRIVE_LETTER) + ":" + path;
+	Surface *surface = decoder(drivePath.c_str(), job.maxWidth, job.maxHeight, cancel, leftovers, needsLvgl);
+	if (needsLvgl && !cancel.isCancelled()) {
+		return surface;
+	}
+
+	needsLvgl = false;
+	InMemoryFS::unregisterFile(path.c_str());
+
+	if ((surface != nullptr) && (store != nullptr) && !cancel.isCancelled()) {
+		store->save(job.source.c_str(), job.maxWidth, job.maxHeight, surface);
+	}
+
+	return surface;
+}
+
+/**
+ * Decodes art the worker left for LVGL's decoders, on the LVGL thread.
+ * A download is removed once decoded, and the art kept in the store as
+ * the worker would have.
+ *
+ * @param job the request
+ * @param store keeps fetched art across reboots, or nullptr
+ * @return the surface or nullptr
+ */
+Surface *CoverArtPipeline::decodeDeferred(const Job &job, ArtStore *store) {
+	if (!isUrl(job.source)) {
+		return lvglDecoder(job.source.c_str(), job.maxWidth, job.maxHeight);
+	}
+
+	std::string path = fetchPath(job.source);
+	std::string drivePath = std::string(1, InMemoryFS::DRIVE_LETTER) + ":" + path;
+	Surface *surface = lvglDecoder(drivePath.c_str(), job.maxWidth, job.maxHeight);
+	InMemoryFS::unregisterFile(path.c_str());
+
+	if ((surface != nullptr) && (store != nullptr)) {
+		store->save(job.source.c_str(), job.maxWidth, job.maxHeight, surface);
+	}
+
+	return surface;
+}
+
+/**
+ * Removes the download kept for art left to the LVGL thread that is no
+ * longer wanted.
+ */
+void CoverArtPipeline::discardDeferred(const Job &job) {
+	if (isUrl(job.source)) {
+		InMemoryFS::unregisterFile(fetchPath(job.source).c_str());
+	}
+}
+
+bool CoverArtPipeline::isUrl(const std::string &source) {
+	return source.find("://") != std::string::npos;
+}
+
+std::string CoverArtPipeline::fetchPath(const std::string &url) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (char c : url) {
+		hash = (hash ^ (uint8_t) c) * 16777619u;
+	}
+
+	char name[16];
+	snprintf(name, sizeof(name), "%08x", (unsigned int) hash);
+
+	std::string path = url.substr(0, url.find_first_of("?#"));
+	size_t slash = path.rfind('/');
+	size_t dot = path.rfind('.');
+	std::string extension = ((dot != std::string::npos) && ((slash == std::string::npos) || (dot > slash))) ? path.substr(dot) : "";
+
+	return FETCH_DIRECTORY + std::string(name) + extension;
+}
+
+#if defined(ESP32)
+void CoverArtPipeline::taskMain(void *parameter) {
+	CoverArtPipeline *pipeline = (CoverArtPipeline *) parameter;
+	pipeline->work();
+
+	{
+		std::lock_guard<std::mutex> lock(pipeline->mutex);
+		pipeline->running = false;
+		pipeline->wake.notify_all();
+	}
+
+	vTaskDelete(nullptr);
+}
+#endif
+
+void CoverArtPipeline::timerCallback(lv_timer_t *timer) {
+	((CoverArtPipeline *) timer->user_data)->poll();
+}
@@ -0,0 +1,191 @@
+#include "ImageScaler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void ImageScaler::fitWithin(uint16_t width, uint16_t height, uint16_t boxWidth, uint16_t boxHeight,
+	uint16_t &fitWidth, uint16_t &fitHeight) {
+	fitWidth = width;
+	fitHeight = height;
+
+	if ((boxWidth != 0) && (fitWidth > boxWidth)) {
+		fitHeight = ((uint32_t) height * boxWidth + (width / 2)) / width;
+		fitWidth = boxWidth;
+	}
+
+	if ((boxHeight != 0) && (fitHeight > boxHeight)) {
+		fitWidth = ((uint32_t) width * boxHeight + (height / 2)) / height;
+		fitHeight = boxHeight;
+	}
+
+	if (fitWidth == 0) {
+		fitWidth = 1;
+	}
+
+	if (fitHeight == 0) {
+		fitHeight = 1;
+	}
+}
+
+ImageScaler::ImageScaler(uint16_t sourceWidth, uint16_t sourceHeight, lv_img_cf_t sourceFormat, Surface *target) :
+	sourceWidth(sourceWidth), sourceHeight(sourceHeight), sourceFormat(sourceFormat), target(target),
+	channels((target->image.header.cf == LV_IMG_CF_TRUE_COLOR_ALPHA) ? 4 : 3), sourceRow(0), targetRow(0),
+	columns(nullptr), rowSums(nullptr), storage(nullptr) {
+
+	uint16_t width = target->width();
+	if ((sourceWidth == 0) || (sourceHeight == 0) || (width > sourceWidth) || (target->height() > sourceHeight)) {
+		return;
+	}
+
+	// One allocation holds the column table, the unpacked row and the sums
+	uint32_t unpackedSize = (sourceWidth + 3) & ~3;
+	uint32_t sumsSize = sourceWidth * sizeof(uint32_t);
+	uint32_t rowSumsSize = (width + 1) * sizeof(uint32_t);
+	storage = (uint8_t *) malloc((sourceWidth * sizeof(Column)) + rowSumsSize + (channels * (unpackedSize + (2 * sumsSize))));
+	if (storage == nullptr) {
+		return;
+	}
+
+	uint8_t *next = storage + (sourceWidth * sizeof(Column));
+	rowSums = (uint32_t *) next;
+	next += rowSumsSize;
+
+	for (uint8_t channel = 0; channel < channels; channel++) {
+		currentSums[channel] = (uint32_t *) next;
+		nextSums[channel] = (uint32_t *) (next + sumsSize);
+		unpacked[channel] = next + (2 * sumsSize);
+		next += unpackedSize + (2 * sumsSize);
+
+		memset(currentSums[channel], 0, sumsSize);
+		memset(nextSums[channel], 0, sumsSize);
+	}
+
+	// In units where a source column is width wide and a target column
+	// is sourceWidth wide, every boundary falls on a whole unit
+	columns = (Column *) storage;
+	for (uint32_t x = 0; x < sourceWidth; x++) {
+		uint32_t start = x * width;
+		uint32_t index = start / sourceWidth;
+		uint32_t remaining = ((index + 1) * sourceWidth) - start;
+		columns[x].index = index;
+		columns[x].weight = (remaining < width) ? remaining : width;
+	}
+}
+
+ImageScaler::~ImageScaler() {
+	free(storage);
+}
+
+/**
+ * Split a source row into its channels, widened to eight bits.
+ *
+ * @param row the row in the source format
+ */
+void ImageScaler::unpack(const uint8_t *row) {
+	uint8_t pixelSize = (sourceFormat == LV_IMG_CF_TRUE_COLOR_ALPHA) ? LV_IMG_PX_SIZE_ALPHA_BYTE : sizeof(lv_color_t);
+	uint8_t *red = unpacked[0];
+	uint8_t *green = unpacked[1];
+	uint8_t *blue = unpacked[2];
+
+	for (uint16_t x = 0; x < sourceWidth; x++) {
+		lv_color_t color;
+		memcpy(&color, row + (x * pixelSize), sizeof(color));
+
+		uint32_t argb = lv_color_to32(color);
+		red[x] = argb >> 16;
+		green[x] = argb >> 8;
+		blue[x] = argb;
+	}
+
+	if (channels == 4) {
+		uint8_t *alpha = unpacked[3];
+		if (sourceFormat == LV_IMG_CF_TRUE_COLOR_ALPHA) {
+			for (uint16_t x = 0; x < sourceWidth; x++) {
+				alpha[x] = row[(x * LV_IMG_PX_SIZE_ALPHA_BYTE) + LV_IMG_PX_SIZE_ALPHA_BYTE - 1];
+			}
+		} else {
+			memset(alpha, 0xFF, sourceWidth);
+		}
+	}
+}
+
+void ImageScaler::pushRow(const uint8_t *row) {
+	if (!isValid() || isComplete()) {
+		return;
+	}
+
+	// The same split as the columns, in units where a source row is
+	// height high and a target row is sourceHeight high
+	uint16_t height = target->height();
+	uint32_t start = (uint32_t) sourceRow * height;
+	uint32_t end = start + height;
+	uint32_t boundary = (uint32_t) (targetRow + 1) * sourceHeight;
+	uint32_t weight = (end < boundary) ? height : (boundary - start);
+	uint32_t spill = height - weight;
+
+	unpack(row);
+
+	// At most 255 * sourceHeight once a target row's weights are summed
+	for (uint8_t channel = 0; channel < channels; channel++) {
+		const uint8_t *values = unpacked[channel];
+		uint32_t *current = currentSums[channel];
+		uint32_t *next = nextSums[channel];
+
+		for (uint16_t x = 0; x < sourceWidth; x++) {
+			current[x] += values[x] * weight;
+			next[x] += values[x] * spill;
+		}
+	}
+
+	sourceRow++;
+	if (end >= boundary) {
+		emitRow();
+	}
+}
+
+/**
+ * Write the completed target row and start on the next.
+ */
+void ImageScaler::emitRow() {
+	uint16_t width = target->width();
+	uint8_t *out = target->row(targetRow);
+	uint8_t pixelSize = target->pixelSize();
+	uint32_t area = (uint32_t) sourceWidth * sourceHeight;
+
+	for (uint8_t channel = 0; channel < channels; channel++) {
+		const uint32_t *sums = currentSums[channel];
+		memset(rowSums, 0, (width + 1) * sizeof(uint32_t));
+
+		// Each source column adds to at most two target columns, so the
+		// extra column at the end absorbs the zero weight spill of the
+		// last.  The totals stay below 255 * sourceHeight * sourceWidth.
+		for (uint16_t x = 0; x < sourceWidth; x++) {
+			uint32_t weight = columns[x].weight;
+			rowSums[columns[x].index] += sums[x] * weight;
+			rowSums[columns[x].index + 1] += sums[x] * (width - weight);
+		}
+
+		// The source row is done with, so its channel holds the result
+		uint8_t *values = unpacked[channel];
+		for (uint16_t x = 0; x < width; x++) {
+			values[x] = (rowSums[x] + (area / 2)) / area;
+		}
+	}
+
+	for (uint16_t x = 0; x < width; x++) {
+		lv_color_t color = lv_color_make(unpacked[0][x], unpacked[1][x], unpacked[2][x]);
+		memcpy(out + (x * pixelSize), &color, sizeof(color));
+		if (channels == 4) {
+			out[(x * pixelSize) + pixelSize - 1] = unpacked[3][x];
+		}
+	}
+
+	for (uint8_t channel = 0; channel < channels; channel++) {
+		uint32_t *finished = currentSums[channel];
+		currentSums[channel] = nextSums[channel];
+		nextSums[channel] = finished;
+		memset(finished, 0, sourceWidth * sizeof(uint32_t));
+	}
+
+	targetRow++;
+}
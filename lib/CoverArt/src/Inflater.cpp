@@ -0,0 +1,486 @@
+#include "Inflater.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const uint16_t LENGTH_BASE[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t LENGTH_EXTRA[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t DISTANCE_BASE[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const uint8_t DISTANCE_EXTRA[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// The order code length code lengths are sent in
+static const uint8_t CODE_LENGTH_ORDER[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+Inflater::Inflater(Input input) :
+	input(input), inputData(nullptr), inputRemaining(0), inputEnded(false), bitBuffer(0), bitCount(0),
+	state(STATE_HEADER), lastBlock(false), storedRemaining(0), matchLength(0), matchDistance(0),
+	window(nullptr), windowPosition(0), windowFill(0), lengthCode(nullptr), distanceCode(nullptr) {
+
+	// The tables share the window's allocation
+	uint8_t *storage = (uint8_t *) malloc(WINDOW_SIZE + (2 * sizeof(Huffman)));
+	if (storage != nullptr) {
+		window = storage;
+		lengthCode = (Huffman *) (storage + WINDOW_SIZE);
+		distanceCode = lengthCode + 1;
+	}
+}
+
+Inflater::~Inflater() {
+	free(window);
+}
+
+/**
+ * Take the next byte of input, fetching another piece when needed.
+ *
+ * @param byte receives the byte
+ * @return false at the end of the input
+ */
+bool Inflater::nextByte(uint8_t &byte) {
+	while (inputRemaining == 0) {
+		if (inputEnded) {
+			return false;
+		}
+
+		inputRemaining = input(inputData);
+		inputEnded = (inputRemaining == 0);
+	}
+
+	byte = *inputData++;
+	inputRemaining--;
+	return true;
+}
+
+/**
+ * Top up the bit buffer with whole bytes while there is room and input.
+ */
+void Inflater::fill() {
+	uint8_t byte;
+	while ((bitCount <= 24) && nextByte(byte)) {
+		bitBuffer |= ((uint32_t) byte) << bitCount;
+		bitCount += 8;
+	}
+}
+
+bool Inflater::need(uint8_t count) {
+	if (bitCount < count) {
+		fill();
+	}
+
+	return bitCount >= count;
+}
+
+/**
+ * Take bits from the stream, least significant first.
+ *
+ * @param count the number of bits, at most 24
+ * @param value receives the bits
+ * @return false at the end of the input
+ */
+bool Inflater::bits(uint8_t count, uint32_t &value) {
+	if (!need(count)) {
+		return false;
+	}
+
+	value = bitBuffer & ((1 << count) - 1);
+	bitBuffer >>= count;
+	bitCount -= count;
+	return true;
+}
+
+/**
+ * Decode the next symbol.
+ *
+ * @param code the code to decode with
+ * @return the symbol or -1 if the bits are not a valid code
+ */
+int Inflater::decode(const Huffman &code) {
+	fill();
+
+	uint16_t entry = code.fast[bitBuffer & ((1 << FAST_BITS) - 1)];
+	if (entry != 0) {
+		uint8_t length = entry >> 9;
+		if (length > bitCount) {
+			return -1;
+		}
+
+		bitBuffer >>= length;
+		bitCount -= length;
+		return entry & 0x1FF;
+	}
+
+	// Codes are assigned in order, so walk the lengths a bit at a time
+	int value = 0;
+	int first = 0;
+	int index = 0;
+	for (uint8_t length = 1; length < 16; length++) {
+		if (!need(1)) {
+			return -1;
+		}
+
+		value |= bitBuffer & 1;
+		bitBuffer >>= 1;
+		bitCount--;
+
+		int count = code.count[length];
+		if (value - count < first) {
+			return code.symbol[index + (value - first)];
+		}
+
+		index += count;
+		first += count;
+		first <<= 1;
+		value <<= 1;
+	}
+
+	return -1;
+}
+
+/**
+ * Build a canonical Huffman code from its code lengths.
+ *
+ * @param code receives the code
+ * @param lengths the length of each symbol's code, 0 if unused
+ * @param count the number of symbols
+ * @return false if the lengths describe more codes than can exist
+ */
+bool Inflater::build(Huffman &code, const uint8_t *lengths, uint16_t count) {
+	memset(code.count, 0, sizeof(code.count));
+	for (uint16_t symbol = 0; symbol < count; symbol++) {
+		code.count[lengths[symbol]]++;
+	}
+
+	// Incomplete codes are allowed, an unused code fails when decoded
+	int left = 1;
+	for (uint8_t length = 1; length < 16; length++) {
+		left <<= 1;
+		left -= code.count[length];
+		if (left < 0) {
+			return false;
+		}
+	}
+
+	uint16_t offsets[16];
+	uint16_t nextCode[16];
+	offsets[1] = 0;
+	nextCode[1] = 0;
+	for (uint8_t length = 1; length < 15; length++) {
+		offsets[length + 1] = offsets[length] + code.count[length];
+		nextCode[length + 1] = (nextCode[length] + code.count[length]) << 1;
+	}
+
+	memset(code.fast, 0, sizeof(code.fast));
+	for (uint16_t symbol = 0; symbol < count; symbol++) {
+		uint8_t length = lengths[symbol];
+		if (length == 0) {
+			continue;
+		}
+
+		code.symbol[offsets[length]++] = symbol;
+		if (length > FAST_BITS) {
+			continue;
+		}
+
+		// The stream holds codes most significant bit first
+		uint16_t value = nextCode[length]++;
+		uint16_t reversed = 0;
+		for (uint8_t bit = 0; bit < length; bit++) {
+			reversed = (reversed << 1) | ((value >> bit) & 1);
+		}
+
+		for (uint16_t index = reversed; index < (1 << FAST_BITS); index += (1 << length)) {
+			code.fast[index] = (length << 9) | symbol;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Check the two byte zlib header.
+ */
+bool Inflater::readHeader() {
+	uint32_t method, flags;
+	if (!bits(8, method) || !bits(8, flags)) {
+		return false;
+	}
+
+	// Deflate with at most a 32KB window, and no preset dictionary
+	return ((method & 0x0F) == 8) && ((method >> 4) <= 7) && ((((method << 8) | flags) % 31) == 0) && !(flags & 0x20);
+}
+
+/**
+ * Read the header of the next block and prepare to decode it.
+ */
+bool Inflater::startBlock() {
+	uint32_t final, type;
+	if (!bits(1, final) || !bits(2, type)) {
+		return false;
+	}
+
+	lastBlock = final;
+
+	if (type == 0) {
+		// Stored blocks start on a byte boundary
+		uint32_t length, complement;
+		bitBuffer >>= (bitCount & 7);
+		bitCount -= (bitCount & 7);
+		if (!bits(16, length) || !bits(16, complement) || (length != (~complement & 0xFFFF))) {
+			return false;
+		}
+
+		storedRemaining = length;
+		state = STATE_STORED;
+		return true;
+	}
+
+	if (type == 1) {
+		uint8_t lengths[MAX_SYMBOLS];
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+		build(*lengthCode, lengths, MAX_SYMBOLS);
+
+		memset(lengths, 5, 30);
+		build(*distanceCode, lengths, 30);
+
+		state = STATE_CODES;
+		return true;
+	}
+
+	if ((type == 2) && readDynamicCodes()) {
+		state = STATE_CODES;
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Read the code lengths of a block with dynamic codes and build them.
+ */
+bool Inflater::readDynamicCodes() {
+	uint32_t lengthCount, distanceCount, codeLengthCount;
+	if (!bits(5, lengthCount) || !bits(5, distanceCount) || !bits(4, codeLengthCount)) {
+		return false;
+	}
+
+	lengthCount += 257;
+	distanceCount += 1;
+	codeLengthCount += 4;
+	if ((lengthCount > 286) || (distanceCount > 30)) {
+		return false;
+	}
+
+	uint8_t lengths[320];
+	memset(lengths, 0, 19);
+	for (uint8_t i = 0; i < codeLengthCount; i++) {
+		uint32_t length;
+		if (!bits(3, length)) {
+			return false;
+		}
+
+		lengths[CODE_LENGTH_ORDER[i]] = length;
+	}
+
+	// The length code is free until the lengths are read
+	if (!build(*lengthCode, lengths, 19)) {
+		return false;
+	}
+
+	uint16_t total = lengthCount + distanceCount;
+	uint16_t index = 0;
+	while (index < total) {
+		int symbol = decode(*lengthCode);
+		if (symbol < 0) {
+			return false;
+		}
+
+		if (symbol < 16) {
+			lengths[index++] = symbol;
+			continue;
+		}
+
+		uint8_t value = 0;
+		uint32_t repeat;
+		if (symbol == 16) {
+			if ((index == 0) || !bits(2, repeat)) {
+				return false;
+			}
+
+			value = lengths[index - 1];
+			repeat += 3;
+		} else if (symbol == 17) {
+			if (!bits(3, repeat)) {
+				return false;
+			}
+
+			repeat += 3;
+		} else {
+			if (!bits(7, repeat)) {
+				return false;
+			}
+
+			repeat += 11;
+		}
+
+		if (index + repeat > total) {
+			return false;
+		}
+
+		memset(lengths + index, value, repeat);
+		index += repeat;
+	}
+
+	// A block without an end code could never finish
+	if (lengths[256] == 0) {
+		return false;
+	}
+
+	return build(*lengthCode, lengths, lengthCount) && build(*distanceCode, lengths + lengthCount, distanceCount);
+}
+
+/**
+ * Copy bytes out of a stored block.
+ *
+ * @param out the next byte of output, advanced past the bytes copied
+ * @param length the bytes still wanted, reduced by the bytes copied
+ */
+bool Inflater::readStored(uint8_t *&out, uint32_t &length) {
+	uint32_t count = (storedRemaining < length) ? storedRemaining : length;
+	for (uint32_t i = 0; i < count; i++) {
+		// Whole bytes already taken into the bit buffer come first
+		uint8_t byte;
+		if (bitCount >= 8) {
+			byte = bitBuffer;
+			bitBuffer >>= 8;
+			bitCount -= 8;
+		} else if (!nextByte(byte)) {
+			return false;
+		}
+
+		emit(byte);
+		*out++ = byte;
+	}
+
+	storedRemaining -= count;
+	length -= count;
+	return true;
+}
+
+/**
+ * Decode the next literal, end of block or back reference.  Literals go
+ * straight to the output and back references are left for read to copy.
+ *
+ * @param out the next byte of output, advanced past a literal
+ * @param length the bytes still wanted, reduced for a literal
+ */
+bool Inflater::readCode(uint8_t *&out, uint32_t &length) {
+	int symbol = decode(*lengthCode);
+	if (symbol < 0) {
+		return false;
+	}
+
+	if (symbol < 256) {
+		emit(symbol);
+		*out++ = symbol;
+		length--;
+		return true;
+	}
+
+	if (symbol == 256) {
+		state = STATE_BLOCK;
+		return true;
+	}
+
+	symbol -= 257;
+	uint32_t extra;
+	if ((symbol >= 29) || !bits(LENGTH_EXTRA[symbol], extra)) {
+		return false;
+	}
+
+	matchLength = LENGTH_BASE[symbol] + extra;
+
+	symbol = decode(*distanceCode);
+	if ((symbol < 0) || (symbol >= 30) || !bits(DISTANCE_EXTRA[symbol], extra)) {
+		return false;
+	}
+
+	matchDistance = DISTANCE_BASE[symbol] + extra;
+	return matchDistance <= windowFill;
+}
+
+bool Inflater::read(uint8_t *out, uint32_t length) {
+	if (!isValid()) {
+		return false;
+	}
+
+	while (length > 0) {
+		if (matchLength > 0) {
+			// A match may be longer than the output wanted, so the rest is
+			// kept for the next read
+			uint32_t count = (matchLength < length) ? matchLength : length;
+			for (uint32_t i = 0; i < count; i++) {
+				uint8_t byte = window[(windowPosition - matchDistance) & (WINDOW_SIZE - 1)];
+				emit(byte);
+				*out++ = byte;
+			}
+
+			matchLength -= count;
+			length -= count;
+			continue;
+		}
+
+		bool ok = false;
+		switch (state) {
+			case STATE_HEADER:
+				ok = readHeader();
+				state = STATE_BLOCK;
+				break;
+
+			case STATE_BLOCK:
+				// More output is wanted than the final block held
+				ok = !lastBlock && startBlock();
+				break;
+
+			case STATE_STORED:
+				ok = readStored(out, length);
+				if (storedRemaining == 0) {
+					state = STATE_BLOCK;
+				}
+				break;
+
+			case STATE_CODES:
+				ok = readCode(out, length);
+				break;
+
+			case STATE_FAILED:
+				break;
+		}
+
+		if (!ok) {
+			state = STATE_FAILED;
+			matchLength = 0;
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+
+/**
+ * Decompresses a zlib stream a piece at a time, so the output can be
+ * consumed as it is produced rather than held in full.
+ *
+ * The only memory needed is the 32KB window that back references reach
+ * into and the Huffman tables for the current block.  Input is pulled
+ * from a function handing out the compressed bytes in whatever pieces
+ * are convenient, such as the data of successive PNG IDAT chunks.
+ *
+ * The trailing Adler-32 checksum is not verified; PNG chunks carry
+ * their own CRCs and a corrupt stream almost always fails to decode.
+ */
+class Inflater {
+public:
+	/**
+	 * A function returning the next piece of compressed input.
+	 *
+	 * @param data receives a pointer to the bytes, which must stay valid
+	 *             until the next call
+	 * @return the number of bytes, or 0 at the end of the input
+	 */
+	typedef std::function<uint32_t(const uint8_t *&data)> Input;
+
+	Inflater(Input input);
+	~Inflater();
+
+	// Disable copy semantics
+	Inflater(const Inflater&) = delete;
+
+	/**
+	 * Return whether the window could be allocated.
+	 */
+	bool isValid() const {
+		return window != nullptr;
+	}
+
+	/**
+	 * Decompress exactly the requested number of bytes.
+	 *
+	 * @param out the buffer to fill
+	 * @param length the number of bytes wanted
+	 * @return false if the stream is malformed or ended first, after
+	 *         which every read fails
+	 */
+	bool read(uint8_t *out, uint32_t length);
+
+private:
+	static const uint16_t WINDOW_SIZE = 32768;
+	static const uint8_t FAST_BITS = 9;
+	static const uint16_t MAX_SYMBOLS = 288;
+
+	/**
+	 * A canonical Huffman code.  Codes no longer than FAST_BITS are found
+	 * with one lookup of the next bits, holding the length above the
+	 * symbol, and longer ones by walking the code lengths.
+	 */
+	struct Huffman {
+		uint16_t count[16];
+		uint16_t symbol[MAX_SYMBOLS];
+		uint16_t fast[1 << FAST_BITS];
+	};
+
+	enum State {
+		STATE_HEADER,
+		STATE_BLOCK,
+		STATE_STORED,
+		STATE_CODES,
+		STATE_FAILED
+	};
+
+	Input input;
+	const uint8_t *inputData;
+	uint32_t inputRemaining;
+	bool inputEnded;
+
+	uint32_t bitBuffer;
+	uint8_t bitCount;
+
+	State state;
+	bool lastBlock;
+	uint32_t storedRemaining;
+	uint16_t matchLength;
+	uint16_t matchDistance;
+
+	uint8_t *window;
+	uint32_t windowPosition;
+	uint32_t windowFill;
+
+	Huffman *lengthCode;
+	Huffman *distanceCode;
+
+	bool nextByte(uint8_t &byte);
+	void fill();
+	bool need(uint8_t count);
+	bool bits(uint8_t count, uint32_t &value);
+	int decode(const Huffman &code);
+
+	static bool build(Huffman &code, const uint8_t *lengths, uint16_t count);
+	bool readHeader();
+	bool startBlock();
+	bool readDynamicCodes();
+	bool readStored(uint8_t *&out, uint32_t &length);
+	bool readCode(uint8_t *&out, uint32_t &length);
+
+	void emit(uint8_t byte) {
+		window[windowPosition++ & (WINDOW_SIZE - 1)] = byte;
+		if (windowFill < WINDOW_SIZE) {
+			windowFill++;
+		}
+	}
+};
@@ -0,0 +1,211 @@
+#include "JpegReader.h"
+
+#include <InMemoryFS.h>
+#include <src/extra/libs/sjpg/tjpgd.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The start of image marker every JPEG begins with
+static const uint8_t SIGNATURE[2] = { 0xFF, 0xD8 };
+
+struct JpegReader::Callbacks {
+	/**
+	 * Read the next bytes of the source, or skip them if there is no
+	 * buffer.
+	 */
+	static size_t input(JDEC *decoder, uint8_t *buffer, size_t count) {
+		return ((JpegReader *) decoder->device)->readBytes(buffer, count);
+	}
+
+	/**
+	 * Take a decoded block of RGB888 pixels.
+	 */
+	static int output(JDEC *decoder, void *bitmap, JRECT *rect) {
+		return ((JpegReader *) decoder->device)->storeBlock((const uint8_t *) bitmap, rect->left, rect->right, rect->top, rect->bottom);
+	}
+};
+
+JpegReader::JpegReader() :
+	memory(nullptr), memorySize(0), memoryPosition(0), storedImage(nullptr), fileOpen(false),
+	decoder(nullptr), workArea(nullptr), jpeg(false), decoded(false), imageWidth(0), imageHeight(0),
+	band(nullptr), bandStride(0), outputWidth(0) {
+}
+
+JpegReader::~JpegReader() {
+	free(band);
+	free(workArea);
+	delete decoder;
+
+	if (fileOpen) {
+		lv_fs_close(&file);
+	}
+
+	if (storedImage != nullptr) {
+		InMemoryFS::releaseImageDescriptor(storedImage);
+	}
+}
+
+/**
+ * Find the bytes behind an image source, or open it as a file.
+ */
+bool JpegReader::openSource(const void *source) {
+	lv_img_src_t sourceType = lv_img_src_get_type(source);
+	if (sourceType == LV_IMG_SRC_VARIABLE) {
+		const lv_img_dsc_t *image = (const lv_img_dsc_t *) source;
+		memory = image->data;
+		memorySize = image->data_size;
+		return memory != nullptr;
+	}
+
+	if (sourceType != LV_IMG_SRC_FILE) {
+		return false;
+	}
+
+	const char *path = (const char *) source;
+	const char *extension = lv_fs_get_ext(path);
+	if ((strcmp(extension, "jpg") != 0) && (strcmp(extension, "JPG") != 0) &&
+		(strcmp(extension, "jpeg") != 0) && (strcmp(extension, "JPEG") != 0)) {
+		return false;
+	}
+
+	if (path[0] == InMemoryFS::DRIVE_LETTER) {
+		storedImage = InMemoryFS::asImageDescriptor(path);
+		if (storedImage != nullptr) {
+			memory = storedImage->data;
+			memorySize = storedImage->data_size;
+			return true;
+		}
+	}
+
+	if (lv_fs_open(&file, path, LV_FS_MODE_RD) != LV_FS_RES_OK) {
+		return false;
+	}
+
+	fileOpen = true;
+	return true;
+}
+
+/**
+ * Copy the next bytes of the source, or skip them when buffer is
+ * nullptr.
+ *
+ * @return the number of bytes, short at the end of the source
+ */
+size_t JpegReader::readBytes(uint8_t *buffer, size_t count) {
+	if (fileOpen) {
+		if (buffer == nullptr) {
+			return (lv_fs_seek(&file, count, LV_FS_SEEK_CUR) == LV_FS_RES_OK) ? count : 0;
+		}
+
+		uint32_t bytesRead = 0;
+		lv_fs_read(&file, buffer, count, &bytesRead);
+		return bytesRead;
+	}
+
+	uint32_t available = memorySize - memoryPosition;
+	if (count > available) {
+		count = available;
+	}
+
+	if (buffer != nullptr) {
+		memcpy(buffer, memory + memoryPosition, count);
+	}
+
+	memoryPosition += count;
+	return count;
+}
+
+bool JpegReader::open(const void *source) {
+	if (!openSource(source)) {
+		return false;
+	}
+
+	uint8_t signature[sizeof(SIGNATURE)];
+	if ((readBytes(signature, sizeof(signature)) != sizeof(signature)) || (memcmp(signature, SIGNATURE, sizeof(SIGNATURE)) != 0)) {
+		return false;
+	}
+
+	jpeg = true;
+	if (fileOpen) {
+		if (lv_fs_seek(&file, 0, LV_FS_SEEK_SET) != LV_FS_RES_OK) {
+			return false;
+		}
+	} else {
+		memoryPosition = 0;
+	}
+
+	decoder = new JDEC;
+	workArea = malloc(WORK_AREA_SIZE);
+	if ((workArea == nullptr) || (jd_prepare(decoder, Callbacks::input, workArea, WORK_AREA_SIZE, this) != JDR_OK)) {
+		return false;
+	}
+
+	imageWidth = decoder->width;
+	imageHeight = decoder->height;
+	return (imageWidth > 0) && (imageHeight > 0);
+}
+
+uint8_t JpegReader::reductionFor(uint16_t minWidth, uint16_t minHeight) const {
+	uint8_t reduction = 0;
+	while ((reduction < 3) && ((imageWidth >> (reduction + 1)) >= minWidth) && ((imageHeight >> (reduction + 1)) >= minHeight)) {
+		reduction++;
+	}
+
+	return reduction;
+}
+
+bool JpegReader::decode(uint8_t reduction, RowHandler handler) {
+	if ((imageWidth == 0) || decoded || (reduction > 3)) {
+		return false;
+	}
+
+	decoded = true;
+
+	// Blocks are output a block row at a time, left to right
+	outputWidth = imageWidth >> reduction;
+	bandStride = (uint32_t) outputWidth * sizeof(lv_color_t);
+	band = (uint8_t *) malloc(bandStride * ((8 * decoder->msy) >> reduction));
+	if (band == nullptr) {
+		return false;
+	}
+
+	rowHandler = handler;
+	bool ok = jd_decomp(decoder, Callbacks::output, reduction) == JDR_OK;
+	rowHandler = nullptr;
+	return ok;
+}
+
+/**
+ * Convert a block into the block row, handing out the rows once the
+ * last block of the row arrives.
+ *
+ * @return false to stop the decode
+ */
+bool JpegReader::storeBlock(const uint8_t *bitmap, uint16_t left, uint16_t right, uint16_t top, uint16_t bottom) {
+	// TJpgDec skips blocks reduced to nothing
+	if ((right < left) || (bottom < top) || (right >= outputWidth)) {
+		return true;
+	}
+
+	for (uint16_t y = top; y <= bottom; y++) {
+		uint8_t *out = band + ((uint32_t) (y - top) * bandStride) + ((uint32_t) left * sizeof(lv_color_t));
+		for (uint16_t x = left; x <= right; x++) {
+			lv_color_t color = lv_color_make(bitmap[0], bitmap[1], bitmap[2]);
+			memcpy(out, &color, sizeof(color));
+			out += sizeof(color);
+			bitmap += 3;
+		}
+	}
+
+	if (right + 1 < outputWidth) {
+		return true;
+	}
+
+	for (uint16_t y = top; y <= bottom; y++) {
+		if (!rowHandler(band + ((uint32_t) (y - top) * bandStride))) {
+			return false;
+		}
+	}
+
+	return true;
+}
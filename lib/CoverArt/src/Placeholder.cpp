@@ -0,0 +1,209 @@
+#include "Placeholder.h"
+
+#include <math.h>
+#include <string.h>
+
+// Thumbnails larger than this are not placeholders
+static const uint16_t MAX_THUMBNAIL_SIZE = 64;
+
+// BlurHash allows up to 9x9 components
+static const uint8_t MAX_COMPONENTS = 9;
+
+// Linear light is converted back to sRGB through a table of this many steps
+static const uint16_t SRGB_STEPS = 1024;
+
+static const char BASE83[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz#$%*+,-.:;=?@[]^_{|}~";
+
+/**
+ * Decode a run of base 83 digits.
+ *
+ * @return the value or -1 if a character is not a digit
+ */
+static int32_t decodeBase83(const char *digits, uint8_t count) {
+	int32_t value = 0;
+	for (uint8_t i = 0; i < count; i++) {
+		const char *found = (digits[i] != '\0') ? strchr(BASE83, digits[i]) : nullptr;
+		if (found == nullptr) {
+			return -1;
+		}
+
+		value = (value * 83) + (found - BASE83);
+	}
+
+	return value;
+}
+
+static float srgbToLinear(uint8_t value) {
+	float v = value / 255.0f;
+	return (v <= 0.04045f) ? (v / 12.92f) : powf((v + 0.055f) / 1.055f, 2.4f);
+}
+
+/**
+ * Return the sRGB value of each step of linear light, building the
+ * table the first time it is needed.
+ */
+static const uint8_t *linearToSrgbTable() {
+	static uint8_t table[SRGB_STEPS];
+	static bool built = false;
+
+	if (!built) {
+		for (uint16_t i = 0; i < SRGB_STEPS; i++) {
+			float v = (float) i / (SRGB_STEPS - 1);
+			float srgb = (v <= 0.0031308f) ? (v * 12.92f) : ((1.055f * powf(v, 1 / 2.4f)) - 0.055f);
+			table[i] = (uint8_t) ((srgb * 255) + 0.5f);
+		}
+
+		built = true;
+	}
+
+	return table;
+}
+
+static float signedSquare(float value) {
+	return (value < 0) ? -(value * value) : (value * value);
+}
+
+Surface *Placeholder::decode(const char *encoded) {
+	Surface *surface = fromBlurHash(encoded);
+	return (surface != nullptr) ? surface : fromThumbnail(encoded);
+}
+
+Surface *Placeholder::fromBlurHash(const char *hash, uint16_t size) {
+	int32_t sizeFlag = decodeBase83(hash, 1);
+	if ((sizeFlag < 0) || (size == 0) || (size > COVERART_PLACEHOLDER_SIZE)) {
+		return nullptr;
+	}
+
+	uint8_t componentsX = (sizeFlag % 9) + 1;
+	uint8_t componentsY = (sizeFlag / 9) + 1;
+	if (strlen(hash) != 4 + (2u * componentsX * componentsY)) {
+		return nullptr;
+	}
+
+	// The DC component holds the average color and the AC components the
+	// variation around it, scaled by the largest of them
+	float colors[MAX_COMPONENTS * MAX_COMPONENTS][3];
+	int32_t quantisedMax = decodeBase83(hash + 1, 1);
+	int32_t average = decodeBase83(hash + 2, 4);
+	if ((quantisedMax < 0) || (average < 0)) {
+		return nullptr;
+	}
+
+	float maxValue = (quantisedMax + 1) / 166.0f;
+	colors[0][0] = srgbToLinear(average >> 16);
+	colors[0][1] = srgbToLinear((average >> 8) & 0xFF);
+	colors[0][2] = srgbToLinear(average & 0xFF);
+
+	for (uint16_t i = 1; i < componentsX * componentsY; i++) {
+		int32_t value = decodeBase83(hash + 4 + (i * 2), 2);
+		if (value < 0) {
+			return nullptr;
+		}
+
+		colors[i][0] = signedSquare(((value / (19 * 19)) - 9) / 9.0f) * maxValue;
+		colors[i][1] = signedSquare((((value / 19) % 19) - 9) / 9.0f) * maxValue;
+		colors[i][2] = signedSquare(((value % 19) - 9) / 9.0f) * maxValue;
+	}
+
+	Surface *surface = Surface::create(size, size, LV_IMG_CF_TRUE_COLOR);
+	if (surface == nullptr) {
+		return nullptr;
+	}
+
+	// The basis is separable, so each row first folds the vertical
+	// cosines into one color per horizontal component.  The horizontal
+	// cosines are the same for every row.
+	float cosines[MAX_COMPONENTS];
+	float columnCosines[COVERART_PLACEHOLDER_SIZE * MAX_COMPONENTS];
+	for (uint16_t x = 0; x < size; x++) {
+		for (uint8_t i = 0; i < componentsX; i++) {
+			columnCosines[(x * componentsX) + i] = cosf((float) M_PI * x * i / size);
+		}
+	}
+
+	float rowColors[MAX_COMPONENTS][3];
+	const uint8_t *toSrgb = linearToSrgbTable();
+	lv_color_t *pixel = (lv_color_t *) surface->pixels();
+
+	for (uint16_t y = 0; y < size; y++) {
+		for (uint8_t j = 0; j < componentsY; j++) {
+			cosines[j] = cosf((float) M_PI * y * j / size);
+		}
+
+		for (uint8_t i = 0; i < componentsX; i++) {
+			rowColors[i][0] = rowColors[i][1] = rowColors[i][2] = 0;
+			for (uint8_t j = 0; j < componentsY; j++) {
+				const float *color = colors[(j * componentsX) + i];
+				rowColors[i][0] += color[0] * cosines[j];
+				rowColors[i][1] += color[1] * cosines[j];
+				rowColors[i][2] += color[2] * cosines[j];
+			}
+		}
+
+		for (uint16_t x = 0; x < size; x++) {
+			float rgb[3] = { 0, 0, 0 };
+			for (uint8_t i = 0; i < componentsX; i++) {
+				float basis = columnCosines[(x * componentsX) + i];
+				rgb[0] += rowColors[i][0] * basis;
+				rgb[1] += rowColors[i][1] * basis;
+				rgb[2] += rowColors[i][2] * basis;
+			}
+
+			uint8_t srgb[3];
+			for (uint8_t c = 0; c < 3; c++) {
+				float v = (rgb[c] < 0) ? 0 : ((rgb[c] > 1) ? 1 : rgb[c]);
+				srgb[c] = toSrgb[(uint16_t) ((v * (SRGB_STEPS - 1)) + 0.5f)];
+			}
+
+			*pixel++ = lv_color_make(srgb[0], srgb[1], srgb[2]);
+		}
+	}
+
+	return surface;
+}
+
+Surface *Placeholder::fromThumbnail(const char *base64) {
+	size_t length = strlen(base64);
+	while ((length > 0) && (base64[length - 1] == '=')) {
+		length--;
+	}
+
+	uint32_t byteCount = (length * 3) / 4;
+	uint16_t size = (uint16_t) sqrtf(byteCount / 3.0f);
+	if ((size == 0) || (size > MAX_THUMBNAIL_SIZE) || ((uint32_t) size * size * 3 != byteCount) || ((length % 4) == 1)) {
+		return nullptr;
+	}
+
+	Surface *surface = Surface::create(size, size, LV_IMG_CF_TRUE_COLOR);
+	if (surface == nullptr) {
+		return nullptr;
+	}
+
+	static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	lv_color_t *pixel = (lv_color_t *) surface->pixels();
+	uint8_t rgb[3];
+	uint8_t filled = 0;
+	uint32_t bits = 0;
+	uint8_t bitCount = 0;
+
+	for (size_t i = 0; i < length; i++) {
+		const char *found = strchr(ALPHABET, base64[i]);
+		if ((found == nullptr) || (base64[i] == '\0')) {
+			surface->release();
+			return nullptr;
+		}
+
+		bits = (bits << 6) | (found - ALPHABET);
+		bitCount += 6;
+		if (bitCount >= 8) {
+			bitCount -= 8;
+			rgb[filled++] = (bits >> bitCount) & 0xFF;
+			if (filled == 3) {
+				*pixel++ = lv_color_make(rgb[0], rgb[1], rgb[2]);
+				filled = 0;
+			}
+		}
+	}
+
+	return surface;
+}
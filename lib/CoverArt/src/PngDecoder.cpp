@@ -0,0 +1,54 @@
+#include "PngDecoder.h"
+#include "PngReader.h"
+#include "Surface.h"
+
+static lv_res_t pngInfo(lv_img_decoder_t *decoder, const void *source, lv_img_header_t *header) {
+	PngReader reader;
+	if (!reader.open(source)) {
+		return LV_RES_INV;
+	}
+
+	header->always_zero = 0;
+	header->cf = reader.format();
+	header->w = reader.width();
+	header->h = reader.height();
+	return LV_RES_OK;
+}
+
+static lv_res_t pngOpen(lv_img_decoder_t *decoder, lv_img_decoder_dsc_t *dsc) {
+	PngReader reader;
+	if (!reader.open(dsc->src)) {
+		return LV_RES_INV;
+	}
+
+	Surface *surface = Surface::create(reader.width(), reader.height(), reader.format());
+	if (surface == nullptr) {
+		return LV_RES_INV;
+	}
+
+	for (uint16_t y = 0; y < surface->height(); y++) {
+		if (!reader.readRow(surface->row(y))) {
+			surface->release();
+			return LV_RES_INV;
+		}
+	}
+
+	dsc->img_data = surface->pixels();
+	dsc->user_data = surface;
+	return LV_RES_OK;
+}
+
+static void pngClose(lv_img_decoder_t *decoder, lv_img_decoder_dsc_t *dsc) {
+	if (dsc->user_data != nullptr) {
+		((Surface *) dsc->user_data)->release();
+		dsc->user_data = nullptr;
+		dsc->img_data = nullptr;
+	}
+}
+
+void PngDecoder::registerDecoder() {
+	lv_img_decoder_t *decoder = lv_img_decoder_create();
+	lv_img_decoder_set_info_cb(decoder, pngInfo);
+	lv_img_decoder_set_open_cb(decoder, pngOpen);
+	lv_img_decoder_set_close_cb(decoder, pngClose);
+}
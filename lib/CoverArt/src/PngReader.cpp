@@ -0,0 +1,536 @@
+#include "PngReader.h"
+#include "Inflater.h"
+
+#include <InMemoryFS.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+#define CHUNK_TYPE(a, b, c, d) ((((uint32_t) (a)) << 24) | (((uint32_t) (b)) << 16) | (((uint32_t) (c)) << 8) | ((uint32_t) (d)))
+
+static const uint32_t CHUNK_IHDR = CHUNK_TYPE('I', 'H', 'D', 'R');
+static const uint32_t CHUNK_PLTE = CHUNK_TYPE('P', 'L', 'T', 'E');
+static const uint32_t CHUNK_TRNS = CHUNK_TYPE('t', 'R', 'N', 'S');
+static const uint32_t CHUNK_IDAT = CHUNK_TYPE('I', 'D', 'A', 'T');
+static const uint32_t CHUNK_IEND = CHUNK_TYPE('I', 'E', 'N', 'D');
+
+enum ColorType {
+	COLOR_GRAY = 0,
+	COLOR_RGB = 2,
+	COLOR_PALETTE = 3,
+	COLOR_GRAY_ALPHA = 4,
+	COLOR_RGBA = 6
+};
+
+static uint32_t readBigEndian(const uint8_t *bytes) {
+	return (((uint32_t) bytes[0]) << 24) | (((uint32_t) bytes[1]) << 16) | (((uint32_t) bytes[2]) << 8) | bytes[3];
+}
+
+/**
+ * Return the samples per pixel for a color type, or 0 if it is invalid.
+ */
+static uint8_t samplesPerPixel(uint8_t colorType) {
+	switch (colorType) {
+		case COLOR_GRAY:
+		case COLOR_PALETTE:
+			return 1;
+
+		case COLOR_GRAY_ALPHA:
+			return 2;
+
+		case COLOR_RGB:
+			return 3;
+
+		case COLOR_RGBA:
+			return 4;
+	}
+
+	return 0;
+}
+
+/**
+ * Write one pixel in the display's format.
+ */
+static inline uint8_t *writePixel(uint8_t *out, uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha, bool hasAlpha) {
+	lv_color_t color = lv_color_make(red, green, blue);
+	memcpy(out, &color, sizeof(color));
+	out += sizeof(color);
+
+	if (hasAlpha) {
+		*out++ = alpha;
+	}
+
+	return out;
+}
+
+PngReader::PngReader() :
+	memory(nullptr), memorySize(0), memoryPosition(0), storedImage(nullptr), fileOpen(false), inputBuffer(nullptr),
+	imageWidth(0), imageHeight(0), colorType(0), bitDepth(0), hasAlpha(false),
+	palette(nullptr), paletteSize(0), hasTransparentColor(false), chunkRemaining(0), inflater(nullptr),
+	rowStorage(nullptr), currentRow(nullptr), previousRow(nullptr), rowBytes(0) {
+}
+
+PngReader::~PngReader() {
+	delete inflater;
+	free(rowStorage);
+	free(palette);
+	free(inputBuffer);
+
+	if (fileOpen) {
+		lv_fs_close(&file);
+	}
+
+	if (storedImage != nullptr) {
+		InMemoryFS::releaseImageDescriptor(storedImage);
+	}
+}
+
+/**
+ * Find the bytes behind an image source, or open it as a file.
+ */
+bool PngReader::openSource(const void *source) {
+	lv_img_src_t sourceType = lv_img_src_get_type(source);
+	if (sourceType == LV_IMG_SRC_VARIABLE) {
+		const lv_img_dsc_t *image = (const lv_img_dsc_t *) source;
+		memory = image->data;
+		memorySize = image->data_size;
+		return memory != nullptr;
+	}
+
+	if (sourceType != LV_IMG_SRC_FILE) {
+		return false;
+	}
+
+	const char *path = (const char *) source;
+	const char *extension = lv_fs_get_ext(path);
+	if ((strcmp(extension, "png") != 0) && (strcmp(extension, "PNG") != 0)) {
+		return false;
+	}
+
+	if (path[0] == InMemoryFS::DRIVE_LETTER) {
+		storedImage = InMemoryFS::asImageDescriptor(path);
+		if (storedImage != nullptr) {
+			memory = storedImage->data;
+			memorySize = storedImage->data_size;
+			return true;
+		}
+	}
+
+	inputBuffer = (uint8_t *) malloc(INPUT_BUFFER_SIZE);
+	if ((inputBuffer == nullptr) || (lv_fs_open(&file, path, LV_FS_MODE_RD) != LV_FS_RES_OK)) {
+		return false;
+	}
+
+	fileOpen = true;
+	return true;
+}
+
+/**
+ * Copy the next bytes of the source.
+ */
+bool PngReader::readBytes(uint8_t *buffer, uint32_t count) {
+	if (fileOpen) {
+		uint32_t bytesRead;
+		return (lv_fs_read(&file, buffer, count, &bytesRead) == LV_FS_RES_OK) && (bytesRead == count);
+	}
+
+	if (count > memorySize - memoryPosition) {
+		return false;
+	}
+
+	memcpy(buffer, memory + memoryPosition, count);
+	memoryPosition += count;
+	return true;
+}
+
+bool PngReader::skipBytes(uint32_t count) {
+	if (fileOpen) {
+		return lv_fs_seek(&file, count, LV_FS_SEEK_CUR) == LV_FS_RES_OK;
+	}
+
+	if (count > memorySize - memoryPosition) {
+		return false;
+	}
+
+	memoryPosition += count;
+	return true;
+}
+
+/**
+ * Return the next bytes of the source without copying them when they
+ * are in memory.
+ *
+ * @param data receives a pointer to the bytes
+ * @param count the most bytes wanted
+ * @return the number of bytes, 0 at the end of the source
+ */
+uint32_t PngReader::borrowBytes(const uint8_t *&data, uint32_t count) {
+	if (fileOpen) {
+		uint32_t bytesRead = 0;
+		lv_fs_read(&file, inputBuffer, (count < INPUT_BUFFER_SIZE) ? count : INPUT_BUFFER_SIZE, &bytesRead);
+		data = inputBuffer;
+		return bytesRead;
+	}
+
+	uint32_t available = memorySize - memoryPosition;
+	if (count > available) {
+		count = available;
+	}
+
+	data = memory + memoryPosition;
+	memoryPosition += count;
+	return count;
+}
+
+bool PngReader::readChunkHeader(uint32_t &length, uint32_t &type) {
+	uint8_t header[8];
+	if (!readBytes(header, sizeof(header))) {
+		return false;
+	}
+
+	length = readBigEndian(header);
+	type = readBigEndian(header + 4);
+	return length <= 0x7FFFFFFF;
+}
+
+bool PngReader::readHeaderChunk(uint32_t length) {
+	uint8_t header[13];
+	if ((length != sizeof(header)) || !readBytes(header, sizeof(header))) {
+		return false;
+	}
+
+	uint32_t width = readBigEndian(header);
+	uint32_t height = readBigEndian(header + 4);
+	bitDepth = header[8];
+	colorType = header[9];
+
+	// Compression and filter method 0 and no interlacing
+	if ((width == 0) || (height == 0) || (width > MAX_DIMENSION) || (height > MAX_DIMENSION) ||
+		(header[10] != 0) || (header[11] != 0) || (header[12] != 0)) {
+		return false;
+	}
+
+	bool validDepth;
+	switch (colorType) {
+		case COLOR_GRAY:
+			validDepth = (bitDepth == 1) || (bitDepth == 2) || (bitDepth == 4) || (bitDepth == 8) || (bitDepth == 16);
+			break;
+
+		case COLOR_PALETTE:
+			validDepth = (bitDepth == 1) || (bitDepth == 2) || (bitDepth == 4) || (bitDepth == 8);
+			break;
+
+		case COLOR_RGB:
+		case COLOR_GRAY_ALPHA:
+		case COLOR_RGBA:
+			validDepth = (bitDepth == 8) || (bitDepth == 16);
+			break;
+
+		default:
+			validDepth = false;
+	}
+
+	imageWidth = width;
+	imageHeight = height;
+	hasAlpha = (colorType == COLOR_GRAY_ALPHA) || (colorType == COLOR_RGBA);
+	return validDepth;
+}
+
+bool PngReader::readPalette(uint32_t length) {
+	if ((length % 3) || (length > 256 * 3) || (palette != nullptr)) {
+		return false;
+	}
+
+	palette = (uint8_t *) malloc(256 * 4);
+	if ((palette == nullptr) || !readBytes(palette, length)) {
+		return false;
+	}
+
+	// Spread the RGB entries out to RGBA from the end backwards, opaque
+	// until a tRNS chunk says otherwise
+	paletteSize = length / 3;
+	for (int entry = 255; entry >= 0; entry--) {
+		uint8_t *rgba = palette + (entry * 4);
+		if (entry < paletteSize) {
+			memmove(rgba, palette + (entry * 3), 3);
+		} else {
+			memset(rgba, 0, 3);
+		}
+
+		rgba[3] = 0xFF;
+	}
+
+	return true;
+}
+
+bool PngReader::readTransparency(uint32_t length) {
+	uint8_t values[256];
+	if ((length > sizeof(values)) || !readBytes(values, length)) {
+		return false;
+	}
+
+	if (colorType == COLOR_PALETTE) {
+		if ((palette == nullptr) || (length > paletteSize)) {
+			return false;
+		}
+
+		for (uint32_t entry = 0; entry < length; entry++) {
+			palette[(entry * 4) + 3] = values[entry];
+		}
+	} else if ((colorType == COLOR_GRAY) && (length == 2)) {
+		transparentColor[0] = (values[0] << 8) | values[1];
+		hasTransparentColor = true;
+	} else if ((colorType == COLOR_RGB) && (length == 6)) {
+		for (uint8_t channel = 0; channel < 3; channel++) {
+			transparentColor[channel] = (values[channel * 2] << 8) | values[(channel * 2) + 1];
+		}
+
+		hasTransparentColor = true;
+	} else {
+		return false;
+	}
+
+	hasAlpha = true;
+	return true;
+}
+
+bool PngReader::open(const void *source) {
+	uint8_t signature[sizeof(SIGNATURE)];
+	if (!openSource(source) || !readBytes(signature, sizeof(signature)) || (memcmp(signature, SIGNATURE, sizeof(SIGNATURE)) != 0)) {
+		return false;
+	}
+
+	uint32_t length, type;
+	if (!readChunkHeader(length, type) || (type != CHUNK_IHDR) || !readHeaderChunk(length) || !skipBytes(4)) {
+		return false;
+	}
+
+	// Read the chunks that matter ahead of the image data
+	while (true) {
+		if (!readChunkHeader(length, type)) {
+			return false;
+		}
+
+		bool ok;
+		if (type == CHUNK_IDAT) {
+			break;
+		} else if (type == CHUNK_PLTE) {
+			ok = readPalette(length);
+		} else if (type == CHUNK_TRNS) {
+			ok = readTransparency(length);
+		} else if (type == CHUNK_IEND) {
+			ok = false;
+		} else {
+			ok = skipBytes(length);
+		}
+
+		if (!ok || !skipBytes(4)) {
+			return false;
+		}
+	}
+
+	if ((colorType == COLOR_PALETTE) && (palette == nullptr)) {
+		return false;
+	}
+
+	chunkRemaining = length;
+
+	uint32_t bitsPerPixel = samplesPerPixel(colorType) * bitDepth;
+	rowBytes = ((imageWidth * bitsPerPixel) + 7) / 8;
+	rowStorage = (uint8_t *) calloc(2, rowBytes + 1);
+	if (rowStorage == nullptr) {
+		return false;
+	}
+
+	// The row above the first is all zeros
+	currentRow = rowStorage;
+	previousRow = rowStorage + rowBytes + 1;
+
+	inflater = new Inflater([this](const uint8_t *&data) {
+		return nextImageData(data);
+	});
+
+	return inflater->isValid();
+}
+
+/**
+ * Hand the inflater the next piece of image data, moving on through
+ * consecutive IDAT chunks.
+ */
+uint32_t PngReader::nextImageData(const uint8_t *&data) {
+	while (chunkRemaining == 0) {
+		uint32_t length, type;
+		if (!skipBytes(4) || !readChunkHeader(length, type) || (type != CHUNK_IDAT)) {
+			return 0;
+		}
+
+		chunkRemaining = length;
+	}
+
+	uint32_t count = borrowBytes(data, chunkRemaining);
+	chunkRemaining -= count;
+	return count;
+}
+
+/**
+ * Reverse the filter on the current row, which is relative to the
+ * previous row.
+ */
+bool PngReader::unfilter() {
+	uint8_t *row = currentRow + 1;
+	const uint8_t *above = previousRow + 1;
+	uint8_t bytesPerPixel = (samplesPerPixel(colorType) * bitDepth + 7) / 8;
+
+	switch (currentRow[0]) {
+		case 0:
+			break;
+
+		case 1:
+			for (uint32_t i = bytesPerPixel; i < rowBytes; i++) {
+				row[i] += row[i - bytesPerPixel];
+			}
+			break;
+
+		case 2:
+			for (uint32_t i = 0; i < rowBytes; i++) {
+				row[i] += above[i];
+			}
+			break;
+
+		case 3:
+			for (uint32_t i = 0; i < bytesPerPixel; i++) {
+				row[i] += above[i] >> 1;
+			}
+
+			for (uint32_t i = bytesPerPixel; i < rowBytes; i++) {
+				row[i] += (row[i - bytesPerPixel] + above[i]) >> 1;
+			}
+			break;
+
+		case 4:
+			for (uint32_t i = 0; i < bytesPerPixel; i++) {
+				row[i] += above[i];
+			}
+
+			for (uint32_t i = bytesPerPixel; i < rowBytes; i++) {
+				int left = row[i - bytesPerPixel];
+				int up = above[i];
+				int upLeft = above[i - bytesPerPixel];
+				int estimate = left + up - upLeft;
+				int leftDistance = abs(estimate - left);
+				int upDistance = abs(estimate - up);
+				int upLeftDistance = abs(estimate - upLeft);
+
+				if ((leftDistance <= upDistance) && (leftDistance <= upLeftDistance)) {
+					row[i] += left;
+				} else if (upDistance <= upLeftDistance) {
+					row[i] += up;
+				} else {
+					row[i] += upLeft;
+				}
+			}
+			break;
+
+		default:
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Convert the current row to the display's format.  Sixteen bit samples
+ * are cut to their high byte, and samples below eight bits are scaled
+ * up to the full range.
+ */
+void PngReader::convert(uint8_t *out) {
+	const uint8_t *row = currentRow + 1;
+	uint16_t width = imageWidth;
+
+	switch (colorType) {
+		case COLOR_GRAY:
+			if (bitDepth < 8) {
+				uint8_t mask = (1 << bitDepth) - 1;
+				uint8_t scale = 255 / mask;
+				for (uint16_t x = 0; x < width; x++) {
+					uint32_t bit = x * bitDepth;
+					uint8_t sample = (row[bit >> 3] >> (8 - bitDepth - (bit & 7))) & mask;
+					uint8_t alpha = (hasTransparentColor && (sample == transparentColor[0])) ? 0 : 0xFF;
+					out = writePixel(out, sample * scale, sample * scale, sample * scale, alpha, hasAlpha);
+				}
+			} else {
+				uint8_t step = bitDepth / 8;
+				for (uint16_t x = 0; x < width; x++) {
+					const uint8_t *sample = row + (x * step);
+					uint16_t value = (step == 2) ? ((sample[0] << 8) | sample[1]) : sample[0];
+					uint8_t alpha = (hasTransparentColor && (value == transparentColor[0])) ? 0 : 0xFF;
+					out = writePixel(out, sample[0], sample[0], sample[0], alpha, hasAlpha);
+				}
+			}
+			break;
+
+		case COLOR_RGB: {
+			uint8_t step = bitDepth / 8;
+			for (uint16_t x = 0; x < width; x++) {
+				const uint8_t *pixel = row + (x * 3 * step);
+				uint8_t alpha = 0xFF;
+				if (hasTransparentColor) {
+					bool match = true;
+					for (uint8_t channel = 0; channel < 3; channel++) {
+						const uint8_t *sample = pixel + (channel * step);
+						uint16_t value = (step == 2) ? ((sample[0] << 8) | sample[1]) : sample[0];
+						match = match && (value == transparentColor[channel]);
+					}
+
+					alpha = match ? 0 : 0xFF;
+				}
+
+				out = writePixel(out, pixel[0], pixel[step], pixel[2 * step], alpha, hasAlpha);
+			}
+			break;
+		}
+
+		case COLOR_PALETTE: {
+			uint8_t mask = (1 << bitDepth) - 1;
+			for (uint16_t x = 0; x < width; x++) {
+				uint32_t bit = x * bitDepth;
+				uint8_t index = (row[bit >> 3] >> (8 - bitDepth - (bit & 7))) & mask;
+				const uint8_t *rgba = palette + (index * 4);
+				out = writePixel(out, rgba[0], rgba[1], rgba[2], rgba[3], hasAlpha);
+			}
+			break;
+		}
+
+		case COLOR_GRAY_ALPHA: {
+			uint8_t step = bitDepth / 8;
+			for (uint16_t x = 0; x < width; x++) {
+				const uint8_t *pixel = row + (x * 2 * step);
+				out = writePixel(out, pixel[0], pixel[0], pixel[0], pixel[step], true);
+			}
+			break;
+		}
+
+		case COLOR_RGBA: {
+			uint8_t step = bitDepth / 8;
+			for (uint16_t x = 0; x < width; x++) {
+				const uint8_t *pixel = row + (x * 4 * step);
+				out = writePixel(out, pixel[0], pixel[step], pixel[2 * step], pixel[3 * step], true);
+			}
+			break;
+		}
+	}
+}
+
+bool PngReader::readRow(uint8_t *out) {
+	if ((inflater == nullptr) || !inflater->read(currentRow, rowBytes + 1) || !unfilter()) {
+		return false;
+	}
+
+	convert(out);
+
+	uint8_t *finished = previousRow;
+	previousRow = currentRow;
+	currentRow = finished;
+	return true;
+}
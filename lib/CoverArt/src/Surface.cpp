@@ -0,0 +1,54 @@
+#include "Surface.h"
+
+#include <new>
+#include <stdlib.h>
+
+#ifdef BOARD_HAS_PSRAM
+#include <esp_heap_caps.h>
+#endif
+
+Surface *Surface::create(uint16_t width, uint16_t height, lv_img_cf_t cf) {
+	uint32_t pixelSize = (cf == LV_IMG_CF_TRUE_COLOR_ALPHA) ? LV_IMG_PX_SIZE_ALPHA_BYTE : sizeof(lv_color_t);
+	uint32_t size = (uint32_t) width * height * pixelSize;
+
+	#ifdef BOARD_HAS_PSRAM
+		void *pixels = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+		if (pixels == nullptr) {
+			pixels = malloc(size);
+		}
+	#else
+		void *pixels = malloc(size);
+	#endif
+
+	if (pixels == nullptr) {
+		return nullptr;
+	}
+
+	Surface *surface = new (std::nothrow) Surface();
+	if (surface == nullptr) {
+		free(pixels);
+		return nullptr;
+	}
+
+	surface->image.header.cf = cf;
+	surface->image.header.always_zero = 0;
+	surface->image.header.reserved = 0;
+	surface->image.header.w = width;
+	surface->image.header.h = height;
+	surface->image.data_size = size;
+	surface->image.data = (const uint8_t *) pixels;
+
+	return surface;
+}
+
+Surface::~Surface() {
+	// Addresses are reused, as InMemoryFS::releaseImageDescriptor explains
+	lv_img_cache_invalidate_src(&image);
+	free((void *) image.data);
+}
+
+void Surface::release() {
+	if (refCount.fetch_sub(1) == 1) {
+		delete this;
+	}
+}
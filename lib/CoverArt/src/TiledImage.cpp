@@ -0,0 +1,398 @@
+#include "TiledImage.h"
+#include "CoverArtDecoder.h"
+
+#include <InMemoryFS.h>
+#include <Lz4.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static_assert(LV_COLOR_DEPTH == 16, "Tiled images hold RGB565 pixels");
+
+static const uint8_t MAGIC[4] = { 'T', 'I', 'L', '1' };
+static const uint32_t HEADER_SIZE = 12;
+
+static uint16_t readLittleEndian16(const uint8_t *bytes) {
+	return bytes[0] | (bytes[1] << 8);
+}
+
+static uint32_t readLittleEndian32(const uint8_t *bytes) {
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+static void putLittleEndian16(std::vector<uint8_t> &out, uint16_t value) {
+	out.push_back(value & 0xFF);
+	out.push_back(value >> 8);
+}
+
+static void writeLittleEndian32(uint8_t *bytes, uint32_t value) {
+	bytes[0] = value & 0xFF;
+	bytes[1] = (value >> 8) & 0xFF;
+	bytes[2] = (value >> 16) & 0xFF;
+	bytes[3] = value >> 24;
+}
+
+/**
+ * Copy pixels between the file and the display's color format, which
+ * differ only in byte order when LVGL swaps the bytes of 16-bit colors.
+ */
+static void copyPixels(uint8_t *dest, const uint8_t *source, uint32_t count, uint8_t pixelSize) {
+#if LV_COLOR_16_SWAP
+	for (uint32_t i = 0; i < count; i++, dest += pixelSize, source += pixelSize) {
+		memcpy(dest, source, pixelSize);
+		dest[0] = source[1];
+		dest[1] = source[0];
+	}
+#else
+	memcpy(dest, source, count * pixelSize);
+#endif
+}
+
+std::vector<uint8_t> TiledImage::encode(Surface *surface, uint8_t tileSize) {
+	std::vector<uint8_t> out;
+	uint8_t pixelSize = surface->pixelSize();
+	uint32_t tileBytes = (uint32_t) tileSize * tileSize * pixelSize;
+	if ((tileSize == 0) || (tileBytes > Lz4::MAX_INPUT_SIZE)) {
+		return out;
+	}
+
+	uint16_t tilesAcross = (surface->width() + tileSize - 1) / tileSize;
+	uint16_t tilesDown = (surface->height() + tileSize - 1) / tileSize;
+	uint32_t tileCount = (uint32_t) tilesAcross * tilesDown;
+
+	out.insert(out.end(), MAGIC, MAGIC + sizeof(MAGIC));
+	putLittleEndian16(out, surface->width());
+	putLittleEndian16(out, surface->height());
+	out.push_back(surface->image.header.cf);
+	out.push_back(tileSize);
+	putLittleEndian16(out, 0);
+
+	// The index is filled in as the tiles are added
+	uint32_t indexOffset = out.size();
+	out.resize(out.size() + ((tileCount + 1) * 4));
+
+	uint8_t *tile = (uint8_t *) malloc(tileBytes * 2);
+	if (tile == nullptr) {
+		out.clear();
+		return out;
+	}
+
+	uint8_t *packed = tile + tileBytes;
+	for (uint32_t index = 0; index < tileCount; index++) {
+		uint16_t left = (index % tilesAcross) * tileSize;
+		uint16_t top = (index / tilesAcross) * tileSize;
+		uint16_t width = LV_MIN(tileSize, surface->width() - left);
+		uint16_t height = LV_MIN(tileSize, surface->height() - top);
+
+		uint32_t rowBytes = (uint32_t) width * pixelSize;
+		for (uint16_t y = 0; y < height; y++) {
+			copyPixels(tile + (y * rowBytes), surface->row(top + y) + (left * pixelSize), width, pixelSize);
+		}
+
+		// Tiles that do not shrink are stored as they are
+		uint32_t length = rowBytes * height;
+		uint32_t stored = Lz4::compress(tile, length, packed, length - 1);
+		writeLittleEndian32(&out[indexOffset + (index * 4)], out.size());
+		if (stored > 0) {
+			out.insert(out.end(), packed, packed + stored);
+		} else {
+			out.insert(out.end(), tile, tile + length);
+		}
+	}
+
+	writeLittleEndian32(&out[indexOffset + (tileCount * 4)], out.size());
+	free(tile);
+	return out;
+}
+
+bool TiledImage::convert(const void *source, const char *path, uint16_t maxWidth, uint16_t maxHeight) {
+	Surface *surface = CoverArtDecoder::decode(source, maxWidth, maxHeight);
+	if (surface == nullptr) {
+		return false;
+	}
+
+	std::vector<uint8_t> bytes = encode(surface);
+	surface->release();
+	if (bytes.empty()) {
+		return false;
+	}
+
+	FILE *file = fopen(path, "wb");
+	if (file == nullptr) {
+		return false;
+	}
+
+	bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+	ok = (fclose(file) == 0) && ok;
+	if (!ok) {
+		remove(path);
+	}
+
+	return ok;
+}
+
+static lv_res_t tiledInfo(lv_img_decoder_t *decoder, const void *source, lv_img_header_t *header) {
+	TiledImage image;
+	if (!image.open(source)) {
+		return LV_RES_INV;
+	}
+
+	header->always_zero = 0;
+	header->cf = image.format();
+	header->w = image.width();
+	header->h = image.height();
+	return LV_RES_OK;
+}
+
+static lv_res_t tiledOpen(lv_img_decoder_t *decoder, lv_img_decoder_dsc_t *dsc) {
+	TiledImage *image = new TiledImage();
+	if (!image->open(dsc->src)) {
+		delete image;
+		return LV_RES_INV;
+	}
+
+	// Without image data LVGL reads only the lines it draws
+	dsc->img_data = nullptr;
+	dsc->user_data = image;
+	return LV_RES_OK;
+}
+
+static lv_res_t tiledReadLine(lv_img_decoder_t *decoder, lv_img_decoder_dsc_t *dsc, lv_coord_t x, lv_coord_t y, lv_coord_t length, uint8_t *buffer) {
+	TiledImage *image = (TiledImage *) dsc->user_data;
+	if ((image == nullptr) || (x < 0) || (y < 0) || (length < 0)) {
+		return LV_RES_INV;
+	}
+
+	return image->readLine(x, y, length, buffer) ? LV_RES_OK : LV_RES_INV;
+}
+
+static void tiledClose(lv_img_decoder_t *decoder, lv_img_decoder_dsc_t *dsc) {
+	delete (TiledImage *) dsc->user_data;
+	dsc->user_data = nullptr;
+}
+
+void TiledImage::registerDecoder() {
+	lv_img_decoder_t *decoder = lv_img_decoder_create();
+	lv_img_decoder_set_info_cb(decoder, tiledInfo);
+	lv_img_decoder_set_open_cb(decoder, tiledOpen);
+	lv_img_decoder_set_read_line_cb(decoder, tiledReadLine);
+	lv_img_decoder_set_close_cb(decoder, tiledClose);
+}
+
+TiledImage::TiledImage() :
+	memory(nullptr), sourceSize(0), storedImage(nullptr), fileOpen(false),
+	imageWidth(0), imageHeight(0), colorFormat(LV_IMG_CF_UNKNOWN), pixelSize(0), tileSize(0), tilesAcross(0), tilesDown(0), offsets(nullptr),
+	band(nullptr), bandTiles(nullptr), scratch(nullptr), bandRow(NO_ROW), tilesDecoded(0) {
+}
+
+TiledImage::~TiledImage() {
+	free(offsets);
+	free(band);
+	free(bandTiles);
+	free(scratch);
+
+	if (fileOpen) {
+		lv_fs_close(&file);
+	}
+
+	if (storedImage != nullptr) {
+		InMemoryFS::releaseImageDescriptor(storedImage);
+	}
+}
+
+bool TiledImage::open(const void *source) {
+	return openSource(source) && readIndex();
+}
+
+/**
+ * Find the bytes behind an image source, or open it as a file.
+ */
+bool TiledImage::openSource(const void *source) {
+	lv_img_src_t sourceType = lv_img_src_get_type(source);
+	if (sourceType == LV_IMG_SRC_VARIABLE) {
+		// Only descriptors of raw bytes, never of pixels LVGL draws itself
+		const lv_img_dsc_t *image = (const lv_img_dsc_t *) source;
+		if ((image->header.cf != LV_IMG_CF_UNKNOWN) && (image->header.cf != LV_IMG_CF_RAW)) {
+			return false;
+		}
+
+		memory = image->data;
+		sourceSize = image->data_size;
+		return memory != nullptr;
+	}
+
+	if (sourceType != LV_IMG_SRC_FILE) {
+		return false;
+	}
+
+	const char *path = (const char *) source;
+	const char *extension = lv_fs_get_ext(path);
+	if ((strcmp(extension, "tile") != 0) && (strcmp(extension, "TILE") != 0)) {
+		return false;
+	}
+
+	if (path[0] == InMemoryFS::DRIVE_LETTER) {
+		storedImage = InMemoryFS::asImageDescriptor(path);
+		if (storedImage != nullptr) {
+			memory = storedImage->data;
+			sourceSize = storedImage->data_size;
+			return true;
+		}
+	}
+
+	if (lv_fs_open(&file, path, LV_FS_MODE_RD) != LV_FS_RES_OK) {
+		return false;
+	}
+
+	fileOpen = true;
+	return (lv_fs_seek(&file, 0, LV_FS_SEEK_END) == LV_FS_RES_OK) && (lv_fs_tell(&file, &sourceSize) == LV_FS_RES_OK);
+}
+
+/**
+ * Read and check the header and the tile index.
+ */
+bool TiledImage::readIndex() {
+	uint8_t header[HEADER_SIZE];
+	if (!readAt(0, header, sizeof(header)) || (memcmp(header, MAGIC, sizeof(MAGIC)) != 0)) {
+		return false;
+	}
+
+	imageWidth = readLittleEndian16(header + 4);
+	imageHeight = readLittleEndian16(header + 6);
+	colorFormat = header[8];
+	tileSize = header[9];
+	if ((imageWidth == 0) || (imageWidth > MAX_DIMENSION) || (imageHeight == 0) || (imageHeight > MAX_DIMENSION) || (tileSize == 0)) {
+		return false;
+	}
+
+	if (colorFormat == LV_IMG_CF_TRUE_COLOR) {
+		pixelSize = sizeof(lv_color_t);
+	} else if (colorFormat == LV_IMG_CF_TRUE_COLOR_ALPHA) {
+		pixelSize = LV_IMG_PX_SIZE_ALPHA_BYTE;
+	} else {
+		return false;
+	}
+
+	tilesAcross = (imageWidth + tileSize - 1) / tileSize;
+	tilesDown = (imageHeight + tileSize - 1) / tileSize;
+	uint32_t count = ((uint32_t) tilesAcross * tilesDown) + 1;
+	offsets = (uint32_t *) malloc(count * sizeof(uint32_t));
+	if ((offsets == nullptr) || !readAt(HEADER_SIZE, (uint8_t *) offsets, count * sizeof(uint32_t))) {
+		return false;
+	}
+
+	// Each tile must lie after the index, within the source and be no
+	// larger than its pixels
+	uint32_t tileBytes = (uint32_t) tileSize * tileSize * pixelSize;
+	uint32_t previous = HEADER_SIZE + (count * sizeof(uint32_t));
+	for (uint32_t i = 0; i < count; i++) {
+		offsets[i] = readLittleEndian32((const uint8_t *) &offsets[i]);
+		if ((offsets[i] < previous) || (offsets[i] > sourceSize) || ((i > 0) && (offsets[i] - previous > tileBytes))) {
+			return false;
+		}
+
+		previous = offsets[i];
+	}
+
+	return offsets[0] == HEADER_SIZE + (count * sizeof(uint32_t));
+}
+
+bool TiledImage::readAt(uint32_t offset, uint8_t *buffer, uint32_t count) {
+	if ((offset > sourceSize) || (count > sourceSize - offset)) {
+		return false;
+	}
+
+	if (!fileOpen) {
+		memcpy(buffer, memory + offset, count);
+		return true;
+	}
+
+	uint32_t bytesRead;
+	return (lv_fs_seek(&file, offset, LV_FS_SEEK_SET) == LV_FS_RES_OK) &&
+		(lv_fs_read(&file, buffer, count, &bytesRead) == LV_FS_RES_OK) && (bytesRead == count);
+}
+
+bool TiledImage::readLine(uint16_t x, uint16_t y, uint16_t length, uint8_t *out) {
+	if ((y >= imageHeight) || (x > imageWidth) || (length > imageWidth - x)) {
+		return false;
+	}
+
+	if (band == nullptr) {
+		uint32_t tileBytes = (uint32_t) tileSize * tileSize * pixelSize;
+		band = (uint8_t *) malloc((uint32_t) imageWidth * tileSize * pixelSize);
+		bandTiles = (uint8_t *) malloc(tilesAcross);
+		scratch = (uint8_t *) malloc(tileBytes * 2);
+		if ((band == nullptr) || (bandTiles == nullptr) || (scratch == nullptr)) {
+			return false;
+		}
+	}
+
+	uint16_t row = y / tileSize;
+	if (row != bandRow) {
+		memset(bandTiles, 0, tilesAcross);
+		bandRow = row;
+	}
+
+	if (length > 0) {
+		for (uint16_t column = x / tileSize; column <= (x + length - 1) / tileSize; column++) {
+			if (!bandTiles[column]) {
+				if (!decodeTile(column)) {
+					return false;
+				}
+
+				bandTiles[column] = true;
+			}
+		}
+	}
+
+	uint32_t stride = (uint32_t) imageWidth * pixelSize;
+	memcpy(out, band + ((y % tileSize) * stride) + (x * pixelSize), (uint32_t) length * pixelSize);
+	return true;
+}
+
+/**
+ * Decode a tile of the row held in the band into place.
+ *
+ * @param column the tile column
+ */
+bool TiledImage::decodeTile(uint16_t column) {
+	uint32_t index = ((uint32_t) bandRow * tilesAcross) + column;
+	uint32_t stored = offsets[index + 1] - offsets[index];
+
+	uint16_t left = column * tileSize;
+	uint16_t width = LV_MIN(tileSize, imageWidth - left);
+	uint16_t height = LV_MIN(tileSize, imageHeight - (bandRow * tileSize));
+	uint32_t rowBytes = (uint32_t) width * pixelSize;
+	uint32_t length = rowBytes * height;
+	if (stored > length) {
+		return false;
+	}
+
+	// Tiles in memory that were stored as they are need no copy
+	const uint8_t *pixels = scratch;
+	const uint8_t *data = memory + offsets[index];
+	if (fileOpen) {
+		uint8_t *read = (stored == length) ? scratch : scratch + length;
+		if (!readAt(offsets[index], read, stored)) {
+			return false;
+		}
+
+		data = read;
+	}
+
+	if (stored < length) {
+		if (Lz4::decompress(data, stored, scratch, length) != (int32_t) length) {
+			return false;
+		}
+	} else {
+		pixels = data;
+	}
+
+	uint32_t stride = (uint32_t) imageWidth * pixelSize;
+	for (uint16_t y = 0; y < height; y++) {
+		copyPixels(band + (y * stride) + (left * pixelSize), pixels + (y * rowBytes), width, pixelSize);
+	}
+
+	tilesDecoded++;
+	return true;
+}
@@ -1,10 +1,302 @@
 #pragma once
 
+#include <functional>
 #include <lvgl.h>
 
+// The number of files that may be open at once.  Cursors come from a
+// fixed pool so opening and closing files never touches the heap.
+#ifndef INMEMORYFS_MAX_OPEN_FILES
+	#define INMEMORYFS_MAX_OPEN_FILES 8
+#endif
+
+// The uncompressed size of each independently compressed block in a
+// compressed file.  Smaller blocks make seeks cheaper, larger blocks
+// compress better.  Each open cursor reading a compressed file holds
+// one block-sized window.
+#ifndef INMEMORYFS_COMPRESSED_BLOCK_SIZE
+	#define INMEMORYFS_COMPRESSED_BLOCK_SIZE 4096
+#endif
+
+// Files too large for any single free block of memory are stored as a
+// chain of segments of this size instead.
+#ifndef INMEMORYFS_SEGMENT_SIZE
+	#define INMEMORYFS_SEGMENT_SIZE 4096
+#endif
+
+// The largest single block allocated for file data, or 0 for no limit.
+// Larger files are stored in segments, which keeps big covers from
+// claiming the large free blocks the rest of the system needs.
+#ifndef INMEMORYFS_MAX_CONTIGUOUS_ALLOCATION
+	#define INMEMORYFS_MAX_CONTIGUOUS_ALLOCATION 0
+#endif
+
+// The number of asset packs that may be mounted.
+#ifndef INMEMORYFS_MAX_ASSET_PACKS
+	#define INMEMORYFS_MAX_ASSET_PACKS 4
+#endif
+
+/**
+ * An LVGL file system driver serving files held in memory.
+ *
+ * Files may be registered, replaced and removed from any thread.  Reads
+ * through the LVGL driver never take a lock, so they are safe on the LVGL
+ * thread while another task publishes new files.
+ *
+ * A file may also be written through the driver by opening it with
+ * LV_FS_MODE_WR.  The data is staged privately and published, replacing
+ * any previous version, when the file is closed.
+ *
+ * Paths containing '/' are listed as directories through the LVGL dir
+ * functions, with subdirectories prefixed by '/'.
+ */
 namespace InMemoryFS {
 	static char DRIVE_LETTER = 'M';
 
+	/**
+	 * @brief A function to release a buffer once the file system
+	 * no longer needs it.
+	 */
+	typedef std::function<void(void *data)> BufferDeleter;
+
+	/**
+	 * @brief The kind of memory holding a file's data.  Internal RAM and
+	 * PSRAM are budgeted separately; static data is never counted.
+	 */
+	enum MemoryRegion {
+		MEMORY_INTERNAL,
+		MEMORY_PSRAM,
+		MEMORY_STATIC
+	};
+
+	/**
+	 * @brief Counters describing the behavior of the file system.
+	 */
+	struct Stats {
+		// Bytes of file data held in each memory region
+		uint32_t residentBytes[MEMORY_STATIC + 1];
+
+		// Number of registered paths, including asset pack files
+		uint32_t entryCount;
+
+		// Successful opens for reading, opens of unregistered paths and
+		// bytes read through the driver.  These wrap around.
+		uint32_t opens;
+		uint32_t misses;
+		uint32_t bytesRead;
+
+		// Cursors open now and the most ever open at once
+		uint32_t openCursors;
+		uint32_t peakOpenCursors;
+
+		// Opens that failed because every pooled cursor was in use
+		uint32_t cursorPoolExhaustions;
+
+		// The current access tick, to compare against EntryInfo::lastAccess
+		uint32_t accessClock;
+
+		// Files published, and how many of them shared the storage of
+		// a file with identical content rather than holding a copy
+		uint32_t registrations;
+		uint32_t dedupHits;
+		uint32_t dedupBytesSaved;
+	};
+
+	/**
+	 * @brief A description of one registered file.
+	 */
+	struct EntryInfo {
+		// Only valid for the duration of the visit
+		const char *path;
+
+		// The file size and the bytes of memory holding it
+		uint32_t size;
+		uint32_t storedSize;
+		MemoryRegion region;
+
+		uint32_t version;
+
+		// The access tick of the last open, higher is more recent
+		uint32_t lastAccess;
+
+		uint32_t openCursors;
+
+		// Whether other paths share the file's storage
+		bool shared;
+	};
+
+	/**
+	 * @brief A function to receive each registered file.
+	 */
+	typedef std::function<void(const EntryInfo &info)> EntryVisitor;
+
 	lv_fs_drv_t *registerInMemoryDriver();
+
+	/**
+	 * Adds a copy of the file data to the InMemoryFS.  The caller
+	 * retains ownership of the provided buffer.  No copy is made when a
+	 * file with identical content is already registered; the two paths
+	 * share one block of storage instead.
+	 */
 	void registerFile(const char *path, void *buffer, uint32_t size);
+
+	/**
+	 * Adds file data to the InMemoryFS without copying it.  Ownership of
+	 * the buffer passes to the file system, which will call the deleter
+	 * once the data is no longer needed.  That may happen before the call
+	 * returns when a file with identical content is already registered.
+	 */
+	void adoptFile(const char *path, void *buffer, uint32_t size, BufferDeleter deleter);
+
+	/**
+	 * Adds file data to the InMemoryFS without copying it.  The buffer
+	 * is borrowed and must remain valid for the life of the program, such
+	 * as constant data placed in flash.
+	 */
+	void registerStaticFile(const char *path, const void *buffer, uint32_t size);
+
+	/**
+	 * Adds a file backed by a read-only memory mapping, so large assets
+	 * are served without being read into RAM.  On the ESP32 the source is
+	 * the label of a data partition in flash, elsewhere the path of a host
+	 * file.  The mapping is released once the file is removed and its last
+	 * cursor closed.  Mapped data is never counted against a budget.
+	 *
+	 * @param offset the offset of the file within the source
+	 * @param size the size of the file, or 0 for the rest of the source
+	 * @return false if the path is already registered or the source
+	 *         could not be mapped
+	 */
+	bool registerMappedFile(const char *path, const char *source, uint32_t offset = 0, uint32_t size = 0);
+
+	/**
+	 * Mounts an asset pack held in a read-only memory mapping of the
+	 * source, which is named as for registerMappedFile.  The mapping
+	 * stays in place for the life of the program.
+	 *
+	 * @return false if the source could not be mapped or the pack is
+	 *         malformed
+	 */
+	bool mountMappedAssetPack(const char *source, uint32_t offset = 0, uint32_t size = 0);
+
+	/**
+	 * Mounts a read-only asset pack built by extra_scripts/pack_assets.py,
+	 * registering every file in it in one step.  The pack is borrowed, so
+	 * like static files it must remain valid for the life of the program.
+	 * Registered files take precedence over pack files with the same
+	 * path, and later packs over earlier ones.  Packs cannot be unmounted.
+	 *
+	 * @return false if the pack is malformed or too many are mounted
+	 */
+	bool mountAssetPack(const void *pack, uint32_t size);
+
+	/**
+	 * Adds an LZ4 compressed copy of the file data to the InMemoryFS.
+	 * Reads decompress on the fly, so this suits data that compresses
+	 * well and is read sequentially, such as raw bitmaps.  Data that does
+	 * not shrink is held uncompressed.
+	 */
+	void registerCompressedFile(const char *path, const void *buffer, uint32_t size);
+
+	/**
+	 * Publishes a copy of the provided buffer as a new version of the
+	 * file, registering it if the path is new.  Cursors already open on
+	 * the previous version keep reading it until they are closed.
+	 *
+	 * @return false if the data could not be stored
+	 */
+	bool replaceFile(const char *path, void *buffer, uint32_t size);
+
+	/**
+	 * Publishes a new version of the file, taking ownership of the buffer
+	 * rather than copying it.
+	 *
+	 * @return false if the data could not be stored
+	 */
+	bool replaceFile(const char *path, void *buffer, uint32_t size, BufferDeleter deleter);
+
+	/**
+	 * Publishes an LZ4 compressed copy of the provided buffer as a new
+	 * version of the file.
+	 *
+	 * @return false if the data could not be stored
+	 */
+	bool replaceCompressedFile(const char *path, const void *buffer, uint32_t size);
+
+	/**
+	 * Preallocates room for a file opened for writing, for example from
+	 * an HTTP Content-Length, so appending to it never has to grow the
+	 * storage.
+	 *
+	 * @return false if the file is not open for writing on this drive or
+	 *         the memory could not be allocated
+	 */
+	bool reserveFile(lv_fs_file_t *file, uint32_t size);
+
+	/**
+	 * Abandons a file opened for writing, such as after a failed
+	 * download.  The file must still be closed, which then releases the
+	 * data instead of publishing it.
+	 */
+	void discardFile(lv_fs_file_t *file);
+
+	/**
+	 * Removes a file from the InMemoryFS.  Its data is released once the
+	 * last open cursor on it is closed.
+	 *
+	 * @return false if the file is not registered
+	 */
+	bool unregisterFile(const char *path);
+
+	/**
+	 * Returns an image descriptor pointing straight at a file's stored
+	 * bytes, so the LVGL image decoders read it in place rather than
+	 * copying it through the driver.  The header is left zeroed for the
+	 * PNG and JPEG decoders to fill in from the data.  The path may
+	 * include the drive letter.
+	 *
+	 * The file's storage stays alive, even if the file is replaced or
+	 * removed, until the descriptor is released.
+	 *
+	 * @return nullptr if the path is not registered or the file is not
+	 *         held uncompressed in one block of memory
+	 */
+	const lv_img_dsc_t *asImageDescriptor(const char *path);
+
+	/**
+	 * Releases a descriptor returned by asImageDescriptor.  Must be called
+	 * on the LVGL thread once no image uses the descriptor.
+	 */
+	void releaseImageDescriptor(const lv_img_dsc_t *descriptor);
+
+	/**
+	 * Returns the currently published version of a file, or 0 if the
+	 * path is not registered.  Every registration or replacement
+	 * publishes a new, higher version.
+	 */
+	uint32_t getVersion(const char *path);
+
+	/**
+	 * Limits the bytes held in a memory region.  When a registration
+	 * pushes the region over budget, the least recently used files
+	 * without open cursors are evicted.  A budget of 0 is unlimited.
+	 */
+	void setMemoryBudget(MemoryRegion region, uint32_t bytes);
+
+	/**
+	 * Returns the bytes of file data currently held in a memory region.
+	 * Compressed files count their compressed size.
+	 */
+	uint32_t getResidentBytes(MemoryRegion region);
+
+	/**
+	 * Returns a snapshot of the file system counters.  Cheap enough to
+	 * poll, and the counters themselves cost a relaxed atomic increment.
+	 */
+	Stats getStats();
+
+	/**
+	 * Visits every registered file.  Registration blocks until the visit
+	 * completes, so the visitor must not register or remove files.
+	 */
+	void forEachEntry(EntryVisitor visitor);
 }
@@ -0,0 +1,92 @@
+#include "AssetPack.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t MAGIC[4] = { 'I', 'M', 'F', 'P' };
+static const uint32_t HEADER_SIZE = 12;
+
+AssetPack::AssetPack(const uint8_t *data, uint32_t count, uint32_t version) :
+	version(version), data(data), index((const IndexEntry *) (data + HEADER_SIZE)), count(count),
+	totalSize(0), buffers(nullptr) {
+}
+
+AssetPack *AssetPack::mount(const void *data, uint32_t size, uint32_t version) {
+	const uint8_t *bytes = (const uint8_t *) data;
+	if ((((uintptr_t) bytes) & 3) || (size < HEADER_SIZE) || (memcmp(bytes, MAGIC, sizeof(MAGIC)) != 0)) {
+		return nullptr;
+	}
+
+	// Both targets are little endian, so the words are read in place
+	const uint32_t *header = (const uint32_t *) bytes;
+	uint32_t count = header[2];
+	if ((header[1] != FORMAT_VERSION) || (count > (size - HEADER_SIZE) / sizeof(IndexEntry))) {
+		return nullptr;
+	}
+
+	// Check every entry up front so lookups can trust the index
+	AssetPack pack(bytes, count, version);
+	for (uint32_t i = 0; i < count; i++) {
+		const IndexEntry &entry = pack.index[i];
+		if ((entry.pathOffset >= size) || (memchr(bytes + entry.pathOffset, '\0', size - entry.pathOffset) == nullptr)) {
+			return nullptr;
+		}
+
+		if ((entry.dataOffset > size) || (entry.size > size - entry.dataOffset)) {
+			return nullptr;
+		}
+
+		if ((i > 0) && (strcmp(pack.pathOf(i - 1), pack.pathOf(i)) >= 0)) {
+			return nullptr;
+		}
+	}
+
+	Buffer *buffers = nullptr;
+	if (count > 0) {
+		buffers = (Buffer *) malloc(count * sizeof(Buffer));
+		if (buffers == nullptr) {
+			return nullptr;
+		}
+	}
+
+	AssetPack *mounted = new AssetPack(bytes, count, version);
+	mounted->buffers = buffers;
+
+	for (uint32_t i = 0; i < count; i++) {
+		const IndexEntry &entry = mounted->index[i];
+
+		// The pack names each buffer once and holds its reference forever
+		Buffer *buffer = new (&buffers[i]) Buffer(bytes + entry.dataOffset, entry.size, InMemoryFS::MEMORY_STATIC, nullptr);
+		buffer->nameCount = 1;
+
+		mounted->totalSize += entry.size;
+	}
+
+	return mounted;
+}
+
+Buffer *AssetPack::find(const char *path) const {
+	uint32_t low = 0;
+	uint32_t high = count;
+
+	while (low < high) {
+		uint32_t middle = low + ((high - low) / 2);
+		int comparison = strcmp(path, pathOf(middle));
+		if (comparison == 0) {
+			return &buffers[middle];
+		} else if (comparison < 0) {
+			high = middle;
+		} else {
+			low = middle + 1;
+		}
+	}
+
+	return nullptr;
+}
+
+void AssetPack::forEach(std::function<void(const char *path, Buffer *buffer)> visitor) const {
+	for (uint32_t i = 0; i < count; i++) {
+		visitor(pathOf(i), &buffers[i]);
+	}
+}
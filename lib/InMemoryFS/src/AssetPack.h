@@ -0,0 +1,91 @@
+#pragma once
+
+#include "Buffer.h"
+
+#include <functional>
+#include <stdint.h>
+
+/**
+ * A read-only blob holding many files, mounted without copying.
+ *
+ * All integers are 32-bit little endian and offsets are from the start
+ * of the pack, which must be 4-byte aligned:
+ *
+ *   header  magic "IMFP", format version, file count
+ *   index   one entry per file of path offset, data offset and size,
+ *           sorted by path so lookups are a binary search
+ *   paths   NUL terminated path strings
+ *   data    the file contents
+ *
+ * extra_scripts/pack_assets.py builds packs from a directory tree.
+ * Every file is served from a buffer borrowing the pack's data, and the
+ * buffers live in one allocation made when the pack is mounted.
+ */
+class AssetPack {
+public:
+	static const uint32_t FORMAT_VERSION = 1;
+
+	/**
+	 * Validate a pack and prepare it for lookups.
+	 *
+	 * @param data the pack, which must remain valid for the life of the program
+	 * @param size the size of the pack
+	 * @param version the version reported for every file in the pack
+	 * @return the mounted pack, or nullptr if the pack is malformed or the
+	 *         memory could not be allocated
+	 */
+	static AssetPack *mount(const void *data, uint32_t size, uint32_t version);
+
+	// Disable copy semantics
+	AssetPack(const AssetPack&) = delete;
+
+	/**
+	 * Find the buffer serving a path.
+	 *
+	 * @param path the path to look up
+	 * @return the buffer or nullptr if the pack does not hold the path
+	 */
+	Buffer *find(const char *path) const;
+
+	/**
+	 * Visit every file in the pack in path order.
+	 *
+	 * @param visitor the function to call for each file
+	 */
+	void forEach(std::function<void(const char *path, Buffer *buffer)> visitor) const;
+
+	/**
+	 * Return the number of files in the pack.
+	 */
+	uint32_t size() const {
+		return count;
+	}
+
+	/**
+	 * Return the total size of the files in the pack.
+	 */
+	uint32_t dataSize() const {
+		return totalSize;
+	}
+
+	const uint32_t version;
+
+private:
+	struct IndexEntry {
+		uint32_t pathOffset;
+		uint32_t dataOffset;
+		uint32_t size;
+	};
+
+	AssetPack(const uint8_t *data, uint32_t count, uint32_t version);
+
+	const uint8_t *data;
+	const IndexEntry *index;
+	uint32_t count;
+	uint32_t totalSize;
+	Buffer *buffers;
+
+	const char *pathOf(uint32_t entry) const {
+		return (const char *) (data + index[entry].pathOffset);
+	}
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <string.h>
+#include <InMemoryFS.h>
+
+class Buffer;
+
+/**
+ * Scratch space a cursor lends to buffers that cannot be read in place,
+ * holding the most recently decoded block.  The space is allocated on
+ * first use and stays with the cursor's pool slot.
+ */
+struct ReadWindow {
+	uint8_t *data;
+	const Buffer *buffer;
+	uint32_t block;
+};
+
+/**
+ * The data backing a single version of a file in the InMemoryFS.
+ *
+ * Buffers are reference counted.  Each path in the table holds one
+ * reference, so files with identical content share a buffer, and each
+ * open cursor holds another.  A replaced or evicted version lives until
+ * its last cursor closes.
+ * The data and size never change once a buffer is published, so any
+ * thread may read them while it holds a reference.
+ */
+class Buffer {
+public:
+	Buffer(const uint8_t *data, uint32_t size, InMemoryFS::MemoryRegion region, InMemoryFS::BufferDeleter deleter) :
+		data(data), size(size), storedSize(size), region(region), contentHash(0), shareable(false), nameCount(0),
+		lastAccess(0), refCount(1), deleter(deleter) {}
+
+	virtual ~Buffer() {
+		if (deleter) {
+			deleter((void *) data);
+		}
+	}
+
+	// Disable copy semantics
+	Buffer(const Buffer& b) = delete;
+
+	const uint8_t *data;
+	uint32_t size;
+
+	// Bytes of memory holding the data, which is less than the size when
+	// the data is compressed
+	uint32_t storedSize;
+	InMemoryFS::MemoryRegion region;
+
+	// Content hash, valid when the buffer may be shared by other paths
+	uint32_t contentHash;
+	bool shareable;
+
+	// Number of paths in the writer's table naming this buffer.  Only
+	// touched by writers under the writer lock.
+	uint32_t nameCount;
+
+	// Access stamp used to find the least recently used buffer
+	std::atomic<uint32_t> lastAccess;
+	std::atomic<uint32_t> refCount;
+
+	/**
+	 * Determine whether any cursor still holds this buffer.  Must be
+	 * called under the writer lock.
+	 */
+	bool isOpen() const {
+		return refCount.load() > nameCount;
+	}
+
+	/**
+	 * Copy file data out of the buffer.  The range must lie within the
+	 * file.
+	 *
+	 * @param offset the file offset to read from
+	 * @param dest receives the data
+	 * @param length the number of bytes to read
+	 * @param window scratch space belonging to the reading cursor
+	 * @return LV_FS_RES_OK or an error if the data could not be decoded
+	 */
+	virtual lv_fs_res_t read(uint32_t offset, uint8_t *dest, uint32_t length, ReadWindow *window) const {
+		memcpy(dest, data + offset, length);
+		return LV_FS_RES_OK;
+	}
+
+	/**
+	 * Return the file data if it is held uncompressed in one block of
+	 * memory, so it can be read in place.
+	 *
+	 * @return the file data or nullptr
+	 */
+	virtual const uint8_t *contiguousData() const {
+		return data;
+	}
+
+	/**
+	 * Determine whether the buffer holds exactly the provided data.
+	 *
+	 * @param other the data to compare against
+	 * @param otherSize the size of the data
+	 * @return true if the contents are identical
+	 */
+	virtual bool equals(const void *other, uint32_t otherSize) const {
+		return (size == otherSize) && ((size == 0) || (memcmp(data, other, size) == 0));
+	}
+
+private:
+	InMemoryFS::BufferDeleter deleter;
+};
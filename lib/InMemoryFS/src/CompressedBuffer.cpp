@@ -0,0 +1,184 @@
+#include "CompressedBuffer.h"
+#include "Memory.h"
+
+#include <Lz4.h>
+#include <stdlib.h>
+
+static const uint32_t BLOCK_SIZE = INMEMORYFS_COMPRESSED_BLOCK_SIZE;
+
+static_assert(BLOCK_SIZE <= Lz4::MAX_INPUT_SIZE, "Compressed blocks must fit in an LZ4 block");
+
+CompressedBuffer::CompressedBuffer(uint8_t *storage, uint32_t size, uint32_t storedSize, InMemoryFS::MemoryRegion region) :
+	Buffer(storage, size, region, free) {
+
+	this->storedSize = storedSize;
+	blockCount = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	blockEnds = (const uint32_t *) storage;
+	blocks = storage + (blockCount * sizeof(uint32_t));
+}
+
+CompressedBuffer *CompressedBuffer::create(const void *data, uint32_t size) {
+	const uint8_t *source = (const uint8_t *) data;
+	uint32_t blockCount = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	uint8_t *scratch = (uint8_t *) malloc(Lz4::compressBound(BLOCK_SIZE));
+	if (scratch == nullptr) {
+		return nullptr;
+	}
+
+	// Size the storage first so it is allocated exactly once, rather than
+	// holding a worst case copy alongside it
+	uint32_t storedSize = blockCount * sizeof(uint32_t);
+	for (uint32_t block = 0; block < blockCount; block++) {
+		uint32_t length = ((block + 1) * BLOCK_SIZE <= size) ? BLOCK_SIZE : size - (block * BLOCK_SIZE);
+		uint32_t compressed = Lz4::compress(source + (block * BLOCK_SIZE), length, scratch, length - 1);
+		storedSize += (compressed > 0) ? compressed : length;
+	}
+
+	if (storedSize >= size) {
+		free(scratch);
+		return nullptr;
+	}
+
+	InMemoryFS::MemoryRegion region;
+	uint8_t *storage = (uint8_t *) Memory::allocate(storedSize, &region);
+	if (storage == nullptr) {
+		free(scratch);
+		return nullptr;
+	}
+
+	uint32_t *blockEnds = (uint32_t *) storage;
+	uint8_t *out = storage + (blockCount * sizeof(uint32_t));
+	uint32_t end = 0;
+	for (uint32_t block = 0; block < blockCount; block++) {
+		const uint8_t *in = source + (block * BLOCK_SIZE);
+		uint32_t length = ((block + 1) * BLOCK_SIZE <= size) ? BLOCK_SIZE : size - (block * BLOCK_SIZE);
+
+		// A block stored at its full length is uncompressed
+		uint32_t compressed = Lz4::compress(in, length, out + end, length - 1);
+		if (compressed == 0) {
+			memcpy(out + end, in, length);
+			compressed = length;
+		}
+
+		end += compressed;
+		blockEnds[block] = end;
+	}
+
+	free(scratch);
+	return new CompressedBuffer(storage, size, storedSize, region);
+}
+
+bool CompressedBuffer::allocateWindow(ReadWindow *window) {
+	if (window->data == nullptr) {
+		InMemoryFS::MemoryRegion region;
+		window->data = (uint8_t *) Memory::allocate(BLOCK_SIZE, &region);
+	}
+
+	return window->data != nullptr;
+}
+
+/**
+ * Return the stored bytes of a block.
+ *
+ * @param block the block index
+ * @param compressedSize receives the stored size of the block
+ * @return the block data
+ */
+const uint8_t *CompressedBuffer::blockData(uint32_t block, uint32_t *compressedSize) const {
+	uint32_t start = (block == 0) ? 0 : blockEnds[block - 1];
+	*compressedSize = blockEnds[block] - start;
+	return blocks + start;
+}
+
+/**
+ * Return the uncompressed size of a block.
+ */
+uint32_t CompressedBuffer::blockSize(uint32_t block) const {
+	return (block + 1 < blockCount) ? BLOCK_SIZE : size - (block * BLOCK_SIZE);
+}
+
+/**
+ * Decode a whole block.
+ *
+ * @param block the block index
+ * @param dest receives blockSize(block) bytes
+ * @return false if the block is corrupt
+ */
+bool CompressedBuffer::decodeBlock(uint32_t block, uint8_t *dest) const {
+	uint32_t compressedSize;
+	const uint8_t *compressed = blockData(block, &compressedSize);
+	uint32_t length = blockSize(block);
+
+	if (compressedSize == length) {
+		memcpy(dest, compressed, length);
+		return true;
+	}
+
+	return Lz4::decompress(compressed, compressedSize, dest, length) == (int32_t) length;
+}
+
+lv_fs_res_t CompressedBuffer::read(uint32_t offset, uint8_t *dest, uint32_t length, ReadWindow *window) const {
+	while (length > 0) {
+		uint32_t block = offset / BLOCK_SIZE;
+		uint32_t blockOffset = offset % BLOCK_SIZE;
+		uint32_t available = blockSize(block) - blockOffset;
+		uint32_t count = (length < available) ? length : available;
+
+		uint32_t compressedSize;
+		const uint8_t *stored = blockData(block, &compressedSize);
+		bool windowHit = (window->buffer == this) && (window->block == block);
+
+		if (compressedSize == blockSize(block)) {
+			// Stored uncompressed, so read it in place
+			memcpy(dest, stored + blockOffset, count);
+		} else if ((blockOffset == 0) && (count == BLOCK_SIZE) && !windowHit) {
+			// The caller wants the whole block, so skip the window
+			if (!decodeBlock(block, dest)) {
+				return LV_FS_RES_INV_PARAM;
+			}
+		} else {
+			if (!windowHit) {
+				if (!allocateWindow(window)) {
+					return LV_FS_RES_OUT_OF_MEM;
+				}
+
+				window->buffer = nullptr;
+				if (!decodeBlock(block, window->data)) {
+					return LV_FS_RES_INV_PARAM;
+				}
+
+				window->buffer = this;
+				window->block = block;
+			}
+
+			memcpy(dest, window->data + blockOffset, count);
+		}
+
+		offset += count;
+		dest += count;
+		length -= count;
+	}
+
+	return LV_FS_RES_OK;
+}
+
+bool CompressedBuffer::equals(const void *other, uint32_t otherSize) const {
+	if (size != otherSize) {
+		return false;
+	}
+
+	uint8_t *scratch = (uint8_t *) malloc(BLOCK_SIZE);
+	if (scratch == nullptr) {
+		return false;
+	}
+
+	const uint8_t *expected = (const uint8_t *) other;
+	bool same = true;
+	for (uint32_t block = 0; same && (block < blockCount); block++) {
+		same = decodeBlock(block, scratch) && (memcmp(scratch, expected + (block * BLOCK_SIZE), blockSize(block)) == 0);
+	}
+
+	free(scratch);
+	return same;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Buffer.h"
+
+/**
+ * A buffer holding file data compressed with LZ4.
+ *
+ * The data is split into blocks of INMEMORYFS_COMPRESSED_BLOCK_SIZE bytes
+ * that are compressed independently, so every block boundary is a seek
+ * checkpoint: a read decodes only the block holding the requested offset
+ * into the cursor's window.  Blocks that do not shrink are stored as is
+ * and read in place.
+ *
+ * The storage is a single allocation holding the end offset of each
+ * block followed by the block data.
+ */
+class CompressedBuffer : public Buffer {
+public:
+	/**
+	 * Compress file data into a new buffer.
+	 *
+	 * @param data the file data
+	 * @param size the size of the file data
+	 * @return the buffer, or nullptr if the data does not compress or the
+	 *         memory could not be allocated
+	 */
+	static CompressedBuffer *create(const void *data, uint32_t size);
+
+	virtual lv_fs_res_t read(uint32_t offset, uint8_t *dest, uint32_t length, ReadWindow *window) const override;
+	virtual bool equals(const void *other, uint32_t otherSize) const override;
+
+	virtual const uint8_t *contiguousData() const override {
+		return nullptr;
+	}
+
+	/**
+	 * Allocate the window a cursor decodes compressed blocks into.
+	 *
+	 * @param window the cursor's window
+	 * @return false if the memory could not be allocated
+	 */
+	static bool allocateWindow(ReadWindow *window);
+
+private:
+	CompressedBuffer(uint8_t *storage, uint32_t size, uint32_t storedSize, InMemoryFS::MemoryRegion region);
+
+	uint32_t blockCount;
+	const uint32_t *blockEnds;
+	const uint8_t *blocks;
+
+	const uint8_t *blockData(uint32_t block, uint32_t *compressedSize) const;
+	uint32_t blockSize(uint32_t block) const;
+	bool decodeBlock(uint32_t block, uint8_t *dest) const;
+};
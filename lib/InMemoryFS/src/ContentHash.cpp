@@ -0,0 +1,72 @@
+#include "ContentHash.h"
+
+static const uint32_t PRIME1 = 2654435761u;
+static const uint32_t PRIME2 = 2246822519u;
+static const uint32_t PRIME3 = 3266489917u;
+static const uint32_t PRIME4 = 668265263u;
+static const uint32_t PRIME5 = 374761393u;
+
+static inline uint32_t rotateLeft(uint32_t value, int bits) {
+	return (value << bits) | (value >> (32 - bits));
+}
+
+/**
+ * Read a little endian word without assuming alignment.
+ */
+static inline uint32_t readWord(const uint8_t *p) {
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint32_t mixLane(uint32_t accumulator, uint32_t input) {
+	accumulator += input * PRIME2;
+	return rotateLeft(accumulator, 13) * PRIME1;
+}
+
+uint32_t ContentHash::xxh32(const void *data, uint32_t size, uint32_t seed) {
+	const uint8_t *p = (const uint8_t *) data;
+	const uint8_t *end = p + size;
+	uint32_t hash;
+
+	if (size >= 16) {
+		// Four independent lanes keep the multiplier pipeline busy
+		uint32_t v1 = seed + PRIME1 + PRIME2;
+		uint32_t v2 = seed + PRIME2;
+		uint32_t v3 = seed;
+		uint32_t v4 = seed - PRIME1;
+
+		const uint8_t *limit = end - 16;
+		do {
+			v1 = mixLane(v1, readWord(p));
+			v2 = mixLane(v2, readWord(p + 4));
+			v3 = mixLane(v3, readWord(p + 8));
+			v4 = mixLane(v4, readWord(p + 12));
+			p += 16;
+		} while (p <= limit);
+
+		hash = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+	} else {
+		hash = seed + PRIME5;
+	}
+
+	hash += size;
+
+	while (p + 4 <= end) {
+		hash += readWord(p) * PRIME3;
+		hash = rotateLeft(hash, 17) * PRIME4;
+		p += 4;
+	}
+
+	while (p < end) {
+		hash += (*p++) * PRIME5;
+		hash = rotateLeft(hash, 11) * PRIME1;
+	}
+
+	// Final avalanche
+	hash ^= hash >> 15;
+	hash *= PRIME2;
+	hash ^= hash >> 13;
+	hash *= PRIME3;
+	hash ^= hash >> 16;
+
+	return hash;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * A fast, non-cryptographic hash of file contents used to find files
+ * with identical data.  Matches are always confirmed by comparing the
+ * data, so the hash only needs to spread well, not resist attack.
+ */
+namespace ContentHash {
+	/**
+	 * Calculate the 32-bit xxHash (XXH32) of a block of data.
+	 *
+	 * @param data the data to hash
+	 * @param size the number of bytes to hash
+	 * @param seed the hash seed
+	 * @return the hash value
+	 */
+	uint32_t xxh32(const void *data, uint32_t size, uint32_t seed = 0);
+}
@@ -1,30 +1,225 @@
 #include "InMemoryFS.h"
+#include "AssetPack.h"
+#include "Buffer.h"
+#include "CompressedBuffer.h"
+#include "ContentHash.h"
+#include "Memory.h"
+#include "PathTable.h"
+#include "Rcu.h"
+#include "SegmentedBuffer.h"
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
 
-class Buffer {
-public:
-	Buffer() : data(nullptr), size(0) {}
-	Buffer(const Buffer& b) : data(b.data), size(b.size) {}
+static_assert(INMEMORYFS_MAX_OPEN_FILES < 256, "Cursor pool indexes must fit in a byte");
 
+/**
+ * The staging area of a cursor open for writing.  The data is published
+ * under the path when the cursor is closed.
+ */
+struct PendingWrite {
+	char *path;
 	uint8_t *data;
 	uint32_t size;
+	uint32_t capacity;
+	InMemoryFS::MemoryRegion region;
+
+	// Takes over from the contiguous data once it can no longer grow
+	SegmentedBuffer *segments;
+
+	// Set once the write is abandoned, either by the caller or because
+	// the staging area could not grow
+	bool discarded;
 };
 
 class BufferCursor {
 public:
-	BufferCursor(): bufferOffset(0), buffer(nullptr) {}
-	BufferCursor(const BufferCursor& b) : bufferOffset(b.bufferOffset), buffer(b.buffer) {}
+	BufferCursor(): bufferOffset(0), buffer(nullptr), window({ nullptr, nullptr, 0 }),
+		pending({ nullptr, nullptr, 0, 0, InMemoryFS::MEMORY_INTERNAL, nullptr, false }), nextFree(0) {}
 
 	uint32_t bufferOffset;
 	Buffer *buffer;
+	ReadWindow window;
+	PendingWrite pending;
+
+	// Pool index + 1 of the next unused cursor while this one is in the pool
+	std::atomic<uint8_t> nextFree;
+};
+
+/**
+ * The names in a directory, captured when it is opened.
+ */
+struct DirectoryListing {
+	std::vector<std::string> names;
+	uint32_t next;
+};
+
+/**
+ * An image descriptor lent out by asImageDescriptor, holding a reference
+ * to the buffer it points into.  The descriptor comes first so the
+ * caller's pointer can be cast back.
+ */
+struct ImageView {
+	lv_img_dsc_t descriptor;
+	Buffer *buffer;
 };
 
 static bool initialized = false;
 static lv_fs_drv_t drv;
 
-static std::unordered_map<std::string, Buffer*> buffersByName;
+// Fixed pool of cursors, threaded into a lock-free free list.  The low
+// byte of the head is the pool index + 1 of the first free cursor and the
+// remaining bits count changes so a stale head cannot be swapped in.
+static BufferCursor cursorPool[INMEMORYFS_MAX_OPEN_FILES];
+static std::atomic<uint32_t> freeCursors(0);
+
+// The published file table.  Readers look paths up inside an
+// Rcu::ReadSection without locking.  Writers serialize on the mutex and
+// publish modified copies of the table.
+static std::atomic<PathTable *> publishedTable(nullptr);
+static std::mutex writerMutex;
+
+// Mounted asset packs.  Packs are never unmounted, so readers only need
+// the count to be published after the slot.
+static AssetPack *mountedPacks[INMEMORYFS_MAX_ASSET_PACKS];
+static std::atomic<uint32_t> mountedPackCount(0);
+
+// Shareable buffers named in the writer's table, keyed by content hash.
+// Only touched under the writer lock.
+static std::unordered_multimap<uint32_t, Buffer *> contentIndex;
+
+// Usage counters.  The hot path ones are relaxed increments so they can
+// stay enabled in production.
+static std::atomic<uint32_t> cursorPoolExhaustions(0);
+static std::atomic<uint32_t> opens(0);
+static std::atomic<uint32_t> misses(0);
+static std::atomic<uint32_t> bytesRead(0);
+static std::atomic<uint32_t> openCursors(0);
+static std::atomic<uint32_t> peakOpenCursors(0);
+static std::atomic<uint32_t> registrations(0);
+static std::atomic<uint32_t> dedupHits(0);
+static std::atomic<uint32_t> dedupBytesSaved(0);
+
+// Memory accounting and least recently used tracking
+static std::atomic<uint32_t> accessClock(0);
+static std::atomic<uint32_t> residentBytes[InMemoryFS::MEMORY_STATIC + 1];
+static uint32_t memoryBudgets[InMemoryFS::MEMORY_STATIC] = { 0, 0 };
+static uint32_t versionClock = 0;
+
+static lv_fs_res_t commitWrite(BufferCursor *cursor);
+
+/**
+ * Drops a reference to a buffer, releasing its data once the last
+ * reference is gone.
+ *
+ * @param buffer The buffer to release.
+ */
+static void releaseBuffer(Buffer *buffer) {
+	if (buffer->refCount.fetch_sub(1) == 1) {
+		residentBytes[buffer->region].fetch_sub(buffer->storedSize);
+		delete buffer;
+	}
+}
+
+/**
+ * Takes a cursor from the pool.
+ *
+ * @return the cursor or nullptr if every cursor is in use
+ */
+static BufferCursor *acquireCursor() {
+	uint32_t head = freeCursors.load();
+
+	while (true) {
+		uint32_t index = head & 0xff;
+		if (index == 0) {
+			cursorPoolExhaustions.fetch_add(1);
+			return nullptr;
+		}
+
+		BufferCursor *cursor = &cursorPool[index - 1];
+		uint32_t next = ((head + 0x100) & ~0xffu) | cursor->nextFree.load();
+		if (freeCursors.compare_exchange_weak(head, next)) {
+			uint32_t open = openCursors.fetch_add(1, std::memory_order_relaxed) + 1;
+			uint32_t peak = peakOpenCursors.load(std::memory_order_relaxed);
+			while ((open > peak) && !peakOpenCursors.compare_exchange_weak(peak, open, std::memory_order_relaxed)) {
+			}
+
+			return cursor;
+		}
+	}
+}
+
+/**
+ * Returns a cursor to the pool.
+ *
+ * @param cursor The cursor to return.
+ */
+static void releaseCursor(BufferCursor *cursor) {
+	uint32_t index = (cursor - cursorPool) + 1;
+	uint32_t head = freeCursors.load();
+
+	cursor->buffer = nullptr;
+	cursor->window.buffer = nullptr;
+	openCursors.fetch_sub(1, std::memory_order_relaxed);
+	do {
+		cursor->nextFree.store(head & 0xff);
+	} while (!freeCursors.compare_exchange_weak(head, ((head + 0x100) & ~0xffu) | index));
+}
+
+/**
+ * Finds the buffer published for a path, falling back to the mounted
+ * asset packs.  Must be called inside an Rcu::ReadSection.
+ *
+ * @param path The path of the file.
+ * @param version Receives the published version of the file.
+ * @return the buffer or nullptr if the path is not registered
+ */
+static Buffer *findBuffer(const char *path, uint32_t *version) {
+	PathTable *table = publishedTable.load();
+	const PathTable::Entry *entry = (table != nullptr) ? table->find(path) : nullptr;
+	if (entry != nullptr) {
+		*version = entry->version;
+		return entry->buffer;
+	}
+
+	for (uint32_t i = mountedPackCount.load(); i > 0; i--) {
+		AssetPack *pack = mountedPacks[i - 1];
+		Buffer *buffer = pack->find(path);
+		if (buffer != nullptr) {
+			*version = pack->version;
+			return buffer;
+		}
+	}
+
+	return nullptr;
+}
+
+/**
+ * Looks up the buffer published for a path and takes a reference to it.
+ * Never blocks, so it is safe on the LVGL thread while other threads
+ * are registering files.
+ *
+ * @param path The path of the file.
+ * @return the buffer, which the caller must release, or nullptr
+ */
+static Buffer *acquireBuffer(const char *path) {
+	Rcu::ReadSection section;
+
+	uint32_t version;
+	Buffer *buffer = findBuffer(path, &version);
+	if (buffer != nullptr) {
+		buffer->refCount.fetch_add(1);
+		buffer->lastAccess.store(accessClock.fetch_add(1) + 1);
+	}
+
+	return buffer;
+}
 
 /**
  * Close an opened file
@@ -36,8 +231,16 @@ static std::unordered_map<std::string, Buffer*> buffersByName;
  */
 lv_fs_res_t mem_fs_close(struct _lv_fs_drv_t *drv, void *file_p) {
 	BufferCursor *cursor = (BufferCursor *) file_p;
-	delete cursor;
-	return LV_FS_RES_OK;
+	lv_fs_res_t result = LV_FS_RES_OK;
+
+	if (cursor->buffer != nullptr) {
+		releaseBuffer(cursor->buffer);
+	} else {
+		result = commitWrite(cursor);
+	}
+
+	releaseCursor(cursor);
+	return result;
 }
 
 /**
@@ -47,22 +250,153 @@ lv_fs_res_t mem_fs_close(struct _lv_fs_drv_t *drv, void *file_p) {
  * @param path      path to the file beginning with the driver letter (e.g. S:/folder/file.txt)
  * @param mode      read: FS_MODE_RD, write: FS_MODE_WR, both: FS_MODE_RD | FS_MODE_WR
  *
- * @return          a file descriptor or NULL on error
+ * @return          a file descriptor or NULL on error (including an unregistered path)
  */
 void *mem_fs_open(struct _lv_fs_drv_t *drv, const char *path, lv_fs_mode_t mode) {
 	BufferCursor *cursor = nullptr;
 
 	if (mode == LV_FS_MODE_RD) {
-		std::string key = path;
-		Buffer *buffer = buffersByName[key];
+		cursor = acquireCursor();
+		if (cursor == nullptr) {
+			return nullptr;
+		}
+
+		Buffer *buffer = acquireBuffer(path);
+		if (buffer == nullptr) {
+			misses.fetch_add(1, std::memory_order_relaxed);
+			releaseCursor(cursor);
+			return nullptr;
+		}
+
+		opens.fetch_add(1, std::memory_order_relaxed);
 
-		cursor = new BufferCursor();
+		cursor->bufferOffset = 0;
 		cursor->buffer = buffer;
+	} else if (mode == LV_FS_MODE_WR) {
+		// The file is staged privately and published when closed
+		char *pendingPath = strdup(path);
+		if (pendingPath == nullptr) {
+			return nullptr;
+		}
+
+		cursor = acquireCursor();
+		if (cursor == nullptr) {
+			free(pendingPath);
+			return nullptr;
+		}
+
+		cursor->bufferOffset = 0;
+		cursor->pending = { pendingPath, nullptr, 0, 0, InMemoryFS::MEMORY_INTERNAL, nullptr, false };
 	}
 
 	return cursor;
 }
 
+/**
+ * Grows the staging area of a write so it can hold at least the
+ * requested number of bytes.
+ *
+ * @param pending The pending write.
+ * @param size The number of bytes required.
+ * @return false if the memory could not be allocated
+ */
+static bool reservePending(PendingWrite *pending, uint32_t size) {
+	if (pending->segments != nullptr) {
+		return pending->segments->reserve(size);
+	}
+
+	if (size <= pending->capacity) {
+		return true;
+	}
+
+	// Grow geometrically so appending small chunks stays linear
+	uint32_t capacity = pending->capacity + (pending->capacity / 2);
+	if (capacity < size) {
+		capacity = size;
+	}
+
+	uint8_t *data = (uint8_t *) Memory::resize(pending->data, capacity, &pending->region);
+	if (data != nullptr) {
+		pending->data = data;
+		pending->capacity = capacity;
+		return true;
+	}
+
+	// No contiguous block is large enough, so move to segments
+	SegmentedBuffer *segments = SegmentedBuffer::create(size);
+	if (segments == nullptr) {
+		return false;
+	}
+
+	segments->write(0, pending->data, pending->size);
+	free(pending->data);
+
+	pending->segments = segments;
+	pending->data = nullptr;
+	pending->capacity = 0;
+	return true;
+}
+
+/**
+ * Write into a file
+ *
+ * @param drv       pointer to a driver where this function belongs
+ * @param file_p    pointer to a file_t variable
+ * @param buf       pointer to a buffer with the bytes to write
+ * @param btw       Bytes To Write
+ * @param bw        the number of real written bytes (Bytes Written). NULL if unused.
+ *
+ * @return          LV_FS_RES_OK: no error or  any error from @lv_fs_res_t enum
+ */
+static lv_fs_res_t mem_fs_write(lv_fs_drv_t *drv, void *file_p, const void *buf, uint32_t btw, uint32_t *bw) {
+	if (bw != nullptr) {
+		*bw = 0;
+	}
+
+	BufferCursor *cursor = (BufferCursor *) file_p;
+	PendingWrite *pending = &cursor->pending;
+	if (cursor->buffer != nullptr) {
+		return LV_FS_RES_DENIED;
+	}
+
+	if (pending->discarded) {
+		return LV_FS_RES_UNKNOWN;
+	}
+
+	// A file cannot reach past 4GB, wherever the cursor was seeked to
+	if (btw > UINT32_MAX - cursor->bufferOffset) {
+		return LV_FS_RES_INV_PARAM;
+	}
+
+	uint32_t end = cursor->bufferOffset + btw;
+	if (!reservePending(pending, end)) {
+		pending->discarded = true;
+		return LV_FS_RES_OUT_OF_MEM;
+	}
+
+	if (pending->segments != nullptr) {
+		pending->segments->write(cursor->bufferOffset, buf, btw);
+	} else {
+		// Seeking past the end leaves a gap, which reads back as zeros
+		if (cursor->bufferOffset > pending->size) {
+			memset(pending->data + pending->size, 0, cursor->bufferOffset - pending->size);
+		}
+
+		memcpy(pending->data + cursor->bufferOffset, buf, btw);
+	}
+
+	cursor->bufferOffset = end;
+	if (end > pending->size) {
+		pending->size = end;
+	}
+
+	if (bw != nullptr) {
+		*bw = btw;
+	}
+
+	return LV_FS_RES_OK;
+}
+
 /**
  * Read data from an opened file
  *
@@ -78,15 +412,23 @@ lv_fs_res_t mem_fs_read(struct _lv_fs_drv_t *drv, void *file_p, void *buf, uint3
 	*br = 0;
 
 	BufferCursor *cursor = (BufferCursor *) file_p;
+	if (cursor->buffer == nullptr) {
+		return LV_FS_RES_DENIED;
+	}
+
 	if (cursor->bufferOffset < cursor->buffer->size) {
 		uint32_t bytesAvailable = cursor->buffer->size - cursor->bufferOffset;
-		if (bytesAvailable > 0) {
-			*br = (btr < bytesAvailable) ? btr : bytesAvailable;
+		uint32_t count = (btr < bytesAvailable) ? btr : bytesAvailable;
 
-			if (*br > 0) {
-				memcpy(buf, cursor->buffer->data + cursor->bufferOffset, *br);
-				cursor->bufferOffset += *br;
+		if (count > 0) {
+			lv_fs_res_t result = cursor->buffer->read(cursor->bufferOffset, (uint8_t *) buf, count, &cursor->window);
+			if (result != LV_FS_RES_OK) {
+				return result;
 			}
+
+			*br = count;
+			cursor->bufferOffset += count;
+			bytesRead.fetch_add(count, std::memory_order_relaxed);
 		}
 	}
 
@@ -126,7 +468,7 @@ static lv_fs_res_t mem_fs_seek(lv_fs_drv_t *drv, void *file_p, uint32_t pos, lv_
 			cursor->bufferOffset = cursor->bufferOffset + pos;
 			break;
 		case LV_FS_SEEK_END:
-			cursor->bufferOffset = cursor->buffer->size + pos;
+			cursor->bufferOffset = ((cursor->buffer != nullptr) ? cursor->buffer->size : cursor->pending.size) + pos;
 			break;
 	}
 
@@ -150,21 +492,871 @@ static lv_fs_res_t mem_fs_tell(lv_fs_drv_t *drv, void *file_p, uint32_t *pos_p)
 }
 
 /**
- * Adds file data to the InMemoryFS.
+ * Open a directory
+ *
+ * @param drv       pointer to a driver where this function belongs
+ * @param path      path to the directory, without the driver letter
+ *
+ * @return          a directory descriptor or NULL if no file lies under the path
+ */
+static void *mem_fs_dir_open(lv_fs_drv_t *drv, const char *path) {
+	std::string prefix(path);
+	prefix.erase(0, prefix.find_first_not_of('/'));
+	prefix.erase(prefix.find_last_not_of('/') + 1);
+	if (!prefix.empty()) {
+		prefix += '/';
+	}
+
+	DirectoryListing *listing = new DirectoryListing();
+	listing->next = 0;
+
+	// Each file under the prefix names either itself or the
+	// subdirectory holding it
+	auto addName = [&](const char *filePath) {
+		if (strncmp(filePath, prefix.c_str(), prefix.size()) != 0) {
+			return;
+		}
+
+		const char *name = filePath + prefix.size();
+		const char *separator = strchr(name, '/');
+		if (separator == nullptr) {
+			listing->names.emplace_back(name);
+		} else {
+			listing->names.emplace_back("/" + std::string(name, separator - name));
+		}
+	};
+
+	{
+		Rcu::ReadSection section;
+
+		PathTable *table = publishedTable.load();
+		if (table != nullptr) {
+			table->forEach([&](const PathTable::Entry &entry) {
+				addName(entry.path);
+			});
+		}
+
+		for (uint32_t i = 0; i < mountedPackCount.load(); i++) {
+			mountedPacks[i]->forEach([&](const char *filePath, Buffer *buffer) {
+				addName(filePath);
+			});
+		}
+	}
+
+	if (!prefix.empty() && listing->names.empty()) {
+		delete listing;
+		return nullptr;
+	}
+
+	std::sort(listing->names.begin(), listing->names.end());
+	listing->names.erase(std::unique(listing->names.begin(), listing->names.end()), listing->names.end());
+
+	return listing;
+}
+
+/**
+ * Read the next filename from a directory.
+ * The name of directories will begin with '/'
+ *
+ * @param drv       pointer to a driver where this function belongs
+ * @param rddir_p   pointer to an initialized 'lv_fs_dir_t' variable
+ * @param fn        pointer to a buffer to store the filename, set to "" after the last entry
+ *
+ * @return          LV_FS_RES_OK or any error from lv_fs_res_t enum
+ */
+static lv_fs_res_t mem_fs_dir_read(lv_fs_drv_t *drv, void *rddir_p, char *fn) {
+	DirectoryListing *listing = (DirectoryListing *) rddir_p;
+
+	if (listing->next < listing->names.size()) {
+		const std::string &name = listing->names[listing->next++];
+		strncpy(fn, name.c_str(), LV_FS_MAX_FN_LENGTH - 1);
+		fn[LV_FS_MAX_FN_LENGTH - 1] = '\0';
+	} else {
+		fn[0] = '\0';
+	}
+
+	return LV_FS_RES_OK;
+}
+
+/**
+ * Close a directory
+ *
+ * @param drv       pointer to a driver where this function belongs
+ * @param rddir_p   pointer to an initialized 'lv_fs_dir_t' variable
+ *
+ * @return          LV_FS_RES_OK or any error from lv_fs_res_t enum
+ */
+static lv_fs_res_t mem_fs_dir_close(lv_fs_drv_t *drv, void *rddir_p) {
+	delete (DirectoryListing *) rddir_p;
+	return LV_FS_RES_OK;
+}
+
+/**
+ * A batch of changes to the file table.  Changes are made to a private
+ * copy under the writer lock and published in one atomic step.  Entries
+ * removed by the update are released once no reader can still see them.
+ */
+class TableUpdate {
+public:
+	TableUpdate() : lock(writerMutex), committed(false) {
+		PathTable *current = publishedTable.load();
+		table = (current != nullptr) ? current->copy() : new PathTable();
+	}
+
+	~TableUpdate() {
+		if (!committed) {
+			delete table;
+		}
+	}
+
+	// Disable copy semantics
+	TableUpdate(const TableUpdate&) = delete;
+
+	/**
+	 * Name a buffer with a path, handing one reference to the table.
+	 *
+	 * @param path The path of the file.
+	 * @param buffer The buffer holding the file data.
+	 * @return true if inserted, false if the path is already registered
+	 */
+	bool insert(const char *path, Buffer *buffer) {
+		if (!table->insert(path, ++versionClock, buffer)) {
+			return false;
+		}
+
+		if ((buffer->nameCount++ == 0) && buffer->shareable) {
+			contentIndex.emplace(buffer->contentHash, buffer);
+		}
+
+		return true;
+	}
+
+	/**
+	 * Remove a path from the table, retiring its entry.
+	 *
+	 * @param path The path of the file.
+	 * @return true if the path was registered
+	 */
+	bool remove(const char *path) {
+		PathTable::Entry removed;
+		if (!table->remove(path, &removed)) {
+			return false;
+		}
+
+		Buffer *buffer = removed.buffer;
+		if ((--buffer->nameCount == 0) && buffer->shareable) {
+			auto range = contentIndex.equal_range(buffer->contentHash);
+			for (auto it = range.first; it != range.second; ++it) {
+				if (it->second == buffer) {
+					contentIndex.erase(it);
+					break;
+				}
+			}
+		}
+
+		retired.push_back(removed);
+		return true;
+	}
+
+	/**
+	 * Publish the updated table and release the retired entries.
+	 */
+	void commit() {
+		PathTable *previous = publishedTable.exchange(table);
+		committed = true;
+
+		Rcu::synchronize();
+		delete previous;
+
+		for (PathTable::Entry &entry : retired) {
+			free(entry.path);
+			releaseBuffer(entry.buffer);
+		}
+	}
+
+	PathTable *table;
+
+private:
+	std::lock_guard<std::mutex> lock;
+	std::vector<PathTable::Entry> retired;
+	bool committed;
+};
+
+/**
+ * Evicts least recently used files from a memory region until it is
+ * back within budget or nothing else can be evicted.  Every path naming
+ * an evicted buffer is removed, since that is the only way to free it.
+ *
+ * @param update The table update to evict within.
+ * @param region The memory region to trim.
+ * @param keep A buffer that must not be evicted.
+ */
+static void evict(TableUpdate &update, InMemoryFS::MemoryRegion region, Buffer *keep) {
+	uint32_t budget = memoryBudgets[region];
+	if ((budget == 0) || (residentBytes[region].load() <= budget)) {
+		return;
+	}
+
+	// Every evictable buffer with the paths naming it, oldest first.  The
+	// access stamp is taken once per buffer, so the order holds while
+	// readers touch files and a buffer is only ever counted once.
+	struct Candidate {
+		uint32_t lastAccess;
+		Buffer *buffer;
+		std::vector<const char *> paths;
+	};
+
+	std::vector<Candidate> candidates;
+	std::unordered_map<Buffer *, size_t> candidateOf;
+	update.table->forEach([&](const PathTable::Entry &entry) {
+		Buffer *buffer = entry.buffer;
+		if ((buffer == keep) || (buffer->region != region) || buffer->isOpen()) {
+			return;
+		}
+
+		auto found = candidateOf.emplace(buffer, candidates.size());
+		if (found.second) {
+			candidates.push_back({ buffer->lastAccess.load(), buffer, {} });
+		}
+
+		candidates[found.first->second].paths.push_back(entry.path);
+	});
+
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+		return a.lastAccess < b.lastAccess;
+	});
+
+	uint32_t evictedBytes = 0;
+	for (size_t i = 0; (i < candidates.size()) && (residentBytes[region].load() > budget + evictedBytes); i++) {
+		evictedBytes += candidates[i].buffer->storedSize;
+		for (const char *path : candidates[i].paths) {
+			update.remove(path);
+		}
+	}
+}
+
+/**
+ * How the file system holds the data passed to a registration.
+ */
+enum Storage {
+	// Copy the data into storage owned by the file system
+	STORAGE_COPY,
+	// Take over the caller's buffer and release it with the deleter
+	STORAGE_ADOPT,
+	// Borrow a buffer that outlives the file system
+	STORAGE_BORROW,
+	// Borrow a read-only mapping, released with the deleter
+	STORAGE_MAP,
+	// Compress the data into storage owned by the file system
+	STORAGE_COMPRESS
+};
+
+/**
+ * Finds a shareable buffer holding exactly the provided data.
+ *
+ * @param hash The content hash of the data.
+ * @param data A pointer to the file data.
+ * @param size The size of the file data.
+ * @return the buffer or nullptr if no buffer matches
+ */
+static Buffer *findDuplicate(uint32_t hash, const void *data, uint32_t size) {
+	auto range = contentIndex.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		Buffer *buffer = it->second;
+		if (buffer->equals(data, size)) {
+			return buffer;
+		}
+	}
+
+	return nullptr;
+}
+
+/**
+ * Creates a buffer holding the file data.
+ *
+ * @param data A pointer to the file data.
+ * @param size The size of the file data.
+ * @param storage How the data is held.
+ * @param deleter Called to release adopted data once it is no longer needed.
+ * @return the buffer or nullptr if the memory could not be allocated
+ */
+static Buffer *createBuffer(const void *data, uint32_t size, Storage storage, InMemoryFS::BufferDeleter deleter) {
+	switch (storage) {
+		case STORAGE_COPY: {
+			InMemoryFS::MemoryRegion region;
+			uint8_t *copy = (uint8_t *) Memory::allocate(size, &region);
+			if (copy == nullptr) {
+				// No single free block is large enough, but segments may fit
+				return (size > INMEMORYFS_SEGMENT_SIZE) ? SegmentedBuffer::create(data, size) : nullptr;
+			}
+
+			memcpy(copy, data, size);
+			return new Buffer(copy, size, region, free);
+		}
+
+		case STORAGE_COMPRESS: {
+			// Data that does not shrink is held as a plain copy
+			Buffer *buffer = CompressedBuffer::create(data, size);
+			return (buffer != nullptr) ? buffer : createBuffer(data, size, STORAGE_COPY, nullptr);
+		}
+
+		case STORAGE_ADOPT:
+			return new Buffer((const uint8_t *) data, size, Memory::regionOf(data), deleter);
+
+		case STORAGE_MAP:
+			return new Buffer((const uint8_t *) data, size, InMemoryFS::MEMORY_STATIC, deleter);
+
+		default:
+			return new Buffer((const uint8_t *) data, size, InMemoryFS::MEMORY_STATIC, nullptr);
+	}
+}
+
+/**
+ * Looks, under the writer lock but without copying the table, whether
+ * registering data would store a new buffer: the path is free or being
+ * replaced, and no buffer already holds the same data.
+ *
+ * @param path The path of the file.
+ * @param hash The content hash of the data.
+ * @param data A pointer to the file data.
+ * @param size The size of the file data.
+ * @param shareable Whether the data may share a buffer.
+ * @param replace Whether an existing version of the file is replaced.
+ * @return true if a buffer has to be created
+ */
+static bool needsBuffer(const char *path, uint32_t hash, const void *data, uint32_t size, bool shareable, bool replace) {
+	std::lock_guard<std::mutex> lock(writerMutex);
+	PathTable *table = publishedTable.load();
+	if (!replace && (table != nullptr) && (table->find(path) != nullptr)) {
+		return false;
+	}
+
+	return !shareable || (findDuplicate(hash, data, size) == nullptr);
+}
+
+/**
+ * Names a buffer with a path and commits the update, trimming the
+ * buffer's memory region back within budget.
+ *
+ * @param update The table update to publish with.
+ * @param path The path of the file.
+ * @param buffer The buffer, whose reference passes to the table.
+ * @param replace Whether to replace an existing version of the file.
+ */
+static void publishBuffer(TableUpdate &update, const char *path, Buffer *buffer, bool replace) {
+	if (replace) {
+		update.remove(path);
+	}
+
+	update.insert(path, buffer);
+	buffer->lastAccess.store(accessClock.fetch_add(1) + 1);
+	registrations.fetch_add(1);
+
+	if (buffer->region != InMemoryFS::MEMORY_STATIC) {
+		evict(update, buffer->region, buffer);
+	}
+
+	update.commit();
+}
+
+/**
+ * Publishes file data in the file system under the specified path.
+ * When another path already holds identical data in memory, the new
+ * path shares its buffer instead of storing a second copy.
+ *
+ * @param path The path of the file.
+ * @param data A pointer to the file data.
+ * @param size The size of the file data.
+ * @param storage How the data is held.
+ * @param deleter Called to release adopted data once it is no longer needed.
+ * @param replace Whether to replace an existing version of the file.
+ *                Otherwise the first registration of a path wins and
+ *                a duplicate is released immediately.
+ * @return true if the data was published
+ */
+static bool addFile(const char *path, const void *data, uint32_t size, Storage storage, InMemoryFS::BufferDeleter deleter, bool replace) {
+	// Static and mapped data cost no memory, so they are never worth comparing
+	bool shareable = (storage != STORAGE_BORROW) && (storage != STORAGE_MAP);
+	uint32_t hash = shareable ? ContentHash::xxh32(data, size) : 0;
+
+	// Copying and compressing are done before the update, like the hash,
+	// but only when the data is not already held and the path is free.
+	// Other data is wrapped regardless, so a buffer the table does not
+	// take releases adopted and mapped data when it is dropped.
+	bool costly = (storage == STORAGE_COPY) || (storage == STORAGE_COMPRESS);
+	bool built = !costly || needsBuffer(path, hash, data, size, shareable, replace);
+	Buffer *created = built ? createBuffer(data, size, storage, deleter) : nullptr;
+	Buffer *unused = created;
+	bool published = false;
+
+	{
+		// The table may have changed since the look, so it is checked again
+		TableUpdate update;
+		if (replace || (update.table->find(path) == nullptr)) {
+			Buffer *buffer = shareable ? findDuplicate(hash, data, size) : nullptr;
+			if (buffer != nullptr) {
+				buffer->refCount.fetch_add(1);
+				dedupHits.fetch_add(1);
+				dedupBytesSaved.fetch_add(size);
+			} else {
+				if (!built) {
+					// The file it matched has been removed since
+					created = createBuffer(data, size, storage, deleter);
+				}
+
+				if (created != nullptr) {
+					buffer = created;
+					buffer->contentHash = hash;
+					buffer->shareable = shareable;
+					residentBytes[buffer->region].fetch_add(buffer->storedSize);
+					unused = nullptr;
+				}
+			}
+
+			if (buffer != nullptr) {
+				publishBuffer(update, path, buffer, replace);
+				published = true;
+			}
+		}
+	}
+
+	delete unused;
+	return published;
+}
+
+/**
+ * Publishes the data written through a cursor under the path it was
+ * opened with, or drops it if the write was abandoned.
+ *
+ * @param cursor The cursor open for writing.
+ * @return LV_FS_RES_OK if the file was published
+ */
+static lv_fs_res_t commitWrite(BufferCursor *cursor) {
+	PendingWrite *pending = &cursor->pending;
+	lv_fs_res_t result = LV_FS_RES_OK;
+
+	if (pending->discarded) {
+		free(pending->data);
+		delete pending->segments;
+		result = LV_FS_RES_UNKNOWN;
+	} else if (pending->segments != nullptr) {
+		// Segmented data is never shared, since matching it would mean
+		// hashing across the segments
+		SegmentedBuffer *segments = pending->segments;
+		segments->trim();
+		residentBytes[segments->region].fetch_add(segments->storedSize);
+
+		TableUpdate update;
+		publishBuffer(update, pending->path, segments, true);
+	} else {
+		// Return the slack left by geometric growth
+		if ((pending->size > 0) && (pending->size < pending->capacity)) {
+			void *trimmed = Memory::resize(pending->data, pending->size, &pending->region);
+			if (trimmed != nullptr) {
+				pending->data = (uint8_t *) trimmed;
+			}
+		}
+
+		// The file system adopts the staging area, so nothing is copied
+		if (!addFile(pending->path, pending->data, pending->size, STORAGE_ADOPT, free, true)) {
+			result = LV_FS_RES_OUT_OF_MEM;
+		}
+	}
+
+	free(pending->path);
+	cursor->pending = { nullptr, nullptr, 0, 0, InMemoryFS::MEMORY_INTERNAL, nullptr, false };
+	return result;
+}
+
+/**
+ * Returns the cursor behind an LVGL file if it is open for writing on
+ * this driver.
+ *
+ * @param file The LVGL file.
+ * @return the cursor or nullptr
+ */
+static BufferCursor *writeCursorOf(lv_fs_file_t *file) {
+	if ((file == nullptr) || (file->drv != &drv) || (file->file_d == nullptr)) {
+		return nullptr;
+	}
+
+	BufferCursor *cursor = (BufferCursor *) file->file_d;
+	return (cursor->buffer == nullptr) ? cursor : nullptr;
+}
+
+/**
+ * Preallocates room for a file being written, such as from a known
+ * Content-Length, so appending never has to grow the storage.
+ *
+ * @param file A file opened for writing on the InMemoryFS drive.
+ * @param size The expected size of the file.
+ * @return true if the room was reserved
+ */
+bool InMemoryFS::reserveFile(lv_fs_file_t *file, uint32_t size) {
+	BufferCursor *cursor = writeCursorOf(file);
+	return (cursor != nullptr) && !cursor->pending.discarded && reservePending(&cursor->pending, size);
+}
+
+/**
+ * Abandons a file being written so closing it does not publish it.
+ *
+ * @param file A file opened for writing on the InMemoryFS drive.
+ */
+void InMemoryFS::discardFile(lv_fs_file_t *file) {
+	BufferCursor *cursor = writeCursorOf(file);
+	if (cursor != nullptr) {
+		cursor->pending.discarded = true;
+	}
+}
+
+/**
+ * Adds a copy of the file data to the InMemoryFS.
  *
  * @param path The path of the file.
  * @param data A pointer to the file data.
  * @param size The size of the file data.
  */
 void InMemoryFS::registerFile(const char *path, void *data, uint32_t size) {
-	std::string key = path;
+	addFile(path, data, size, STORAGE_COPY, nullptr, false);
+}
+
+/**
+ * Adds file data to the InMemoryFS, taking storage of the buffer
+ * rather than copying it.
+ *
+ * @param path The path of the file.
+ * @param data A pointer to the file data.
+ * @param size The size of the file data.
+ * @param deleter Called to release the data once it is no longer needed.
+ */
+void InMemoryFS::adoptFile(const char *path, void *data, uint32_t size, BufferDeleter deleter) {
+	addFile(path, data, size, STORAGE_ADOPT, deleter, false);
+}
 
-	Buffer *buffer = new Buffer();
-	buffer->data = (uint8_t* ) malloc(size);
-	buffer->size = size;
+/**
+ * Adds file data to the InMemoryFS, borrowing a buffer that outlives
+ * the file system (for example constant data in flash).
+ *
+ * @param path The path of the file.
+ * @param data A pointer to the file data.
+ * @param size The size of the file data.
+ */
+void InMemoryFS::registerStaticFile(const char *path, const void *data, uint32_t size) {
+	addFile(path, data, size, STORAGE_BORROW, nullptr, false);
+}
 
-	memcpy(buffer->data, data, size);
-	buffersByName.insert({ key, buffer });
+/**
+ * Publishes a copy of the provided data as a new version of the file.
+ * Cursors open on the previous version keep it alive until closed.
+ *
+ * @param path The path of the file.
+ * @param data A pointer to the file data.
+ * @param size The size of the file data.
+ * @return true if the new version was published
+ */
+bool InMemoryFS::replaceFile(const char *path, void *data, uint32_t size) {
+	return addFile(path, data, size, STORAGE_COPY, nullptr, true);
+}
+
+/**
+ * Publishes the provided data as a new version of the file, taking
+ * storage of the buffer rather than copying it.
+ *
+ * @param path The path of the file.
+ * @param data A pointer to the file data.
+ * @param size The size of the file data.
+ * @param deleter Called to release the data once it is no longer needed.
+ * @return true if the new version was published
+ */
+bool InMemoryFS::replaceFile(const char *path, void *data, uint32_t size, BufferDeleter deleter) {
+	return addFile(path, data, size, STORAGE_ADOPT, deleter, true);
+}
+
+/**
+ * Adds a file backed by a read-only memory mapping.
+ *
+ * @param path The path of the file.
+ * @param source The flash partition label or host file path to map.
+ * @param offset The offset of the file within the source.
+ * @param size The size of the file, or 0 for the rest of the source.
+ * @return true if the file was registered
+ */
+bool InMemoryFS::registerMappedFile(const char *path, const char *source, uint32_t offset, uint32_t size) {
+	BufferDeleter unmap;
+	uint32_t mappedSize;
+	const void *data = Memory::map(source, offset, size, &mappedSize, &unmap);
+	if (data == nullptr) {
+		return false;
+	}
+
+	return addFile(path, data, mappedSize, STORAGE_MAP, unmap, false);
+}
+
+/**
+ * Mounts an asset pack from a read-only memory mapping.
+ *
+ * @param source The flash partition label or host file path to map.
+ * @param offset The offset of the pack within the source.
+ * @param size The size of the pack, or 0 for the rest of the source.
+ * @return true if the pack was mounted
+ */
+bool InMemoryFS::mountMappedAssetPack(const char *source, uint32_t offset, uint32_t size) {
+	BufferDeleter unmap;
+	uint32_t mappedSize;
+	const void *data = Memory::map(source, offset, size, &mappedSize, &unmap);
+	if (data == nullptr) {
+		return false;
+	}
+
+	if (!mountAssetPack(data, mappedSize)) {
+		unmap((void *) data);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Mounts a read-only asset pack, borrowing its data.
+ *
+ * @param pack A pointer to the pack.
+ * @param size The size of the pack.
+ * @return true if the pack was mounted
+ */
+bool InMemoryFS::mountAssetPack(const void *pack, uint32_t size) {
+	std::lock_guard<std::mutex> lock(writerMutex);
+
+	uint32_t count = mountedPackCount.load();
+	if (count == INMEMORYFS_MAX_ASSET_PACKS) {
+		return false;
+	}
+
+	AssetPack *mounted = AssetPack::mount(pack, size, ++versionClock);
+	if (mounted == nullptr) {
+		return false;
+	}
+
+	mountedPacks[count] = mounted;
+	mountedPackCount.store(count + 1);
+
+	residentBytes[MEMORY_STATIC].fetch_add(mounted->dataSize());
+	registrations.fetch_add(mounted->size());
+	return true;
+}
+
+/**
+ * Adds a compressed copy of the file data to the InMemoryFS.
+ *
+ * @param path The path of the file.
+ * @param data A pointer to the file data.
+ * @param size The size of the file data.
+ */
+void InMemoryFS::registerCompressedFile(const char *path, const void *data, uint32_t size) {
+	addFile(path, data, size, STORAGE_COMPRESS, nullptr, false);
+}
+
+/**
+ * Publishes a compressed copy of the provided data as a new version of
+ * the file.
+ *
+ * @param path The path of the file.
+ * @param data A pointer to the file data.
+ * @param size The size of the file data.
+ * @return true if the new version was published
+ */
+bool InMemoryFS::replaceCompressedFile(const char *path, const void *data, uint32_t size) {
+	return addFile(path, data, size, STORAGE_COMPRESS, nullptr, true);
+}
+
+/**
+ * Removes a file from the InMemoryFS.  Its data is released once the
+ * last cursor open on it is closed.
+ *
+ * @param path The path of the file.
+ * @return true if the file was removed
+ */
+bool InMemoryFS::unregisterFile(const char *path) {
+	TableUpdate update;
+	if (!update.remove(path)) {
+		return false;
+	}
+
+	update.commit();
+	return true;
+}
+
+/**
+ * Resolves a path to an image descriptor pointing at the stored bytes.
+ *
+ * @param path The path of the file, with or without the drive letter.
+ * @return the descriptor or nullptr if the data cannot be read in place
+ */
+const lv_img_dsc_t *InMemoryFS::asImageDescriptor(const char *path) {
+	if ((path[0] == DRIVE_LETTER) && (path[1] == ':')) {
+		path += 2;
+	}
+
+	Buffer *buffer = acquireBuffer(path);
+	if (buffer == nullptr) {
+		misses.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	const uint8_t *data = buffer->contiguousData();
+	if (data == nullptr) {
+		releaseBuffer(buffer);
+		return nullptr;
+	}
+
+	opens.fetch_add(1, std::memory_order_relaxed);
+
+	ImageView *view = new ImageView();
+	view->descriptor.header.cf = LV_IMG_CF_UNKNOWN;
+	view->descriptor.header.always_zero = 0;
+	view->descriptor.header.reserved = 0;
+	view->descriptor.header.w = 0;
+	view->descriptor.header.h = 0;
+	view->descriptor.data_size = buffer->size;
+	view->descriptor.data = data;
+	view->buffer = buffer;
+
+	return &view->descriptor;
+}
+
+/**
+ * Releases an image descriptor and the reference it holds.
+ *
+ * LVGL's image cache knows a descriptor by its address alone.  A
+ * descriptor allocated later may get the same address, and would then
+ * be drawn from the cached decode of this one, so that entry is
+ * invalidated first.
+ *
+ * @param descriptor The descriptor returned by asImageDescriptor.
+ */
+void InMemoryFS::releaseImageDescriptor(const lv_img_dsc_t *descriptor) {
+	if (descriptor == nullptr) {
+		return;
+	}
+
+	lv_img_cache_invalidate_src(descriptor);
+
+	ImageView *view = (ImageView *) descriptor;
+	releaseBuffer(view->buffer);
+	delete view;
+}
+
+/**
+ * Returns the currently published version of a file.
+ *
+ * @param path The path of the file.
+ * @return the version or 0 if the path is not registered
+ */
+uint32_t InMemoryFS::getVersion(const char *path) {
+	Rcu::ReadSection section;
+
+	uint32_t version = 0;
+	findBuffer(path, &version);
+	return version;
+}
+
+/**
+ * Sets the byte budget for a memory region and evicts files to meet it.
+ *
+ * @param region The memory region.
+ * @param bytes The budget in bytes, or 0 for unlimited.
+ */
+void InMemoryFS::setMemoryBudget(MemoryRegion region, uint32_t bytes) {
+	if (region != MEMORY_STATIC) {
+		TableUpdate update;
+		memoryBudgets[region] = bytes;
+		evict(update, region, nullptr);
+		update.commit();
+	}
+}
+
+/**
+ * Returns the bytes of file data held in a memory region, including
+ * replaced versions that are still open.
+ *
+ * @param region The memory region.
+ * @return the resident byte count
+ */
+uint32_t InMemoryFS::getResidentBytes(MemoryRegion region) {
+	return residentBytes[region].load();
+}
+
+/**
+ * Returns a snapshot of the file system counters.
+ *
+ * @return the counters
+ */
+InMemoryFS::Stats InMemoryFS::getStats() {
+	Stats stats;
+	for (int region = MEMORY_INTERNAL; region <= MEMORY_STATIC; region++) {
+		stats.residentBytes[region] = residentBytes[region].load();
+	}
+
+	{
+		Rcu::ReadSection section;
+		PathTable *table = publishedTable.load();
+		stats.entryCount = (table != nullptr) ? table->size() : 0;
+	}
+
+	for (uint32_t i = 0; i < mountedPackCount.load(); i++) {
+		stats.entryCount += mountedPacks[i]->size();
+	}
+
+	stats.opens = opens.load(std::memory_order_relaxed);
+	stats.misses = misses.load(std::memory_order_relaxed);
+	stats.bytesRead = bytesRead.load(std::memory_order_relaxed);
+	stats.openCursors = openCursors.load(std::memory_order_relaxed);
+	stats.peakOpenCursors = peakOpenCursors.load(std::memory_order_relaxed);
+	stats.cursorPoolExhaustions = cursorPoolExhaustions.load();
+	stats.accessClock = accessClock.load();
+	stats.registrations = registrations.load();
+	stats.dedupHits = dedupHits.load();
+	stats.dedupBytesSaved = dedupBytesSaved.load();
+
+	return stats;
+}
+
+/**
+ * Visits every registered file.
+ *
+ * @param visitor Called with a description of each file.
+ */
+void InMemoryFS::forEachEntry(EntryVisitor visitor) {
+	// Holding the writer lock keeps the published table, and with it the
+	// path strings, in place without blocking readers
+	std::lock_guard<std::mutex> lock(writerMutex);
+
+	auto visit = [&](const char *path, uint32_t version, Buffer *buffer) {
+		EntryInfo info;
+		info.path = path;
+		info.size = buffer->size;
+		info.storedSize = buffer->storedSize;
+		info.region = buffer->region;
+		info.version = version;
+		info.lastAccess = buffer->lastAccess.load();
+		info.openCursors = buffer->refCount.load() - buffer->nameCount;
+		info.shared = (buffer->nameCount > 1);
+
+		visitor(info);
+	};
+
+	PathTable *table = publishedTable.load();
+	if (table != nullptr) {
+		table->forEach([&](const PathTable::Entry &entry) {
+			visit(entry.path, entry.version, entry.buffer);
+		});
+	}
+
+	for (uint32_t i = 0; i < mountedPackCount.load(); i++) {
+		AssetPack *pack = mountedPacks[i];
+		pack->forEach([&](const char *path, Buffer *buffer) {
+			visit(path, pack->version, buffer);
+		});
+	}
 }
 
 /**
@@ -174,6 +1366,12 @@ void InMemoryFS::registerFile(const char *path, void *data, uint32_t size) {
  */
 lv_fs_drv_t *InMemoryFS::registerInMemoryDriver() {
 	if (!initialized) {
+		// Thread every cursor onto the free list in pool order
+		for (int i = 0; i < INMEMORYFS_MAX_OPEN_FILES; i++) {
+			cursorPool[i].nextFree.store((i + 1 < INMEMORYFS_MAX_OPEN_FILES) ? i + 2 : 0);
+		}
+		freeCursors.store(1);
+
 		lv_fs_drv_init(&drv);
 
 		drv.letter = InMemoryFS::DRIVE_LETTER;
@@ -183,13 +1381,13 @@ lv_fs_drv_t *InMemoryFS::registerInMemoryDriver() {
 		drv.open_cb = mem_fs_open;
 		drv.close_cb = mem_fs_close;
 		drv.read_cb = mem_fs_read;
-		drv.write_cb = nullptr;
+		drv.write_cb = mem_fs_write;
 		drv.seek_cb = mem_fs_seek;
 		drv.tell_cb = mem_fs_tell;
 
-		drv.dir_open_cb = nullptr;
-		drv.dir_read_cb = nullptr;
-		drv.dir_close_cb = nullptr;
+		drv.dir_open_cb = mem_fs_dir_open;
+		drv.dir_read_cb = mem_fs_dir_read;
+		drv.dir_close_cb = mem_fs_dir_close;
 
 		drv.user_data = nullptr;
 
@@ -0,0 +1,173 @@
+#include "Memory.h"
+
+#include <stdlib.h>
+
+#ifdef BOARD_HAS_PSRAM
+#include <esp_heap_caps.h>
+#if __has_include(<esp_memory_utils.h>)
+#include <esp_memory_utils.h>
+#else
+#include <soc/soc_memory_layout.h>
+#endif
+#endif
+
+#if defined(ESP32)
+#include <esp_partition.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Determine whether a single block of the size may be allocated.
+ */
+static inline bool withinContiguousLimit(uint32_t size) {
+	return (INMEMORYFS_MAX_CONTIGUOUS_ALLOCATION == 0) || (size <= INMEMORYFS_MAX_CONTIGUOUS_ALLOCATION);
+}
+
+void *Memory::allocate(uint32_t size, InMemoryFS::MemoryRegion *region) {
+	*region = InMemoryFS::MEMORY_INTERNAL;
+	if (!withinContiguousLimit(size)) {
+		return nullptr;
+	}
+
+	#ifdef BOARD_HAS_PSRAM
+		void *data = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+		if (data != nullptr) {
+			*region = InMemoryFS::MEMORY_PSRAM;
+			return data;
+		}
+	#endif
+
+	return malloc(size);
+}
+
+void *Memory::allocateIn(uint32_t size, InMemoryFS::MemoryRegion region) {
+	if (!withinContiguousLimit(size)) {
+		return nullptr;
+	}
+
+	#ifdef BOARD_HAS_PSRAM
+		if (region == InMemoryFS::MEMORY_PSRAM) {
+			return heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+		}
+
+		return heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	#else
+		return malloc(size);
+	#endif
+}
+
+void *Memory::resize(void *data, uint32_t size, InMemoryFS::MemoryRegion *region) {
+	if (data == nullptr) {
+		return allocate(size, region);
+	}
+
+	if (!withinContiguousLimit(size)) {
+		return nullptr;
+	}
+
+	#ifdef BOARD_HAS_PSRAM
+		if (*region == InMemoryFS::MEMORY_PSRAM) {
+			return heap_caps_realloc(data, size, MALLOC_CAP_SPIRAM);
+		}
+	#endif
+
+	return realloc(data, size);
+}
+
+InMemoryFS::MemoryRegion Memory::regionOf(const void *data) {
+	#ifdef BOARD_HAS_PSRAM
+		if (esp_ptr_external_ram(data)) {
+			return InMemoryFS::MEMORY_PSRAM;
+		}
+	#endif
+
+	return InMemoryFS::MEMORY_INTERNAL;
+}
+
+/**
+ * Work out how much of a source of the given length to map.
+ */
+static inline bool mappedRange(uint32_t length, uint32_t offset, uint32_t size, uint32_t *mappedSize) {
+	if (offset > length) {
+		return false;
+	}
+
+	*mappedSize = (size == 0) ? (length - offset) : size;
+	return *mappedSize <= length - offset;
+}
+
+#if defined(ESP32)
+
+const void *Memory::map(const char *source, uint32_t offset, uint32_t size, uint32_t *mappedSize, InMemoryFS::BufferDeleter *unmap) {
+	const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, source);
+	if ((partition == nullptr) || !mappedRange(partition->size, offset, size, mappedSize) || (*mappedSize == 0)) {
+		return nullptr;
+	}
+
+	// The partition API takes care of aligning the offset to an MMU page
+	const void *data;
+	#if ESP_IDF_VERSION_MAJOR >= 5
+		esp_partition_mmap_handle_t handle;
+		if (esp_partition_mmap(partition, offset, *mappedSize, ESP_PARTITION_MMAP_DATA, &data, &handle) != ESP_OK) {
+			return nullptr;
+		}
+
+		*unmap = [handle](void *) {
+			esp_partition_munmap(handle);
+		};
+	#else
+		spi_flash_mmap_handle_t handle;
+		if (esp_partition_mmap(partition, offset, *mappedSize, SPI_FLASH_MMAP_DATA, &data, &handle) != ESP_OK) {
+			return nullptr;
+		}
+
+		*unmap = [handle](void *) {
+			spi_flash_munmap(handle);
+		};
+	#endif
+
+	return data;
+}
+
+#elif defined(__unix__) || defined(__APPLE__)
+
+const void *Memory::map(const char *source, uint32_t offset, uint32_t size, uint32_t *mappedSize, InMemoryFS::BufferDeleter *unmap) {
+	int fd = open(source, O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+
+	struct stat status;
+	if ((fstat(fd, &status) != 0) || !mappedRange(status.st_size, offset, size, mappedSize) || (*mappedSize == 0)) {
+		close(fd);
+		return nullptr;
+	}
+
+	// Mappings start on a page boundary, so map from the page holding the offset
+	uint32_t pageOffset = offset % sysconf(_SC_PAGESIZE);
+	size_t length = *mappedSize + pageOffset;
+	void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, offset - pageOffset);
+	close(fd);
+
+	if (mapping == MAP_FAILED) {
+		return nullptr;
+	}
+
+	*unmap = [mapping, length](void *) {
+		munmap(mapping, length);
+	};
+
+	return (const uint8_t *) mapping + pageOffset;
+}
+
+#else
+
+const void *Memory::map(const char *source, uint32_t offset, uint32_t size, uint32_t *mappedSize, InMemoryFS::BufferDeleter *unmap) {
+	return nullptr;
+}
+
+#endif
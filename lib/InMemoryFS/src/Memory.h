@@ -0,0 +1,61 @@
+#pragma once
+
+#include <InMemoryFS.h>
+
+/**
+ * Platform specific helpers for placing file data in memory.
+ */
+namespace Memory {
+	/**
+	 * Allocate storage for file data, preferring PSRAM when the board
+	 * has it so internal RAM stays free for the system.
+	 *
+	 * @param size the number of bytes to allocate
+	 * @param region receives the region the storage was allocated from
+	 * @return the storage or nullptr if the allocation failed
+	 */
+	void *allocate(uint32_t size, InMemoryFS::MemoryRegion *region);
+
+	/**
+	 * Allocate storage for file data from a specific region.
+	 *
+	 * @param size the number of bytes to allocate
+	 * @param region the region to allocate from
+	 * @return the storage or nullptr if the allocation failed
+	 */
+	void *allocateIn(uint32_t size, InMemoryFS::MemoryRegion region);
+
+	/**
+	 * Resize storage returned by allocate, keeping it in the same region.
+	 *
+	 * @param data the storage, or nullptr to allocate new storage
+	 * @param size the new size in bytes
+	 * @param region the region of the storage, updated when new storage
+	 *               is allocated
+	 * @return the resized storage or nullptr if it could not be resized,
+	 *         in which case the original storage is untouched
+	 */
+	void *resize(void *data, uint32_t size, InMemoryFS::MemoryRegion *region);
+
+	/**
+	 * Determine which region holds a caller supplied buffer.
+	 *
+	 * @param data the buffer
+	 * @return the memory region
+	 */
+	InMemoryFS::MemoryRegion regionOf(const void *data);
+
+	/**
+	 * Map read-only data into the address space without copying it.  On
+	 * the ESP32 the source is the label of a flash partition, elsewhere
+	 * it is the path of a host file.
+	 *
+	 * @param source the partition label or file path
+	 * @param offset the offset of the data within the source
+	 * @param size the number of bytes to map, or 0 for the rest of the source
+	 * @param mappedSize receives the number of bytes mapped
+	 * @param unmap receives the function that releases the mapping
+	 * @return the mapped data or nullptr if the source could not be mapped
+	 */
+	const void *map(const char *source, uint32_t offset, uint32_t size, uint32_t *mappedSize, InMemoryFS::BufferDeleter *unmap);
+}
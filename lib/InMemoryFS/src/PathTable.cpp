@@ -0,0 +1,149 @@
+#include "PathTable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+PathTable::PathTable() : slots(nullptr), capacity(0), count(0) {
+}
+
+PathTable::PathTable(uint32_t capacity, uint32_t count) : capacity(capacity), count(count) {
+	slots = (Slot *) calloc(capacity, sizeof(Slot));
+}
+
+PathTable::~PathTable() {
+	free(slots);
+}
+
+PathTable *PathTable::copy() const {
+	PathTable *table = new PathTable(capacity, count);
+	if (capacity > 0) {
+		memcpy(table->slots, slots, capacity * sizeof(Slot));
+	}
+
+	return table;
+}
+
+/**
+ * Calculate the 32-bit FNV-1a hash of a path.
+ *
+ * @param path the path to hash
+ * @return the hash value
+ */
+uint32_t PathTable::hashPath(const char *path) {
+	uint32_t hash = 2166136261u;
+
+	while (*path) {
+		hash ^= (uint8_t) *path++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/**
+ * Find the slot holding the path, or the empty slot that ends its
+ * probe sequence.
+ *
+ * @param path the path to look up
+ * @param hash the precomputed hash of the path
+ * @return the slot or nullptr if the table has not been allocated
+ */
+const PathTable::Slot *PathTable::findSlot(const char *path, uint32_t hash) const {
+	if (capacity == 0) {
+		return nullptr;
+	}
+
+	uint32_t mask = capacity - 1;
+	for (uint32_t index = hash & mask; ; index = (index + 1) & mask) {
+		const Slot *slot = &slots[index];
+		if ((slot->entry.path == nullptr) || ((slot->hash == hash) && (strcmp(slot->entry.path, path) == 0))) {
+			return slot;
+		}
+	}
+}
+
+const PathTable::Entry *PathTable::find(const char *path) const {
+	const Slot *slot = findSlot(path, hashPath(path));
+	return ((slot != nullptr) && (slot->entry.path != nullptr)) ? &slot->entry : nullptr;
+}
+
+bool PathTable::insert(const char *path, uint32_t version, Buffer *buffer) {
+	// Keep the load factor below 3/4 so probe sequences stay short
+	if ((count + 1) * 4 > capacity * 3) {
+		grow();
+	}
+
+	uint32_t hash = hashPath(path);
+	Slot *slot = (Slot *) findSlot(path, hash);
+	if (slot->entry.path != nullptr) {
+		return false;
+	}
+
+	slot->hash = hash;
+	slot->entry.path = strdup(path);
+	slot->entry.version = version;
+	slot->entry.buffer = buffer;
+	count++;
+
+	return true;
+}
+
+bool PathTable::remove(const char *path, Entry *removed) {
+	Slot *slot = (Slot *) findSlot(path, hashPath(path));
+	if ((slot == nullptr) || (slot->entry.path == nullptr)) {
+		return false;
+	}
+
+	*removed = slot->entry;
+	count--;
+
+	// Shift later members of the probe sequence back into the hole so
+	// lookups never need tombstones
+	uint32_t mask = capacity - 1;
+	uint32_t hole = slot - slots;
+	for (uint32_t index = (hole + 1) & mask; slots[index].entry.path != nullptr; index = (index + 1) & mask) {
+		uint32_t home = slots[index].hash & mask;
+		if (((index - home) & mask) >= ((index - hole) & mask)) {
+			slots[hole] = slots[index];
+			hole = index;
+		}
+	}
+
+	slots[hole].entry.path = nullptr;
+	slots[hole].entry.buffer = nullptr;
+
+	return true;
+}
+
+void PathTable::forEach(std::function<void(const Entry &entry)> visitor) const {
+	for (uint32_t i = 0; i < capacity; i++) {
+		if (slots[i].entry.path != nullptr) {
+			visitor(slots[i].entry);
+		}
+	}
+}
+
+/**
+ * Double the capacity of the table and rehash the existing slots.
+ */
+void PathTable::grow() {
+	Slot *oldSlots = slots;
+	uint32_t oldCapacity = capacity;
+
+	capacity = (oldCapacity == 0) ? INITIAL_CAPACITY : oldCapacity * 2;
+	slots = (Slot *) calloc(capacity, sizeof(Slot));
+
+	uint32_t mask = capacity - 1;
+	for (uint32_t i = 0; i < oldCapacity; i++) {
+		if (oldSlots[i].entry.path != nullptr) {
+			uint32_t index = oldSlots[i].hash & mask;
+			while (slots[index].entry.path != nullptr) {
+				index = (index + 1) & mask;
+			}
+
+			slots[index] = oldSlots[i];
+		}
+	}
+
+	free(oldSlots);
+}
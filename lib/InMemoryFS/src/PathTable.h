@@ -0,0 +1,104 @@
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+#include "Buffer.h"
+
+/**
+ * An open-addressing hash table mapping file paths to their buffers.
+ *
+ * Paths are hashed once on insertion and the hash is stored alongside
+ * the key, so a lookup compares strings only on a hash match.  Lookups
+ * never allocate, which keeps the LVGL open path off the heap.
+ *
+ * A published table is never modified.  Writers change a copy and
+ * publish it in its place, so the path strings are shared between
+ * copies and are freed by whoever removes them from the table.
+ */
+class PathTable {
+public:
+	/**
+	 * A path, the version published for it and the buffer holding its
+	 * data.  Several paths may share one buffer.
+	 */
+	struct Entry {
+		char *path;
+		uint32_t version;
+		Buffer *buffer;
+	};
+
+	PathTable();
+	~PathTable();
+
+	// Disable copy semantics
+	PathTable(const PathTable&) = delete;
+
+	/**
+	 * Create a copy of the table to be modified and published.
+	 *
+	 * @return the new table
+	 */
+	PathTable *copy() const;
+
+	/**
+	 * Find the entry registered for the path.
+	 *
+	 * @param path the path to look up
+	 * @return the entry or nullptr if the path is not registered
+	 */
+	const Entry *find(const char *path) const;
+
+	/**
+	 * Register a buffer for the path.
+	 *
+	 * @param path the path of the file
+	 * @param version the version being published
+	 * @param buffer the buffer holding the file data
+	 * @return true if inserted, false if the path is already registered
+	 */
+	bool insert(const char *path, uint32_t version, Buffer *buffer);
+
+	/**
+	 * Remove the path from the table.  The removed path string is handed
+	 * to the caller, which must free it once no reader can see it.
+	 *
+	 * @param path the path of the file
+	 * @param removed receives the removed path and buffer
+	 * @return true if the path was registered
+	 */
+	bool remove(const char *path, Entry *removed);
+
+	/**
+	 * Visit every registered entry.  The table must not be modified
+	 * during the visit.
+	 *
+	 * @param visitor the function to call for each entry
+	 */
+	void forEach(std::function<void(const Entry &entry)> visitor) const;
+
+	/**
+	 * Return the number of registered paths.
+	 */
+	uint32_t size() const {
+		return count;
+	}
+
+	static uint32_t hashPath(const char *path);
+
+private:
+	static const uint32_t INITIAL_CAPACITY = 16;
+
+	struct Slot {
+		uint32_t hash;
+		Entry entry;
+	};
+
+	PathTable(uint32_t capacity, uint32_t count);
+
+	Slot *slots;
+	uint32_t capacity;
+	uint32_t count;
+
+	const Slot *findSlot(const char *path, uint32_t hash) const;
+	void grow();
+};
@@ -0,0 +1,21 @@
+#include "Rcu.h"
+
+#include <chrono>
+#include <thread>
+
+std::atomic<uint32_t> Rcu::phase(0);
+std::atomic<uint32_t> Rcu::activeReaders[2];
+
+#ifdef RCU_TEST_HOOKS
+void (*Rcu::readerJoinHook)() = nullptr;
+#endif
+
+void Rcu::synchronize() {
+	// New readers enter the other phase, so the count being drained can
+	// only fall.  Sleep rather than spin so a writer with a higher priority
+	// than the reader cannot starve it.
+	uint32_t previousPhase = phase.fetch_add(1) & 1;
+	while (activeReaders[previousPhase].load() != 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
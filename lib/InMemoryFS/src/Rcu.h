@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * A minimal read-copy-update scheme so the LVGL thread can read the
+ * published file table without ever taking a lock.
+ *
+ * Readers bracket their access with a ReadSection, which only bumps an
+ * atomic counter.  Writers publish a new version of the data, then call
+ * synchronize() to wait until every reader that could still see the old
+ * version has left its section, after which the old version can be freed.
+ */
+namespace Rcu {
+	extern std::atomic<uint32_t> phase;
+	extern std::atomic<uint32_t> activeReaders[2];
+
+#ifdef RCU_TEST_HOOKS
+	// Called between a reader observing the phase and joining it, so tests
+	// can stall a reader in that window
+	extern void (*readerJoinHook)();
+#endif
+
+	/**
+	 * Marks a read-side critical section for the lifetime of the object.
+	 * Sections are short and never block.
+	 */
+	class ReadSection {
+	public:
+		ReadSection() {
+			// A writer may flip the phase between the load and the join,
+			// leaving the reader counted in a phase it has already drained.
+			// Only once the phase is unchanged after joining is the reader
+			// sure to be waited for.  The full value is compared, as two
+			// flips restore the parity.
+			for (;;) {
+				uint32_t observed = phase.load();
+				readerPhase = observed & 1;
+#ifdef RCU_TEST_HOOKS
+				if (readerJoinHook != nullptr) {
+					readerJoinHook();
+				}
+#endif
+				activeReaders[readerPhase].fetch_add(1);
+				if (phase.load() == observed) {
+					break;
+				}
+
+				activeReaders[readerPhase].fetch_sub(1);
+			}
+		}
+
+		~ReadSection() {
+			activeReaders[readerPhase].fetch_sub(1);
+		}
+
+		// Disable copy semantics
+		ReadSection(const ReadSection&) = delete;
+
+	private:
+		uint32_t readerPhase;
+	};
+
+	/**
+	 * Wait for every read-side section that started before the call to
+	 * finish.  Only called by writers, which may block.
+	 */
+	void synchronize();
+}
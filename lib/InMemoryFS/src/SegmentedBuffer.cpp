@@ -0,0 +1,158 @@
+#include "SegmentedBuffer.h"
+#include "Memory.h"
+
+#include <stdlib.h>
+
+static const uint32_t SEGMENT_SIZE = INMEMORYFS_SEGMENT_SIZE;
+
+SegmentedBuffer::SegmentedBuffer(InMemoryFS::MemoryRegion region) :
+	Buffer(nullptr, 0, region, nullptr), segments(nullptr), segmentCount(0) {
+}
+
+SegmentedBuffer::~SegmentedBuffer() {
+	for (uint32_t i = 0; i < segmentCount; i++) {
+		free(segments[i]);
+	}
+
+	free(segments);
+}
+
+SegmentedBuffer *SegmentedBuffer::create(uint32_t capacity) {
+	// The first segment goes wherever memory allows and the rest follow it
+	InMemoryFS::MemoryRegion region;
+	uint8_t *first = (uint8_t *) Memory::allocate(SEGMENT_SIZE, &region);
+	if (first == nullptr) {
+		return nullptr;
+	}
+
+	SegmentedBuffer *buffer = new SegmentedBuffer(region);
+	buffer->segments = (uint8_t **) malloc(sizeof(uint8_t *));
+	if (buffer->segments == nullptr) {
+		free(first);
+		delete buffer;
+		return nullptr;
+	}
+
+	memset(first, 0, SEGMENT_SIZE);
+	buffer->segments[0] = first;
+	buffer->segmentCount = 1;
+
+	if (!buffer->reserve(capacity)) {
+		delete buffer;
+		return nullptr;
+	}
+
+	buffer->updateStoredSize();
+	return buffer;
+}
+
+SegmentedBuffer *SegmentedBuffer::create(const void *data, uint32_t size) {
+	SegmentedBuffer *buffer = create(size);
+	if (buffer != nullptr) {
+		buffer->write(0, data, size);
+	}
+
+	return buffer;
+}
+
+bool SegmentedBuffer::reserve(uint32_t capacity) {
+	uint32_t count = (capacity + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+	if (count <= segmentCount) {
+		return true;
+	}
+
+	uint8_t **grown = (uint8_t **) realloc(segments, count * sizeof(uint8_t *));
+	if (grown == nullptr) {
+		return false;
+	}
+
+	segments = grown;
+	while (segmentCount < count) {
+		uint8_t *segment = (uint8_t *) Memory::allocateIn(SEGMENT_SIZE, region);
+		if (segment == nullptr) {
+			updateStoredSize();
+			return false;
+		}
+
+		memset(segment, 0, SEGMENT_SIZE);
+		segments[segmentCount++] = segment;
+	}
+
+	updateStoredSize();
+	return true;
+}
+
+void SegmentedBuffer::write(uint32_t offset, const void *source, uint32_t length) {
+	const uint8_t *in = (const uint8_t *) source;
+	uint32_t end = offset + length;
+
+	while (length > 0) {
+		uint32_t segmentOffset = offset % SEGMENT_SIZE;
+		uint32_t count = SEGMENT_SIZE - segmentOffset;
+		if (count > length) {
+			count = length;
+		}
+
+		memcpy(segments[offset / SEGMENT_SIZE] + segmentOffset, in, count);
+		in += count;
+		offset += count;
+		length -= count;
+	}
+
+	if (end > size) {
+		size = end;
+	}
+}
+
+void SegmentedBuffer::trim() {
+	uint32_t count = (size + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+	if (count == 0) {
+		count = 1;
+	}
+
+	while (segmentCount > count) {
+		free(segments[--segmentCount]);
+	}
+
+	updateStoredSize();
+}
+
+/**
+ * Recalculate the memory held by the segments.
+ */
+void SegmentedBuffer::updateStoredSize() {
+	storedSize = segmentCount * SEGMENT_SIZE;
+}
+
+lv_fs_res_t SegmentedBuffer::read(uint32_t offset, uint8_t *dest, uint32_t length, ReadWindow *window) const {
+	while (length > 0) {
+		uint32_t segmentOffset = offset % SEGMENT_SIZE;
+		uint32_t count = SEGMENT_SIZE - segmentOffset;
+		if (count > length) {
+			count = length;
+		}
+
+		memcpy(dest, segments[offset / SEGMENT_SIZE] + segmentOffset, count);
+		dest += count;
+		offset += count;
+		length -= count;
+	}
+
+	return LV_FS_RES_OK;
+}
+
+bool SegmentedBuffer::equals(const void *other, uint32_t otherSize) const {
+	if (size != otherSize) {
+		return false;
+	}
+
+	const uint8_t *expected = (const uint8_t *) other;
+	for (uint32_t offset = 0; offset < size; offset += SEGMENT_SIZE) {
+		uint32_t count = ((size - offset) < SEGMENT_SIZE) ? (size - offset) : SEGMENT_SIZE;
+		if (memcmp(segments[offset / SEGMENT_SIZE], expected + offset, count) != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
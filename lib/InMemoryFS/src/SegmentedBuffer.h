@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Buffer.h"
+
+/**
+ * A buffer holding file data in a chain of INMEMORYFS_SEGMENT_SIZE
+ * segments rather than one contiguous block.
+ *
+ * A fragmented heap can fail a large allocation while plenty of memory
+ * is free in total, so files fall back to segments when a contiguous
+ * block cannot be found.  Reads walk the segments transparently.
+ *
+ * Every segment comes from the same memory region so the buffer is
+ * budgeted as a whole.
+ */
+class SegmentedBuffer : public Buffer {
+public:
+	/**
+	 * Create a buffer holding a copy of the file data.
+	 *
+	 * @param data the file data
+	 * @param size the size of the file data
+	 * @return the buffer or nullptr if the memory could not be allocated
+	 */
+	static SegmentedBuffer *create(const void *data, uint32_t size);
+
+	/**
+	 * Create an empty buffer to be filled by a writer before it is
+	 * published.
+	 *
+	 * @param capacity the number of bytes to reserve
+	 * @return the buffer or nullptr if the memory could not be allocated
+	 */
+	static SegmentedBuffer *create(uint32_t capacity);
+
+	virtual ~SegmentedBuffer();
+
+	/**
+	 * Grow the buffer so it can hold at least the requested number of
+	 * bytes.  Bytes that have not been written read as zero.  Only valid
+	 * before the buffer is published.
+	 *
+	 * @param capacity the number of bytes required
+	 * @return false if the memory could not be allocated
+	 */
+	bool reserve(uint32_t capacity);
+
+	/**
+	 * Write file data, extending the size of the file as needed.  Only
+	 * valid before the buffer is published.
+	 *
+	 * @param offset the file offset to write at
+	 * @param source the data to write
+	 * @param length the number of bytes to write, which must fit within
+	 *               the reserved capacity
+	 */
+	void write(uint32_t offset, const void *source, uint32_t length);
+
+	/**
+	 * Release segments beyond the end of the file.
+	 */
+	void trim();
+
+	virtual lv_fs_res_t read(uint32_t offset, uint8_t *dest, uint32_t length, ReadWindow *window) const override;
+	virtual bool equals(const void *other, uint32_t otherSize) const override;
+
+private:
+	SegmentedBuffer(InMemoryFS::MemoryRegion region);
+
+	uint8_t **segments;
+	uint32_t segmentCount;
+
+	void updateStoredSize();
+};
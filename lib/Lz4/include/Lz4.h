@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * A small implementation of the LZ4 block format.
+ *
+ * Blocks produced here can be decoded by any LZ4 implementation and vice
+ * versa.  The compressor is a simple greedy matcher tuned for a small
+ * memory footprint rather than ratio, and is limited to blocks of at
+ * most MAX_INPUT_SIZE bytes.  The decompressor checks every bound, so
+ * corrupt input fails rather than overrunning memory.
+ */
+namespace Lz4 {
+	static const uint32_t MAX_INPUT_SIZE = 65535;
+
+	/**
+	 * Return the worst case compressed size of a block.
+	 *
+	 * @param size the uncompressed size
+	 * @return the largest compressed size the block may need
+	 */
+	constexpr uint32_t compressBound(uint32_t size) {
+		return size + (size / 255) + 16;
+	}
+
+	/**
+	 * Compress a block.
+	 *
+	 * @param source the data to compress
+	 * @param sourceSize the size of the data, at most MAX_INPUT_SIZE
+	 * @param dest receives the compressed block
+	 * @param destCapacity the size of the destination
+	 * @return the compressed size, or 0 if the block does not fit in the
+	 *         destination or the source is too large
+	 */
+	uint32_t compress(const void *source, uint32_t sourceSize, void *dest, uint32_t destCapacity);
+
+	/**
+	 * Decompress a block.
+	 *
+	 * @param source the compressed block
+	 * @param sourceSize the size of the compressed block
+	 * @param dest receives the decompressed data
+	 * @param destCapacity the size of the destination
+	 * @return the decompressed size, or -1 if the block is malformed or
+	 *         does not fit in the destination
+	 */
+	int32_t decompress(const void *source, uint32_t sourceSize, void *dest, uint32_t destCapacity);
+}
@@ -0,0 +1,211 @@
+#include "Lz4.h"
+
+#include <string.h>
+
+// Matches are at least four bytes long
+static const uint32_t MIN_MATCH = 4;
+
+// The format requires the last five bytes to be literals and the last
+// match to start at least twelve bytes before the end of the block
+static const uint32_t LAST_LITERALS = 5;
+static const uint32_t MATCH_FIND_LIMIT = 12;
+
+// A 2 KB table of recent positions keeps the compressor stack friendly
+static const uint32_t HASH_BITS = 10;
+
+static inline uint32_t readWord(const uint8_t *p) {
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t hashWord(uint32_t value) {
+	return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/**
+ * Write a length that overflows its token nibble as a run of 255s
+ * followed by the remainder.
+ */
+static inline uint8_t *writeLength(uint8_t *out, uint32_t length) {
+	while (length >= 255) {
+		*out++ = 255;
+		length -= 255;
+	}
+
+	*out++ = (uint8_t) length;
+	return out;
+}
+
+/**
+ * Emit one sequence: a token, its literals and, unless this is the last
+ * sequence, the match that follows them.
+ *
+ * @return the new output position or nullptr if the output is full
+ */
+static uint8_t *writeSequence(uint8_t *out, uint8_t *outEnd, const uint8_t *literals, uint32_t literalLength, uint32_t offset, uint32_t matchLength) {
+	// Token, literals, worst case length bytes and the offset
+	if ((out + 1 + literalLength + (literalLength / 255) + 1 + 2 + (matchLength / 255) + 1) > outEnd) {
+		return nullptr;
+	}
+
+	uint8_t *token = out++;
+	*token = (uint8_t) (((literalLength < 15) ? literalLength : 15) << 4);
+	if (literalLength >= 15) {
+		out = writeLength(out, literalLength - 15);
+	}
+
+	if (literalLength > 0) {
+		memcpy(out, literals, literalLength);
+		out += literalLength;
+	}
+
+	if (matchLength > 0) {
+		*out++ = (uint8_t) offset;
+		*out++ = (uint8_t) (offset >> 8);
+
+		uint32_t code = matchLength - MIN_MATCH;
+		*token |= (uint8_t) ((code < 15) ? code : 15);
+		if (code >= 15) {
+			out = writeLength(out, code - 15);
+		}
+	}
+
+	return out;
+}
+
+uint32_t Lz4::compress(const void *source, uint32_t sourceSize, void *dest, uint32_t destCapacity) {
+	if (sourceSize > MAX_INPUT_SIZE) {
+		return 0;
+	}
+
+	const uint8_t *in = (const uint8_t *) source;
+	uint8_t *out = (uint8_t *) dest;
+	uint8_t *outEnd = out + destCapacity;
+
+	// Positions are stored + 1 so zero marks an empty slot
+	uint16_t table[1 << HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	uint32_t anchor = 0;
+	if (sourceSize > MATCH_FIND_LIMIT) {
+		uint32_t matchStartLimit = sourceSize - MATCH_FIND_LIMIT;
+		uint32_t matchEndLimit = sourceSize - LAST_LITERALS;
+		uint32_t position = 0;
+
+		while (position < matchStartLimit) {
+			uint32_t word = readWord(in + position);
+			uint32_t hash = hashWord(word);
+			uint32_t candidate = table[hash];
+			table[hash] = (uint16_t) (position + 1);
+
+			if ((candidate == 0) || (readWord(in + candidate - 1) != word)) {
+				position++;
+				continue;
+			}
+
+			uint32_t reference = candidate - 1;
+			uint32_t matchLength = MIN_MATCH;
+			while ((position + matchLength < matchEndLimit) && (in[reference + matchLength] == in[position + matchLength])) {
+				matchLength++;
+			}
+
+			out = writeSequence(out, outEnd, in + anchor, position - anchor, position - reference, matchLength);
+			if (out == nullptr) {
+				return 0;
+			}
+
+			position += matchLength;
+			anchor = position;
+		}
+	}
+
+	out = writeSequence(out, outEnd, in + anchor, sourceSize - anchor, 0, 0);
+	if (out == nullptr) {
+		return 0;
+	}
+
+	return out - (uint8_t *) dest;
+}
+
+/**
+ * Read a length that overflowed its token nibble.
+ *
+ * @return false if the input ran out
+ */
+static inline bool readLength(const uint8_t *&in, const uint8_t *inEnd, uint32_t &length) {
+	uint8_t next;
+	do {
+		if (in >= inEnd) {
+			return false;
+		}
+
+		next = *in++;
+		length += next;
+	} while (next == 255);
+
+	return true;
+}
+
+int32_t Lz4::decompress(const void *source, uint32_t sourceSize, void *dest, uint32_t destCapacity) {
+	const uint8_t *in = (const uint8_t *) source;
+	const uint8_t *inEnd = in + sourceSize;
+	uint8_t *out = (uint8_t *) dest;
+	uint8_t *outEnd = out + destCapacity;
+
+	while (in < inEnd) {
+		uint8_t token = *in++;
+
+		uint32_t literalLength = token >> 4;
+		if ((literalLength == 15) && !readLength(in, inEnd, literalLength)) {
+			return -1;
+		}
+
+		if ((literalLength > (uint32_t) (inEnd - in)) || (literalLength > (uint32_t) (outEnd - out))) {
+			return -1;
+		}
+
+		memcpy(out, in, literalLength);
+		in += literalLength;
+		out += literalLength;
+
+		// The last sequence has no match
+		if (in == inEnd) {
+			break;
+		}
+
+		if (inEnd - in < 2) {
+			return -1;
+		}
+
+		uint32_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		if ((offset == 0) || (offset > (uint32_t) (out - (uint8_t *) dest))) {
+			return -1;
+		}
+
+		uint32_t matchLength = token & 15;
+		if ((matchLength == 15) && !readLength(in, inEnd, matchLength)) {
+			return -1;
+		}
+
+		matchLength += MIN_MATCH;
+		if (matchLength > (uint32_t) (outEnd - out)) {
+			return -1;
+		}
+
+		// Matches may overlap their own output, so copy forwards a byte
+		// at a time unless the regions are far enough apart
+		const uint8_t *match = out - offset;
+		if (offset >= matchLength) {
+			memcpy(out, match, matchLength);
+			out += matchLength;
+		} else {
+			while (matchLength--) {
+				*out++ = *match++;
+			}
+		}
+	}
+
+	return out - (uint8_t *) dest;
+}
@@ -10,9 +10,11 @@
 
 #include <arduino/ESP32Terminal/ESP32Terminal.h>
 #include <arduino/logging/Logger.h>
+#include <arduino/network/NetworkUtils.h>
 #include <arduino/settings/SettingsManager.h>
 #include <shared/ui/DisplayManager.h>
 #include <shared/misc/Utils.h>
+#include <CoverArtPipeline.h>
 
 #include "ArduinoApp.h"
 
@@ -54,6 +56,18 @@ void ArduinoApp::afterLvglInit() {
 
 	DisplayManager::get().setCurrentScreen(&playbackScreen);
 
+	// Cover art URLs are downloaded on the pipeline task, and a newer
+	// track change abandons the download
+	CoverArtPipeline::get().setFetcher([](const char *url, const char *path, const CancelToken &cancel) {
+		String urlString(url);
+		return NetworkUtils::httpGetToFile(urlString, path, cancel);
+	});
+
+	// Keep fetched art on LittleFS so it survives a reboot
+	if (ArtStore::get().start()) {
+		CoverArtPipeline::get().setStore(&ArtStore::get());
+	}
+
 	networkManager.start();
   Logger::get().println("Setup done");
 }
@@ -9,6 +9,9 @@
 #include <ArduinoOTA.h>
 #include <ESPmDNS.h>
 #include <LittleFS.h>
+#include <InMemoryFS.h>
+#include <string>
+#include <vector>
 
 #include <defaults.h>
 #include <arduino/logging/Logger.h>
@@ -280,6 +283,90 @@ void NetworkManager::getInfo(AsyncWebServerRequest *request, bool featuresOnly)
     request->send(response);
 }
 
+/**
+ * @brief A copy of an InMemoryFS entry, taken so the response can be
+ * built after the file system is released.
+ */
+struct MemoryFSEntry {
+    std::string path;
+    InMemoryFS::EntryInfo info;
+};
+
+/**
+ * @brief Handle a request for the InMemoryFS statistics and
+ * the files it currently holds.
+ *
+ * @param request The incoming request information.
+ */
+void getMemoryFS(AsyncWebServerRequest *request) {
+    static const char *regionNames[] = { "Internal", "Psram", "Static" };
+
+    InMemoryFS::Stats stats = InMemoryFS::getStats();
+
+    // Copy the entries out so the file system is not held while the
+    // response is built
+    std::vector<MemoryFSEntry> copies;
+    copies.reserve(stats.entryCount);
+    InMemoryFS::forEachEntry([&copies](const InMemoryFS::EntryInfo &info) {
+        copies.push_back({ info.path, info });
+    });
+
+    // The paths are copied into the document, everything else fits in the slots
+    size_t capacity = JSON_OBJECT_SIZE(13) + JSON_OBJECT_SIZE(3) + JSON_ARRAY_SIZE(copies.size());
+    for (const MemoryFSEntry &copy : copies) {
+        capacity += JSON_OBJECT_SIZE(8) + copy.path.size() + 1;
+    }
+
+    AsyncJsonResponse *response = new AsyncJsonResponse(false, capacity);
+    JsonVariant &root = response->getRoot();
+    JsonObject obj = root.to<JsonObject>();
+
+    JsonObject resident = obj.createNestedObject("ResidentBytes");
+    for (int region = InMemoryFS::MEMORY_INTERNAL; region <= InMemoryFS::MEMORY_STATIC; region++) {
+        resident[regionNames[region]] = stats.residentBytes[region];
+    }
+
+    obj["EntryCount"] = stats.entryCount;
+    obj["Opens"] = stats.opens;
+    obj["Misses"] = stats.misses;
+    obj["BytesRead"] = stats.bytesRead;
+    obj["OpenCursors"] = stats.openCursors;
+    obj["PeakOpenCursors"] = stats.peakOpenCursors;
+    obj["CursorPoolExhaustions"] = stats.cursorPoolExhaustions;
+    obj["AccessClock"] = stats.accessClock;
+    obj["Registrations"] = stats.registrations;
+    obj["DedupHits"] = stats.dedupHits;
+    obj["DedupBytesSaved"] = stats.dedupBytesSaved;
+
+    JsonArray entries = obj.createNestedArray("Entries");
+    bool complete = !entries.isNull();
+    for (const MemoryFSEntry &copy : copies) {
+        JsonObject entry = entries.createNestedObject();
+        complete = complete && !entry.isNull() && entry["Path"].set(copy.path);
+        if (!complete) {
+            break;
+        }
+
+        entry["Size"] = copy.info.size;
+        entry["StoredSize"] = copy.info.storedSize;
+        entry["Region"] = regionNames[copy.info.region];
+        entry["Version"] = copy.info.version;
+        entry["LastAccess"] = copy.info.lastAccess;
+        entry["OpenCursors"] = copy.info.openCursors;
+        entry["Shared"] = copy.info.shared;
+    }
+
+    // Rather than a response silently missing entries
+    if (!complete) {
+        delete response;
+        request->send(507, "text/plain", "Not enough memory to list the files");
+        return;
+    }
+
+    response->setLength();
+    request->send(response);
+}
+
 /**
  * @brief Handle a request for a network scan for available
  * wireless networks.
@@ -396,6 +483,10 @@ void NetworkManager::registerHandlers() {
         this->getInfo(request);
     });
     webServer.on("/api/networks", getNetworks);
+    webServer.on("/api/fs/memory", HTTP_GET, [](AsyncWebServerRequest *request) {
+        Logger::get().println("Received get memory fs request");
+        getMemoryFS(request);
+    });
 
     // Web application serving
     webServer.rewrite("/", "/index.html");
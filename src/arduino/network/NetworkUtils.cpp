@@ -7,7 +7,10 @@
  **********************************************************************************/
 #include "NetworkUtils.h"
 
+#include <algorithm>
 #include <HTTPClient.h>
+#include <InMemoryFS.h>
+#include <lvgl.h>
 #include <arduino/logging/Logger.h>
 
 #ifdef ESP32
@@ -40,12 +43,74 @@ WiFiClient* getWifiClient(String& url) {
 }
 
 /**
- * @brief Retrieve a payload from the specified URL.
+ * @brief A response stream that ends as soon as its request is cancelled,
+ * so a receiver reading it stops at its next read.
+ */
+class CancellableStream : public Stream {
+public:
+    CancellableStream(Stream &stream, const CancelToken &cancel) : stream(stream), cancel(cancel) {}
+
+    int available() override {
+        return cancel.isCancelled() ? 0 : stream.available();
+    }
+
+    int read() override {
+        return cancel.isCancelled() ? -1 : stream.read();
+    }
+
+    int peek() override {
+        return cancel.isCancelled() ? -1 : stream.peek();
+    }
+
+    size_t readBytes(char *buffer, size_t length) override {
+        // Read in pieces so a cancel is noticed part way through a large read
+        size_t total = 0;
+        while ((total < length) && !cancel.isCancelled()) {
+            size_t wanted = std::min(length - total, READ_PIECE);
+            size_t count = stream.readBytes(buffer + total, wanted);
+            total += count;
+            if (count < wanted) {
+                break;
+            }
+        }
+
+        return total;
+    }
+
+    size_t write(uint8_t byte) override {
+        return stream.write(byte);
+    }
+
+    void flush() override {
+        stream.flush();
+    }
+
+private:
+    static const size_t READ_PIECE = 512;
+
+    Stream &stream;
+    const CancelToken &cancel;
+};
+
+/**
+ * @brief A function to handle the response to a GET request while the
+ * connection is still open.
+ */
+typedef std::function<void(int httpResponse, HTTPClient &http)> ResponseHandler;
+
+/**
+ * @brief Execute a GET request and hand the response to the handler,
+ * unless the request is cancelled before the response arrives.
  *
  * @param url
- * @param receiver
+ * @param handler
+ * @param cancel
  */
-void NetworkUtils::httpGet(String& url, StreamReceiver receiver) {
+static void executeGet(String& url, ResponseHandler handler, const CancelToken &cancel) {
+    if (cancel.isCancelled()) {
+        return;
+    }
+
     WiFiClient* client = getWifiClient(url);
 
     // Set up the REST client to make it easy to handle JSON
@@ -60,9 +125,104 @@ void NetworkUtils::httpGet(String& url, StreamReceiver receiver) {
     int httpResponseCode = http.GET();
     Logger::get().printf("GET request result code: %d\n", httpResponseCode);
 
-    receiver(httpResponseCode, http.getStream());
+    if (!cancel.isCancelled()) {
+        handler(httpResponseCode, http);
+    }
 
     http.end();
     client->stop();
     delete(client);
 }
+
+/**
+ * @brief Retrieve a payload from the specified URL.
+ *
+ * @param url
+ * @param receiver
+ * @param cancel
+ */
+void NetworkUtils::httpGet(String& url, StreamReceiver receiver, const CancelToken &cancel) {
+    executeGet(url, [&](int httpResponse, HTTPClient &http) {
+        CancellableStream stream(http.getStream(), cancel);
+        receiver(httpResponse, stream);
+    }, cancel);
+}
+
+/**
+ * @brief Copy a response body into a file opened for writing.
+ *
+ * @param stream The response body
+ * @param contentLength The expected length, or -1 if unknown
+ * @param file The file to write
+ * @param cancel Checked between chunks
+ * @return true if the whole body was written
+ */
+static bool streamToFile(Stream &stream, int contentLength, lv_fs_file_t *file, const CancelToken &cancel) {
+    uint8_t chunk[512];
+    uint32_t received = 0;
+
+    while ((contentLength < 0) || (received < (uint32_t) contentLength)) {
+        size_t wanted = sizeof(chunk);
+        if ((contentLength >= 0) && (contentLength - received < wanted)) {
+            wanted = contentLength - received;
+        }
+
+        // Returns short only when the stream times out or ends
+        size_t count = cancel.isCancelled() ? 0 : stream.readBytes(chunk, wanted);
+        if (count == 0) {
+            break;
+        }
+
+        uint32_t written;
+        if (lv_fs_write(file, chunk, count, &written) != LV_FS_RES_OK) {
+            return false;
+        }
+
+        received += count;
+    }
+
+    if (cancel.isCancelled()) {
+        return false;
+    }
+
+    return (contentLength < 0) || (received == (uint32_t) contentLength);
+}
+
+/**
+ * @brief Download a payload from the specified URL into an InMemoryFS file.
+ *
+ * @param url
+ * @param path
+ * @param cancel
+ * @return true if the file was downloaded and published
+ */
+bool NetworkUtils::httpGetToFile(String& url, const char *path, const CancelToken &cancel) {
+    bool success = false;
+
+    executeGet(url, [&](int httpResponse, HTTPClient &http) {
+        if (httpResponse != HTTP_CODE_OK) {
+            return;
+        }
+
+        String drivePath = String(InMemoryFS::DRIVE_LETTER) + ":" + path;
+        lv_fs_file_t file;
+        if (lv_fs_open(&file, drivePath.c_str(), LV_FS_MODE_WR) != LV_FS_RES_OK) {
+            Logger::get().printf("Unable to open %s for writing\n", drivePath.c_str());
+            return;
+        }
+
+        // Size the file once up front when the server reports the length
+        int contentLength = http.getSize();
+        if ((contentLength > 0) && !InMemoryFS::reserveFile(&file, contentLength)) {
+            Logger::get().printf("Unable to reserve %d bytes for %s\n", contentLength, path);
+            InMemoryFS::discardFile(&file);
+        } else if (!streamToFile(http.getStream(), contentLength, &file, cancel)) {
+            Logger::get().printf("Download of %s incomplete\n", path);
+            InMemoryFS::discardFile(&file);
+        }
+
+        success = (lv_fs_close(&file) == LV_FS_RES_OK);
+    }, cancel);
+
+    return success;
+}
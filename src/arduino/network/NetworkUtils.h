@@ -9,6 +9,7 @@
 
 #include <functional>
 #include <ArduinoJson.h>
+#include <CancelToken.h>
 
 /**
  * @brief A function to receive the result of an HTTP operation.
@@ -21,10 +22,26 @@ typedef std::function<void(int httpResponse, Stream &responseStream)> StreamRece
  */
 namespace NetworkUtils {
     /**
-     * @brief Retrieve a payload from the specified URL.
+     * @brief Retrieve a payload from the specified URL.  Once the token
+     * is cancelled the response stream ends early, so the receiver stops
+     * reading and the connection is closed.
      *
      * @param url
      * @param receiver
+     * @param cancel
      */
-    void httpGet(String& url, StreamReceiver receiver);
+    void httpGet(String& url, StreamReceiver receiver, const CancelToken &cancel = CancelToken());
+
+    /**
+     * @brief Download a payload from the specified URL straight into
+     * an InMemoryFS file, streaming the body through the driver rather
+     * than buffering it first.  The file is published only once the
+     * whole body has arrived.
+     *
+     * @param url
+     * @param path The InMemoryFS path of the file, without the drive letter
+     * @param cancel Abandons the download, discarding the partial file
+     * @return true if the file was downloaded and published
+     */
+    bool httpGetToFile(String& url, const char *path, const CancelToken &cancel = CancelToken());
 };
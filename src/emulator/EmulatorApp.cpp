@@ -43,15 +43,10 @@ void testCoverImage(PlaybackScreen *playbackScreen) {
 	auto testImagesFolder = cwd / "test/assets/images";
 	auto imagePath = testImagesFolder / FILENAME;
 
-	auto fileSize = std::filesystem::file_size(imagePath);
-	uint8_t *imageData = new uint8_t[fileSize];
-	auto file = std::fopen(imagePath.c_str(), "rb");
-	std::fread(imageData, 1, fileSize, file);
-	InMemoryFS::registerFile(FILENAME, imageData, fileSize);
-	fclose(file);
-
-	playbackScreen->setCoverImage(FILENAME_WITH_DRIVE);
-	delete [] imageData;
+	// Served straight from the mapped file, so nothing is read into memory
+	InMemoryFS::registerMappedFile(FILENAME, imagePath.c_str());
+
+	playbackScreen->setCoverArt(FILENAME_WITH_DRIVE);
 }
 
 void EmulatorApp::afterLvglInit() {
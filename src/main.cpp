@@ -15,6 +15,9 @@
 #ifdef USE_SDL
   #include <emulator/EmulatorApp.h>
   EmulatorApp app;
+#elif defined(SIDECAR)
+  #include <sidecar/SidecarApp.h>
+  SidecarApp app;
 #else
   #include <arduino/ArduinoApp.h>
   ArduinoApp app;
@@ -34,7 +37,7 @@ void setup() {
   app.setup();
 }
 
-#ifdef USE_SDL
+#if defined(USE_SDL) || defined(SIDECAR)
 /**
  * @brief Main method to match behavior of Arduino
  *
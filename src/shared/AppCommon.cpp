@@ -6,7 +6,10 @@
  * You can obtain one at https://mozilla.org/MPL/2.0/.
  **********************************************************************************/
 #include "AppCommon.h"
+#include <CoverArtPipeline.h>
 #include <InMemoryFS.h>
+#include <PngDecoder.h>
+#include <TiledImage.h>
 
 void AppCommon::lvglInit() {
   // Setup the graphics and hardware abstraction
@@ -18,6 +21,9 @@ void AppCommon::lvglInit() {
     true, LV_FONT_DEFAULT);
 
 	InMemoryFS::registerInMemoryDriver();
+	PngDecoder::registerDecoder();
+	TiledImage::registerDecoder();
+	CoverArtPipeline::get().start();
 }
 
 void AppCommon::setup() {
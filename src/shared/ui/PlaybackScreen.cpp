@@ -7,6 +7,31 @@
  **********************************************************************************/
 #include "PlaybackScreen.h"
 
+#include <CoverArtCache.h>
+#include <CoverArtPipeline.h>
+#include <Placeholder.h>
+#include <string>
+
+// The radius of the cover art corners
+static const uint16_t COVER_RADIUS = 10;
+
+/**
+ * @brief Return the color showing behind an object, that of the nearest
+ * ancestor with an opaque background.
+ *
+ * @param obj
+ * @return lv_color_t
+ */
+static lv_color_t backgroundBehind(lv_obj_t *obj) {
+	for (lv_obj_t *parent = lv_obj_get_parent(obj); parent != nullptr; parent = lv_obj_get_parent(parent)) {
+		if (lv_obj_get_style_bg_opa(parent, LV_PART_MAIN) >= LV_OPA_COVER) {
+			return lv_obj_get_style_bg_color(parent, LV_PART_MAIN);
+		}
+	}
+
+	return lv_obj_get_style_bg_color(lv_obj_get_screen(obj), LV_PART_MAIN);
+}
+
 /**
  * @brief Add the album coverimage image to the parent.
  *
@@ -24,8 +49,9 @@ void PlaybackScreen::addCoverImage(lv_obj_t *parent) {
 	lv_img_set_src(coverImage, &logo);
 	lv_obj_align(coverImage, LV_ALIGN_CENTER, 0, 0);
 	lv_obj_set_size(coverImage, LV_SIZE_CONTENT, LV_SIZE_CONTENT);
-	lv_obj_set_style_radius(coverImage, 10, 0);
-	lv_obj_set_style_clip_corner(coverImage, true, LV_PART_MAIN);
+	lv_img_set_size_mode(coverImage, LV_IMG_SIZE_MODE_REAL);
+	lv_img_set_antialias(coverImage, true);
+	setCornersClipped(true);
 }
 
 /**
@@ -137,6 +163,15 @@ void PlaybackScreen::createScreenWidgets(lv_obj_t *parent) {
 	lv_obj_t *rightLayout = createLayoutContainer(parent);
 	lv_obj_set_size(rightLayout, lv_pct(45), lv_pct(100));
 	addCoverImage(rightLayout);
+
+	// Decode cover art at the size of its column rather than scaling it
+	// every time it is drawn
+	lv_obj_update_layout(rightLayout);
+	CoverArtCache::get().setTargetSize(lv_obj_get_content_width(rightLayout), lv_obj_get_content_height(rightLayout));
+
+	// Round the corners of cover art once as it is cached, rather than
+	// masking them every time the art is drawn
+	CoverArtCache::get().setCorners(COVER_RADIUS, backgroundBehind(coverImage));
 }
 
 void PlaybackScreen::handleEvent(lv_event_t *event, int action) {
@@ -174,8 +209,93 @@ void PlaybackScreen::setArtist(const char *artist) {
 	lv_label_set_text(artistLabel, artist);
 }
 
+/**
+ * @brief Show cover art, decoded once and kept in the cover art cache
+ * so redraws are a blit rather than a decode.  Art not yet cached is
+ * decoded by the cover art pipeline and appears when it is ready, while
+ * the current art stays on screen, or the placeholder if one is given.
+ *
+ * @param source The path of the image, such as an InMemoryFS path.
+ * @param placeholder A BlurHash or tiny thumbnail of the art, or nullptr.
+ */
+void PlaybackScreen::setCoverArt(const char *source, const char *placeholder) {
+	if ((placeholder != nullptr) && !CoverArtCache::get().contains(source)) {
+		showPlaceholder(placeholder);
+	}
+
+	std::string path(source);
+	CoverArtPipeline::get().request(source, [this, path](const lv_img_dsc_t *image) {
+		showCoverArt(image, path.c_str());
+	});
+}
+
 void PlaybackScreen::setCoverImage(const void *src) {
+	CoverArtPipeline::get().cancel();
 	lv_img_set_src(coverImage, src);
+	lv_img_set_zoom(coverImage, LV_IMG_ZOOM_NONE);
+	setCornersClipped(true);
+
+	CoverArtCache::get().release(coverArt);
+	coverArt = nullptr;
+}
+
+/**
+ * @brief Swap in decoded cover art, releasing the art it replaces.  Art
+ * that could not be fetched leaves the current art or placeholder in
+ * place, as LVGL has nothing it could draw from a URL.
+ *
+ * @param image The decoded art, or nullptr if it could not be decoded.
+ * @param source The path or URL the art was requested from.
+ */
+void PlaybackScreen::showCoverArt(const lv_img_dsc_t *image, const char *source) {
+	if ((image == nullptr) && CoverArtPipeline::isUrl(source)) {
+		return;
+	}
+
+	const lv_img_dsc_t *previous = coverArt;
+	coverArt = image;
+
+	// Fall back to letting LVGL decode a local image itself
+	lv_img_set_src(coverImage, (coverArt != nullptr) ? (const void *) coverArt : source);
+	lv_img_set_zoom(coverImage, LV_IMG_ZOOM_NONE);
+	setCornersClipped(coverArt == nullptr);
+	CoverArtCache::get().release(previous);
+}
+
+/**
+ * @brief Show a placeholder for art on its way.  It is decoded small
+ * and zoomed to the size the full art will be shown at, so the cover
+ * does not jump when the art replaces it.
+ *
+ * @param placeholder A BlurHash or tiny thumbnail of the art.
+ */
+void PlaybackScreen::showPlaceholder(const char *placeholder) {
+	Surface *surface = Placeholder::decode(placeholder);
+	if (surface == nullptr) {
+		return;
+	}
+
+	uint16_t slot = LV_MIN(CoverArtCache::get().getTargetWidth(), CoverArtCache::get().getTargetHeight());
+	uint16_t size = LV_MAX(surface->width(), surface->height());
+
+	const lv_img_dsc_t *previous = coverArt;
+	coverArt = &surface->image;
+	lv_img_set_src(coverImage, coverArt);
+	lv_img_set_zoom(coverImage, (slot > 0) ? (LV_IMG_ZOOM_NONE * slot) / size : LV_IMG_ZOOM_NONE);
+	setCornersClipped(true);
+	CoverArtCache::get().release(previous);
+}
+
+/**
+ * @brief Clip the corners of the cover image while it shows an image
+ * without rounded corners of its own, such as the logo or a placeholder.
+ * Cached art has its corners baked in and is drawn without the mask.
+ *
+ * @param clipped Whether the corners are clipped.
+ */
+void PlaybackScreen::setCornersClipped(bool clipped) {
+	lv_obj_set_style_radius(coverImage, clipped ? COVER_RADIUS : 0, LV_PART_MAIN);
+	lv_obj_set_style_clip_corner(coverImage, clipped, LV_PART_MAIN);
 }
 
 void PlaybackScreen::setTitle(const char *title) {
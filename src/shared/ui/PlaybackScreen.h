@@ -12,7 +12,7 @@
 
 class PlaybackScreen : public Screen {
 public:
-	PlaybackScreen() : Screen() {}
+	PlaybackScreen() : Screen(), coverArt(nullptr) {}
 
 	virtual void createScreenWidgets(lv_obj_t *parent);
 
@@ -21,6 +21,7 @@ public:
 	void onPreviousClick(EventHandler eventHandler);
 
 	void setArtist(const char *artist);
+	void setCoverArt(const char *source, const char *placeholder = nullptr);
 	void setCoverImage(const void *src);
 	void setTitle(const char *title);
 	void setProgress(int progress);
@@ -44,6 +45,7 @@ private:
 	lv_obj_t *titleLabel;
 	lv_obj_t *artistLabel;
 	lv_obj_t *coverImage;
+	const lv_img_dsc_t *coverArt;
 	lv_obj_t *progressStartLabel;
 	lv_obj_t *progressSlider;
 	lv_obj_t *progressEndLabel;
@@ -56,4 +58,7 @@ private:
 	lv_obj_t *addPlaybackControlButton(lv_obj_t *parent, const char *label);
 	lv_obj_t *addPlaybackControls(lv_obj_t *parent);
 	lv_obj_t *addProgressControls(lv_obj_t *parent);
+	void showCoverArt(const lv_img_dsc_t *image, const char *source);
+	void showPlaceholder(const char *placeholder);
+	void setCornersClipped(bool clipped);
 };
@@ -0,0 +1,148 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#include "ArtServer.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static const char *ART_PREFIX = "GET /art/";
+
+// Requests are a line and a few headers; anything longer is refused
+static const size_t MAX_REQUEST_SIZE = 2048;
+
+// How long a client may take to send its request
+static const int REQUEST_TIMEOUT_SECONDS = 5;
+
+static bool sendAll(int socket, const void *data, size_t size) {
+	const uint8_t *bytes = (const uint8_t *) data;
+	while (size > 0) {
+		ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+		if (sent <= 0) {
+			return false;
+		}
+
+		bytes += sent;
+		size -= sent;
+	}
+
+	return true;
+}
+
+static void sendStatus(int socket, const char *status) {
+	char response[128];
+	int length = snprintf(response, sizeof(response),
+		"HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+	sendAll(socket, response, length);
+}
+
+bool ArtServer::start(uint16_t port) {
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener < 0) {
+		return false;
+	}
+
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if ((bind(listener, (sockaddr *) &address, sizeof(address)) != 0) || (listen(listener, 8) != 0)) {
+		close(listener);
+		listener = -1;
+		return false;
+	}
+
+	running = true;
+	thread = std::thread([this] { serve(); });
+	return true;
+}
+
+void ArtServer::stop() {
+	if (!running.exchange(false)) {
+		return;
+	}
+
+	thread.join();
+	close(listener);
+	listener = -1;
+}
+
+void ArtServer::serve() {
+	while (running) {
+		// Wake up now and then to notice being stopped
+		pollfd pending = { listener, POLLIN, 0 };
+		if (poll(&pending, 1, 250) <= 0) {
+			continue;
+		}
+
+		int client = accept(listener, nullptr, nullptr);
+		if (client < 0) {
+			continue;
+		}
+
+		timeval timeout = { REQUEST_TIMEOUT_SECONDS, 0 };
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		answer(client);
+		close(client);
+	}
+}
+
+/**
+ * Reads the request line and answers it.  The headers are read up to
+ * the blank line so the client sees the response, but otherwise ignored.
+ */
+void ArtServer::answer(int client) {
+	std::string request;
+	char buffer[512];
+	while (request.find("\r\n\r\n") == std::string::npos) {
+		ssize_t count = recv(client, buffer, sizeof(buffer), 0);
+		if (count <= 0) {
+			return;
+		}
+
+		request.append(buffer, count);
+		if (request.size() > MAX_REQUEST_SIZE) {
+			sendStatus(client, "431 Request Header Fields Too Large");
+			return;
+		}
+	}
+
+	std::string line = request.substr(0, request.find("\r\n"));
+	if (line.compare(0, strlen(ART_PREFIX), ART_PREFIX) != 0) {
+		sendStatus(client, "404 Not Found");
+		return;
+	}
+
+	size_t nameStart = strlen(ART_PREFIX);
+	std::string name = line.substr(nameStart, line.find(' ', nameStart) - nameStart);
+	ArtTranscoder::Payload payload = lookup(name);
+	if (!payload) {
+		sendStatus(client, "404 Not Found");
+		return;
+	}
+
+	// Payloads never change under a name, so displays may keep them
+	char header[192];
+	int length = snprintf(header, sizeof(header),
+		"HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %u\r\n"
+		"Cache-Control: max-age=31536000, immutable\r\nConnection: close\r\n\r\n",
+		(unsigned int) payload->size());
+
+	if (sendAll(client, header, length)) {
+		sendAll(client, payload->data(), payload->size());
+	}
+}
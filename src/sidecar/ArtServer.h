@@ -0,0 +1,52 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#pragma once
+
+#include <ArtTranscoder.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+/**
+ * A minimal HTTP server handing transcoded art to displays.  Only
+ * GET /art/<name> is answered, with the payload found under the name or
+ * a 404.  Requests are answered one at a time on the server's thread;
+ * payloads are small and displays fetch each once.
+ */
+class ArtServer {
+public:
+	/**
+	 * @brief Looks up the payload for a name, or returns nullptr.
+	 */
+	typedef std::function<ArtTranscoder::Payload(const std::string &name)> Lookup;
+
+	ArtServer(Lookup lookup) : lookup(lookup), listener(-1), running(false) {}
+	~ArtServer() { stop(); }
+
+	// Disable copy semantics
+	ArtServer(const ArtServer&) = delete;
+
+	/**
+	 * Listens on the port and starts answering requests.
+	 *
+	 * @return false if the port could not be bound
+	 */
+	bool start(uint16_t port);
+	void stop();
+
+private:
+	Lookup lookup;
+	int listener;
+	std::atomic<bool> running;
+	std::thread thread;
+
+	void serve();
+	void answer(int client);
+};
@@ -0,0 +1,240 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#include "SidecarApp.h"
+
+#include <InMemoryFS.h>
+#include <PngDecoder.h>
+#include <TiledImage.h>
+#include <curl/curl.h>
+#include <defaults.h>
+#include <mosquitto.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+#ifndef SIDECAR_MQTT_HOST
+	#define SIDECAR_MQTT_HOST "localhost"
+#endif
+
+#ifndef SIDECAR_MQTT_PORT
+	#define SIDECAR_MQTT_PORT 1883
+#endif
+
+#ifndef SIDECAR_ART_TOPIC
+	#define SIDECAR_ART_TOPIC MDNS_NAME "/art_url"
+#endif
+
+#ifndef SIDECAR_HTTP_PORT
+	#define SIDECAR_HTTP_PORT 8080
+#endif
+
+// The cover art slot of the playback screen
+#ifndef SIDECAR_ART_WIDTH
+	#define SIDECAR_ART_WIDTH 216
+#endif
+
+#ifndef SIDECAR_ART_HEIGHT
+	#define SIDECAR_ART_HEIGHT 320
+#endif
+
+// How long the loop sleeps when there is no art to transcode
+static const std::chrono::milliseconds IDLE_SLEEP(50);
+
+static const long FETCH_CONNECT_TIMEOUT_SECONDS = 10;
+static const long FETCH_TIMEOUT_SECONDS = 60;
+
+static std::string setting(const char *name, const char *fallback) {
+	const char *value = getenv(name);
+	return ((value != nullptr) && (*value != '\0')) ? value : fallback;
+}
+
+static long setting(const char *name, long fallback) {
+	const char *value = getenv(name);
+	return ((value != nullptr) && (*value != '\0')) ? strtol(value, nullptr, 10) : fallback;
+}
+
+static std::string defaultPublicUrl() {
+	char host[256] = "localhost";
+	gethostname(host, sizeof(host) - 1);
+	return "http://" + std::string(host) + ":" + std::to_string(setting("SIDECAR_HTTP_PORT", (long) SIDECAR_HTTP_PORT));
+}
+
+static size_t writeToFile(char *data, size_t size, size_t count, void *file) {
+	uint32_t written = 0;
+	if (lv_fs_write((lv_fs_file_t *) file, data, size * count, &written) != LV_FS_RES_OK) {
+		return 0;
+	}
+
+	return written;
+}
+
+static int checkCancelled(void *cancel, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+	return ((const CancelToken *) cancel)->isCancelled() ? 1 : 0;
+}
+
+/**
+ * @brief Download a URL into an InMemoryFS file, as the displays do.
+ *
+ * @return true if the file was downloaded and published
+ */
+static bool fetchArt(const char *url, const char *path, const CancelToken &cancel) {
+	std::string drivePath = std::string(1, InMemoryFS::DRIVE_LETTER) + ":" + path;
+	lv_fs_file_t file;
+	if (lv_fs_open(&file, drivePath.c_str(), LV_FS_MODE_WR) != LV_FS_RES_OK) {
+		fprintf(stderr, "Unable to open %s for writing\n", drivePath.c_str());
+		return false;
+	}
+
+	CURL *curl = curl_easy_init();
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, FETCH_CONNECT_TIMEOUT_SECONDS);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, FETCH_TIMEOUT_SECONDS);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToFile);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &file);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, checkCancelled);
+	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &cancel);
+
+	CURLcode result = curl_easy_perform(curl);
+	curl_easy_cleanup(curl);
+	if (result != CURLE_OK) {
+		fprintf(stderr, "Download of %s failed: %s\n", url, curl_easy_strerror(result));
+		InMemoryFS::discardFile(&file);
+	}
+
+	return (lv_fs_close(&file) == LV_FS_RES_OK) && (result == CURLE_OK);
+}
+
+SidecarApp::SidecarApp() :
+	AppCommon(),
+	artTopic(setting("SIDECAR_ART_TOPIC", SIDECAR_ART_TOPIC)),
+	publicUrl(setting("SIDECAR_PUBLIC_URL", defaultPublicUrl().c_str())),
+	transcoder(fetchArt, setting("SIDECAR_ART_WIDTH", (long) SIDECAR_ART_WIDTH), setting("SIDECAR_ART_HEIGHT", (long) SIDECAR_ART_HEIGHT)),
+	server([this](const std::string &name) { return transcoder.find(name); }),
+	mqtt(nullptr) {
+}
+
+/**
+ * There is no display, so only the file system and the image decoders
+ * are set up.
+ */
+void SidecarApp::lvglInit() {
+	lv_init();
+
+	InMemoryFS::registerInMemoryDriver();
+	PngDecoder::registerDecoder();
+	TiledImage::registerDecoder();
+}
+
+void SidecarApp::afterLvglInit() {
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+
+	uint16_t httpPort = setting("SIDECAR_HTTP_PORT", (long) SIDECAR_HTTP_PORT);
+	if (server.start(httpPort)) {
+		printf("Serving art on port %u as %s/art/\n", httpPort, publicUrl.c_str());
+	} else {
+		fprintf(stderr, "Unable to serve art on port %u\n", httpPort);
+	}
+
+	startMqtt();
+}
+
+void SidecarApp::startMqtt() {
+	mosquitto_lib_init();
+
+	std::string clientId = MDNS_NAME "-sidecar-" + std::to_string(getpid());
+	mqtt = mosquitto_new(clientId.c_str(), true, this);
+	if (mqtt == nullptr) {
+		fprintf(stderr, "Unable to create the MQTT client\n");
+		return;
+	}
+
+	mosquitto_connect_callback_set(mqtt, onConnect);
+	mosquitto_message_callback_set(mqtt, onMessage);
+
+	// The network thread keeps reconnecting if the broker goes away
+	std::string host = setting("SIDECAR_MQTT_HOST", SIDECAR_MQTT_HOST);
+	int port = setting("SIDECAR_MQTT_PORT", (long) SIDECAR_MQTT_PORT);
+	mosquitto_connect_async(mqtt, host.c_str(), port, 60);
+	mosquitto_loop_start(mqtt);
+
+	printf("Transcoding art published to %s on %s:%d\n", artTopic.c_str(), host.c_str(), port);
+}
+
+/**
+ * Subscribes on every connection, so a reconnect picks up again.
+ */
+void SidecarApp::onConnect(mosquitto *mqtt, void *app, int result) {
+	SidecarApp *sidecar = (SidecarApp *) app;
+	if (result != 0) {
+		fprintf(stderr, "MQTT connection refused: %s\n", mosquitto_connack_string(result));
+		return;
+	}
+
+	mosquitto_subscribe(mqtt, nullptr, sidecar->artTopic.c_str(), 1);
+}
+
+/**
+ * Queues art URLs for the loop, which transcodes on the LVGL thread.
+ */
+void SidecarApp::onMessage(mosquitto *mqtt, void *app, const mosquitto_message *message) {
+	SidecarApp *sidecar = (SidecarApp *) app;
+	if (message->payloadlen <= 0) {
+		return;
+	}
+
+	std::string url((const char *) message->payload, message->payloadlen);
+	std::lock_guard<std::mutex> lock(sidecar->mutex);
+	if (sidecar->pendingUrls.empty() || (sidecar->pendingUrls.back() != url)) {
+		sidecar->pendingUrls.push_back(url);
+	}
+}
+
+/**
+ * Transcodes the art at a URL and publishes it to the displays.  Both
+ * messages are retained so a display starting later finds the art.
+ */
+void SidecarApp::transcode(const std::string &url) {
+	ArtTranscoder::Payload payload = transcoder.transcode(url);
+	if (!payload) {
+		fprintf(stderr, "Unable to transcode %s\n", url.c_str());
+		return;
+	}
+
+	std::string tileTopic = artTopic + "/tile";
+	std::string tileUrl = publicUrl + "/art/" + ArtTranscoder::nameOf(url);
+	mosquitto_publish(mqtt, nullptr, tileTopic.c_str(), payload->size(), payload->data(), 1, true);
+	mosquitto_publish(mqtt, nullptr, (tileTopic + "_url").c_str(), tileUrl.size(), tileUrl.c_str(), 1, true);
+
+	ArtTranscoder::Stats stats = transcoder.getStats();
+	printf("Transcoded %s into %s (%u bytes, %u kept)\n", url.c_str(), tileUrl.c_str(),
+		(unsigned int) payload->size(), (unsigned int) stats.entryCount);
+}
+
+void SidecarApp::loop() {
+	std::string url;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!pendingUrls.empty()) {
+			url = pendingUrls.front();
+			pendingUrls.pop_front();
+		}
+	}
+
+	if (url.empty()) {
+		std::this_thread::sleep_for(IDLE_SLEEP);
+		return;
+	}
+
+	transcode(url);
+}
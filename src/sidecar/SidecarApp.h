@@ -0,0 +1,61 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#pragma once
+
+#include <ArtTranscoder.h>
+#include <shared/AppCommon.h>
+#include <sidecar/ArtServer.h>
+
+#include <deque>
+#include <mutex>
+#include <string>
+
+struct mosquitto;
+struct mosquitto_message;
+
+/**
+ * A headless host for the displays sharing a player.  It listens to the
+ * cover art URLs the player publishes, downloads and transcodes the art
+ * once, and hands every display a TiledImage payload it draws without
+ * decoding: retained on MQTT under <art topic>/tile, and over HTTP at
+ * the URL retained under <art topic>/tile_url.
+ *
+ * Settings are read from the environment, falling back to the SIDECAR_*
+ * build defaults:
+ *   SIDECAR_MQTT_HOST, SIDECAR_MQTT_PORT  the broker
+ *   SIDECAR_ART_TOPIC                     the topic carrying art URLs
+ *   SIDECAR_HTTP_PORT                     the port art is served on
+ *   SIDECAR_PUBLIC_URL                    how displays reach this host
+ *   SIDECAR_ART_WIDTH, SIDECAR_ART_HEIGHT the size displays show art at
+ */
+class SidecarApp : public AppCommon {
+public:
+	SidecarApp();
+	virtual void loop();
+
+protected:
+	virtual void lvglInit();
+	virtual void afterLvglInit();
+
+private:
+	std::string artTopic;
+	std::string publicUrl;
+	ArtTranscoder transcoder;
+	ArtServer server;
+	mosquitto *mqtt;
+
+	// Guarded by the mutex
+	std::mutex mutex;
+	std::deque<std::string> pendingUrls;
+
+	void startMqtt();
+	void transcode(const std::string &url);
+
+	static void onConnect(mosquitto *mqtt, void *app, int result);
+	static void onMessage(mosquitto *mqtt, void *app, const mosquitto_message *message);
+};
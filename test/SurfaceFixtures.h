@@ -0,0 +1,35 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#pragma once
+
+#include <Surface.h>
+#include <string.h>
+
+/**
+ * Create a surface whose top half is smooth and whose bottom half is
+ * noise, so some of it compresses and some does not.
+ *
+ * @param seed varies the noise, so surfaces of one size can differ
+ */
+static inline Surface *makeSurface(uint16_t width, uint16_t height, lv_img_cf_t cf, uint32_t seed = 1) {
+  Surface *surface = Surface::create(width, height, cf);
+  for (uint16_t y = 0; y < height; y++) {
+    uint8_t *row = surface->row(y);
+    for (uint32_t i = 0; i < surface->stride(); i++) {
+      seed = (seed * 1103515245u) + 12345u;
+      row[i] = (y < height / 2) ? (uint8_t) (i / 8) : (uint8_t) (seed >> 16);
+    }
+  }
+
+  return surface;
+}
+
+static inline bool samePixels(Surface *a, Surface *b) {
+  return (a->width() == b->width()) && (a->height() == b->height()) &&
+    (a->byteSize() == b->byteSize()) && (memcmp(a->pixels(), b->pixels(), a->byteSize()) == 0);
+}
@@ -0,0 +1,236 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#include "unity.h"
+#include "../SurfaceFixtures.h"
+#include <ArtStore.h>
+#include <CoverArtPipeline.h>
+#include <InMemoryFS.h>
+#include <chrono>
+#include <filesystem>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+static std::string directory;
+
+static uint32_t fileCount() {
+  uint32_t count = 0;
+  for (const auto &entry : std::filesystem::directory_iterator(directory)) {
+    if (entry.path().extension() == ".art") {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+void setUp() {
+  lv_init();
+  InMemoryFS::registerInMemoryDriver();
+
+  char pattern[] = "/tmp/artstoreXXXXXX";
+  directory = mkdtemp(pattern);
+}
+
+void tearDown() {
+  std::filesystem::remove_all(directory);
+}
+
+void test_art_round_trips() {
+  ArtStore store(directory.c_str());
+  TEST_ASSERT_TRUE(store.start());
+
+  Surface *art = makeSurface(100, 80, LV_IMG_CF_TRUE_COLOR, 1);
+  store.save("http://example.com/a.jpg", 216, 320, art);
+  store.flush();
+
+  ArtStore::Stats stats = store.getStats();
+  TEST_ASSERT_EQUAL(1, stats.writes);
+  TEST_ASSERT_EQUAL(1, stats.entryCount);
+
+  // Half the art compresses, so the file is well under the raw size
+  TEST_ASSERT_LESS_THAN(art->byteSize() * 3 / 4, stats.storedBytes);
+
+  Surface *loaded = store.load("http://example.com/a.jpg", 216, 320);
+  TEST_ASSERT_NOT_NULL(loaded);
+  TEST_ASSERT_TRUE(samePixels(art, loaded));
+  loaded->release();
+
+  // Art decoded for another size or from another source is not a match
+  TEST_ASSERT_NULL(store.load("http://example.com/a.jpg", 100, 100));
+  TEST_ASSERT_NULL(store.load("http://example.com/b.jpg", 216, 320));
+
+  art->release();
+}
+
+void test_art_survives_restart() {
+  Surface *first = makeSurface(40, 40, LV_IMG_CF_TRUE_COLOR, 1);
+  Surface *second = makeSurface(40, 40, LV_IMG_CF_TRUE_COLOR, 2);
+  {
+    ArtStore store(directory.c_str());
+    store.start();
+    store.save("http://example.com/1.jpg", 40, 40, first);
+    store.save("http://example.com/2.jpg", 40, 40, second);
+    store.stop();
+  }
+
+  // A write interrupted by a power cut leaves a temporary file behind
+  FILE *partial = fopen((directory + "/0badf00d.tmp").c_str(), "wb");
+  fputs("partial", partial);
+  fclose(partial);
+
+  ArtStore store(directory.c_str());
+  TEST_ASSERT_TRUE(store.start());
+  TEST_ASSERT_EQUAL(2, store.getStats().entryCount);
+  TEST_ASSERT_FALSE(std::filesystem::exists(directory + "/0badf00d.tmp"));
+
+  Surface *loaded = store.load("http://example.com/2.jpg", 40, 40);
+  TEST_ASSERT_NOT_NULL(loaded);
+  TEST_ASSERT_TRUE(samePixels(second, loaded));
+  loaded->release();
+
+  first->release();
+  second->release();
+}
+
+void test_least_recently_used_art_is_evicted() {
+  Surface *art = makeSurface(64, 64, LV_IMG_CF_TRUE_COLOR, 3);
+  uint32_t fileSize;
+  {
+    ArtStore probe(directory.c_str());
+    probe.start();
+    probe.save("probe", 64, 64, art);
+    probe.flush();
+    fileSize = probe.getStats().storedBytes;
+  }
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directory(directory);
+
+  // Room for two files
+  ArtStore store(directory.c_str(), (fileSize * 2) + (fileSize / 2));
+  store.start();
+  store.save("http://example.com/a.jpg", 64, 64, art);
+  store.flush();
+  store.save("http://example.com/b.jpg", 64, 64, art);
+  store.flush();
+
+  Surface *loaded = store.load("http://example.com/a.jpg", 64, 64);
+  TEST_ASSERT_NOT_NULL(loaded);
+  loaded->release();
+
+  store.save("http://example.com/c.jpg", 64, 64, art);
+  store.flush();
+
+  ArtStore::Stats stats = store.getStats();
+  TEST_ASSERT_EQUAL(2, stats.entryCount);
+  TEST_ASSERT_EQUAL(1, stats.evictions);
+  TEST_ASSERT_EQUAL(2, fileCount());
+  TEST_ASSERT_NULL(store.load("http://example.com/b.jpg", 64, 64));
+
+  loaded = store.load("http://example.com/a.jpg", 64, 64);
+  TEST_ASSERT_NOT_NULL(loaded);
+  loaded->release();
+
+  art->release();
+}
+
+void test_corrupt_art_is_dropped() {
+  Surface *art = makeSurface(64, 64, LV_IMG_CF_TRUE_COLOR, 4);
+  ArtStore store(directory.c_str());
+  store.start();
+  store.save("http://example.com/a.jpg", 64, 64, art);
+  store.flush();
+
+  for (const auto &entry : std::filesystem::directory_iterator(directory)) {
+    if (entry.path().extension() == ".art") {
+      std::filesystem::resize_file(entry.path(), std::filesystem::file_size(entry.path()) - 100);
+    }
+  }
+
+  TEST_ASSERT_NULL(store.load("http://example.com/a.jpg", 64, 64));
+  TEST_ASSERT_EQUAL(0, store.getStats().entryCount);
+  TEST_ASSERT_EQUAL(0, fileCount());
+
+  art->release();
+}
+
+void test_pipeline_loads_stored_art_after_restart() {
+  int fetches = 0;
+  CoverArtPipeline::Fetcher fetcher = [&](const char *url, const char *path, const CancelToken &cancel) {
+    fetches++;
+    static uint8_t bytes[4] = { 1, 2, 3, 4 };
+    InMemoryFS::registerStaticFile(path, bytes, sizeof(bytes));
+    return true;
+  };
+
+  CoverArtPipeline::Decoder decoder = [](const char *source, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel,
+    CoverArtDecoder::Retired &retired, bool &needsLvgl) {
+    return makeSurface(24, 24, LV_IMG_CF_TRUE_COLOR, 5);
+  };
+
+  const char *url = "http://example.com/art/cover.jpg";
+  {
+    ArtStore store(directory.c_str());
+    store.start();
+
+    CoverArtCache cache;
+    CoverArtPipeline pipeline(cache, decoder);
+    pipeline.setFetcher(fetcher);
+    pipeline.setStore(&store);
+
+    int shown = 0;
+    pipeline.request(url, [&](const lv_img_dsc_t *image) {
+      shown++;
+      cache.release(image);
+    });
+
+    TEST_ASSERT_EQUAL(1, shown);
+    TEST_ASSERT_EQUAL(1, fetches);
+    store.stop();
+  }
+
+  // After a reboot the art comes from flash without a download
+  ArtStore store(directory.c_str());
+  store.start();
+
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, decoder);
+  pipeline.setFetcher(fetcher);
+  pipeline.setStore(&store);
+
+  uint16_t width = 0;
+  pipeline.request(url, [&](const lv_img_dsc_t *image) {
+    width = (image != nullptr) ? image->header.w : 0;
+    cache.release(image);
+  });
+
+  TEST_ASSERT_EQUAL(24, width);
+  TEST_ASSERT_EQUAL(1, fetches);
+  TEST_ASSERT_EQUAL(1, store.getStats().hits);
+}
+
+int runUnityTests(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_art_round_trips);
+  RUN_TEST(test_art_survives_restart);
+  RUN_TEST(test_least_recently_used_art_is_evicted);
+  RUN_TEST(test_corrupt_art_is_dropped);
+  RUN_TEST(test_pipeline_loads_stored_art_after_restart);
+
+  return UNITY_END();
+}
+
+/**
+ * For native dev-platform or for some embedded frameworks
+ */
+int main(void) {
+  return runUnityTests();
+}
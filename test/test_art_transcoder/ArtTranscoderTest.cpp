@@ -0,0 +1,206 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#include "unity.h"
+#include <ArtTranscoder.h>
+#include <CoverArtDecoder.h>
+#include <InMemoryFS.h>
+#include <PngDecoder.h>
+#include <TiledImage.h>
+#include <filesystem>
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+
+static std::filesystem::path CWD = std::filesystem::current_path();
+static std::filesystem::path TEST_ASSETS_FOLDER = CWD / "test/assets";
+
+/**
+ * Fetches URLs from the test assets, where the URL is a path relative
+ * to the assets folder.  Counts the fetches of each URL.
+ */
+static std::map<std::string, int> fetches;
+static std::vector<std::string> fetchedPaths;
+
+static bool fakeFetch(const char *url, const char *path, const CancelToken &cancel) {
+  fetches[url]++;
+  fetchedPaths.push_back(path);
+
+  auto fullPath = TEST_ASSETS_FOLDER / url;
+  if (!std::filesystem::exists(fullPath)) {
+    return false;
+  }
+
+  uint32_t size = std::filesystem::file_size(fullPath);
+  uint8_t *data = new uint8_t[size];
+  auto file = std::fopen(fullPath.c_str(), "rb");
+  std::fread(data, 1, size, file);
+  fclose(file);
+
+  InMemoryFS::adoptFile(path, data, size, [](void *data) {
+    delete [] (uint8_t *) data;
+  });
+
+  return true;
+}
+
+/**
+ * Decode a payload the way a display would.
+ */
+static Surface *decodePayload(const ArtTranscoder::Payload &payload) {
+  InMemoryFS::registerFile("payload.tile", (void *) payload->data(), payload->size());
+  Surface *surface = CoverArtDecoder::decode("M:payload.tile");
+  InMemoryFS::unregisterFile("payload.tile");
+  return surface;
+}
+
+void setUp() {
+  lv_init();
+  InMemoryFS::registerInMemoryDriver();
+  PngDecoder::registerDecoder();
+  TiledImage::registerDecoder();
+  fetches.clear();
+  fetchedPaths.clear();
+}
+
+void tearDown() {
+}
+
+void test_art_is_transcoded_to_display_size() {
+  ArtTranscoder transcoder(fakeFetch, 96, 120);
+
+  ArtTranscoder::Payload payload = transcoder.transcode("images/coverimage1.png");
+  TEST_ASSERT_NOT_NULL(payload.get());
+
+  // The same art as the display would decode from the original
+  fakeFetch("images/coverimage1.png", "expected.png", CancelToken());
+  Surface *expected = CoverArtDecoder::decode("M:expected.png", 96, 120);
+  InMemoryFS::unregisterFile("expected.png");
+
+  Surface *decoded = decodePayload(payload);
+  TEST_ASSERT_NOT_NULL(decoded);
+  TEST_ASSERT_EQUAL(96, decoded->width());
+  TEST_ASSERT_EQUAL(96, decoded->height());
+  TEST_ASSERT_EQUAL(expected->byteSize(), decoded->byteSize());
+  TEST_ASSERT_EQUAL_MEMORY(expected->pixels(), decoded->pixels(), expected->byteSize());
+
+  // The download is not kept
+  TEST_ASSERT_EQUAL(2, fetchedPaths.size());
+  TEST_ASSERT_EQUAL(0, InMemoryFS::getVersion(fetchedPaths[0].c_str()));
+
+  decoded->release();
+  expected->release();
+}
+
+void test_jpeg_art_is_transcoded() {
+  ArtTranscoder transcoder(fakeFetch, 96, 120);
+
+  ArtTranscoder::Payload payload = transcoder.transcode("images/dmb-baseline.jpg");
+  TEST_ASSERT_NOT_NULL(payload.get());
+
+  fakeFetch("images/dmb-baseline.jpg", "expected.jpg", CancelToken());
+  Surface *expected = CoverArtDecoder::decode("M:expected.jpg", 96, 120);
+  InMemoryFS::unregisterFile("expected.jpg");
+  TEST_ASSERT_NOT_NULL(expected);
+
+  Surface *decoded = decodePayload(payload);
+  TEST_ASSERT_NOT_NULL(decoded);
+  TEST_ASSERT_EQUAL(96, decoded->width());
+  TEST_ASSERT_EQUAL(96, decoded->height());
+  TEST_ASSERT_EQUAL_MEMORY(expected->pixels(), decoded->pixels(), expected->byteSize());
+
+  decoded->release();
+  expected->release();
+}
+
+void test_art_is_fetched_once() {
+  ArtTranscoder transcoder(fakeFetch, 64, 64);
+
+  ArtTranscoder::Payload first = transcoder.transcode("images/coverimage1.png");
+  ArtTranscoder::Payload second = transcoder.transcode("images/coverimage1.png");
+  TEST_ASSERT_NOT_NULL(first.get());
+  TEST_ASSERT_TRUE(first == second);
+  TEST_ASSERT_EQUAL(1, fetches["images/coverimage1.png"]);
+
+  // Displays look the payload up by name
+  std::string name = ArtTranscoder::nameOf("images/coverimage1.png");
+  TEST_ASSERT_TRUE(transcoder.find(name) == first);
+  TEST_ASSERT_NULL(transcoder.find(ArtTranscoder::nameOf("images/ajr.png")).get());
+
+  ArtTranscoder::Stats stats = transcoder.getStats();
+  TEST_ASSERT_EQUAL(1, stats.transcodes);
+  TEST_ASSERT_EQUAL(1, stats.hits);
+  TEST_ASSERT_EQUAL(1, stats.entryCount);
+  TEST_ASSERT_EQUAL(first->size(), stats.storedBytes);
+}
+
+void test_names_identify_urls() {
+  std::string name = ArtTranscoder::nameOf("http://example.com/art/1.jpg");
+  TEST_ASSERT_EQUAL(13, name.size());
+  TEST_ASSERT_EQUAL(8, name.rfind(".tile"));
+  TEST_ASSERT_EQUAL_STRING(name.c_str(), ArtTranscoder::nameOf("http://example.com/art/1.jpg").c_str());
+  TEST_ASSERT_NOT_EQUAL(0, name.compare(ArtTranscoder::nameOf("http://example.com/art/2.jpg")));
+}
+
+void test_failures_are_not_kept() {
+  ArtTranscoder transcoder(fakeFetch, 64, 64);
+
+  // Missing
+  TEST_ASSERT_NULL(transcoder.transcode("images/missing.png").get());
+
+  // Not an image
+  TEST_ASSERT_NULL(transcoder.transcode("images/../../platformio.ini").get());
+
+  // Failures are tried again
+  TEST_ASSERT_NULL(transcoder.transcode("images/missing.png").get());
+  TEST_ASSERT_EQUAL(2, fetches["images/missing.png"]);
+
+  ArtTranscoder::Stats stats = transcoder.getStats();
+  TEST_ASSERT_EQUAL(3, stats.failures);
+  TEST_ASSERT_EQUAL(0, stats.entryCount);
+  for (const std::string &path : fetchedPaths) {
+    TEST_ASSERT_EQUAL(0, InMemoryFS::getVersion(path.c_str()));
+  }
+}
+
+void test_least_recently_used_art_is_dropped() {
+  ArtTranscoder sizing(fakeFetch, 64, 64);
+  uint32_t size = sizing.transcode("images/coverimage1.png")->size();
+
+  // Room for one payload
+  ArtTranscoder transcoder(fakeFetch, 64, 64, size + 1);
+  transcoder.transcode("images/coverimage1.png");
+  transcoder.transcode("images/ajr.png");
+  TEST_ASSERT_EQUAL(1, transcoder.getStats().entryCount);
+  TEST_ASSERT_NULL(transcoder.find(ArtTranscoder::nameOf("images/coverimage1.png")).get());
+  TEST_ASSERT_NOT_NULL(transcoder.find(ArtTranscoder::nameOf("images/ajr.png")).get());
+
+  // Art over budget on its own is still handed out
+  ArtTranscoder tiny(fakeFetch, 64, 64, 1);
+  TEST_ASSERT_NOT_NULL(tiny.transcode("images/coverimage1.png").get());
+  TEST_ASSERT_EQUAL(1, tiny.getStats().entryCount);
+}
+
+int runUnityTests(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_art_is_transcoded_to_display_size);
+  RUN_TEST(test_jpeg_art_is_transcoded);
+  RUN_TEST(test_art_is_fetched_once);
+  RUN_TEST(test_names_identify_urls);
+  RUN_TEST(test_failures_are_not_kept);
+  RUN_TEST(test_least_recently_used_art_is_dropped);
+
+  return UNITY_END();
+}
+
+/**
+ * For native dev-platform or for some embedded frameworks
+ */
+int main(void) {
+  return runUnityTests();
+}
@@ -0,0 +1,481 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#include "unity.h"
+#include <CornerMask.h>
+#include <CoverArtCache.h>
+#include <CoverArtDecoder.h>
+#include <ImageScaler.h>
+#include <InMemoryFS.h>
+#include <filesystem>
+#include <stdlib.h>
+#include <string.h>
+
+static std::filesystem::path TEST_ASSETS_FOLDER = std::filesystem::current_path() / "test/assets";
+
+static uint32_t decodeCount;
+
+/**
+ * Stands in for a real decoder, producing a square surface whose size
+ * is given by the digits in the source and whose pixels hold the
+ * decode count.
+ */
+static Surface *fakeDecode(const char *source) {
+  const char *digits = strpbrk(source, "0123456789");
+  if (digits == nullptr) {
+    return nullptr;
+  }
+
+  uint16_t size = atoi(digits);
+  Surface *surface = Surface::create(size, size, LV_IMG_CF_TRUE_COLOR);
+  memset(surface->pixels(), ++decodeCount, surface->byteSize());
+  return surface;
+}
+
+// A 10x10 RGB565 surface
+static const uint32_t SURFACE_BYTES = 10 * 10 * sizeof(lv_color_t);
+
+void setUp() {
+  lv_init();
+  InMemoryFS::registerInMemoryDriver();
+  decodeCount = 0;
+}
+
+void tearDown() {
+}
+
+void test_cache_hit_skips_decode() {
+  CoverArtCache cache(4 * SURFACE_BYTES, fakeDecode);
+
+  const lv_img_dsc_t *first = cache.acquire("a/10.png");
+  TEST_ASSERT_NOT_NULL(first);
+  TEST_ASSERT_EQUAL(LV_IMG_CF_TRUE_COLOR, first->header.cf);
+  TEST_ASSERT_EQUAL(10, first->header.w);
+  TEST_ASSERT_EQUAL(SURFACE_BYTES, first->data_size);
+
+  const lv_img_dsc_t *second = cache.acquire("a/10.png");
+  TEST_ASSERT_EQUAL_PTR(first, second);
+  TEST_ASSERT_EQUAL(1, decodeCount);
+
+  CoverArtCache::Stats stats = cache.getStats();
+  TEST_ASSERT_EQUAL(1, stats.hits);
+  TEST_ASSERT_EQUAL(1, stats.misses);
+  TEST_ASSERT_EQUAL(SURFACE_BYTES, stats.residentBytes);
+
+  cache.release(first);
+  cache.release(second);
+
+  TEST_ASSERT_NULL(cache.acquire("undecodable.png"));
+}
+
+void test_cache_evicts_least_recently_used() {
+  CoverArtCache cache(2 * SURFACE_BYTES, fakeDecode);
+
+  cache.release(cache.acquire("a/10.png"));
+  cache.release(cache.acquire("b/10.png"));
+  cache.release(cache.acquire("a/10.png"));
+
+  // Over budget, so b is the one to go
+  cache.release(cache.acquire("c/10.png"));
+  TEST_ASSERT_EQUAL(2, cache.getStats().entryCount);
+  TEST_ASSERT_EQUAL(1, cache.getStats().evictions);
+
+  cache.release(cache.acquire("a/10.png"));
+  TEST_ASSERT_EQUAL(3, decodeCount);
+  cache.release(cache.acquire("b/10.png"));
+  TEST_ASSERT_EQUAL(4, decodeCount);
+
+  // Art larger than the whole budget is still kept while it is newest
+  const lv_img_dsc_t *large = cache.acquire("large/30.png");
+  TEST_ASSERT_NOT_NULL(large);
+  TEST_ASSERT_EQUAL(1, cache.getStats().entryCount);
+  cache.release(large);
+}
+
+void test_evicted_art_stays_valid_while_shown() {
+  CoverArtCache cache(SURFACE_BYTES, fakeDecode);
+
+  const lv_img_dsc_t *shown = cache.acquire("a/10.png");
+  uint8_t firstPixel = shown->data[0];
+
+  cache.release(cache.acquire("b/10.png"));
+  TEST_ASSERT_EQUAL(1, cache.getStats().entryCount);
+  TEST_ASSERT_EQUAL(SURFACE_BYTES, cache.getStats().residentBytes);
+  TEST_ASSERT_EQUAL(firstPixel, shown->data[0]);
+
+  cache.clear();
+  TEST_ASSERT_EQUAL(0, cache.getStats().residentBytes);
+  TEST_ASSERT_EQUAL(firstPixel, shown->data[SURFACE_BYTES - 1]);
+  cache.release(shown);
+}
+
+void test_replaced_file_invalidates_art() {
+  CoverArtCache cache(4 * SURFACE_BYTES, fakeDecode);
+
+  uint8_t data[] = { 'c', 'o', 'v', 'e', 'r' };
+  InMemoryFS::registerFile("cover10.png", data, sizeof(data));
+  cache.release(cache.acquire("M:cover10.png"));
+  cache.release(cache.acquire("M:cover10.png"));
+  TEST_ASSERT_EQUAL(1, decodeCount);
+
+  data[0] = 'C';
+  InMemoryFS::replaceFile("cover10.png", data, sizeof(data));
+  cache.release(cache.acquire("M:cover10.png"));
+  TEST_ASSERT_EQUAL(2, decodeCount);
+  TEST_ASSERT_EQUAL(1, cache.getStats().entryCount);
+
+  InMemoryFS::unregisterFile("cover10.png");
+}
+
+/**
+ * Build an RGB565 image whose pixels come from a function of their position.
+ */
+static lv_img_dsc_t makeImage(uint16_t width, uint16_t height, lv_color_t (*pixel)(uint16_t x, uint16_t y)) {
+  lv_color_t *pixels = (lv_color_t *) malloc(width * height * sizeof(lv_color_t));
+  for (uint16_t y = 0; y < height; y++) {
+    for (uint16_t x = 0; x < width; x++) {
+      pixels[(y * width) + x] = pixel(x, y);
+    }
+  }
+
+  lv_img_dsc_t image;
+  memset(&image, 0, sizeof(image));
+  image.header.cf = LV_IMG_CF_TRUE_COLOR;
+  image.header.w = width;
+  image.header.h = height;
+  image.data_size = width * height * sizeof(lv_color_t);
+  image.data = (const uint8_t *) pixels;
+  return image;
+}
+
+static lv_color_t checkerboard(uint16_t x, uint16_t y) {
+  return ((x + y) & 1) ? lv_color_white() : lv_color_black();
+}
+
+static lv_color_t gradient(uint16_t x, uint16_t y) {
+  return lv_color_make((x * 255) / 599, 0, (y * 255) / 599);
+}
+
+static lv_color_t redColumns(uint16_t x, uint16_t y) {
+  return (x < 3) ? lv_color_make(0xFF, 0, 0) : lv_color_make(0, 0, 0xFF);
+}
+
+static lv_color_t surfacePixel(Surface *surface, uint16_t x, uint16_t y) {
+  lv_color_t color;
+  memcpy(&color, surface->row(y) + (x * surface->pixelSize()), sizeof(color));
+  return color;
+}
+
+void test_fit_within_keeps_aspect_ratio() {
+  uint16_t width, height;
+
+  ImageScaler::fitWithin(600, 600, 216, 320, width, height);
+  TEST_ASSERT_EQUAL(216, width);
+  TEST_ASSERT_EQUAL(216, height);
+
+  ImageScaler::fitWithin(1000, 500, 216, 320, width, height);
+  TEST_ASSERT_EQUAL(216, width);
+  TEST_ASSERT_EQUAL(108, height);
+
+  ImageScaler::fitWithin(300, 900, 216, 320, width, height);
+  TEST_ASSERT_EQUAL(107, width);
+  TEST_ASSERT_EQUAL(320, height);
+
+  // Never scaled up, and no limit when the box is empty
+  ImageScaler::fitWithin(192, 192, 216, 320, width, height);
+  TEST_ASSERT_EQUAL(192, width);
+  ImageScaler::fitWithin(800, 600, 0, 0, width, height);
+  TEST_ASSERT_EQUAL(800, width);
+  TEST_ASSERT_EQUAL(600, height);
+}
+
+void test_scaler_averages_covered_area() {
+  // Each 2x2 block of a checkerboard averages to mid gray
+  lv_img_dsc_t image = makeImage(8, 8, checkerboard);
+  Surface *surface = Surface::create(4, 4, LV_IMG_CF_TRUE_COLOR);
+  ImageScaler scaler(8, 8, LV_IMG_CF_TRUE_COLOR, surface);
+  TEST_ASSERT_TRUE(scaler.isValid());
+
+  for (uint16_t y = 0; y < 8; y++) {
+    TEST_ASSERT_FALSE(scaler.isComplete());
+    scaler.pushRow(image.data + (y * 8 * sizeof(lv_color_t)));
+  }
+
+  TEST_ASSERT_TRUE(scaler.isComplete());
+  lv_color_t gray = lv_color_make(0x80, 0x80, 0x80);
+  for (uint16_t y = 0; y < 4; y++) {
+    for (uint16_t x = 0; x < 4; x++) {
+      TEST_ASSERT_EQUAL_HEX16(gray.full, surfacePixel(surface, x, y).full);
+    }
+  }
+
+  surface->release();
+  free((void *) image.data);
+}
+
+void test_scaler_splits_straddling_pixels() {
+  // Six columns into four: the middle target columns each take half of
+  // the boundary between red and blue
+  lv_img_dsc_t image = makeImage(6, 3, redColumns);
+  Surface *surface = Surface::create(4, 2, LV_IMG_CF_TRUE_COLOR_ALPHA);
+  ImageScaler scaler(6, 3, LV_IMG_CF_TRUE_COLOR, surface);
+  for (uint16_t y = 0; y < 3; y++) {
+    scaler.pushRow(image.data + (y * 6 * sizeof(lv_color_t)));
+  }
+
+  TEST_ASSERT_TRUE(scaler.isComplete());
+  for (uint16_t y = 0; y < 2; y++) {
+    TEST_ASSERT_EQUAL_HEX16(lv_color_make(0xFF, 0, 0).full, surfacePixel(surface, 0, y).full);
+    TEST_ASSERT_EQUAL_HEX16(lv_color_make(0xFF, 0, 0).full, surfacePixel(surface, 1, y).full);
+    TEST_ASSERT_EQUAL_HEX16(lv_color_make(0, 0, 0xFF).full, surfacePixel(surface, 2, y).full);
+    TEST_ASSERT_EQUAL_HEX16(lv_color_make(0, 0, 0xFF).full, surfacePixel(surface, 3, y).full);
+
+    // Opaque sources stay opaque
+    TEST_ASSERT_EQUAL(0xFF, surface->row(y)[surface->pixelSize() - 1]);
+  }
+
+  surface->release();
+  free((void *) image.data);
+
+  // Scaling up is refused
+  surface = Surface::create(8, 8, LV_IMG_CF_TRUE_COLOR);
+  ImageScaler upscaler(4, 4, LV_IMG_CF_TRUE_COLOR, surface);
+  TEST_ASSERT_FALSE(upscaler.isValid());
+  surface->release();
+}
+
+void test_decode_scales_to_target() {
+  lv_img_dsc_t image = makeImage(600, 600, gradient);
+
+  Surface *full = CoverArtDecoder::decode(&image);
+  TEST_ASSERT_NOT_NULL(full);
+  TEST_ASSERT_EQUAL(600, full->width());
+  TEST_ASSERT_EQUAL(0, memcmp(image.data, full->pixels(), image.data_size));
+  full->release();
+
+  Surface *scaled = CoverArtDecoder::decode(&image, 216, 320);
+  TEST_ASSERT_NOT_NULL(scaled);
+  TEST_ASSERT_EQUAL(216, scaled->width());
+  TEST_ASSERT_EQUAL(216, scaled->height());
+  TEST_ASSERT_EQUAL(216 * 216 * sizeof(lv_color_t), scaled->byteSize());
+
+  // The gradients run the same way at the smaller size
+  TEST_ASSERT_EQUAL(0, surfacePixel(scaled, 0, 0).ch.red);
+  TEST_ASSERT_INT_WITHIN(1, 0x80 >> 3, surfacePixel(scaled, 108, 0).ch.red);
+  TEST_ASSERT_INT_WITHIN(1, 0x80 >> 3, surfacePixel(scaled, 0, 108).ch.blue);
+  TEST_ASSERT_INT_WITHIN(1, 0xFF >> 3, surfacePixel(scaled, 215, 215).ch.blue);
+  scaled->release();
+
+  free((void *) image.data);
+}
+
+void test_decode_stops_when_cancelled() {
+  lv_img_dsc_t image = makeImage(64, 64, gradient);
+  std::atomic<uint32_t> latest(1);
+
+  Surface *current = CoverArtDecoder::decode(&image, 32, 32, CancelToken(latest, 1));
+  TEST_ASSERT_NOT_NULL(current);
+  current->release();
+
+  // A newer request makes the decode obsolete
+  latest++;
+  TEST_ASSERT_NULL(CoverArtDecoder::decode(&image, 32, 32, CancelToken(latest, 1)));
+  TEST_ASSERT_NULL(CoverArtDecoder::decode(&image, 0, 0, CancelToken(latest, 1)));
+
+  free((void *) image.data);
+}
+
+static void loadAsset(const char *relativePath, const char *path) {
+  auto fullPath = TEST_ASSETS_FOLDER / relativePath;
+
+  uint32_t size = std::filesystem::file_size(fullPath);
+  uint8_t *data = new uint8_t[size];
+  auto file = std::fopen(fullPath.c_str(), "rb");
+  std::fread(data, 1, size, file);
+  fclose(file);
+
+  InMemoryFS::adoptFile(path, data, size, [](void *data) {
+    delete [] (uint8_t *) data;
+  });
+}
+
+void test_decode_jpeg_art() {
+  // The baseline copies of the JPEG assets hold the same coefficients
+  loadAsset("images/coverimage1-baseline.jpg", "cover.jpg");
+  loadAsset("images/coverimage1.png", "cover.png");
+  loadAsset("images/dmb-baseline.jpg", "dmb.jpg");
+  loadAsset("images/dmb.jpg", "progressive.jpg");
+
+  Surface *jpeg = CoverArtDecoder::decode("M:cover.jpg", 96, 96);
+  TEST_ASSERT_NOT_NULL(jpeg);
+  TEST_ASSERT_EQUAL(96, jpeg->width());
+  TEST_ASSERT_EQUAL(96, jpeg->height());
+  TEST_ASSERT_EQUAL(LV_IMG_CF_TRUE_COLOR, jpeg->image.header.cf);
+
+  // The same art as the PNG, give or take the compression
+  Surface *png = CoverArtDecoder::decode("M:cover.png", 96, 96);
+  for (uint16_t y = 0; y < 96; y += 5) {
+    for (uint16_t x = 0; x < 96; x += 5) {
+      lv_color_t expected = surfacePixel(png, x, y);
+      lv_color_t actual = surfacePixel(jpeg, x, y);
+      TEST_ASSERT_INT_WITHIN(4, expected.ch.red, actual.ch.red);
+      TEST_ASSERT_INT_WITHIN(8, expected.ch.green, actual.ch.green);
+      TEST_ASSERT_INT_WITHIN(4, expected.ch.blue, actual.ch.blue);
+    }
+  }
+
+  Surface *full = CoverArtDecoder::decode("M:dmb.jpg");
+  TEST_ASSERT_NOT_NULL(full);
+  TEST_ASSERT_EQUAL(192, full->width());
+  TEST_ASSERT_EQUAL(192, full->height());
+
+  // Progressive JPEGs are beyond TJpgDec, so they are refused rather
+  // than drawn wrongly
+  TEST_ASSERT_NULL(CoverArtDecoder::decode("M:progressive.jpg", 96, 96));
+
+  jpeg->release();
+  png->release();
+  full->release();
+  InMemoryFS::unregisterFile("cover.jpg");
+  InMemoryFS::unregisterFile("cover.png");
+  InMemoryFS::unregisterFile("dmb.jpg");
+  InMemoryFS::unregisterFile("progressive.jpg");
+}
+
+void test_jpeg_art_decodes_off_thread() {
+  loadAsset("images/dmb-baseline.jpg", "dmb.jpg");
+  loadAsset("images/dmb.jpg", "progressive.jpg");
+
+  // Read in place and halved as it is decoded, matching the LVGL thread
+  CoverArtDecoder::Retired retired;
+  bool needsLvgl = true;
+  Surface *reduced = CoverArtDecoder::decodeOffThread("M:dmb.jpg", 96, 96, CancelToken(), retired, needsLvgl);
+  TEST_ASSERT_NOT_NULL(reduced);
+  TEST_ASSERT_FALSE(needsLvgl);
+  TEST_ASSERT_EQUAL(96, reduced->width());
+  TEST_ASSERT_EQUAL(96, reduced->height());
+  TEST_ASSERT_EQUAL(1, retired.descriptors.size());
+
+  Surface *expected = CoverArtDecoder::decode("M:dmb.jpg", 96, 96);
+  TEST_ASSERT_EQUAL_MEMORY(expected->image.data, reduced->image.data, expected->image.data_size);
+
+  // Sizes between the reductions are scaled the rest of the way
+  Surface *scaled = CoverArtDecoder::decodeOffThread("M:dmb.jpg", 80, 0, CancelToken(), retired, needsLvgl);
+  TEST_ASSERT_NOT_NULL(scaled);
+  TEST_ASSERT_EQUAL(80, scaled->width());
+  TEST_ASSERT_EQUAL(80, scaled->height());
+  uint32_t reducedSum[3] = { 0, 0, 0 };
+  uint32_t scaledSum[3] = { 0, 0, 0 };
+  for (uint16_t y = 0; y < 96; y++) {
+    for (uint16_t x = 0; x < 96; x++) {
+      lv_color_t color = surfacePixel(reduced, x, y);
+      reducedSum[0] += color.ch.red;
+      reducedSum[1] += color.ch.green;
+      reducedSum[2] += color.ch.blue;
+    }
+  }
+
+  for (uint16_t y = 0; y < 80; y++) {
+    for (uint16_t x = 0; x < 80; x++) {
+      lv_color_t color = surfacePixel(scaled, x, y);
+      scaledSum[0] += color.ch.red;
+      scaledSum[1] += color.ch.green;
+      scaledSum[2] += color.ch.blue;
+    }
+  }
+
+  // The overall color survives the scaling
+  for (int channel = 0; channel < 3; channel++) {
+    TEST_ASSERT_INT_WITHIN(1, reducedSum[channel] / (96 * 96), scaledSum[channel] / (80 * 80));
+  }
+
+  // SJPG could do no better with a progressive JPEG, so it is not handed back
+  needsLvgl = true;
+  TEST_ASSERT_NULL(CoverArtDecoder::decodeOffThread("M:progressive.jpg", 96, 96, CancelToken(), retired, needsLvgl));
+  TEST_ASSERT_FALSE(needsLvgl);
+  TEST_ASSERT_EQUAL(3, retired.descriptors.size());
+
+  retired.release();
+  reduced->release();
+  expected->release();
+  scaled->release();
+  InMemoryFS::unregisterFile("dmb.jpg");
+  InMemoryFS::unregisterFile("progressive.jpg");
+}
+
+void test_cached_art_has_rounded_corners() {
+  CoverArtCache cache(4 * SURFACE_BYTES, fakeDecode);
+  cache.setCorners(4, lv_color_black());
+
+  Surface *surface = Surface::create(10, 10, LV_IMG_CF_TRUE_COLOR);
+  for (uint16_t y = 0; y < 10; y++) {
+    for (uint16_t x = 0; x < 10; x++) {
+      ((lv_color_t *) surface->row(y))[x] = lv_color_white();
+    }
+  }
+
+  cache.release(cache.insert("a/10.png", 0, surface));
+
+  // The corners take the background, the edge of the arc is blended and
+  // everything inside it is untouched
+  TEST_ASSERT_EQUAL_HEX16(lv_color_black().full, surfacePixel(surface, 0, 0).full);
+  TEST_ASSERT_EQUAL_HEX16(lv_color_black().full, surfacePixel(surface, 9, 0).full);
+  TEST_ASSERT_EQUAL_HEX16(lv_color_black().full, surfacePixel(surface, 0, 9).full);
+  TEST_ASSERT_EQUAL_HEX16(lv_color_black().full, surfacePixel(surface, 9, 9).full);
+
+  lv_color_t edge = surfacePixel(surface, 1, 0);
+  TEST_ASSERT_TRUE((edge.ch.green > 0) && (edge.ch.green < 63));
+  TEST_ASSERT_EQUAL_HEX16(lv_color_white().full, surfacePixel(surface, 3, 3).full);
+  TEST_ASSERT_EQUAL_HEX16(lv_color_white().full, surfacePixel(surface, 4, 0).full);
+  TEST_ASSERT_EQUAL_HEX16(lv_color_white().full, surfacePixel(surface, 5, 5).full);
+
+  // Changing the corners drops the art rounded the old way
+  cache.setCorners(6, lv_color_black());
+  TEST_ASSERT_EQUAL(0, cache.getStats().entryCount);
+}
+
+void test_corners_fade_out_art_with_alpha() {
+  Surface *surface = Surface::create(10, 10, LV_IMG_CF_TRUE_COLOR_ALPHA);
+  memset(surface->pixels(), 0xFF, surface->byteSize());
+
+  CornerMask::apply(surface, 4, lv_color_black());
+
+  TEST_ASSERT_EQUAL(LV_OPA_TRANSP, surface->row(0)[LV_IMG_PX_SIZE_ALPHA_BYTE - 1]);
+  TEST_ASSERT_EQUAL(LV_OPA_COVER, surface->row(5)[(5 * LV_IMG_PX_SIZE_ALPHA_BYTE) + LV_IMG_PX_SIZE_ALPHA_BYTE - 1]);
+
+  // The color is left alone
+  TEST_ASSERT_EQUAL_HEX16(lv_color_white().full, surfacePixel(surface, 0, 0).full);
+
+  surface->release();
+}
+
+int runUnityTests(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_cache_hit_skips_decode);
+  RUN_TEST(test_cache_evicts_least_recently_used);
+  RUN_TEST(test_evicted_art_stays_valid_while_shown);
+  RUN_TEST(test_replaced_file_invalidates_art);
+  RUN_TEST(test_fit_within_keeps_aspect_ratio);
+  RUN_TEST(test_scaler_averages_covered_area);
+  RUN_TEST(test_scaler_splits_straddling_pixels);
+  RUN_TEST(test_decode_scales_to_target);
+  RUN_TEST(test_decode_stops_when_cancelled);
+  RUN_TEST(test_decode_jpeg_art);
+  RUN_TEST(test_jpeg_art_decodes_off_thread);
+  RUN_TEST(test_cached_art_has_rounded_corners);
+  RUN_TEST(test_corners_fade_out_art_with_alpha);
+
+  return UNITY_END();
+}
+
+/**
+  * For native dev-platform or for some embedded frameworks
+  */
+int main(void) {
+  return runUnityTests();
+}
@@ -0,0 +1,156 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#include "unity.h"
+#include <CoverArtDecoder.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Compares decoding cover art at full size, as it was shown before
+// resizing on decode, with decoding it scaled to the 216x320 cover slot.
+// The full size surface is only a copy, but it costs more memory and
+// LVGL has to scale it every time it is drawn; the slot sized surface
+// pays for the area filter once.  Run with
+// "pio test -e test_inmemory_fs -f test_cover_art_bench -v" to see the
+// timings.
+//
+
+static const uint16_t SOURCE_SIZE = 600;
+static const uint16_t SLOT_WIDTH = 216;
+static const uint16_t SLOT_HEIGHT = 320;
+static const int ITERATIONS = 20;
+
+static lv_img_dsc_t sourceImage;
+static lv_img_dsc_t lineSource;
+static lv_img_decoder_t *lineDecoder;
+
+/**
+ * The decoded form of a photo-like cover, as the PNG decoder leaves it.
+ */
+static void buildSourceImage(lv_img_cf_t cf) {
+  uint8_t pixelSize = (cf == LV_IMG_CF_TRUE_COLOR_ALPHA) ? LV_IMG_PX_SIZE_ALPHA_BYTE : sizeof(lv_color_t);
+  uint8_t *pixels = (uint8_t *) malloc(SOURCE_SIZE * SOURCE_SIZE * pixelSize);
+
+  for (uint16_t y = 0; y < SOURCE_SIZE; y++) {
+    for (uint16_t x = 0; x < SOURCE_SIZE; x++) {
+      lv_color_t color = lv_color_make(x * 255 / SOURCE_SIZE, (x ^ y) & 0xFF, y * 255 / SOURCE_SIZE);
+      uint8_t *pixel = pixels + (((y * SOURCE_SIZE) + x) * pixelSize);
+      memcpy(pixel, &color, sizeof(color));
+      if (cf == LV_IMG_CF_TRUE_COLOR_ALPHA) {
+        pixel[pixelSize - 1] = 0xFF;
+      }
+    }
+  }
+
+  memset(&sourceImage, 0, sizeof(sourceImage));
+  sourceImage.header.cf = cf;
+  sourceImage.header.w = SOURCE_SIZE;
+  sourceImage.header.h = SOURCE_SIZE;
+  sourceImage.data_size = SOURCE_SIZE * SOURCE_SIZE * pixelSize;
+  sourceImage.data = pixels;
+}
+
+/**
+ * A decoder that hands out the source a line at a time and reports it
+ * as raw, like SJPG.
+ */
+static lv_res_t lineInfo(lv_img_decoder_t *decoder, const void *src, lv_img_header_t *header) {
+  if (src != &lineSource) {
+    return LV_RES_INV;
+  }
+
+  *header = sourceImage.header;
+  header->cf = LV_IMG_CF_RAW;
+  return LV_RES_OK;
+}
+
+static lv_res_t lineOpen(lv_img_decoder_t *decoder, lv_img_decoder_dsc_t *dsc) {
+  return LV_RES_OK;
+}
+
+static lv_res_t lineRead(lv_img_decoder_t *decoder, lv_img_decoder_dsc_t *dsc, lv_coord_t x, lv_coord_t y,
+  lv_coord_t len, uint8_t *buf) {
+  uint32_t stride = sourceImage.data_size / SOURCE_SIZE;
+  memcpy(buf, sourceImage.data + (y * stride), stride);
+  return LV_RES_OK;
+}
+
+/**
+ * Decode the source repeatedly, reporting the time per decode and the
+ * bytes held by the result.
+ */
+static void benchmark(const char *name, const void *source, uint16_t maxWidth, uint16_t maxHeight) {
+  uint32_t bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    Surface *surface = CoverArtDecoder::decode(source, maxWidth, maxHeight);
+    TEST_ASSERT_NOT_NULL(surface);
+    bytes = surface->byteSize();
+    surface->release();
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+  char message[128];
+  snprintf(message, sizeof(message), "%-28s %8.2f ms per decode, %7u bytes resident",
+    name, elapsed.count() / 1000.0 / ITERATIONS, bytes);
+  TEST_MESSAGE(message);
+}
+
+void setUp() {
+  lv_init();
+}
+
+void tearDown() {
+  free((void *) sourceImage.data);
+  sourceImage.data = nullptr;
+}
+
+void test_benchmark_whole_image_decoder() {
+  buildSourceImage(LV_IMG_CF_TRUE_COLOR_ALPHA);
+
+  benchmark("whole image, full size", &sourceImage, 0, 0);
+  benchmark("whole image, slot size", &sourceImage, SLOT_WIDTH, SLOT_HEIGHT);
+}
+
+void test_benchmark_line_decoder() {
+  buildSourceImage(LV_IMG_CF_TRUE_COLOR);
+
+  lineDecoder = lv_img_decoder_create();
+  lv_img_decoder_set_info_cb(lineDecoder, lineInfo);
+  lv_img_decoder_set_open_cb(lineDecoder, lineOpen);
+  lv_img_decoder_set_read_line_cb(lineDecoder, lineRead);
+
+  // Only the line decoder recognizes this source
+  memset(&lineSource, 0, sizeof(lineSource));
+  lineSource.header.cf = LV_IMG_CF_RAW;
+
+  benchmark("line at a time, full size", &lineSource, 0, 0);
+  benchmark("line at a time, slot size", &lineSource, SLOT_WIDTH, SLOT_HEIGHT);
+
+  lv_img_decoder_delete(lineDecoder);
+}
+
+int runUnityTests(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_benchmark_whole_image_decoder);
+  RUN_TEST(test_benchmark_line_decoder);
+
+  return UNITY_END();
+}
+
+/**
+  * For native dev-platform or for some embedded frameworks
+  */
+int main(void) {
+  return runUnityTests();
+}
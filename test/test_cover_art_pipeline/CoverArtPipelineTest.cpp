@@ -0,0 +1,546 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#include "unity.h"
+#include <CoverArtPipeline.h>
+#include <InMemoryFS.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::mutex gateMutex;
+static std::condition_variable gateChanged;
+static bool gateOpen;
+static std::atomic<int> started;
+
+static std::mutex decodedMutex;
+static std::vector<std::string> decoded;
+static std::thread::id decodeThread;
+static std::atomic<int> abandoned;
+
+// A 10x10 RGB565 surface
+static const uint32_t SURFACE_BYTES = 10 * 10 * sizeof(lv_color_t);
+
+/**
+ * Stands in for a real decoder, waiting for the gate to open and then
+ * producing a square surface whose size is given by the digits in the
+ * source.  A decode cancelled while waiting is abandoned.
+ */
+static Surface *fakeDecode(const char *source, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel,
+  CoverArtDecoder::Retired &retired, bool &needsLvgl) {
+  started++;
+  {
+    std::unique_lock<std::mutex> lock(gateMutex);
+    gateChanged.wait(lock, [] { return gateOpen; });
+  }
+
+  if (cancel.isCancelled()) {
+    abandoned++;
+    return nullptr;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(decodedMutex);
+    decoded.push_back(source);
+    decodeThread = std::this_thread::get_id();
+  }
+
+  // Downloads are named by a hash, so fetched art is always 8x8
+  const char *digits = (strstr(source, "coverart/") != nullptr) ? "8" : strpbrk(source, "0123456789");
+  if (digits == nullptr) {
+    return nullptr;
+  }
+
+  uint16_t size = atoi(digits);
+  Surface *surface = Surface::create(size, size, LV_IMG_CF_TRUE_COLOR);
+  memset(surface->pixels(), 0, surface->byteSize());
+  return surface;
+}
+
+/**
+ * Stands in for the worker's decoder meeting a format only LVGL's
+ * decoders read.
+ */
+static Surface *handBackDecode(const char *source, uint16_t maxWidth, uint16_t maxHeight, const CancelToken &cancel,
+  CoverArtDecoder::Retired &retired, bool &needsLvgl) {
+  started++;
+  needsLvgl = true;
+  return nullptr;
+}
+
+static std::thread::id lvglDecodeThread;
+static std::vector<std::string> lvglDecoded;
+
+static Surface *fakeLvglDecode(const char *source, uint16_t maxWidth, uint16_t maxHeight) {
+  lvglDecodeThread = std::this_thread::get_id();
+  lvglDecoded.push_back(source);
+
+  Surface *surface = Surface::create(12, 12, LV_IMG_CF_TRUE_COLOR);
+  memset(surface->pixels(), 0, surface->byteSize());
+  return surface;
+}
+
+static void setGate(bool open) {
+  std::lock_guard<std::mutex> lock(gateMutex);
+  gateOpen = open;
+  gateChanged.notify_all();
+}
+
+static size_t decodedCount() {
+  std::lock_guard<std::mutex> lock(decodedMutex);
+  return decoded.size();
+}
+
+/**
+ * Polls the pipeline the way the LVGL timer does until a condition
+ * holds, giving up after two seconds.
+ */
+template <typename Condition>
+static bool pollUntil(CoverArtPipeline &pipeline, Condition condition) {
+  for (int i = 0; i < 2000; i++) {
+    pipeline.poll();
+    if (condition()) {
+      return true;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  return false;
+}
+
+/**
+ * Waits for the worker to start a number of decodes.
+ */
+static void waitForDecodes(int count) {
+  while (started < count) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+/**
+ * Records what a request was handed, releasing the art once checked.
+ */
+struct Delivery {
+  int count = 0;
+  uint16_t width = 0;
+  bool failed = false;
+
+  CoverArtPipeline::Handler handler(CoverArtCache &cache) {
+    return [this, &cache](const lv_img_dsc_t *image) {
+      count++;
+      failed = (image == nullptr);
+      width = failed ? 0 : image->header.w;
+      cache.release(image);
+    };
+  }
+};
+
+void setUp() {
+  lv_init();
+  InMemoryFS::registerInMemoryDriver();
+  setGate(true);
+  started = 0;
+  abandoned = 0;
+  decoded.clear();
+  decodeThread = std::thread::id();
+  lvglDecodeThread = std::thread::id();
+  lvglDecoded.clear();
+}
+
+void tearDown() {
+  setGate(true);
+}
+
+void test_art_decodes_off_the_lvgl_thread() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, fakeDecode);
+  pipeline.start();
+
+  setGate(false);
+  Delivery delivery;
+  pipeline.request("M:cover20.png", delivery.handler(cache));
+
+  // Nothing is handed over until the decode finishes and is polled
+  pipeline.poll();
+  TEST_ASSERT_EQUAL(0, delivery.count);
+
+  setGate(true);
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return delivery.count > 0; }));
+  TEST_ASSERT_EQUAL(1, delivery.count);
+  TEST_ASSERT_EQUAL(20, delivery.width);
+  TEST_ASSERT_TRUE(decodeThread != std::this_thread::get_id());
+
+  // The art is now cached and handed over at once
+  Delivery again;
+  pipeline.request("M:cover20.png", again.handler(cache));
+  TEST_ASSERT_EQUAL(1, again.count);
+  TEST_ASSERT_EQUAL(20, again.width);
+  TEST_ASSERT_EQUAL(1, decodedCount());
+
+  pipeline.stop();
+}
+
+void test_latest_request_wins() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, fakeDecode);
+  pipeline.start();
+
+  setGate(false);
+  Delivery first, second, third;
+  pipeline.request("M:cover10.png", first.handler(cache));
+
+  // Wait for the worker to take the first request
+  waitForDecodes(1);
+
+  pipeline.request("M:cover11.png", second.handler(cache));
+  pipeline.request("M:cover12.png", third.handler(cache));
+  setGate(true);
+
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return third.count > 0; }));
+  TEST_ASSERT_EQUAL(0, first.count);
+  TEST_ASSERT_EQUAL(0, second.count);
+  TEST_ASSERT_EQUAL(12, third.width);
+
+  // The first decode was cancelled and the waiting request replaced
+  // before it was started
+  TEST_ASSERT_EQUAL(1, abandoned);
+  TEST_ASSERT_EQUAL(1, decodedCount());
+  TEST_ASSERT_EQUAL_STRING("M:cover12.png", decoded[0].c_str());
+
+  pipeline.stop();
+}
+
+void test_cached_art_replaces_pending_request() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, fakeDecode);
+  pipeline.start();
+
+  Delivery cached;
+  pipeline.request("M:cover10.png", cached.handler(cache));
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return cached.count > 0; }));
+
+  setGate(false);
+  Delivery slow, again;
+  pipeline.request("M:cover30.png", slow.handler(cache));
+  pipeline.request("M:cover10.png", again.handler(cache));
+  TEST_ASSERT_EQUAL(1, again.count);
+  TEST_ASSERT_EQUAL(10, again.width);
+
+  setGate(true);
+  pipeline.stop();
+  pipeline.poll();
+  TEST_ASSERT_EQUAL(0, slow.count);
+}
+
+void test_cancel_drops_request() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, fakeDecode);
+  pipeline.start();
+
+  setGate(false);
+  Delivery cancelled, next;
+  pipeline.request("M:cover10.png", cancelled.handler(cache));
+  pipeline.cancel();
+  setGate(true);
+
+  // A later request still completes, and the cancelled one never does
+  pipeline.request("M:cover15.png", next.handler(cache));
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return next.count > 0; }));
+  TEST_ASSERT_EQUAL(0, cancelled.count);
+  TEST_ASSERT_EQUAL(15, next.width);
+
+  pipeline.stop();
+}
+
+void test_rapid_skips_cost_one_decode() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, fakeDecode);
+  pipeline.start();
+
+  setGate(false);
+  Delivery deliveries[10];
+  char source[32];
+  for (int i = 0; i < 10; i++) {
+    snprintf(source, sizeof(source), "M:cover%d.png", 40 + i);
+    pipeline.request(source, deliveries[i].handler(cache));
+
+    if (i == 0) {
+      waitForDecodes(1);
+    }
+  }
+
+  setGate(true);
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return deliveries[9].count > 0; }));
+  TEST_ASSERT_EQUAL(49, deliveries[9].width);
+  for (int i = 0; i < 9; i++) {
+    TEST_ASSERT_EQUAL(0, deliveries[i].count);
+  }
+
+  TEST_ASSERT_EQUAL(2, started.load());
+  TEST_ASSERT_EQUAL(1, decodedCount());
+  TEST_ASSERT_EQUAL(1, cache.getStats().entryCount);
+
+  pipeline.stop();
+}
+
+void test_urls_are_fetched_then_decoded() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, fakeDecode);
+
+  std::string fetchedUrl;
+  std::string fetchedPath;
+  pipeline.setFetcher([&](const char *url, const char *path, const CancelToken &cancel) {
+    fetchedUrl = url;
+    fetchedPath = path;
+    static uint8_t bytes[4] = { 1, 2, 3, 4 };
+    InMemoryFS::registerStaticFile(path, bytes, sizeof(bytes));
+    return true;
+  });
+  pipeline.start();
+
+  Delivery delivery;
+  pipeline.request("http://example.com/art/cover7.jpg?size=large", delivery.handler(cache));
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return delivery.count > 0; }));
+
+  // The download keeps the extension and is removed once decoded
+  TEST_ASSERT_EQUAL_STRING("http://example.com/art/cover7.jpg?size=large", fetchedUrl.c_str());
+  TEST_ASSERT_EQUAL(0, fetchedPath.find("coverart/"));
+  TEST_ASSERT_EQUAL(fetchedPath.size() - 4, fetchedPath.rfind(".jpg"));
+  TEST_ASSERT_EQUAL_STRING(("M:" + fetchedPath).c_str(), decoded[0].c_str());
+  TEST_ASSERT_EQUAL(0, InMemoryFS::getVersion(fetchedPath.c_str()));
+
+  // The art is cached under the URL
+  Delivery again;
+  pipeline.request("http://example.com/art/cover7.jpg?size=large", again.handler(cache));
+  TEST_ASSERT_EQUAL(1, again.count);
+  TEST_ASSERT_EQUAL(1, decodedCount());
+
+  pipeline.stop();
+}
+
+void test_upcoming_art_is_prefetched() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, fakeDecode);
+  pipeline.start();
+
+  pipeline.setUpcoming({ "M:cover10.png", "M:cover11.png" });
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return cache.getStats().entryCount == 2; }));
+  TEST_ASSERT_EQUAL(2, decodedCount());
+
+  // The track change finds its art ready
+  Delivery delivery;
+  pipeline.request("M:cover11.png", delivery.handler(cache));
+  TEST_ASSERT_EQUAL(1, delivery.count);
+  TEST_ASSERT_EQUAL(11, delivery.width);
+
+  // Art already cached is not prefetched again
+  pipeline.setUpcoming({ "M:cover10.png", "M:cover11.png" });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  TEST_ASSERT_EQUAL(2, started.load());
+
+  pipeline.stop();
+}
+
+void test_request_preempts_prefetch() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, fakeDecode);
+  pipeline.start();
+
+  setGate(false);
+  pipeline.setUpcoming({ "M:cover10.png", "M:cover11.png" });
+  waitForDecodes(1);
+
+  Delivery delivery;
+  pipeline.request("M:cover20.png", delivery.handler(cache));
+  setGate(true);
+
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return delivery.count > 0; }));
+  TEST_ASSERT_EQUAL(20, delivery.width);
+  TEST_ASSERT_EQUAL(1, abandoned.load());
+  TEST_ASSERT_EQUAL_STRING("M:cover20.png", decoded[0].c_str());
+
+  // The prefetch that gave way is retried afterwards
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return cache.getStats().entryCount == 3; }));
+  TEST_ASSERT_EQUAL(3, decodedCount());
+
+  pipeline.stop();
+}
+
+void test_request_takes_over_prefetch() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, fakeDecode);
+  pipeline.start();
+
+  setGate(false);
+  pipeline.setUpcoming({ "M:cover10.png" });
+  waitForDecodes(1);
+
+  Delivery delivery;
+  pipeline.request("M:cover10.png", delivery.handler(cache));
+  setGate(true);
+
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return delivery.count > 0; }));
+  TEST_ASSERT_EQUAL(10, delivery.width);
+  TEST_ASSERT_EQUAL(1, started.load());
+  TEST_ASSERT_EQUAL(0, abandoned.load());
+
+  pipeline.stop();
+}
+
+void test_prefetch_stays_within_budget() {
+  // Room for the art being shown and two upcoming covers
+  CoverArtCache cache(3 * SURFACE_BYTES);
+  cache.setTargetSize(10, 10);
+  CoverArtPipeline pipeline(cache, fakeDecode);
+  pipeline.start();
+
+  pipeline.setUpcoming({ "M:cover10a.png", "M:cover10b.png", "M:cover10c.png", "M:cover10d.png" });
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return cache.getStats().entryCount == 2; }));
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  pipeline.poll();
+  TEST_ASSERT_EQUAL(2, decodedCount());
+  TEST_ASSERT_EQUAL(0, cache.getStats().evictions);
+
+  pipeline.stop();
+}
+
+void test_failed_decode_is_reported() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, fakeDecode);
+  pipeline.start();
+
+  Delivery delivery;
+  pipeline.request("M:broken.png", delivery.handler(cache));
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return delivery.count > 0; }));
+  TEST_ASSERT_TRUE(delivery.failed);
+
+  pipeline.stop();
+}
+
+void test_unstarted_pipeline_decodes_in_place() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, fakeDecode);
+
+  Delivery delivery;
+  pipeline.request("M:cover25.png", delivery.handler(cache));
+  TEST_ASSERT_EQUAL(1, delivery.count);
+  TEST_ASSERT_EQUAL(25, delivery.width);
+  TEST_ASSERT_TRUE(decodeThread == std::this_thread::get_id());
+  TEST_ASSERT_EQUAL(1, cache.getStats().entryCount);
+}
+
+void test_lvgl_formats_are_decoded_on_the_lvgl_thread() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, handBackDecode, fakeLvglDecode);
+
+  std::string fetchedPath;
+  pipeline.setFetcher([&](const char *url, const char *path, const CancelToken &cancel) {
+    fetchedPath = path;
+    static uint8_t bytes[4] = { 0xFF, 0xD8, 0xFF, 0xE0 };
+    InMemoryFS::registerStaticFile(path, bytes, sizeof(bytes));
+    return true;
+  });
+  pipeline.start();
+
+  // The download is kept for the LVGL thread, then removed
+  Delivery delivery;
+  pipeline.request("http://example.com/art/cover.jpg", delivery.handler(cache));
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return delivery.count > 0; }));
+  TEST_ASSERT_EQUAL(12, delivery.width);
+  TEST_ASSERT_TRUE(lvglDecodeThread == std::this_thread::get_id());
+  TEST_ASSERT_EQUAL_STRING(("M:" + fetchedPath).c_str(), lvglDecoded[0].c_str());
+  TEST_ASSERT_EQUAL(0, InMemoryFS::getVersion(fetchedPath.c_str()));
+
+  // Art no longer wanted is not decoded at all
+  pipeline.request("M:other.jpg", delivery.handler(cache));
+  waitForDecodes(2);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  pipeline.cancel();
+  pipeline.poll();
+  TEST_ASSERT_EQUAL(1, lvglDecoded.size());
+
+  pipeline.stop();
+}
+
+void test_prefetched_lvgl_formats_wait_for_request() {
+  CoverArtCache cache;
+  CoverArtPipeline pipeline(cache, handBackDecode, fakeLvglDecode);
+  pipeline.setFetcher([](const char *url, const char *path, const CancelToken &cancel) {
+    static uint8_t bytes[4] = { 0xFF, 0xD8, 0xFF, 0xE0 };
+    InMemoryFS::registerStaticFile(path, bytes, sizeof(bytes));
+    return true;
+  });
+  pipeline.start();
+
+  // Only the downloads are prefetched, leaving the LVGL thread alone
+  std::string first = CoverArtPipeline::fetchPath("http://example.com/1.jpg");
+  std::string second = CoverArtPipeline::fetchPath("http://example.com/2.jpg");
+  pipeline.setUpcoming({ "http://example.com/1.jpg", "http://example.com/2.jpg" });
+  waitForDecodes(2);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  pipeline.poll();
+  TEST_ASSERT_EQUAL(0, lvglDecoded.size());
+  TEST_ASSERT_NOT_EQUAL(0, InMemoryFS::getVersion(first.c_str()));
+  TEST_ASSERT_NOT_EQUAL(0, InMemoryFS::getVersion(second.c_str()));
+
+  // and they are not fetched again
+  pipeline.setUpcoming({ "http://example.com/1.jpg", "http://example.com/2.jpg" });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  TEST_ASSERT_EQUAL(2, started.load());
+
+  // A request decodes its art alone
+  Delivery delivery;
+  pipeline.request("http://example.com/2.jpg", delivery.handler(cache));
+  TEST_ASSERT_TRUE(pollUntil(pipeline, [&] { return delivery.count > 0; }));
+  TEST_ASSERT_EQUAL(12, delivery.width);
+  TEST_ASSERT_EQUAL(1, lvglDecoded.size());
+  TEST_ASSERT_EQUAL_STRING(("M:" + second).c_str(), lvglDecoded[0].c_str());
+  TEST_ASSERT_EQUAL(0, InMemoryFS::getVersion(second.c_str()));
+
+  // Downloads of art no longer upcoming are removed
+  pipeline.setUpcoming({});
+  TEST_ASSERT_EQUAL(0, InMemoryFS::getVersion(first.c_str()));
+  TEST_ASSERT_EQUAL(1, lvglDecoded.size());
+
+  pipeline.stop();
+}
+
+int runUnityTests(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_art_decodes_off_the_lvgl_thread);
+  RUN_TEST(test_latest_request_wins);
+  RUN_TEST(test_cached_art_replaces_pending_request);
+  RUN_TEST(test_cancel_drops_request);
+  RUN_TEST(test_rapid_skips_cost_one_decode);
+  RUN_TEST(test_urls_are_fetched_then_decoded);
+  RUN_TEST(test_upcoming_art_is_prefetched);
+  RUN_TEST(test_request_preempts_prefetch);
+  RUN_TEST(test_request_takes_over_prefetch);
+  RUN_TEST(test_prefetch_stays_within_budget);
+  RUN_TEST(test_failed_decode_is_reported);
+  RUN_TEST(test_unstarted_pipeline_decodes_in_place);
+  RUN_TEST(test_lvgl_formats_are_decoded_on_the_lvgl_thread);
+  RUN_TEST(test_prefetched_lvgl_formats_wait_for_request);
+
+  return UNITY_END();
+}
+
+/**
+ * For native dev-platform or for some embedded frameworks
+ */
+int main(void) {
+  return runUnityTests();
+}
@@ -7,7 +7,10 @@
  **********************************************************************************/
 #include "unity.h"
 #include <InMemoryFS.h>
+#include <algorithm>
 #include <filesystem>
+#include <string>
+#include <vector>
 
 static std::filesystem::path CWD = std::filesystem::current_path();
 static std::filesystem::path TEST_ASSETS_FOLDER = CWD / "test/assets";
@@ -27,15 +30,29 @@ static uint8_t *getAssetData(const char *relativePath, uint32_t *bytesRead) {
 static void loadFileIntoFileSystem(const char *relativePath) {
   uint32_t bytesRead;
   uint8_t *data = getAssetData(relativePath, &bytesRead);
-  InMemoryFS::registerFile(relativePath, data, bytesRead);
-  delete [] data;
+  InMemoryFS::adoptFile(relativePath, data, bytesRead, [](void *data) {
+    delete [] (uint8_t *) data;
+  });
+}
+
+static bool fileExists(const char *path) {
+  lv_fs_file_t file;
+  if (lv_fs_open(&file, path, LV_FS_MODE_RD) != LV_FS_RES_OK) {
+    return false;
+  }
+
+  lv_fs_close(&file);
+  return true;
 }
 
+static const uint8_t STATIC_DATA[] = { 'i', 'n', ' ', 'f', 'l', 'a', 's', 'h' };
+
 void setUp() {
   lv_init();
 	InMemoryFS::registerInMemoryDriver();
 
   loadFileIntoFileSystem("binary_test.bin");
+  InMemoryFS::registerStaticFile("static.txt", STATIC_DATA, sizeof(STATIC_DATA));
 }
 
 void tearDown() {
@@ -149,6 +166,695 @@ void test_seek_and_read() {
   TEST_ASSERT_EQUAL(LV_FS_RES_OK, result);
 }
 
+void test_copied_file_is_independent() {
+  uint8_t data[4] = { 1, 2, 3, 4 };
+  InMemoryFS::registerFile("copied.bin", data, sizeof(data));
+  data[0] = 99;
+
+  lv_fs_file_t file;
+  lv_fs_res_t result = lv_fs_open(&file, "M:copied.bin", LV_FS_MODE_RD);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, result);
+
+  uint8_t buffer[8];
+  uint32_t bytesRead;
+  result = lv_fs_read(&file, buffer, sizeof(buffer), &bytesRead);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, result);
+  TEST_ASSERT_EQUAL(4, bytesRead);
+  TEST_ASSERT_EQUAL(1, buffer[0]);
+
+  result = lv_fs_close(&file);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, result);
+}
+
+void test_static_file_read() {
+  lv_fs_file_t file;
+  lv_fs_res_t result = lv_fs_open(&file, "M:static.txt", LV_FS_MODE_RD);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, result);
+
+  uint8_t buffer[16];
+  uint32_t bytesRead;
+  result = lv_fs_read(&file, buffer, sizeof(buffer), &bytesRead);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, result);
+  TEST_ASSERT_EQUAL(sizeof(STATIC_DATA), bytesRead);
+  TEST_ASSERT_EQUAL_MEMORY(STATIC_DATA, buffer, sizeof(STATIC_DATA));
+
+  result = lv_fs_close(&file);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, result);
+}
+
+void test_open_missing_file() {
+  lv_fs_file_t file;
+  lv_fs_res_t result = lv_fs_open(&file, "M:missing.bin", LV_FS_MODE_RD);
+  TEST_ASSERT_NOT_EQUAL(LV_FS_RES_OK, result);
+}
+
+void test_many_registered_files() {
+  char path[32];
+  for (uint32_t i = 0; i < 300; i++) {
+    snprintf(path, sizeof(path), "many/%u.bin", i);
+    InMemoryFS::registerFile(path, &i, sizeof(i));
+  }
+
+  for (uint32_t i = 0; i < 300; i++) {
+    snprintf(path, sizeof(path), "M:many/%u.bin", i);
+
+    lv_fs_file_t file;
+    lv_fs_res_t result = lv_fs_open(&file, path, LV_FS_MODE_RD);
+    TEST_ASSERT_EQUAL(LV_FS_RES_OK, result);
+
+    uint32_t value;
+    uint32_t bytesRead;
+    result = lv_fs_read(&file, &value, sizeof(value), &bytesRead);
+    TEST_ASSERT_EQUAL(LV_FS_RES_OK, result);
+    TEST_ASSERT_EQUAL(sizeof(value), bytesRead);
+    TEST_ASSERT_EQUAL(i, value);
+
+    lv_fs_close(&file);
+  }
+}
+
+void test_unregister_and_replace() {
+  uint8_t data[16] = { 0 };
+  InMemoryFS::registerFile("replaced.bin", data, sizeof(data));
+  uint32_t firstVersion = InMemoryFS::getVersion("replaced.bin");
+  TEST_ASSERT_NOT_EQUAL(0, firstVersion);
+
+  data[0] = 1;
+  TEST_ASSERT_TRUE(InMemoryFS::replaceFile("replaced.bin", data, 8));
+  TEST_ASSERT_GREATER_THAN(firstVersion, InMemoryFS::getVersion("replaced.bin"));
+
+  lv_fs_file_t file;
+  lv_fs_res_t result = lv_fs_open(&file, "M:replaced.bin", LV_FS_MODE_RD);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, result);
+
+  uint8_t buffer[16];
+  uint32_t bytesRead;
+  lv_fs_read(&file, buffer, sizeof(buffer), &bytesRead);
+  TEST_ASSERT_EQUAL(8, bytesRead);
+  TEST_ASSERT_EQUAL(1, buffer[0]);
+  lv_fs_close(&file);
+
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("replaced.bin"));
+  TEST_ASSERT_FALSE(InMemoryFS::unregisterFile("replaced.bin"));
+  TEST_ASSERT_FALSE(fileExists("M:replaced.bin"));
+  TEST_ASSERT_EQUAL(0, InMemoryFS::getVersion("replaced.bin"));
+}
+
+void test_replace_while_open() {
+  uint32_t residentBefore = InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL);
+
+  uint8_t oldData[64];
+  memset(oldData, 'o', sizeof(oldData));
+  InMemoryFS::registerFile("cover.png", oldData, sizeof(oldData));
+
+  lv_fs_file_t oldFile;
+  lv_fs_res_t result = lv_fs_open(&oldFile, "M:cover.png", LV_FS_MODE_RD);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, result);
+
+  uint8_t *newData = new uint8_t[32];
+  memset(newData, 'n', 32);
+  TEST_ASSERT_TRUE(InMemoryFS::replaceFile("cover.png", newData, 32, [](void *data) {
+    delete [] (uint8_t *) data;
+  }));
+
+  // Both versions are resident while the old one is open
+  TEST_ASSERT_EQUAL(residentBefore + 96, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  lv_fs_file_t newFile;
+  result = lv_fs_open(&newFile, "M:cover.png", LV_FS_MODE_RD);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, result);
+
+  uint8_t buffer[128];
+  uint32_t bytesRead;
+  lv_fs_read(&oldFile, buffer, sizeof(buffer), &bytesRead);
+  TEST_ASSERT_EQUAL(64, bytesRead);
+  TEST_ASSERT_EQUAL('o', buffer[63]);
+
+  lv_fs_read(&newFile, buffer, sizeof(buffer), &bytesRead);
+  TEST_ASSERT_EQUAL(32, bytesRead);
+  TEST_ASSERT_EQUAL('n', buffer[31]);
+
+  lv_fs_close(&oldFile);
+  TEST_ASSERT_EQUAL(residentBefore + 32, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("cover.png"));
+  TEST_ASSERT_EQUAL(residentBefore + 32, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  lv_fs_close(&newFile);
+  TEST_ASSERT_EQUAL(residentBefore, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+}
+
+void test_budget_evicts_least_recently_used() {
+  // Distinct contents so the files do not share storage
+  static uint8_t data[1000];
+  data[0] = 'a';
+  InMemoryFS::registerFile("lru/a.bin", data, sizeof(data));
+  data[0] = 'b';
+  InMemoryFS::registerFile("lru/b.bin", data, sizeof(data));
+  data[0] = 'c';
+  InMemoryFS::registerFile("lru/c.bin", data, sizeof(data));
+
+  // Trims everything registered before the three files
+  InMemoryFS::setMemoryBudget(InMemoryFS::MEMORY_INTERNAL, 3000);
+  TEST_ASSERT_EQUAL(3000, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  // Touch a.bin and keep c.bin open so b.bin is the only candidate
+  TEST_ASSERT_TRUE(fileExists("M:lru/a.bin"));
+  lv_fs_file_t file;
+  lv_fs_open(&file, "M:lru/c.bin", LV_FS_MODE_RD);
+  data[0] = 'd';
+  InMemoryFS::registerFile("lru/d.bin", data, sizeof(data));
+  lv_fs_close(&file);
+
+  TEST_ASSERT_TRUE(fileExists("M:lru/a.bin"));
+  TEST_ASSERT_FALSE(fileExists("M:lru/b.bin"));
+  TEST_ASSERT_TRUE(fileExists("M:lru/c.bin"));
+  TEST_ASSERT_TRUE(fileExists("M:lru/d.bin"));
+  TEST_ASSERT_EQUAL(3000, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  // Static data is never budgeted
+  TEST_ASSERT_TRUE(fileExists("M:static.txt"));
+
+  InMemoryFS::setMemoryBudget(InMemoryFS::MEMORY_INTERNAL, 0);
+}
+
+void test_eviction_removes_every_name_of_shared_storage() {
+  static uint8_t data[1000];
+  data[0] = 'e';
+  InMemoryFS::registerFile("lru/e.bin", data, sizeof(data));
+  InMemoryFS::registerFile("lru/e-copy.bin", data, sizeof(data));
+  data[0] = 'f';
+  InMemoryFS::registerFile("lru/f.bin", data, sizeof(data));
+
+  InMemoryFS::setMemoryBudget(InMemoryFS::MEMORY_INTERNAL, 2000);
+  TEST_ASSERT_EQUAL(2000, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  // The shared storage is the oldest, and goes with both of its names
+  data[0] = 'g';
+  InMemoryFS::registerFile("lru/g.bin", data, sizeof(data));
+  TEST_ASSERT_FALSE(fileExists("M:lru/e.bin"));
+  TEST_ASSERT_FALSE(fileExists("M:lru/e-copy.bin"));
+  TEST_ASSERT_TRUE(fileExists("M:lru/f.bin"));
+  TEST_ASSERT_TRUE(fileExists("M:lru/g.bin"));
+  TEST_ASSERT_EQUAL(2000, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  InMemoryFS::setMemoryBudget(InMemoryFS::MEMORY_INTERNAL, 0);
+}
+
+void test_identical_files_share_storage() {
+  uint8_t data[512];
+  memset(data, 'x', sizeof(data));
+
+  uint32_t residentBefore = InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL);
+  InMemoryFS::Stats statsBefore = InMemoryFS::getStats();
+
+  InMemoryFS::registerFile("albums/1/cover.jpg", data, sizeof(data));
+  InMemoryFS::registerFile("albums/1/track2.jpg", data, sizeof(data));
+  TEST_ASSERT_EQUAL(residentBefore + sizeof(data), InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  InMemoryFS::Stats stats = InMemoryFS::getStats();
+  TEST_ASSERT_EQUAL(statsBefore.registrations + 2, stats.registrations);
+  TEST_ASSERT_EQUAL(statsBefore.dedupHits + 1, stats.dedupHits);
+  TEST_ASSERT_EQUAL(statsBefore.dedupBytesSaved + sizeof(data), stats.dedupBytesSaved);
+
+  // Each path keeps its own version
+  TEST_ASSERT_NOT_EQUAL(InMemoryFS::getVersion("albums/1/cover.jpg"), InMemoryFS::getVersion("albums/1/track2.jpg"));
+
+  // The shared storage lives on while any path still names it
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("albums/1/cover.jpg"));
+  TEST_ASSERT_EQUAL(residentBefore + sizeof(data), InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  lv_fs_file_t file;
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:albums/1/track2.jpg", LV_FS_MODE_RD));
+  uint8_t buffer[sizeof(data)];
+  uint32_t bytesRead;
+  lv_fs_read(&file, buffer, sizeof(buffer), &bytesRead);
+  TEST_ASSERT_EQUAL(sizeof(data), bytesRead);
+  TEST_ASSERT_EQUAL_MEMORY(data, buffer, sizeof(data));
+  lv_fs_close(&file);
+
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("albums/1/track2.jpg"));
+  TEST_ASSERT_EQUAL(residentBefore, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+}
+
+void test_compressed_file_read_and_seek() {
+  // Two and a half blocks of a repetitive pattern, as in a raw bitmap
+  const uint32_t size = INMEMORYFS_COMPRESSED_BLOCK_SIZE * 5 / 2;
+  uint8_t *data = new uint8_t[size];
+  for (uint32_t i = 0; i < size; i++) {
+    data[i] = (uint8_t) ((i / 64) + (i % 7));
+  }
+
+  uint32_t residentBefore = InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL);
+  InMemoryFS::registerCompressedFile("bitmap.bin", data, size);
+  TEST_ASSERT_LESS_THAN(residentBefore + size / 2, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  lv_fs_file_t file;
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:bitmap.bin", LV_FS_MODE_RD));
+
+  // Read in odd sized pieces that straddle block boundaries
+  uint8_t *buffer = new uint8_t[size + 16];
+  uint32_t offset = 0;
+  uint32_t bytesRead;
+  do {
+    TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_read(&file, buffer + offset, 1000, &bytesRead));
+    offset += bytesRead;
+  } while (bytesRead > 0);
+  TEST_ASSERT_EQUAL(size, offset);
+  TEST_ASSERT_EQUAL_MEMORY(data, buffer, size);
+
+  // Seek backwards into an earlier block, then read across the next boundary
+  uint32_t position = INMEMORYFS_COMPRESSED_BLOCK_SIZE - 10;
+  lv_fs_seek(&file, position, LV_FS_SEEK_SET);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_read(&file, buffer, 20, &bytesRead));
+  TEST_ASSERT_EQUAL(20, bytesRead);
+  TEST_ASSERT_EQUAL_MEMORY(data + position, buffer, 20);
+
+  lv_fs_seek(&file, 3, LV_FS_SEEK_SET);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_read(&file, buffer, 1, &bytesRead));
+  TEST_ASSERT_EQUAL(data[3], buffer[0]);
+
+  lv_fs_close(&file);
+  delete [] buffer;
+
+  // Identical content registered uncompressed shares the compressed copy
+  uint32_t hitsBefore = InMemoryFS::getStats().dedupHits;
+  InMemoryFS::registerFile("bitmap-copy.bin", data, size);
+  TEST_ASSERT_EQUAL(hitsBefore + 1, InMemoryFS::getStats().dedupHits);
+
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("bitmap.bin"));
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("bitmap-copy.bin"));
+  TEST_ASSERT_EQUAL(residentBefore, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+  delete [] data;
+}
+
+void test_incompressible_file_stored_plain() {
+  uint8_t data[300];
+  uint32_t seed = 12345;
+  for (uint32_t i = 0; i < sizeof(data); i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = (uint8_t) (seed >> 16);
+  }
+
+  uint32_t residentBefore = InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL);
+  InMemoryFS::registerCompressedFile("noise.bin", data, sizeof(data));
+  TEST_ASSERT_EQUAL(residentBefore + sizeof(data), InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  lv_fs_file_t file;
+  uint8_t buffer[sizeof(data)];
+  uint32_t bytesRead;
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:noise.bin", LV_FS_MODE_RD));
+  lv_fs_read(&file, buffer, sizeof(buffer), &bytesRead);
+  TEST_ASSERT_EQUAL_MEMORY(data, buffer, sizeof(data));
+  lv_fs_close(&file);
+
+  InMemoryFS::unregisterFile("noise.bin");
+}
+
+void test_streamed_write_published_on_close() {
+  lv_fs_file_t file;
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:download.jpg", LV_FS_MODE_WR));
+  TEST_ASSERT_TRUE(InMemoryFS::reserveFile(&file, 1000));
+
+  // Append in chunks, as they would arrive from the network
+  uint8_t chunk[100];
+  uint32_t bytesWritten;
+  for (int i = 0; i < 12; i++) {
+    memset(chunk, 'a' + i, sizeof(chunk));
+    TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_write(&file, chunk, sizeof(chunk), &bytesWritten));
+    TEST_ASSERT_EQUAL(sizeof(chunk), bytesWritten);
+  }
+
+  // A write that would end past 4GB is refused, leaving the file intact
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_seek(&file, UINT32_MAX - 10, LV_FS_SEEK_SET));
+  TEST_ASSERT_EQUAL(LV_FS_RES_INV_PARAM, lv_fs_write(&file, chunk, sizeof(chunk), &bytesWritten));
+  TEST_ASSERT_EQUAL(0, bytesWritten);
+
+  // Nothing is visible until the file is closed
+  TEST_ASSERT_FALSE(fileExists("M:download.jpg"));
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_close(&file));
+
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:download.jpg", LV_FS_MODE_RD));
+  uint8_t buffer[1500];
+  uint32_t bytesRead;
+  lv_fs_read(&file, buffer, sizeof(buffer), &bytesRead);
+  TEST_ASSERT_EQUAL(1200, bytesRead);
+  TEST_ASSERT_EQUAL('a', buffer[0]);
+  TEST_ASSERT_EQUAL('a' + 11, buffer[1199]);
+
+  // A read cursor cannot be written
+  TEST_ASSERT_NOT_EQUAL(LV_FS_RES_OK, lv_fs_write(&file, chunk, sizeof(chunk), &bytesWritten));
+  lv_fs_close(&file);
+
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("download.jpg"));
+}
+
+void test_discarded_write_not_published() {
+  lv_fs_file_t file;
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:partial.jpg", LV_FS_MODE_WR));
+
+  uint8_t chunk[64] = { 0 };
+  uint32_t bytesWritten;
+  lv_fs_write(&file, chunk, sizeof(chunk), &bytesWritten);
+
+  InMemoryFS::discardFile(&file);
+  TEST_ASSERT_NOT_EQUAL(LV_FS_RES_OK, lv_fs_write(&file, chunk, sizeof(chunk), &bytesWritten));
+  TEST_ASSERT_NOT_EQUAL(LV_FS_RES_OK, lv_fs_close(&file));
+  TEST_ASSERT_FALSE(fileExists("M:partial.jpg"));
+}
+
+void test_large_file_stored_in_segments() {
+  // Larger than the biggest contiguous block the test build allows
+  const uint32_t size = 100000;
+  uint8_t *data = new uint8_t[size];
+  for (uint32_t i = 0; i < size; i++) {
+    data[i] = (uint8_t) (i * 31);
+  }
+
+  uint32_t residentBefore = InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL);
+  InMemoryFS::registerFile("large.raw", data, size);
+
+  uint32_t segments = (size + INMEMORYFS_SEGMENT_SIZE - 1) / INMEMORYFS_SEGMENT_SIZE;
+  TEST_ASSERT_EQUAL(residentBefore + segments * INMEMORYFS_SEGMENT_SIZE, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  lv_fs_file_t file;
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:large.raw", LV_FS_MODE_RD));
+
+  uint8_t *buffer = new uint8_t[size];
+  uint32_t bytesRead;
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_read(&file, buffer, size, &bytesRead));
+  TEST_ASSERT_EQUAL(size, bytesRead);
+  TEST_ASSERT_EQUAL_MEMORY(data, buffer, size);
+
+  // Read across a segment boundary after a seek
+  lv_fs_seek(&file, INMEMORYFS_SEGMENT_SIZE * 3 - 2, LV_FS_SEEK_SET);
+  lv_fs_read(&file, buffer, 4, &bytesRead);
+  TEST_ASSERT_EQUAL_MEMORY(data + INMEMORYFS_SEGMENT_SIZE * 3 - 2, buffer, 4);
+  lv_fs_close(&file);
+
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("large.raw"));
+  TEST_ASSERT_EQUAL(residentBefore, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  // A streamed write moves to segments once it outgrows a single block
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:large.raw", LV_FS_MODE_WR));
+  uint32_t bytesWritten;
+  for (uint32_t offset = 0; offset < size; offset += 1000) {
+    TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_write(&file, data + offset, 1000, &bytesWritten));
+  }
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_close(&file));
+
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:large.raw", LV_FS_MODE_RD));
+  memset(buffer, 0, size);
+  lv_fs_read(&file, buffer, size, &bytesRead);
+  TEST_ASSERT_EQUAL(size, bytesRead);
+  TEST_ASSERT_EQUAL_MEMORY(data, buffer, size);
+  lv_fs_close(&file);
+
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("large.raw"));
+  delete [] buffer;
+  delete [] data;
+}
+
+void test_stats_count_usage() {
+  InMemoryFS::Stats before = InMemoryFS::getStats();
+
+  lv_fs_file_t first;
+  lv_fs_file_t second;
+  lv_fs_open(&first, "M:binary_test.bin", LV_FS_MODE_RD);
+  lv_fs_open(&second, "M:static.txt", LV_FS_MODE_RD);
+  TEST_ASSERT_FALSE(fileExists("M:missing.bin"));
+
+  uint8_t buffer[100];
+  uint32_t bytesRead;
+  lv_fs_read(&first, buffer, sizeof(buffer), &bytesRead);
+
+  InMemoryFS::Stats during = InMemoryFS::getStats();
+  TEST_ASSERT_EQUAL(before.opens + 2, during.opens);
+  TEST_ASSERT_EQUAL(before.misses + 1, during.misses);
+  TEST_ASSERT_EQUAL(before.bytesRead + 100, during.bytesRead);
+  TEST_ASSERT_EQUAL(before.openCursors + 2, during.openCursors);
+  TEST_ASSERT_GREATER_OR_EQUAL(2, during.peakOpenCursors);
+  TEST_ASSERT_EQUAL(InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL), during.residentBytes[InMemoryFS::MEMORY_INTERNAL]);
+
+  lv_fs_close(&first);
+  lv_fs_close(&second);
+  TEST_ASSERT_EQUAL(before.openCursors, InMemoryFS::getStats().openCursors);
+}
+
+void test_entry_listing() {
+  lv_fs_file_t file;
+  lv_fs_open(&file, "M:binary_test.bin", LV_FS_MODE_RD);
+
+  uint32_t entries = 0;
+  bool foundBinary = false;
+  bool foundStatic = false;
+  InMemoryFS::forEachEntry([&](const InMemoryFS::EntryInfo &info) {
+    entries++;
+
+    if (strcmp(info.path, "binary_test.bin") == 0) {
+      foundBinary = true;
+      TEST_ASSERT_EQUAL(2560, info.size);
+      TEST_ASSERT_EQUAL(1, info.openCursors);
+      TEST_ASSERT_EQUAL(InMemoryFS::getStats().accessClock, info.lastAccess);
+    } else if (strcmp(info.path, "static.txt") == 0) {
+      foundStatic = true;
+      TEST_ASSERT_EQUAL(InMemoryFS::MEMORY_STATIC, info.region);
+      TEST_ASSERT_EQUAL(0, info.openCursors);
+    }
+  });
+
+  lv_fs_close(&file);
+
+  TEST_ASSERT_TRUE(foundBinary);
+  TEST_ASSERT_TRUE(foundStatic);
+  TEST_ASSERT_EQUAL(InMemoryFS::getStats().entryCount, entries);
+}
+
+void test_image_descriptor_reads_in_place() {
+  const lv_img_dsc_t *descriptor = InMemoryFS::asImageDescriptor("M:static.txt");
+  TEST_ASSERT_NOT_NULL(descriptor);
+  TEST_ASSERT_EQUAL_PTR(STATIC_DATA, descriptor->data);
+  TEST_ASSERT_EQUAL(sizeof(STATIC_DATA), descriptor->data_size);
+  TEST_ASSERT_EQUAL(LV_IMG_CF_UNKNOWN, descriptor->header.cf);
+  InMemoryFS::releaseImageDescriptor(descriptor);
+
+  TEST_ASSERT_NULL(InMemoryFS::asImageDescriptor("missing.png"));
+
+  // The descriptor keeps a replaced version alive
+  uint8_t oldData[24];
+  uint8_t newData[40];
+  memset(oldData, 'i', sizeof(oldData));
+  memset(newData, 'j', sizeof(newData));
+  InMemoryFS::registerFile("cover.png", oldData, sizeof(oldData));
+  descriptor = InMemoryFS::asImageDescriptor("cover.png");
+  TEST_ASSERT_NOT_NULL(descriptor);
+
+  uint32_t residentBefore = InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL);
+  TEST_ASSERT_TRUE(InMemoryFS::replaceFile("cover.png", newData, sizeof(newData)));
+  TEST_ASSERT_EQUAL(residentBefore + sizeof(newData), InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+  TEST_ASSERT_EQUAL_MEMORY(oldData, descriptor->data, sizeof(oldData));
+
+  InMemoryFS::releaseImageDescriptor(descriptor);
+  TEST_ASSERT_EQUAL(residentBefore + sizeof(newData) - sizeof(oldData), InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("cover.png"));
+
+  // Compressed data cannot be read in place
+  uint8_t zeros[2048] = { 0 };
+  InMemoryFS::registerCompressedFile("zeros.bin", zeros, sizeof(zeros));
+  TEST_ASSERT_NULL(InMemoryFS::asImageDescriptor("zeros.bin"));
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("zeros.bin"));
+}
+
+/**
+ * Builds an asset pack the way extra_scripts/pack_assets.py does.  The
+ * files must be sorted by path.
+ */
+static std::vector<uint32_t> buildAssetPack(const std::vector<std::pair<std::string, std::string>> &files) {
+  uint32_t count = files.size();
+  uint32_t pathOffset = 12 + count * 12;
+
+  std::string paths;
+  for (auto &file : files) {
+    paths += file.first + '\0';
+  }
+
+  uint32_t dataStart = (pathOffset + paths.size() + 3) & ~3u;
+  uint32_t header[3] = { 0, 1, count };
+  memcpy(header, "IMFP", 4);
+
+  std::string index;
+  std::string data;
+  for (auto &file : files) {
+    uint32_t entry[3] = { pathOffset, (uint32_t) (dataStart + data.size()), (uint32_t) file.second.size() };
+    index.append((const char *) entry, sizeof(entry));
+    pathOffset += file.first.size() + 1;
+
+    data += file.second;
+    data.resize((data.size() + 3) & ~3u);
+  }
+
+  std::string bytes = std::string((const char *) header, sizeof(header)) + index + paths;
+  bytes.resize(dataStart);
+  bytes += data;
+
+  std::vector<uint32_t> pack((bytes.size() + 3) / 4);
+  memcpy(pack.data(), bytes.data(), bytes.size());
+  return pack;
+}
+
+static std::vector<std::string> listDirectory(const char *path) {
+  std::vector<std::string> names;
+
+  lv_fs_dir_t dir;
+  if (lv_fs_dir_open(&dir, path) != LV_FS_RES_OK) {
+    return names;
+  }
+
+  char name[LV_FS_MAX_FN_LENGTH];
+  while ((lv_fs_dir_read(&dir, name) == LV_FS_RES_OK) && (name[0] != '\0')) {
+    names.push_back(name);
+  }
+
+  lv_fs_dir_close(&dir);
+  return names;
+}
+
+void test_asset_pack_mount() {
+  static std::vector<uint32_t> pack = buildAssetPack({
+    { "pack/fonts/small.bin", "small font" },
+    { "pack/icons/next.png", "next" },
+    { "pack/icons/play.png", "play icon" },
+    { "pack/readme.txt", "hello" }
+  });
+
+  uint32_t entriesBefore = InMemoryFS::getStats().entryCount;
+  uint32_t staticBefore = InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_STATIC);
+  TEST_ASSERT_TRUE(InMemoryFS::mountAssetPack(pack.data(), pack.size() * 4));
+  TEST_ASSERT_EQUAL(entriesBefore + 4, InMemoryFS::getStats().entryCount);
+  TEST_ASSERT_EQUAL(staticBefore + 28, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_STATIC));
+
+  // Files are read in place
+  lv_fs_file_t file;
+  uint8_t buffer[32];
+  uint32_t bytesRead;
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:pack/icons/play.png", LV_FS_MODE_RD));
+  lv_fs_read(&file, buffer, sizeof(buffer), &bytesRead);
+  TEST_ASSERT_EQUAL(9, bytesRead);
+  TEST_ASSERT_EQUAL_MEMORY("play icon", buffer, 9);
+  lv_fs_close(&file);
+
+  const lv_img_dsc_t *descriptor = InMemoryFS::asImageDescriptor("pack/icons/next.png");
+  TEST_ASSERT_NOT_NULL(descriptor);
+  TEST_ASSERT_EQUAL(4, descriptor->data_size);
+  TEST_ASSERT_EQUAL_MEMORY("next", descriptor->data, 4);
+  InMemoryFS::releaseImageDescriptor(descriptor);
+
+  TEST_ASSERT_FALSE(fileExists("M:pack/icons/stop.png"));
+  TEST_ASSERT_NOT_EQUAL(0, InMemoryFS::getVersion("pack/readme.txt"));
+
+  // A registered file takes precedence over the pack
+  InMemoryFS::registerFile("pack/readme.txt", (void *) "override", 8);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:pack/readme.txt", LV_FS_MODE_RD));
+  lv_fs_read(&file, buffer, sizeof(buffer), &bytesRead);
+  TEST_ASSERT_EQUAL(8, bytesRead);
+  lv_fs_close(&file);
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("pack/readme.txt"));
+  TEST_ASSERT_TRUE(fileExists("M:pack/readme.txt"));
+
+  // Malformed packs are refused
+  std::vector<uint32_t> unsorted = buildAssetPack({ { "b", "1" }, { "a", "2" } });
+  TEST_ASSERT_FALSE(InMemoryFS::mountAssetPack(unsorted.data(), unsorted.size() * 4));
+  TEST_ASSERT_FALSE(InMemoryFS::mountAssetPack(pack.data(), 20));
+}
+
+void test_directory_listing() {
+  uint8_t data[] = { 'd', 'i', 'r' };
+  InMemoryFS::registerFile("pack/icons/registered.png", data, sizeof(data));
+
+  std::vector<std::string> names = listDirectory("M:pack");
+  TEST_ASSERT_EQUAL(3, names.size());
+  TEST_ASSERT_EQUAL_STRING("/fonts", names[0].c_str());
+  TEST_ASSERT_EQUAL_STRING("/icons", names[1].c_str());
+  TEST_ASSERT_EQUAL_STRING("readme.txt", names[2].c_str());
+
+  names = listDirectory("M:/pack/icons/");
+  TEST_ASSERT_EQUAL(3, names.size());
+  TEST_ASSERT_EQUAL_STRING("next.png", names[0].c_str());
+  TEST_ASSERT_EQUAL_STRING("play.png", names[1].c_str());
+  TEST_ASSERT_EQUAL_STRING("registered.png", names[2].c_str());
+
+  names = listDirectory("M:");
+  TEST_ASSERT_TRUE(std::find(names.begin(), names.end(), "/pack") != names.end());
+  TEST_ASSERT_TRUE(std::find(names.begin(), names.end(), "static.txt") != names.end());
+
+  lv_fs_dir_t dir;
+  TEST_ASSERT_NOT_EQUAL(LV_FS_RES_OK, lv_fs_dir_open(&dir, "M:nothing/here"));
+
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("pack/icons/registered.png"));
+}
+
+void test_mapped_file() {
+  uint32_t size;
+  uint8_t *expected = getAssetData("binary_test.bin", &size);
+  std::string source = (TEST_ASSETS_FOLDER / "binary_test.bin").string();
+
+  uint32_t internalBefore = InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL);
+  TEST_ASSERT_TRUE(InMemoryFS::registerMappedFile("mapped.bin", source.c_str()));
+  TEST_ASSERT_TRUE(InMemoryFS::registerMappedFile("mapped-tail.bin", source.c_str(), 100, 50));
+  TEST_ASSERT_FALSE(InMemoryFS::registerMappedFile("mapped.bin", source.c_str()));
+  TEST_ASSERT_FALSE(InMemoryFS::registerMappedFile("missing.bin", "/no/such/file"));
+  TEST_ASSERT_FALSE(InMemoryFS::registerMappedFile("beyond.bin", source.c_str(), size, 1));
+  TEST_ASSERT_EQUAL(internalBefore, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+
+  lv_fs_file_t file;
+  uint8_t buffer[4096];
+  uint32_t bytesRead;
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:mapped.bin", LV_FS_MODE_RD));
+  lv_fs_read(&file, buffer, sizeof(buffer), &bytesRead);
+  TEST_ASSERT_EQUAL(size, bytesRead);
+  TEST_ASSERT_EQUAL_MEMORY(expected, buffer, size);
+  lv_fs_close(&file);
+
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&file, "M:mapped-tail.bin", LV_FS_MODE_RD));
+  lv_fs_read(&file, buffer, sizeof(buffer), &bytesRead);
+  TEST_ASSERT_EQUAL(50, bytesRead);
+  TEST_ASSERT_EQUAL_MEMORY(expected + 100, buffer, 50);
+  lv_fs_close(&file);
+
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("mapped.bin"));
+  TEST_ASSERT_TRUE(InMemoryFS::unregisterFile("mapped-tail.bin"));
+  delete [] expected;
+}
+
+void test_cursor_pool_exhaustion() {
+  lv_fs_file_t files[INMEMORYFS_MAX_OPEN_FILES];
+  uint32_t exhaustionsBefore = InMemoryFS::getStats().cursorPoolExhaustions;
+
+  for (int i = 0; i < INMEMORYFS_MAX_OPEN_FILES; i++) {
+    TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&files[i], "M:binary_test.bin", LV_FS_MODE_RD));
+  }
+
+  lv_fs_file_t extra;
+  TEST_ASSERT_NOT_EQUAL(LV_FS_RES_OK, lv_fs_open(&extra, "M:binary_test.bin", LV_FS_MODE_RD));
+  TEST_ASSERT_EQUAL(exhaustionsBefore + 1, InMemoryFS::getStats().cursorPoolExhaustions);
+
+  // A closed cursor goes back to the pool and starts at offset 0 again
+  uint8_t value;
+  uint32_t bytesRead;
+  lv_fs_read(&files[0], &value, 1, &bytesRead);
+  lv_fs_close(&files[0]);
+  TEST_ASSERT_EQUAL(LV_FS_RES_OK, lv_fs_open(&extra, "M:binary_test.bin", LV_FS_MODE_RD));
+
+  uint32_t pos;
+  lv_fs_tell(&extra, &pos);
+  TEST_ASSERT_EQUAL(0, pos);
+  lv_fs_close(&extra);
+
+  for (int i = 1; i < INMEMORYFS_MAX_OPEN_FILES; i++) {
+    lv_fs_close(&files[i]);
+  }
+}
+
 int runUnityTests(void) {
   UNITY_BEGIN();
 
@@ -156,6 +862,27 @@ int runUnityTests(void) {
   RUN_TEST(test_filesystem_open);
   RUN_TEST(test_filesystem_read);
   RUN_TEST(test_seek_and_read);
+  RUN_TEST(test_copied_file_is_independent);
+  RUN_TEST(test_static_file_read);
+  RUN_TEST(test_open_missing_file);
+  RUN_TEST(test_many_registered_files);
+  RUN_TEST(test_unregister_and_replace);
+  RUN_TEST(test_replace_while_open);
+  RUN_TEST(test_identical_files_share_storage);
+  RUN_TEST(test_compressed_file_read_and_seek);
+  RUN_TEST(test_incompressible_file_stored_plain);
+  RUN_TEST(test_streamed_write_published_on_close);
+  RUN_TEST(test_discarded_write_not_published);
+  RUN_TEST(test_large_file_stored_in_segments);
+  RUN_TEST(test_stats_count_usage);
+  RUN_TEST(test_entry_listing);
+  RUN_TEST(test_image_descriptor_reads_in_place);
+  RUN_TEST(test_asset_pack_mount);
+  RUN_TEST(test_directory_listing);
+  RUN_TEST(test_mapped_file);
+  RUN_TEST(test_cursor_pool_exhaustion);
+  RUN_TEST(test_budget_evicts_least_recently_used);
+  RUN_TEST(test_eviction_removes_every_name_of_shared_storage);
 
   return UNITY_END();
 }
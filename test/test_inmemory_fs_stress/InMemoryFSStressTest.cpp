@@ -0,0 +1,215 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#include "unity.h"
+#include <InMemoryFS.h>
+#include <Rcu.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static const int READER_THREADS = 4;
+static const int WRITER_THREADS = 2;
+static const int FILE_COUNT = 8;
+static const int WRITES_PER_WRITER = 2000;
+
+static std::atomic<bool> writersDone;
+static std::atomic<uint32_t> successfulReads;
+static std::atomic<uint32_t> tornReads;
+
+static void formatPath(char *path, size_t length, int file, bool withDrive) {
+  snprintf(path, length, "%sstress/%d.bin", withDrive ? "M:" : "", file);
+}
+
+/**
+ * Publish, replace and remove files filled with a single byte value so a
+ * reader can detect a file that mixes bytes from two versions.
+ */
+static void writer(int id) {
+  char path[32];
+
+  for (int i = 0; i < WRITES_PER_WRITER; i++) {
+    formatPath(path, sizeof(path), (i * 3 + id) % FILE_COUNT, false);
+
+    uint32_t size = 64 + ((i * 37) % 1024);
+    uint8_t *data = new uint8_t[size];
+    memset(data, (uint8_t) (i + id), size);
+
+    switch (i % 4) {
+      case 0:
+        if ((i / 4) % 2) {
+          InMemoryFS::replaceCompressedFile(path, data, size);
+        } else {
+          InMemoryFS::replaceFile(path, data, size);
+        }
+        delete [] data;
+        break;
+
+      case 1:
+      case 2:
+        InMemoryFS::replaceFile(path, data, size, [](void *data) {
+          delete [] (uint8_t *) data;
+        });
+        break;
+
+      case 3:
+        InMemoryFS::unregisterFile(path);
+        delete [] data;
+        break;
+    }
+  }
+}
+
+/**
+ * Repeatedly open and read whole files through the LVGL driver, checking
+ * that every byte read belongs to the same version.
+ */
+static void reader(int id) {
+  char path[32];
+  uint8_t buffer[37];
+  int file = id;
+
+  while (!writersDone.load()) {
+    formatPath(path, sizeof(path), file++ % FILE_COUNT, true);
+
+    lv_fs_file_t handle;
+    if (lv_fs_open(&handle, path, LV_FS_MODE_RD) != LV_FS_RES_OK) {
+      continue;
+    }
+
+    uint32_t size;
+    lv_fs_seek(&handle, 0, LV_FS_SEEK_END);
+    lv_fs_tell(&handle, &size);
+    lv_fs_seek(&handle, 0, LV_FS_SEEK_SET);
+
+    bool torn = false;
+    int expected = -1;
+    uint32_t total = 0;
+    uint32_t bytesRead;
+
+    do {
+      lv_fs_read(&handle, buffer, sizeof(buffer), &bytesRead);
+      for (uint32_t i = 0; i < bytesRead; i++) {
+        if (expected < 0) {
+          expected = buffer[i];
+        }
+
+        torn |= (buffer[i] != expected);
+      }
+
+      total += bytesRead;
+    } while (bytesRead > 0);
+
+    lv_fs_close(&handle);
+
+    if (torn || (total != size)) {
+      tornReads.fetch_add(1);
+    } else {
+      successfulReads.fetch_add(1);
+    }
+  }
+}
+
+void setUp() {
+  lv_init();
+  InMemoryFS::registerInMemoryDriver();
+}
+
+void tearDown() {
+}
+
+void test_concurrent_readers_and_writers() {
+  writersDone = false;
+  successfulReads = 0;
+  tornReads = 0;
+
+  // Keep eviction busy alongside explicit replacement
+  InMemoryFS::setMemoryBudget(InMemoryFS::MEMORY_INTERNAL, 4096);
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < READER_THREADS; i++) {
+    readers.emplace_back(reader, i);
+  }
+
+  std::vector<std::thread> writers;
+  for (int i = 0; i < WRITER_THREADS; i++) {
+    writers.emplace_back(writer, i);
+  }
+
+  for (std::thread &thread : writers) {
+    thread.join();
+  }
+
+  writersDone = true;
+  for (std::thread &thread : readers) {
+    thread.join();
+  }
+
+  TEST_ASSERT_EQUAL(0, tornReads.load());
+  TEST_ASSERT_GREATER_THAN(0, successfulReads.load());
+
+  // Every version is released once the files are gone
+  char path[32];
+  for (int i = 0; i < FILE_COUNT; i++) {
+    formatPath(path, sizeof(path), i, false);
+    InMemoryFS::unregisterFile(path);
+  }
+
+  InMemoryFS::setMemoryBudget(InMemoryFS::MEMORY_INTERNAL, 0);
+  TEST_ASSERT_EQUAL(0, InMemoryFS::getResidentBytes(InMemoryFS::MEMORY_INTERNAL));
+  TEST_ASSERT_EQUAL(0, InMemoryFS::getStats().cursorPoolExhaustions);
+}
+
+/**
+ * Stands in for a writer publishing while a reader is stalled between
+ * observing the phase and joining it.
+ */
+static void publishWhileJoining() {
+  Rcu::readerJoinHook = nullptr;
+  Rcu::synchronize();
+}
+
+void test_reader_stalled_while_joining_is_waited_for() {
+  Rcu::readerJoinHook = publishWhileJoining;
+
+  std::atomic<bool> synchronized(false);
+  std::thread nextWriter;
+  {
+    Rcu::ReadSection section;
+
+    // The reader may be using what the stalled-over writer published, so
+    // the next writer has to wait for it
+    nextWriter = std::thread([&] {
+      Rcu::synchronize();
+      synchronized = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    TEST_ASSERT_FALSE(synchronized.load());
+  }
+
+  nextWriter.join();
+  TEST_ASSERT_TRUE(synchronized.load());
+}
+
+int runUnityTests(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_concurrent_readers_and_writers);
+  RUN_TEST(test_reader_stalled_while_joining_is_waited_for);
+
+  return UNITY_END();
+}
+
+/**
+  * For native dev-platform or for some embedded frameworks
+  */
+int main(void) {
+  return runUnityTests();
+}
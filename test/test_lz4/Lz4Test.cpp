@@ -0,0 +1,101 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#include "unity.h"
+#include <Lz4.h>
+#include <string.h>
+
+static uint8_t source[8192];
+static uint8_t compressed[Lz4::compressBound(sizeof(source))];
+static uint8_t decompressed[sizeof(source)];
+
+static void assertRoundTrip(uint32_t size) {
+  uint32_t compressedSize = Lz4::compress(source, size, compressed, sizeof(compressed));
+  TEST_ASSERT_GREATER_THAN(0, compressedSize);
+
+  int32_t decompressedSize = Lz4::decompress(compressed, compressedSize, decompressed, sizeof(decompressed));
+  TEST_ASSERT_EQUAL(size, decompressedSize);
+  TEST_ASSERT_EQUAL_MEMORY(source, decompressed, size);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_round_trip_repetitive() {
+  for (uint32_t i = 0; i < sizeof(source); i++) {
+    source[i] = (uint8_t) ((i / 16) % 5);
+  }
+
+  assertRoundTrip(sizeof(source));
+  TEST_ASSERT_LESS_THAN(sizeof(source) / 4, Lz4::compress(source, sizeof(source), compressed, sizeof(compressed)));
+}
+
+void test_round_trip_random() {
+  uint32_t seed = 1;
+  for (uint32_t i = 0; i < sizeof(source); i++) {
+    seed = seed * 1103515245 + 12345;
+    source[i] = (uint8_t) (seed >> 16);
+  }
+
+  assertRoundTrip(sizeof(source));
+}
+
+void test_round_trip_short_blocks() {
+  memset(source, 'a', sizeof(source));
+
+  for (uint32_t size = 0; size < 40; size++) {
+    assertRoundTrip(size);
+  }
+}
+
+void test_long_runs_overlap_their_output() {
+  memset(source, 'z', sizeof(source));
+  source[0] = 'a';
+
+  assertRoundTrip(sizeof(source));
+}
+
+void test_compress_fails_when_output_too_small() {
+  memset(source, 'q', sizeof(source));
+  TEST_ASSERT_EQUAL(0, Lz4::compress(source, sizeof(source), compressed, 4));
+}
+
+void test_decompress_rejects_bad_offsets() {
+  // One literal then a match reaching back further than the output
+  const uint8_t corrupt[] = { 0x10, 'a', 0x05, 0x00, 'b', 'c', 'd', 'e', 'f' };
+  TEST_ASSERT_EQUAL(-1, Lz4::decompress(corrupt, sizeof(corrupt), decompressed, sizeof(decompressed)));
+}
+
+void test_decompress_rejects_small_output() {
+  memset(source, 'r', sizeof(source));
+  uint32_t compressedSize = Lz4::compress(source, sizeof(source), compressed, sizeof(compressed));
+  TEST_ASSERT_EQUAL(-1, Lz4::decompress(compressed, compressedSize, decompressed, sizeof(source) - 1));
+}
+
+int runUnityTests(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_round_trip_repetitive);
+  RUN_TEST(test_round_trip_random);
+  RUN_TEST(test_round_trip_short_blocks);
+  RUN_TEST(test_long_runs_overlap_their_output);
+  RUN_TEST(test_compress_fails_when_output_too_small);
+  RUN_TEST(test_decompress_rejects_bad_offsets);
+  RUN_TEST(test_decompress_rejects_small_output);
+
+  return UNITY_END();
+}
+
+/**
+  * For native dev-platform or for some embedded frameworks
+  */
+int main(void) {
+  return runUnityTests();
+}
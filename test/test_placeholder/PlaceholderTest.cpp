@@ -0,0 +1,110 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#include "unity.h"
+#include <Placeholder.h>
+
+// The example hash from the BlurHash documentation
+static const char *HASH = "LEHV6nWB2yk8pyo0adR*.7kCMdnj";
+
+static lv_color_t pixelAt(Surface *surface, uint16_t x, uint16_t y) {
+  return ((lv_color_t *) surface->pixels())[(y * surface->width()) + x];
+}
+
+/**
+ * Assert a pixel is within one step of the expected RGB565 channels,
+ * allowing for the rounding of the single precision decode.
+ */
+static void assertPixel(Surface *surface, uint16_t x, uint16_t y, uint8_t red, uint8_t green, uint8_t blue) {
+  lv_color_t color = pixelAt(surface, x, y);
+  TEST_ASSERT_INT_WITHIN(1, red, color.ch.red);
+  TEST_ASSERT_INT_WITHIN(1, green, color.ch.green);
+  TEST_ASSERT_INT_WITHIN(1, blue, color.ch.blue);
+}
+
+void setUp() {
+  lv_init();
+}
+
+void tearDown() {
+}
+
+void test_blurhash_matches_reference_decode() {
+  Surface *surface = Placeholder::fromBlurHash(HASH);
+  TEST_ASSERT_NOT_NULL(surface);
+  TEST_ASSERT_EQUAL(COVERART_PLACEHOLDER_SIZE, surface->width());
+  TEST_ASSERT_EQUAL(COVERART_PLACEHOLDER_SIZE, surface->height());
+  TEST_ASSERT_EQUAL(LV_IMG_CF_TRUE_COLOR, surface->image.header.cf);
+
+  // Expected values from the reference implementation at 32x32
+  assertPixel(surface, 0, 0, 16, 41, 22);
+  assertPixel(surface, 16, 16, 19, 31, 13);
+  assertPixel(surface, 31, 31, 16, 35, 18);
+  assertPixel(surface, 5, 20, 16, 34, 18);
+  assertPixel(surface, 28, 3, 17, 41, 22);
+
+  surface->release();
+}
+
+void test_malformed_blurhash_is_rejected() {
+  // Too short for the components it declares
+  TEST_ASSERT_NULL(Placeholder::fromBlurHash("LEHV6nWB2yk8pyo0adR*.7kCMdn"));
+
+  // Not base 83
+  TEST_ASSERT_NULL(Placeholder::fromBlurHash("LEHV6nWB2yk8pyo0adR/.7kCMdnj"));
+
+  TEST_ASSERT_NULL(Placeholder::fromBlurHash(""));
+  TEST_ASSERT_NULL(Placeholder::decode("not a placeholder"));
+}
+
+void test_thumbnail_is_decoded() {
+  // Red, green, blue and white in a 2x2 square
+  Surface *surface = Placeholder::fromThumbnail("/wAAAP8AAAD/////");
+  TEST_ASSERT_NOT_NULL(surface);
+  TEST_ASSERT_EQUAL(2, surface->width());
+  TEST_ASSERT_EQUAL(2, surface->height());
+
+  assertPixel(surface, 0, 0, 31, 0, 0);
+  assertPixel(surface, 1, 0, 0, 63, 0);
+  assertPixel(surface, 0, 1, 0, 0, 31);
+  assertPixel(surface, 1, 1, 31, 63, 31);
+
+  surface->release();
+
+  // Three pixels do not make a square
+  TEST_ASSERT_NULL(Placeholder::fromThumbnail("/wAAAP8AAAD/"));
+}
+
+void test_either_encoding_is_recognized() {
+  Surface *blurred = Placeholder::decode(HASH);
+  TEST_ASSERT_NOT_NULL(blurred);
+  TEST_ASSERT_EQUAL(COVERART_PLACEHOLDER_SIZE, blurred->width());
+  blurred->release();
+
+  Surface *thumbnail = Placeholder::decode("/wAAAP8AAAD/////");
+  TEST_ASSERT_NOT_NULL(thumbnail);
+  TEST_ASSERT_EQUAL(2, thumbnail->width());
+  thumbnail->release();
+}
+
+int runUnityTests(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_blurhash_matches_reference_decode);
+  RUN_TEST(test_malformed_blurhash_is_rejected);
+  RUN_TEST(test_thumbnail_is_decoded);
+  RUN_TEST(test_either_encoding_is_recognized);
+
+  return UNITY_END();
+}
+
+/**
+ * For native dev-platform or for some embedded frameworks
+ */
+int main(void) {
+  return runUnityTests();
+}
@@ -0,0 +1,427 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#include "unity.h"
+#include <CoverArtDecoder.h>
+#include <InMemoryFS.h>
+#include <PngDecoder.h>
+#include <PngReader.h>
+#include <filesystem>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static std::filesystem::path CWD = std::filesystem::current_path();
+static std::filesystem::path TEST_ASSETS_FOLDER = CWD / "test/assets";
+
+static void loadFileIntoFileSystem(const char *relativePath, const char *path) {
+  auto fullPath = TEST_ASSETS_FOLDER / relativePath;
+
+  uint32_t size = std::filesystem::file_size(fullPath);
+  uint8_t *data = new uint8_t[size];
+  auto file = std::fopen(fullPath.c_str(), "rb");
+  std::fread(data, 1, size, file);
+  fclose(file);
+
+  InMemoryFS::adoptFile(path, data, size, [](void *data) {
+    delete [] (uint8_t *) data;
+  });
+}
+
+static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0) {
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+
+  return ~crc;
+}
+
+static void appendBigEndian(std::vector<uint8_t> &out, uint32_t value) {
+  out.push_back(value >> 24);
+  out.push_back(value >> 16);
+  out.push_back(value >> 8);
+  out.push_back(value);
+}
+
+static void appendChunk(std::vector<uint8_t> &png, const char *type, const std::vector<uint8_t> &data) {
+  appendBigEndian(png, data.size());
+
+  std::vector<uint8_t> typed(type, type + 4);
+  typed.insert(typed.end(), data.begin(), data.end());
+  png.insert(png.end(), typed.begin(), typed.end());
+  appendBigEndian(png, crc32(typed.data(), typed.size()));
+}
+
+/**
+ * Build a PNG around already filtered scanlines, stored without
+ * compression in small deflate blocks and split over several IDAT
+ * chunks, so both boundaries land mid row.
+ */
+static std::vector<uint8_t> buildPng(uint16_t width, uint16_t height, uint8_t bitDepth, uint8_t colorType,
+  const std::vector<uint8_t> &scanlines, const std::vector<uint8_t> &palette = {},
+  const std::vector<uint8_t> &transparency = {}, uint8_t interlace = 0) {
+
+  std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+  std::vector<uint8_t> header;
+  appendBigEndian(header, width);
+  appendBigEndian(header, height);
+  header.insert(header.end(), { bitDepth, colorType, 0, 0, interlace });
+  appendChunk(png, "IHDR", header);
+  appendChunk(png, "tEXt", { 'C', 'o', 'm', 'm', 'e', 'n', 't', 0, 'h', 'i' });
+
+  if (!palette.empty()) {
+    appendChunk(png, "PLTE", palette);
+  }
+
+  if (!transparency.empty()) {
+    appendChunk(png, "tRNS", transparency);
+  }
+
+  const size_t BLOCK_SIZE = 7;
+  std::vector<uint8_t> zlib = { 0x78, 0x01 };
+  for (size_t offset = 0; offset < scanlines.size(); offset += BLOCK_SIZE) {
+    size_t length = std::min(BLOCK_SIZE, scanlines.size() - offset);
+    zlib.push_back((offset + length == scanlines.size()) ? 1 : 0);
+    zlib.insert(zlib.end(), { (uint8_t) length, 0, (uint8_t) ~length, 0xFF });
+    zlib.insert(zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + length);
+  }
+
+  uint32_t a = 1, b = 0;
+  for (uint8_t byte : scanlines) {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  appendBigEndian(zlib, (b << 16) | a);
+
+  const size_t CHUNK_SIZE = 5;
+  for (size_t offset = 0; offset < zlib.size(); offset += CHUNK_SIZE) {
+    size_t length = std::min(CHUNK_SIZE, zlib.size() - offset);
+    appendChunk(png, "IDAT", std::vector<uint8_t>(zlib.begin() + offset, zlib.begin() + offset + length));
+  }
+
+  appendChunk(png, "IEND", {});
+  return png;
+}
+
+static uint8_t paeth(int left, int up, int upLeft) {
+  int estimate = left + up - upLeft;
+  int leftDistance = abs(estimate - left);
+  int upDistance = abs(estimate - up);
+  int upLeftDistance = abs(estimate - upLeft);
+
+  if ((leftDistance <= upDistance) && (leftDistance <= upLeftDistance)) {
+    return left;
+  }
+
+  return (upDistance <= upLeftDistance) ? up : upLeft;
+}
+
+/**
+ * Filter raw rows the way an encoder would, row y with filter y % 5.
+ */
+static std::vector<uint8_t> filterRows(const std::vector<uint8_t> &raw, uint32_t rowBytes, uint8_t bytesPerPixel) {
+  std::vector<uint8_t> filtered;
+  std::vector<uint8_t> above(rowBytes, 0);
+
+  for (size_t start = 0; start < raw.size(); start += rowBytes) {
+    const uint8_t *row = raw.data() + start;
+    uint8_t filter = (start / rowBytes) % 5;
+    filtered.push_back(filter);
+
+    for (uint32_t i = 0; i < rowBytes; i++) {
+      int left = (i >= bytesPerPixel) ? row[i - bytesPerPixel] : 0;
+      int upLeft = (i >= bytesPerPixel) ? above[i - bytesPerPixel] : 0;
+      int predicted[] = { 0, left, above[i], (left + above[i]) >> 1, paeth(left, above[i], upLeft) };
+      filtered.push_back(row[i] - predicted[filter]);
+    }
+
+    above.assign(row, row + rowBytes);
+  }
+
+  return filtered;
+}
+
+static lv_img_dsc_t asDescriptor(const std::vector<uint8_t> &png) {
+  lv_img_dsc_t image;
+  memset(&image, 0, sizeof(image));
+  image.header.cf = LV_IMG_CF_RAW_ALPHA;
+  image.data_size = png.size();
+  image.data = png.data();
+  return image;
+}
+
+static uint16_t pixelAt(const uint8_t *row, uint16_t x, uint8_t pixelSize) {
+  lv_color_t color;
+  memcpy(&color, row + (x * pixelSize), sizeof(color));
+  return color.full;
+}
+
+/**
+ * FNV-1a over RGB565 pixels, matching the expected values computed from
+ * the assets with an independent decoder.
+ */
+static uint32_t hashRows(PngReader &reader) {
+  std::vector<uint8_t> row(reader.width() * sizeof(lv_color_t));
+  uint32_t hash = 0x811C9DC5;
+
+  for (uint16_t y = 0; y < reader.height(); y++) {
+    TEST_ASSERT_TRUE(reader.readRow(row.data()));
+    for (uint8_t byte : row) {
+      hash = (hash ^ byte) * 0x01000193;
+    }
+  }
+
+  return hash;
+}
+
+void setUp() {
+  lv_init();
+  InMemoryFS::registerInMemoryDriver();
+}
+
+void tearDown() {
+}
+
+void test_rgb_rows_with_every_filter() {
+  const uint16_t SIZE = 10;
+  std::vector<uint8_t> raw;
+  for (uint16_t y = 0; y < SIZE; y++) {
+    for (uint16_t x = 0; x < SIZE; x++) {
+      raw.insert(raw.end(), { (uint8_t) (x * 25), (uint8_t) (y * 25), (uint8_t) ((x * y) ^ 0xA5) });
+    }
+  }
+
+  std::vector<uint8_t> png = buildPng(SIZE, SIZE, 8, 2, filterRows(raw, SIZE * 3, 3));
+  lv_img_dsc_t image = asDescriptor(png);
+
+  PngReader reader;
+  TEST_ASSERT_TRUE(reader.open(&image));
+  TEST_ASSERT_EQUAL(SIZE, reader.width());
+  TEST_ASSERT_EQUAL(SIZE, reader.height());
+  TEST_ASSERT_EQUAL(LV_IMG_CF_TRUE_COLOR, reader.format());
+
+  uint8_t row[SIZE * sizeof(lv_color_t)];
+  for (uint16_t y = 0; y < SIZE; y++) {
+    TEST_ASSERT_TRUE(reader.readRow(row));
+    for (uint16_t x = 0; x < SIZE; x++) {
+      const uint8_t *rgb = &raw[((y * SIZE) + x) * 3];
+      TEST_ASSERT_EQUAL_HEX16(lv_color_make(rgb[0], rgb[1], rgb[2]).full, pixelAt(row, x, sizeof(lv_color_t)));
+    }
+  }
+
+  // The image data is used up
+  TEST_ASSERT_FALSE(reader.readRow(row));
+}
+
+void test_palette_with_transparency() {
+  // Two bit indexes, with a width that leaves the last byte part filled
+  const uint16_t WIDTH = 5;
+  std::vector<uint8_t> palette = { 0xFF, 0, 0, 0, 0xFF, 0, 0, 0, 0xFF, 0xFF, 0xFF, 0xFF };
+  std::vector<uint8_t> raw = { 0x1B, 0x00, 0xE4, 0xC0 };
+
+  std::vector<uint8_t> png = buildPng(WIDTH, 2, 2, 3, filterRows(raw, 2, 1), palette, { 0xFF, 0x80 });
+  lv_img_dsc_t image = asDescriptor(png);
+
+  PngReader reader;
+  TEST_ASSERT_TRUE(reader.open(&image));
+  TEST_ASSERT_EQUAL(LV_IMG_CF_TRUE_COLOR_ALPHA, reader.format());
+
+  uint8_t row[WIDTH * LV_IMG_PX_SIZE_ALPHA_BYTE];
+  uint8_t expected[2][WIDTH] = { { 0, 1, 2, 3, 0 }, { 3, 2, 1, 0, 3 } };
+  for (uint16_t y = 0; y < 2; y++) {
+    TEST_ASSERT_TRUE(reader.readRow(row));
+    for (uint16_t x = 0; x < WIDTH; x++) {
+      const uint8_t *rgb = &palette[expected[y][x] * 3];
+      TEST_ASSERT_EQUAL_HEX16(lv_color_make(rgb[0], rgb[1], rgb[2]).full, pixelAt(row, x, LV_IMG_PX_SIZE_ALPHA_BYTE));
+
+      uint8_t alpha = (expected[y][x] == 1) ? 0x80 : 0xFF;
+      TEST_ASSERT_EQUAL(alpha, row[(x * LV_IMG_PX_SIZE_ALPHA_BYTE) + LV_IMG_PX_SIZE_ALPHA_BYTE - 1]);
+    }
+  }
+}
+
+void test_gray_formats() {
+  // Sixteen bit gray with a transparent value
+  std::vector<uint8_t> raw = { 0x12, 0x34, 0xFF, 0xFF, 0x80, 0x00 };
+  std::vector<uint8_t> png = buildPng(3, 1, 16, 0, filterRows(raw, 6, 2), {}, { 0xFF, 0xFF });
+  lv_img_dsc_t image = asDescriptor(png);
+
+  PngReader gray;
+  TEST_ASSERT_TRUE(gray.open(&image));
+  TEST_ASSERT_EQUAL(LV_IMG_CF_TRUE_COLOR_ALPHA, gray.format());
+
+  uint8_t row[4 * LV_IMG_PX_SIZE_ALPHA_BYTE];
+  TEST_ASSERT_TRUE(gray.readRow(row));
+  TEST_ASSERT_EQUAL_HEX16(lv_color_make(0x12, 0x12, 0x12).full, pixelAt(row, 0, LV_IMG_PX_SIZE_ALPHA_BYTE));
+  TEST_ASSERT_EQUAL(0xFF, row[2]);
+  TEST_ASSERT_EQUAL(0, row[5]);
+  TEST_ASSERT_EQUAL_HEX16(lv_color_make(0x80, 0x80, 0x80).full, pixelAt(row, 2, LV_IMG_PX_SIZE_ALPHA_BYTE));
+
+  // One bit gray is scaled to the full range
+  raw = { 0xA0 };
+  png = buildPng(4, 1, 1, 0, filterRows(raw, 1, 1));
+  image = asDescriptor(png);
+
+  PngReader mono;
+  TEST_ASSERT_TRUE(mono.open(&image));
+  TEST_ASSERT_EQUAL(LV_IMG_CF_TRUE_COLOR, mono.format());
+  TEST_ASSERT_TRUE(mono.readRow(row));
+  TEST_ASSERT_EQUAL_HEX16(lv_color_white().full, pixelAt(row, 0, sizeof(lv_color_t)));
+  TEST_ASSERT_EQUAL_HEX16(lv_color_black().full, pixelAt(row, 1, sizeof(lv_color_t)));
+  TEST_ASSERT_EQUAL_HEX16(lv_color_white().full, pixelAt(row, 2, sizeof(lv_color_t)));
+
+  // Gray with alpha
+  raw = { 0x40, 0x10, 0xC0, 0xF0 };
+  png = buildPng(2, 1, 8, 4, filterRows(raw, 4, 2));
+  image = asDescriptor(png);
+
+  PngReader grayAlpha;
+  TEST_ASSERT_TRUE(grayAlpha.open(&image));
+  TEST_ASSERT_EQUAL(LV_IMG_CF_TRUE_COLOR_ALPHA, grayAlpha.format());
+  TEST_ASSERT_TRUE(grayAlpha.readRow(row));
+  TEST_ASSERT_EQUAL_HEX16(lv_color_make(0xC0, 0xC0, 0xC0).full, pixelAt(row, 1, LV_IMG_PX_SIZE_ALPHA_BYTE));
+  TEST_ASSERT_EQUAL(0xF0, row[5]);
+}
+
+void test_refuses_what_it_cannot_stream() {
+  std::vector<uint8_t> raw(3 * 4, 0x55);
+  lv_img_dsc_t image;
+
+  // Interlaced
+  std::vector<uint8_t> png = buildPng(4, 1, 8, 2, filterRows(raw, 12, 3), {}, {}, 1);
+  image = asDescriptor(png);
+  PngReader interlaced;
+  TEST_ASSERT_FALSE(interlaced.open(&image));
+
+  // Not a PNG at all
+  uint8_t notPng[] = { 'G', 'I', 'F', '8', '9', 'a', 0, 0, 0, 0 };
+  image.data = notPng;
+  image.data_size = sizeof(notPng);
+  PngReader gif;
+  TEST_ASSERT_FALSE(gif.open(&image));
+
+  PngReader wrongExtension;
+  TEST_ASSERT_FALSE(wrongExtension.open("M:cover.jpg"));
+
+  // Truncated image data opens, then fails to produce its rows
+  png = buildPng(4, 1, 8, 2, filterRows(raw, 12, 3));
+  png.resize(png.size() - 40);
+  image = asDescriptor(png);
+
+  PngReader truncated;
+  uint8_t row[4 * sizeof(lv_color_t)];
+  TEST_ASSERT_TRUE(truncated.open(&image));
+  TEST_ASSERT_FALSE(truncated.readRow(row));
+}
+
+void test_compressed_assets() {
+  // Held contiguously, so read in place
+  loadFileIntoFileSystem("images/coverimage1.png", "cover.png");
+  PngReader cover;
+  TEST_ASSERT_TRUE(cover.open("M:cover.png"));
+  TEST_ASSERT_EQUAL(192, cover.width());
+  TEST_ASSERT_EQUAL(LV_IMG_CF_TRUE_COLOR, cover.format());
+  TEST_ASSERT_EQUAL_HEX32(0xFAE1D99D, hashRows(cover));
+
+  // Larger than the contiguous allocation limit, so read through the driver
+  loadFileIntoFileSystem("images/ajr.png", "ajr.png");
+  PngReader ajr;
+  TEST_ASSERT_TRUE(ajr.open("M:ajr.png"));
+  TEST_ASSERT_EQUAL_HEX32(0xA91AF5EA, hashRows(ajr));
+
+  InMemoryFS::unregisterFile("cover.png");
+  InMemoryFS::unregisterFile("ajr.png");
+}
+
+void test_lvgl_decoder() {
+  PngDecoder::registerDecoder();
+  loadFileIntoFileSystem("images/coverimage1.png", "cover.png");
+
+  lv_img_header_t header;
+  TEST_ASSERT_EQUAL(LV_RES_OK, lv_img_decoder_get_info("M:cover.png", &header));
+  TEST_ASSERT_EQUAL(LV_IMG_CF_TRUE_COLOR, header.cf);
+  TEST_ASSERT_EQUAL(192, header.w);
+
+  lv_img_decoder_dsc_t dsc;
+  TEST_ASSERT_EQUAL(LV_RES_OK, lv_img_decoder_open(&dsc, "M:cover.png", lv_color_black(), 0));
+  TEST_ASSERT_NOT_NULL(dsc.img_data);
+  TEST_ASSERT_EQUAL_HEX16(0x7C77, pixelAt(dsc.img_data + (96 * 192 * sizeof(lv_color_t)), 96, sizeof(lv_color_t)));
+  lv_img_decoder_close(&dsc);
+
+  // Cover art is scaled while the rows stream through
+  Surface *surface = CoverArtDecoder::decode("M:cover.png", 96, 96);
+  TEST_ASSERT_NOT_NULL(surface);
+  TEST_ASSERT_EQUAL(96, surface->width());
+  TEST_ASSERT_EQUAL(96, surface->height());
+  surface->release();
+
+  InMemoryFS::unregisterFile("cover.png");
+}
+
+void test_off_thread_decode_leaves_lvgl_work() {
+  loadFileIntoFileSystem("images/coverimage1.png", "cover.png");
+
+  // Read in place, leaving the descriptor to be released on the LVGL thread
+  CoverArtDecoder::Retired retired;
+  bool needsLvgl = true;
+  Surface *surface = CoverArtDecoder::decodeOffThread("M:cover.png", 96, 96, CancelToken(), retired, needsLvgl);
+  TEST_ASSERT_NOT_NULL(surface);
+  TEST_ASSERT_FALSE(needsLvgl);
+  TEST_ASSERT_EQUAL(96, surface->width());
+  TEST_ASSERT_EQUAL(1, retired.descriptors.size());
+  TEST_ASSERT_EQUAL(0, retired.surfaces.size());
+
+  // Formats only LVGL's decoders read are handed back, as are other drives
+  uint8_t image[] = { LV_IMG_CF_TRUE_COLOR, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00 };
+  InMemoryFS::registerFile("cover.bin", image, sizeof(image));
+  TEST_ASSERT_NULL(CoverArtDecoder::decodeOffThread("M:cover.bin", 96, 96, CancelToken(), retired, needsLvgl));
+  TEST_ASSERT_TRUE(needsLvgl);
+
+  needsLvgl = false;
+  TEST_ASSERT_NULL(CoverArtDecoder::decodeOffThread("S:cover.png", 96, 96, CancelToken(), retired, needsLvgl));
+  TEST_ASSERT_TRUE(needsLvgl);
+
+  // A file that only claims to be a PNG still has its descriptor retired
+  InMemoryFS::registerFile("fake.png", image, sizeof(image));
+  TEST_ASSERT_NULL(CoverArtDecoder::decodeOffThread("M:fake.png", 96, 96, CancelToken(), retired, needsLvgl));
+  TEST_ASSERT_TRUE(needsLvgl);
+  TEST_ASSERT_EQUAL(2, retired.descriptors.size());
+
+  retired.release();
+  TEST_ASSERT_EQUAL(0, retired.descriptors.size());
+  surface->release();
+
+  InMemoryFS::unregisterFile("cover.png");
+  InMemoryFS::unregisterFile("cover.bin");
+  InMemoryFS::unregisterFile("fake.png");
+}
+
+int runUnityTests(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_rgb_rows_with_every_filter);
+  RUN_TEST(test_palette_with_transparency);
+  RUN_TEST(test_gray_formats);
+  RUN_TEST(test_refuses_what_it_cannot_stream);
+  RUN_TEST(test_compressed_assets);
+  RUN_TEST(test_lvgl_decoder);
+  RUN_TEST(test_off_thread_decode_leaves_lvgl_work);
+
+  return UNITY_END();
+}
+
+/**
+  * For native dev-platform or for some embedded frameworks
+  */
+int main(void) {
+  return runUnityTests();
+}
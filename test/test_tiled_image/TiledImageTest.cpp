@@ -0,0 +1,238 @@
+/**********************************************************************************
+ * Copyright (C) 2023 Craig Setera
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ **********************************************************************************/
+#include "unity.h"
+#include "../SurfaceFixtures.h"
+#include <CoverArtDecoder.h>
+#include <InMemoryFS.h>
+#include <TiledImage.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+static lv_img_dsc_t describe(const std::vector<uint8_t> &bytes) {
+  lv_img_dsc_t image;
+  memset(&image, 0, sizeof(image));
+  image.header.cf = LV_IMG_CF_RAW;
+  image.data_size = bytes.size();
+  image.data = bytes.data();
+  return image;
+}
+
+void setUp() {
+  lv_init();
+  InMemoryFS::registerInMemoryDriver();
+}
+
+void tearDown() {
+}
+
+void test_image_round_trips_through_decoder() {
+  TiledImage::registerDecoder();
+
+  Surface *art = makeSurface(70, 45, LV_IMG_CF_TRUE_COLOR);
+  std::vector<uint8_t> bytes = TiledImage::encode(art);
+  TEST_ASSERT_FALSE(bytes.empty());
+
+  // The smooth half compresses
+  TEST_ASSERT_LESS_THAN(art->byteSize(), bytes.size());
+
+  InMemoryFS::registerFile("art.tile", bytes.data(), bytes.size());
+  Surface *decoded = CoverArtDecoder::decode("M:art.tile");
+  TEST_ASSERT_NOT_NULL(decoded);
+  TEST_ASSERT_TRUE(samePixels(art, decoded));
+  decoded->release();
+
+  InMemoryFS::unregisterFile("art.tile");
+  art->release();
+}
+
+void test_alpha_image_round_trips() {
+  Surface *art = makeSurface(33, 20, LV_IMG_CF_TRUE_COLOR_ALPHA);
+  std::vector<uint8_t> bytes = TiledImage::encode(art, 16);
+  lv_img_dsc_t source = describe(bytes);
+
+  TiledImage image;
+  TEST_ASSERT_TRUE(image.open(&source));
+  TEST_ASSERT_EQUAL(LV_IMG_CF_TRUE_COLOR_ALPHA, image.format());
+
+  uint8_t line[33 * LV_IMG_PX_SIZE_ALPHA_BYTE];
+  for (uint16_t y = 0; y < art->height(); y++) {
+    TEST_ASSERT_TRUE(image.readLine(0, y, art->width(), line));
+    TEST_ASSERT_EQUAL_MEMORY(art->row(y), line, art->stride());
+  }
+
+  art->release();
+}
+
+void test_partial_lines_decode_only_crossed_tiles() {
+  Surface *art = makeSurface(70, 70, LV_IMG_CF_TRUE_COLOR);
+  std::vector<uint8_t> bytes = TiledImage::encode(art, 32);
+  lv_img_dsc_t source = describe(bytes);
+
+  TiledImage image;
+  TEST_ASSERT_TRUE(image.open(&source));
+
+  // A redraw of a small area in the middle touches one tile
+  lv_color_t line[70];
+  for (uint16_t y = 35; y < 45; y++) {
+    TEST_ASSERT_TRUE(image.readLine(40, y, 10, (uint8_t *) line));
+    TEST_ASSERT_EQUAL_MEMORY(art->row(y) + (40 * sizeof(lv_color_t)), line, 10 * sizeof(lv_color_t));
+  }
+
+  TEST_ASSERT_EQUAL(1, image.getTilesDecoded());
+
+  // A full line of another row of tiles crosses all three of its tiles
+  TEST_ASSERT_TRUE(image.readLine(0, 69, 70, (uint8_t *) line));
+  TEST_ASSERT_EQUAL_MEMORY(art->row(69), line, art->stride());
+  TEST_ASSERT_EQUAL(4, image.getTilesDecoded());
+
+  TEST_ASSERT_FALSE(image.readLine(60, 0, 11, (uint8_t *) line));
+  TEST_ASSERT_FALSE(image.readLine(0, 70, 1, (uint8_t *) line));
+
+  art->release();
+}
+
+void test_image_is_read_from_file() {
+  // Too big to be held in one block, so it is read through the driver
+  Surface *art = makeSurface(256, 256, LV_IMG_CF_TRUE_COLOR);
+  std::vector<uint8_t> bytes = TiledImage::encode(art);
+  TEST_ASSERT_GREATER_THAN(65536, bytes.size());
+  InMemoryFS::registerFile("large.tile", bytes.data(), bytes.size());
+
+  TiledImage image;
+  TEST_ASSERT_TRUE(image.open("M:large.tile"));
+
+  lv_color_t line[256];
+  for (uint16_t y = 0; y < art->height(); y += 7) {
+    TEST_ASSERT_TRUE(image.readLine(0, y, art->width(), (uint8_t *) line));
+    TEST_ASSERT_EQUAL_MEMORY(art->row(y), line, art->stride());
+  }
+
+  InMemoryFS::unregisterFile("large.tile");
+  art->release();
+}
+
+void test_corrupt_images_are_refused() {
+  Surface *art = makeSurface(40, 40, LV_IMG_CF_TRUE_COLOR);
+  std::vector<uint8_t> bytes = TiledImage::encode(art);
+  art->release();
+
+  // Truncated
+  std::vector<uint8_t> truncated(bytes.begin(), bytes.end() - 10);
+  lv_img_dsc_t source = describe(truncated);
+  TiledImage shortImage;
+  TEST_ASSERT_FALSE(shortImage.open(&source));
+
+  // Not a tiled image
+  std::vector<uint8_t> renamed = bytes;
+  renamed[0] = 'X';
+  source = describe(renamed);
+  TiledImage otherImage;
+  TEST_ASSERT_FALSE(otherImage.open(&source));
+
+  // Pixels LVGL draws itself are never taken for a tiled image
+  source = describe(bytes);
+  source.header.cf = LV_IMG_CF_TRUE_COLOR;
+  TiledImage pixels;
+  TEST_ASSERT_FALSE(pixels.open(&source));
+
+  // A damaged compressed tile fails the line rather than producing
+  // garbage.  The first tile follows the index of four tiles.
+  std::vector<uint8_t> damaged = bytes;
+  memset(&damaged[12 + (5 * 4)], 0xFF, 16);
+  source = describe(damaged);
+  TiledImage damagedImage;
+  TEST_ASSERT_TRUE(damagedImage.open(&source));
+
+  lv_color_t line[40];
+  TEST_ASSERT_FALSE(damagedImage.readLine(0, 0, 40, (uint8_t *) line));
+}
+
+void test_convert_writes_tiled_file() {
+  Surface *art = makeSurface(64, 48, LV_IMG_CF_TRUE_COLOR);
+  char path[] = "/tmp/tiledXXXXXX";
+  close(mkstemp(path));
+
+  TEST_ASSERT_TRUE(TiledImage::convert(&art->image, path, 32, 32));
+
+  FILE *file = fopen(path, "rb");
+  std::vector<uint8_t> bytes(64 * 48 * sizeof(lv_color_t));
+  bytes.resize(fread(bytes.data(), 1, bytes.size(), file));
+  fclose(file);
+  remove(path);
+
+  lv_img_dsc_t source = describe(bytes);
+  TiledImage image;
+  TEST_ASSERT_TRUE(image.open(&source));
+  TEST_ASSERT_EQUAL(32, image.width());
+  TEST_ASSERT_EQUAL(24, image.height());
+
+  art->release();
+}
+
+void test_off_thread_decode_reads_tiles_directly() {
+  // No LVGL decoder is needed, and the descriptor is left for the LVGL thread
+  Surface *art = makeSurface(64, 48, LV_IMG_CF_TRUE_COLOR_ALPHA);
+  std::vector<uint8_t> bytes = TiledImage::encode(art, 16);
+  InMemoryFS::registerFile("art.tile", bytes.data(), bytes.size());
+
+  CoverArtDecoder::Retired retired;
+  bool needsLvgl = true;
+  Surface *decoded = CoverArtDecoder::decodeOffThread("M:art.tile", 0, 0, CancelToken(), retired, needsLvgl);
+  TEST_ASSERT_NOT_NULL(decoded);
+  TEST_ASSERT_FALSE(needsLvgl);
+  TEST_ASSERT_TRUE(samePixels(art, decoded));
+  TEST_ASSERT_EQUAL(1, retired.descriptors.size());
+
+  // Scaled while it is read
+  Surface *scaled = CoverArtDecoder::decodeOffThread("M:art.tile", 32, 32, CancelToken(), retired, needsLvgl);
+  TEST_ASSERT_NOT_NULL(scaled);
+  TEST_ASSERT_EQUAL(32, scaled->width());
+  TEST_ASSERT_EQUAL(24, scaled->height());
+  TEST_ASSERT_EQUAL(2, retired.descriptors.size());
+
+  // A damaged tile fails the decode without falling back to LVGL.  The
+  // first tile follows the index of twelve tiles.
+  std::vector<uint8_t> damaged = bytes;
+  memset(&damaged[12 + (13 * 4)], 0xFF, 16);
+  InMemoryFS::registerFile("damaged.tile", damaged.data(), damaged.size());
+  TEST_ASSERT_NULL(CoverArtDecoder::decodeOffThread("M:damaged.tile", 0, 0, CancelToken(), retired, needsLvgl));
+  TEST_ASSERT_FALSE(needsLvgl);
+  TEST_ASSERT_EQUAL(1, retired.surfaces.size());
+  TEST_ASSERT_EQUAL(3, retired.descriptors.size());
+
+  retired.release();
+  decoded->release();
+  scaled->release();
+  art->release();
+  InMemoryFS::unregisterFile("art.tile");
+  InMemoryFS::unregisterFile("damaged.tile");
+}
+
+int runUnityTests(void) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_image_round_trips_through_decoder);
+  RUN_TEST(test_alpha_image_round_trips);
+  RUN_TEST(test_partial_lines_decode_only_crossed_tiles);
+  RUN_TEST(test_image_is_read_from_file);
+  RUN_TEST(test_corrupt_images_are_refused);
+  RUN_TEST(test_convert_writes_tiled_file);
+  RUN_TEST(test_off_thread_decode_reads_tiles_directly);
+
+  return UNITY_END();
+}
+
+/**
+ * For native dev-platform or for some embedded frameworks
+ */
+int main(void) {
+  return runUnityTests();
+}